@@ -0,0 +1,120 @@
+// Times a tight counting loop compiled with and without Config::code_align.
+//
+// Without alignment, where the loop lands depends on the code generated
+// around it, so each fragment is compiled in several variants with a
+// different amount of straight-line code after the loop.  The spread of
+// times across variants is what alignment is meant to remove.
+//
+// usage: loopalign [iterations]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <chrono>
+#include "nanojit.h"
+
+using namespace nanojit;
+
+typedef int32_t (*LoopFn)(int32_t);
+
+static const int NUM_VARIANTS = 8;
+
+// int32_t f(int32_t n) {
+//     int32_t i = 0, s = 0;
+//     do { s = (s ^ i) + 3; i++; } while (i < n);
+//     return s;    // preceded by 'variant' dummy stores
+// }
+static LoopFn compileLoop(Assembler& assm, Allocator& alloc, const Config& config,
+                          int variant)
+{
+    LirBuffer *buf = new (alloc) LirBuffer(alloc);
+    LirBufWriter out(buf, config);
+    buf->abi = ABI_CDECL;
+
+    Fragment* f = new (alloc) Fragment(NULL verbose_only(, 0));
+    f->lirbuf = buf;
+
+    out.ins0(LIR_start);
+    LIns *n = out.insParam(0, 0);
+#ifdef NANOJIT_64BIT
+    n = out.ins1(LIR_q2i, n);
+#endif
+    LIns *vars = out.insAlloc(8 + 4 * NUM_VARIANTS);
+    LIns *zero = out.insImmI(0);
+    out.insStore(LIR_sti, zero, vars, 0, ACCSET_ALL);
+    out.insStore(LIR_sti, zero, vars, 4, ACCSET_ALL);
+
+    LIns *loop = out.ins0(LIR_label);
+    LIns *i = out.insLoad(LIR_ldi, vars, 0, ACCSET_ALL, LOAD_NORMAL);
+    LIns *s = out.insLoad(LIR_ldi, vars, 4, ACCSET_ALL, LOAD_NORMAL);
+    LIns *s2 = out.ins2(LIR_addi, out.ins2(LIR_xori, s, i), out.insImmI(3));
+    LIns *i2 = out.ins2(LIR_addi, i, out.insImmI(1));
+    out.insStore(LIR_sti, s2, vars, 4, ACCSET_ALL);
+    out.insStore(LIR_sti, i2, vars, 0, ACCSET_ALL);
+    out.insBranch(LIR_jt, out.ins2(LIR_lti, i2, n), loop);
+
+    // Straight-line code after the loop moves it to a different address.
+    LIns *res = out.insLoad(LIR_ldi, vars, 4, ACCSET_ALL, LOAD_NORMAL);
+    for (int k = 0; k < variant; k++)
+        out.insStore(LIR_sti, res, vars, 8 + 4 * k, ACCSET_ALL);
+    f->lastIns = out.ins1(LIR_reti, res);
+
+    assm.compile(f, alloc, true verbose_only(, NULL));
+    if (assm.error() != None) {
+        fprintf(stderr, "error: %d\n", assm.error());
+        exit(1);
+    }
+    return reinterpret_cast<LoopFn>(f->code());
+}
+
+static double timeLoop(LoopFn fn, int32_t iterations)
+{
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        volatile int32_t res = fn(iterations);
+        (void)res;
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        if (run == 0 || t.count() < best)
+            best = t.count();
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    int32_t iterations = argc > 1 ? atoi(argv[1]) : 50000000;
+
+    LogControl lc;
+    lc.lcbits = 0;
+    Allocator alloc;
+
+    static const uint8_t aligns[] = { 0, 16, 32, 64 };
+    printf("%d iterations, best of 5, ms per variant\n", iterations);
+    printf("align  ");
+    for (int v = 0; v < NUM_VARIANTS; v++)
+        printf("   v%d  ", v);
+    printf("    min     max\n");
+
+    for (size_t a = 0; a < sizeof(aligns) / sizeof(aligns[0]); a++) {
+        Config config;
+        config.code_align = aligns[a];
+        CodeAlloc codeAlloc(&config);
+        Assembler assm(codeAlloc, alloc, alloc, &lc, config);
+
+        double lo = 0, hi = 0;
+        printf("%5d  ", aligns[a]);
+        for (int v = 0; v < NUM_VARIANTS; v++) {
+            LoopFn fn = compileLoop(assm, alloc, config, v);
+            double t = timeLoop(fn, iterations) * 1000;
+            printf("%6.1f ", t);
+            if (v == 0 || t < lo) lo = t;
+            if (v == 0 || t > hi) hi = t;
+        }
+        printf("%7.1f %7.1f\n", lo, hi);
+    }
+#if !NJ_CODE_ALIGNMENT_SUPPORTED
+    printf("(code alignment is not supported on this platform)\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,137 @@
+// Times a streaming copy compiled with ordinary stores, with non-temporal
+// stores, and with and without software prefetching of the source.
+//
+// The buffers are much larger than the last-level cache, so every line is
+// touched once.  Ordinary stores read each destination line into the cache
+// before overwriting it and evict useful lines doing so; non-temporal stores
+// write around the cache.
+//
+// usage: streaming [megabytes]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "nanojit.h"
+
+using namespace nanojit;
+
+typedef int32_t (*CopyFn)(void*, const void*, size_t);
+
+// Bytes copied per loop iteration: one cache line, as four float4s.
+static const int LINE = 64;
+
+// How far ahead of the copy the source is prefetched.
+static const int PREFETCH_DISTANCE = 8 * LINE;
+
+// int32_t f(void* dst, const void* src, size_t n) {
+//     size_t i = 0;
+//     do {
+//         prefetch(src + i + PREFETCH_DISTANCE);       // if 'prefetch'
+//         copy LINE bytes from src + i to dst + i;
+//         i += LINE;
+//     } while (i < n);
+//     return 0;
+// }
+static CopyFn compileCopy(Assembler& assm, Allocator& alloc, const Config& config,
+                          bool nonTemporal, bool prefetch)
+{
+    LirBuffer *buf = new (alloc) LirBuffer(alloc);
+    LirBufWriter out(buf, config);
+    buf->abi = ABI_CDECL;
+
+    Fragment* f = new (alloc) Fragment(NULL verbose_only(, 0));
+    f->lirbuf = buf;
+
+    out.ins0(LIR_start);
+    LIns *dst = out.insParam(0, 0);
+    LIns *src = out.insParam(1, 0);
+    LIns *n = out.insParam(2, 0);
+    LIns *vars = out.insAlloc(sizeof(void*));
+    out.insStore(LIR_stp, out.insImmWord(0), vars, 0, ACCSET_ALL);
+
+    LIns *loop = out.ins0(LIR_label);
+    LIns *i = out.insLoad(LIR_ldp, vars, 0, ACCSET_ALL, LOAD_NORMAL);
+    LIns *s = out.ins2(LIR_addp, src, i);
+    LIns *d = out.ins2(LIR_addp, dst, i);
+    if (prefetch)
+        out.insPrefetch(out.ins2(LIR_addp, s, out.insImmWord(PREFETCH_DISTANCE)), PREFETCH_NTA);
+    for (int k = 0; k < LINE; k += 16) {
+        LIns *v = out.insLoad(LIR_ldf4, s, k, ACCSET_ALL, LOAD_NORMAL);
+        out.insStore(nonTemporal ? LIR_stntf4 : LIR_stf4, v, d, k, ACCSET_ALL);
+    }
+    LIns *i2 = out.ins2(LIR_addp, i, out.insImmWord(LINE));
+    out.insStore(LIR_stp, i2, vars, 0, ACCSET_ALL);
+    out.insBranch(LIR_jt, out.ins2(LIR_ltup, i2, n), loop);
+
+    f->lastIns = out.ins1(LIR_reti, out.insImmI(0));
+
+    assm.compile(f, alloc, true verbose_only(, NULL));
+    if (assm.error() != None) {
+        fprintf(stderr, "error: %d\n", assm.error());
+        exit(1);
+    }
+    return reinterpret_cast<CopyFn>(f->code());
+}
+
+static double timeCopy(CopyFn fn, void* dst, const void* src, size_t n)
+{
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        fn(dst, src, n);
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        if (run == 0 || t.count() < best)
+            best = t.count();
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = argc > 1 ? size_t(atoi(argv[1])) : 256;
+    size_t n = megabytes << 20;
+
+    // stntf4 needs 16-byte alignment; line alignment keeps the runs comparable.
+    // Prefetches past the end of the source are harmless: they never fault.
+    char *src = (char*)malloc(n + 2 * LINE);
+    char *dst = (char*)malloc(n + 2 * LINE);
+    if (!src || !dst) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    char *s = (char*)((uintptr_t(src) + LINE - 1) & ~uintptr_t(LINE - 1));
+    char *d = (char*)((uintptr_t(dst) + LINE - 1) & ~uintptr_t(LINE - 1));
+    for (size_t k = 0; k < n; k++)
+        s[k] = char(k * 7);
+
+    LogControl lc;
+    lc.lcbits = 0;
+    Allocator alloc;
+    Config config;
+    CodeAlloc codeAlloc(&config);
+    Assembler assm(codeAlloc, alloc, alloc, &lc, config);
+
+    printf("%u MB copy, best of 5\n", unsigned(megabytes));
+    printf("stores         prefetch      ms     GB/s\n");
+    for (int nt = 0; nt < 2; nt++) {
+        for (int pf = 0; pf < 2; pf++) {
+            CopyFn fn = compileCopy(assm, alloc, config, nt != 0, pf != 0);
+            memset(d, 0, n);
+            double t = timeCopy(fn, d, s, n);
+            printf("%-14s %-8s %8.1f %8.2f\n", nt ? "non-temporal" : "ordinary",
+                   pf ? "yes" : "no", t * 1000, n / t / 1e9);
+            if (memcmp(s, d, n) != 0) {
+                fprintf(stderr, "copy mismatch\n");
+                return 1;
+            }
+        }
+    }
+#if !NJ_CACHE_CONTROL_SUPPORTED
+    printf("(prefetch and non-temporal stores are not supported on this platform)\n");
+#endif
+    free(src);
+    free(dst);
+    return 0;
+}
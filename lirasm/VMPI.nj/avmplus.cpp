@@ -83,9 +83,9 @@ nanojit::CodeAlloc::freeCodeChunk(void *p, size_t nbytes) {
 
 #elif defined(AVMPLUS_UNIX)
 
-void*
-nanojit::CodeAlloc::allocCodeChunk(size_t nbytes) {
-    return mmap(NULL,
+static void*
+mmapCode(void* addr, size_t nbytes) {
+    return mmap((maddr_ptr)addr,
                 nbytes,
                 PROT_READ | PROT_WRITE | PROT_EXEC,
                 MAP_PRIVATE | MAP_ANON,
@@ -93,6 +93,41 @@ nanojit::CodeAlloc::allocCodeChunk(size_t nbytes) {
                 0);
 }
 
+#ifdef NANOJIT_64BIT
+// Where the next chunk near the hint is tried first: just below the last
+// one, so chunks pack downwards from the hint.
+static uintptr_t nearCursor = 0;
+#endif
+
+void*
+nanojit::CodeAlloc::allocCodeChunk(size_t nbytes) {
+#ifdef NANOJIT_64BIT
+    // mmap() only takes the address as a hint, so check where each chunk
+    // lands and try further away when it isn't within reach of nearHint.
+    if (nearHint) {
+        uintptr_t near = uintptr_t(nearHint) & ~(bytesPerPage - 1);
+        const uintptr_t reach = (uintptr_t(1) << 31) - nbytes;
+        if (nearCursor == 0 || near - nearCursor > reach)
+            nearCursor = near;
+        for (uintptr_t step = nbytes; step < reach; step <<= 1) {
+            if (nearCursor < step)
+                break;
+            void* p = mmapCode((void*)(nearCursor - step), nbytes);
+            if (p == MAP_FAILED)
+                continue;
+            uintptr_t at = uintptr_t(p);
+            if ((at < near ? near - at : at + nbytes - near) <= reach) {
+                if (at < nearCursor)
+                    nearCursor = at;
+                return p;
+            }
+            munmap((maddr_ptr)p, nbytes);
+        }
+    }
+#endif
+    return mmapCode(NULL, nbytes);
+}
+
 void
 nanojit::CodeAlloc::freeCodeChunk(void *p, size_t nbytes) {
     munmap((maddr_ptr)p, nbytes);
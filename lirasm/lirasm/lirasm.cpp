@@ -7,6 +7,7 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <set>
 #include <string>
 #include <iostream>
 #include <sstream>
@@ -16,6 +17,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
+#define NULL_DEVICE "/dev/null"
+#elif defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#define NULL_DEVICE "NUL"
 #endif
 
 #include <stdlib.h>
@@ -37,9 +44,9 @@ static std::ostream& print_float(float f) {
 }
 
 static std::ostream& print_double(double f) {
-    cout << flush;
-    printf("%g", f);
-    return cout;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%g", f);
+    return cout << buf;
 }
 
 /* Macro to print floating point special vals. consistently across platforms */
@@ -51,12 +58,14 @@ static std::ostream& print_double(double f) {
 
 static const uint8_t LIRASM_NUM_USED_ACCS = 1;
 
-typedef int32_t (FASTCALL *RetInt)();
-typedef int64_t (FASTCALL *RetQuad)();
-typedef double (FASTCALL *RetDouble)();
-typedef float (FASTCALL *RetFloat)();
-typedef float4_t (FASTCALL *RetFloat4)();
-typedef GuardRecord* (FASTCALL *RetGuard)();
+// Fragments are entered with the runtime context pointer as their first
+// argument; LIR_contextp reads it.
+typedef int32_t (FASTCALL *RetInt)(void*);
+typedef int64_t (FASTCALL *RetQuad)(void*);
+typedef double (FASTCALL *RetDouble)(void*);
+typedef float (FASTCALL *RetFloat)(void*);
+typedef float4_t (FASTCALL *RetFloat4)(void*);
+typedef GuardRecord* (FASTCALL *RetGuard)(void*);
 
 struct Function {
     const char *name;
@@ -87,6 +96,13 @@ enum ReturnType {
 #define FN(name, args) \
     {#name, CI(name, args)}
 
+#define CI_CLOBBERS(name, args, clobbers) \
+    {(uintptr_t) (&name), args, nanojit::ABI_CDECL, /*isPure*/0, ACCSET_STORE_ANY \
+     DEBUG_ONLY_NAME(name), clobbers}
+
+#define FN_CLOBBERS(name, args, clobbers) \
+    {#name, CI_CLOBBERS(name, args, clobbers)}
+
 enum LirTokenType {
     NAME, NUMBER, PUNCT, NEWLINE
 };
@@ -184,6 +200,32 @@ public:
     ReturnType mReturnType;
     Fragment *fragptr;
     map<string, LIns*> mLabels;
+    vector< pair<LIns*, size_t> > mBranchLines;     // for --edge-counters
+};
+
+// Records the line of each conditional branch and jump table that reaches
+// the LirBuffer, so --edge-counters can say which branch a count is for.
+class BranchLineWriter : public LirWriter {
+public:
+    BranchLineWriter(LirWriter *out, vector< pair<LIns*, size_t> > &lines, const size_t &lineno)
+        : LirWriter(out), mLines(lines), mLineno(lineno) {}
+
+    LIns *insBranch(LOpcode op, LIns *cond, LIns *to) {
+        LIns *ins = out->insBranch(op, cond, to);
+        if (ins && (ins->isop(LIR_jt) || ins->isop(LIR_jf)))
+            mLines.push_back(make_pair(ins, mLineno));
+        return ins;
+    }
+
+    LIns *insJtbl(LIns *index, uint32_t size) {
+        LIns *ins = out->insJtbl(index, size);
+        mLines.push_back(make_pair(ins, mLineno));
+        return ins;
+    }
+
+private:
+    vector< pair<LIns*, size_t> > &mLines;
+    const size_t &mLineno;
 };
 
 typedef map<string, LirasmFragment> Fragments;
@@ -218,7 +260,8 @@ private:
 
 class FragmentAssembler {
 public:
-    FragmentAssembler(Lirasm &parent, const string &fragmentName, bool optimize);
+    FragmentAssembler(Lirasm &parent, const string &fragmentName, bool optimize,
+                      AbiKind abi = ABI_FASTCALL);
     ~FragmentAssembler();
 
     void assembleFragment(LirTokenStream &in,
@@ -250,6 +293,7 @@ private:
     LirWriter *mValidateWriter1;
     LirWriter *mValidateWriter2;
     vector< pair<string, LIns*> > mJumps;
+    vector< pair<string, pair<SwitchTargets*, uint32_t> > > mSwitchJumps;
     map<string, LIns*> mJumpLabels;
 
     size_t mLineno;
@@ -257,6 +301,7 @@ private:
     size_t mOpcount;
 
     char mReturnTypeBits;
+    LIns *mLastIns;
     vector<string> mTokens;
 
     void tokenizeLine(LirTokenStream &in, LirToken &token);
@@ -269,6 +314,7 @@ private:
     LIns *assemble_guard(bool isCond);
     LIns *assemble_guard_xov();
     LIns *assemble_jump_jov();
+    void assemble_switch();
     void bad(const string &msg);
     void nyi(const string &opname);
     void extract_any_label(string &lab, char lab_delim);
@@ -360,6 +406,21 @@ void printi(int x) {
     cout << x << endl;
 }
 
+#if NJ_CALL_CLOBBERS_SUPPORTED && defined __GNUC__
+// A helper written to a preserve-most convention:  it only clobbers its
+// result register, so callers can keep live values in the other scratch
+// registers across the call.
+extern "C" int pmaddi(int, int) __asm__("lirasm_pmaddi");
+__asm__(".text\n"
+        "lirasm_pmaddi:\n"
+#ifdef _WIN64
+        "    leal (%rcx,%rdx), %eax\n"
+#else
+        "    leal (%rdi,%rsi), %eax\n"
+#endif
+        "    ret\n");
+#endif
+
 Function functions[] = {
     FN(puts,      CallInfo::typeSig1(ARGTYPE_I, ARGTYPE_P)),
     FN(sin,       CallInfo::typeSig1(ARGTYPE_D, ARGTYPE_D)),
@@ -388,6 +449,9 @@ Function functions[] = {
     FN(callf4_mt, CallInfo::typeSig8(ARGTYPE_F4, ARGTYPE_F, ARGTYPE_I, ARGTYPE_D,
                                   ARGTYPE_F4, ARGTYPE_I, ARGTYPE_D, ARGTYPE_F, ARGTYPE_F4)),
     FN(printi,  CallInfo::typeSig1(ARGTYPE_V, ARGTYPE_I)),
+#if NJ_CALL_CLOBBERS_SUPPORTED && defined __GNUC__
+    FN_CLOBBERS(pmaddi, CallInfo::typeSig2(ARGTYPE_I, ARGTYPE_I, ARGTYPE_I), rmask(RAX)),
+#endif
 };
 
 template<typename out, typename in> out
@@ -540,7 +604,8 @@ dump_srecords(ostream &, Fragment *)
 uint32_t
 FragmentAssembler::sProfId = 0;
 
-FragmentAssembler::FragmentAssembler(Lirasm &parent, const string &fragmentName, bool optimize)
+FragmentAssembler::FragmentAssembler(Lirasm &parent, const string &fragmentName, bool optimize,
+                                     AbiKind abi)
     : mParent(parent), mFragName(fragmentName), optimize(optimize),
       mBufWriter(NULL), mCseFilter(NULL), mExprFilter(NULL), mSoftFloatFilter(NULL), mVerboseWriter(NULL),
       mValidateWriter1(NULL), mValidateWriter2(NULL)
@@ -549,9 +614,14 @@ FragmentAssembler::FragmentAssembler(Lirasm &parent, const string &fragmentName,
                                                   nanojit::LC_FragProfile) ?
                                                   sProfId++ : 0));
     mFragment->lirbuf = mParent.mLirbuf;
+    mFragment->lirbuf->abi = abi;
     mParent.mFragments[mFragName].fragptr = mFragment;
 
     mLir = mBufWriter  = new LirBufWriter(mParent.mLirbuf, mParent.mConfig);
+    if (mParent.mConfig.edge_counters) {
+        mLir = new BranchLineWriter(mLir, mParent.mFragments[mFragName].mBranchLines,
+                                    mLineno);
+    }
 #ifdef DEBUG
     if (optimize) {     // don't re-validate if no optimization has taken place
         mLir = mValidateWriter2 =
@@ -582,6 +652,7 @@ FragmentAssembler::FragmentAssembler(Lirasm &parent, const string &fragmentName,
 #endif
 
     mReturnTypeBits = 0;
+    mLastIns = NULL;
     mLir->ins0(LIR_start);
     for (int i = 0; i < nanojit::NumSavedRegs; ++i)
         mLir->insParam(i, 1);
@@ -699,6 +770,8 @@ FragmentAssembler::assemble_call(const string &op)
         _abi = ABI_THISCALL;
     else if (abi == "cdecl")
         _abi = ABI_CDECL;
+    else if (abi == "internal")
+        _abi = ABI_INTERNAL;
     else
         bad("call abi name '" + abi + "'");
 
@@ -724,17 +797,18 @@ FragmentAssembler::assemble_call(const string &op)
         // type) from the call site.
         ci->_abi = _abi;
         size_t argc = mTokens.size();
-        ArgType argTypes[MAXARGS];
+        ArgType argTypes[MAXARGS];      // in left-to-right order, unlike args[]
         for (size_t i = 0; i < argc; ++i) {
             NanoAssert(i < MAXARGS);    // should give a useful error msg if this fails
             args[i] = ref(mTokens[mTokens.size() - (i+1)]);
-            if      (args[i]->isD()) argTypes[i] = ARGTYPE_D;
-            else if (args[i]->isF()) argTypes[i] = ARGTYPE_F;
-            else if (args[i]->isF4()) argTypes[i] = ARGTYPE_F4;
+            ArgType &ty = argTypes[argc - (i+1)];
+            if      (args[i]->isD()) ty = ARGTYPE_D;
+            else if (args[i]->isF()) ty = ARGTYPE_F;
+            else if (args[i]->isF4()) ty = ARGTYPE_F4;
 #ifdef NANOJIT_64BIT
-            else if (args[i]->isQ()) argTypes[i] = ARGTYPE_Q;
+            else if (args[i]->isQ()) ty = ARGTYPE_Q;
 #endif
-            else                     argTypes[i] = ARGTYPE_I;
+            else                     ty = ARGTYPE_I;
         }
 
         // Select return type from opcode.
@@ -827,10 +901,56 @@ FragmentAssembler::assemble_jump_jov()
     string name = mTokens[2];
 
     LIns *ins = mLir->insBranchJov(mOpcode, a, b, NULL);
-    mJumps.push_back(make_pair(name, ins));
+    // ExprFilter may have proven that overflow is impossible, in which case
+    // there is no branch left to resolve.
+    if (ins->isJov())
+        mJumps.push_back(make_pair(name, ins));
     return ins;
 }
 
+// switch <value> <default-label> <case-value> <case-label> ...
+// A case value of the form <lo>..<hi> stands for all the values from lo to hi.
+void
+FragmentAssembler::assemble_switch()
+{
+    if (mTokens.size() < 2 || mTokens.size() % 2 != 0)
+        bad("switch needs a value, a default label and a label for every case value");
+
+    LIns *value = ref(mTokens[0]);
+    string defaultName = mTokens[1];
+
+    // Cases that go to the same label share a destination.
+    vector<string> destNames;
+    vector<SwitchCase> cases;
+    set<int32_t> values;
+    for (size_t i = 2; i < mTokens.size(); i += 2) {
+        SwitchCase c;
+        size_t dots = mTokens[i].find("..");
+        int32_t lo = immI(mTokens[i].substr(0, dots));
+        int32_t hi = dots == string::npos ? lo : immI(mTokens[i].substr(dots + 2));
+        if (hi < lo)
+            bad("empty switch case range " + mTokens[i]);
+        c.target = 0;
+        while (c.target < destNames.size() && destNames[c.target] != mTokens[i + 1])
+            c.target++;
+        if (c.target == destNames.size())
+            destNames.push_back(mTokens[i + 1]);
+        for (int64_t v = lo; v <= hi; v++) {
+            c.value = int32_t(v);
+            if (!values.insert(c.value).second)
+                bad("duplicate switch case " + mTokens[i]);
+            cases.push_back(c);
+        }
+    }
+
+    uint32_t ndests = uint32_t(destNames.size());
+    SwitchTargets *targets = mLir->insSwitch(value, cases.empty() ? NULL : &cases[0],
+                                             uint32_t(cases.size()), ndests, mParent.mAlloc);
+    for (uint32_t d = 0; d < ndests; d++)
+        mSwitchJumps.push_back(make_pair(destNames[d], make_pair(targets, d)));
+    mSwitchJumps.push_back(make_pair(defaultName, make_pair(targets, ndests)));
+}
+
 void
 FragmentAssembler::endFragment()
 {
@@ -854,8 +974,13 @@ FragmentAssembler::endFragment()
              << mFragName << "'" << endl;
     }
 
-    mFragment->lastIns =
-        mLir->insGuard(LIR_x, NULL, createGuardRecord(createSideExit()));
+    // A fragment that ends by returning doesn't need the closing exit, and
+    // leaving it off lets the back-end treat it as a leaf.
+    if (mLastIns && mLastIns->isRet())
+        mFragment->lastIns = mLastIns;
+    else
+        mFragment->lastIns =
+            mLir->insGuard(LIR_x, NULL, createGuardRecord(createSideExit()));
 
     mParent.mAssm.compile(mFragment, mParent.mAlloc, optimize
               verbose_only(, mParent.mLirbuf->printer));
@@ -866,6 +991,7 @@ FragmentAssembler::endFragment()
           case nanojit::BranchTooFar: cerr << "BranchTooFar"; break;
           case nanojit::StackFull: cerr << "StackFull"; break;
           case nanojit::UnknownBranch:  cerr << "UnknownBranch"; break;
+          case nanojit::StackParam: cerr << "StackParam"; break;
           case nanojit::None: cerr << "None"; break;
           default: NanoAssert(0); break;
         }
@@ -951,6 +1077,14 @@ FragmentAssembler::resolve_jumps()
             bad("No label exists for jump target '" + i->first + "'");
         i->second->setTarget( target->second );
     }
+
+    typedef vector< pair<string, pair<SwitchTargets*, uint32_t> > > switchvec;
+    for ( switchvec::const_iterator i = mSwitchJumps.begin(); i != mSwitchJumps.end(); ++i ) {
+        lm_ci target = mJumpLabels.find(i->first);
+        if ( target == mJumpLabels.end() )
+            bad("No label exists for switch target '" + i->first + "'");
+        i->second.first->setTarget( i->second.second, target->second );
+    }
 }
 
 void
@@ -1007,6 +1141,16 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
 
         assert(!mTokens.empty());
         op = pop_front(mTokens);
+
+        // 'switch' expands to several instructions and has no result.
+        if (op == "switch") {
+            if (!lab.empty())
+                bad("switch has no result to name");
+            assemble_switch();
+            mLastIns = NULL;
+            continue;
+        }
+
         if (mParent.mOpMap.find(op) == mParent.mOpMap.end())
             bad("unknown instruction '" + op + "'");
 
@@ -1018,6 +1162,10 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
             break;
 
           case LIR_regfence:
+#if defined NANOJIT_X64
+          case LIR_fence:
+          case LIR_contextp:
+#endif
             need(0);
             ins = mLir->ins0(mOpcode);
             break;
@@ -1032,6 +1180,20 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_negf:
           case LIR_negf4:
           case LIR_noti:
+#if NJ_ROUNDING_SUPPORTED
+          case LIR_floord:
+          case LIR_ceild:
+          case LIR_truncd:
+          case LIR_roundd:
+          case LIR_floorf:
+          case LIR_ceilf:
+          case LIR_truncf:
+          case LIR_roundf:
+          case LIR_floorf4:
+          case LIR_ceilf4:
+          case LIR_truncf4:
+          case LIR_roundf4:
+#endif
           CASESF(LIR_dlo2i:)
           CASESF(LIR_dhi2i:)
           CASE64(LIR_q2i:)
@@ -1054,6 +1216,9 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_d2f:
 #if defined NANOJIT_IA32 || defined NANOJIT_X64
           case LIR_modi:
+#endif
+#if defined NANOJIT_X64
+          case LIR_modq:
 #endif
             need(1);
             ins = mLir->ins1(mOpcode,
@@ -1070,6 +1235,9 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_subd:
           case LIR_muld:
           case LIR_divd:
+#if NJ_ROUNDING_SUPPORTED
+          case LIR_copysignd:
+#endif
           case LIR_addf:
           case LIR_subf:
           case LIR_mulf:
@@ -1080,6 +1248,14 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_divf4:
           CASE64(LIR_addq:)
           CASE64(LIR_subq:)
+          CASE64(LIR_mulq:)
+#if defined NANOJIT_X64
+          case LIR_divq:
+          case LIR_xaddi:
+          case LIR_xaddq:
+          case LIR_xchgi:
+          case LIR_xchgq:
+#endif
           case LIR_andi:
           case LIR_ori:
           case LIR_xori:
@@ -1133,6 +1309,10 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_cmovd:
           case LIR_cmovf:
           case LIR_cmovf4:
+#if defined NANOJIT_X64
+          case LIR_casi:
+          case LIR_casq:
+#endif
             need(3);
             ins = mLir->ins3(mOpcode,
                              ref(mTokens[0]),
@@ -1187,6 +1367,14 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_std:
           case LIR_stf:
           case LIR_stf4:
+#if defined NANOJIT_X64
+          case LIR_streli:
+          case LIR_strelq:
+#endif
+          case LIR_stnti:
+          CASE64(LIR_stntq:)
+          case LIR_stntd:
+          case LIR_stntf4:
             need(3);
             ins = mLir->insStore(mOpcode, ref(mTokens[0]),
                                   ref(mTokens[1]),
@@ -1205,9 +1393,36 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_ldd:
           case LIR_ldf:
           case LIR_ldf4:
+#if defined NANOJIT_X64
+          case LIR_ldacqi:
+          case LIR_ldacqq:
+#endif
             ins = assemble_load();
             break;
 
+          case LIR_memcpy:
+          case LIR_memset:
+          case LIR_memcmp:
+            need(3);
+            ins = mLir->insMem(mOpcode, ref(mTokens[0]), ref(mTokens[1]),
+                               ref(mTokens[2]), ACCSET_OTHER);
+            break;
+
+          case LIR_prefetch: {
+            need(2);
+            PrefetchHint hint = PREFETCH_T0;
+            if (mTokens[1] == "nta")
+                hint = PREFETCH_NTA;
+            else if (mTokens[1] == "t1")
+                hint = PREFETCH_T1;
+            else if (mTokens[1] == "t2")
+                hint = PREFETCH_T2;
+            else if (mTokens[1] != "t0")
+                bad("prefetch hint must be one of nta, t0, t1 or t2");
+            ins = mLir->insPrefetch(ref(mTokens[0]), hint);
+            break;
+          }
+
           // XXX: insParam gives the one appropriate for the platform.  Eg. if
           // you specify qparam on x86 you'll end up with iparam anyway.  Fix
           // this.
@@ -1217,6 +1432,15 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
                                  immI(mTokens[1]));
             break;
 
+#if defined NANOJIT_X64
+          case LIR_paramd:
+          case LIR_paramf:
+          case LIR_paramf4:
+            need(1);
+            ins = mLir->insFpParam(mOpcode, immI(mTokens[0]));
+            break;
+#endif
+
           // XXX: similar to iparam/qparam above.
           case LIR_allocp:
             need(1);
@@ -1240,6 +1464,9 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_addxovi:
           case LIR_subxovi:
           case LIR_mulxovi:
+          CASE64(LIR_addxovq:)
+          CASE64(LIR_subxovq:)
+          CASE64(LIR_mulxovq:)
             ins = assemble_guard_xov();
             break;
 
@@ -1248,6 +1475,7 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_muljovi:
           CASE64(LIR_addjovq:)
           CASE64(LIR_subjovq:)
+          CASE64(LIR_muljovq:)
             ins = assemble_jump_jov();
             break;
 
@@ -1301,6 +1529,7 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
         }
 
         assert(ins);
+        mLastIns = ins;
         if (!lab.empty())
             mLabels.insert(make_pair(lab, ins));
 
@@ -1532,6 +1761,7 @@ FragmentAssembler::assembleRandomFragment(int nIns)
 #ifdef NANOJIT_64BIT
     vector<LOpcode> Q_QQ_ops;
     Q_QQ_ops.push_back(LIR_addq);
+    Q_QQ_ops.push_back(LIR_mulq);
     Q_QQ_ops.push_back(LIR_andq);
     Q_QQ_ops.push_back(LIR_orq);
     Q_QQ_ops.push_back(LIR_xorq);
@@ -2433,7 +2663,7 @@ FragmentAssembler::assembleRandomFragment(int nIns)
 
     // Return 0.
     mReturnTypeBits |= RT_INT;
-    mLir->ins1(LIR_reti, mLir->insImmI(0));
+    mLastIns = mLir->ins1(LIR_reti, mLir->insImmI(0));
 
     endFragment();
 }
@@ -2446,6 +2676,9 @@ Lirasm::Lirasm(bool verbose, Config& config) :
     mVerbose = verbose;
     mLogc.lcbits = 0;
 
+    // Place code where it can call our own helpers directly.
+    mCodeAlloc.setNearHint((void*)&calld1);
+
     mLirbuf = new (mAlloc) LirBuffer(mAlloc);
 #ifdef DEBUG
     if (mVerbose) {
@@ -2543,10 +2776,20 @@ Lirasm::assemble(istream &in, bool optimize)
             string name;
             if (!ts.getName(name))
                 bad("expected fragment name after .begin");
-            if (!ts.eat(NEWLINE))
+
+            // '.begin name internal' declares a fragment that is called
+            // with the internal ABI.
+            AbiKind abi = ABI_FASTCALL;
+            LirToken t;
+            bool ok = ts.get(t);
+            if (ok && t.type == NAME && t.data == "internal") {
+                abi = ABI_INTERNAL;
+                ok = ts.get(t);
+            }
+            if (!ok || t.type != NEWLINE)
                 bad("extra junk after .begin " + name);
 
-            FragmentAssembler assembler(*this, name, optimize);
+            FragmentAssembler assembler(*this, name, optimize, abi);
             assembler.assembleFragment(ts, false, NULL);
             first = false;
         } else if (op == ".end") {
@@ -2610,6 +2853,20 @@ usageAndQuit(const string& progname)
         "  --[no-]optimize   enable or disable optimization of the LIR (default=off)\n"
         "  --random [N]      generate a random LIR block of size N (default=100)\n"
         "  --stkskip [N]     push approximately N Kbytes of stack before execution (default=100)\n"
+        "  --pc-map          map the code back to LIR, and print what the entry and\n"
+        "                    the jumps to the exits of each fragment map to\n"
+        "  --code-index      look up code addresses in the index of the code allocator\n"
+        "  --free-code       at the end, free the code of 'main' and then all code,\n"
+        "                    printing which fragment the index finds at each entry\n"
+#ifdef __linux__
+        "  --perf-map        write /tmp/perf-<pid>.map naming the code for perf\n"
+        "  --jitdump         write jit-<pid>.dump with the code, for perf inject --jit\n"
+        "  --check-perf-map  write the perf map, check that it has one line for each\n"
+        "                    block of code and covers the entry and exits of each\n"
+        "                    fragment, and remove it\n"
+        "  --profile [N]     after executing, run 'main' for N ms of CPU time under the\n"
+        "                    sampling profiler and print where the time went (default=100)\n"
+#endif
         "\n"
         "Build query options (these print a value for this build of lirasm and exit)\n"
         "  --show-arch       show the architecture ('i386', 'X64', 'arm', 'ppc',\n"
@@ -2620,6 +2877,19 @@ usageAndQuit(const string& progname)
         "i386-specific options:\n"
         "  --[no]sse         use SSE2 instructions (default=on)\n"
         "\n"
+        "X64-specific options:\n"
+        "  --align N         align loops and fragment entries to N (16, 32 or 64) bytes\n"
+        "  --nosse41         don't use SSE4.1 instructions, even if the CPU has them\n"
+        "  --relax-branches  reassemble loops whose back edges fit in short branches\n"
+        "  --pinned-context  keep the context pointer (see contextp) pinned in R15\n"
+        "  --lazy-exits      use lazy exit stubs; with --execute, main is run once\n"
+        "                    more after giving the exits it took their own stubs\n"
+        "  --share-exits     share exit stubs between guards with the same exit state\n"
+        "  --prof-counters   count fragment entries and exits; with --execute, the\n"
+        "                    counts are printed after running main\n"
+        "  --edge-counters   count the edges taken at every branch and jump table;\n"
+        "                    with --execute, the counts are printed after running main\n"
+        "\n"
         "ARM-specific options:\n"
         "  --arch N          use ARM architecture version N instructions (default=7)\n"
         "  --[no]vfp         use ARM VFP instructions (default=on)\n"
@@ -2644,6 +2914,13 @@ struct CmdLineOptions {
     bool    optimize;
     int     random;
     int     stkskip;
+    bool    pcMap;
+    bool    freeCode;
+#ifdef __linux__
+    int     perfFormats;    // PerfMapWriter formats to write
+    bool    checkPerfMap;
+    int     profile;        // milliseconds to run 'main' under a SamplingProfiler
+#endif
     string  filename;
     Config  config;
 };
@@ -2679,6 +2956,13 @@ processCmdLine(int argc, char **argv, CmdLineOptions& opts)
     opts.random   = 0;
     opts.optimize = false;
     opts.stkskip  = 0;
+    opts.pcMap    = false;
+    opts.freeCode = false;
+#ifdef __linux__
+    opts.perfFormats = 0;
+    opts.checkPerfMap = false;
+    opts.profile  = 0;
+#endif
 
     // Architecture-specific options.
 #if defined NANOJIT_IA32
@@ -2710,6 +2994,32 @@ processCmdLine(int argc, char **argv, CmdLineOptions& opts)
             if (!parseOptionalInt(argc, argv, &i, &opts.stkskip, 100))
                 errMsgAndQuit(opts.progname, "--stkskip argument must be greater than zero");
         }
+        else if (arg == "--pc-map") {
+            opts.pcMap = true;
+            opts.config.pc_map = true;
+        }
+        else if (arg == "--code-index")
+            opts.config.code_index = true;
+        else if (arg == "--free-code") {
+            opts.freeCode = true;
+            opts.config.code_index = true;
+        }
+#ifdef __linux__
+        else if (arg == "--perf-map")
+            opts.perfFormats |= PerfMapWriter::PERF_MAP;
+        else if (arg == "--jitdump")
+            opts.perfFormats |= PerfMapWriter::JITDUMP;
+        else if (arg == "--check-perf-map") {
+            opts.perfFormats |= PerfMapWriter::PERF_MAP;
+            opts.checkPerfMap = true;
+        }
+        else if (arg == "--profile") {
+            if (!parseOptionalInt(argc, argv, &i, &opts.profile, 100))
+                errMsgAndQuit(opts.progname, "--profile argument must be greater than zero");
+            opts.config.pc_map = true;
+            opts.config.code_index = true;
+        }
+#endif
         else if (arg == "--show-arch") {
             const char* str =
 #if defined NANOJIT_IA32
@@ -2754,6 +3064,36 @@ processCmdLine(int argc, char **argv, CmdLineOptions& opts)
         else if (arg == "--nosse") {
             i386_sse = false;
         }
+#elif defined NANOJIT_X64
+        else if ((arg == "--align") && (i < argc-1)) {
+            char* endptr;
+            unsigned long align = strtoul(argv[i+1], &endptr, 10);
+            if ('\0' != *endptr || (align != 16 && align != 32 && align != 64))
+                errMsgAndQuit(opts.progname, "--align argument must be 16, 32 or 64");
+            opts.config.code_align = uint8_t(align);
+            i++;
+        }
+        else if (arg == "--nosse41") {
+            opts.config.i386_sse41 = false;
+        }
+        else if (arg == "--relax-branches") {
+            opts.config.relax_branches = true;
+        }
+        else if (arg == "--pinned-context") {
+            opts.config.pinned_context = true;
+        }
+        else if (arg == "--lazy-exits") {
+            opts.config.lazy_exits = true;
+        }
+        else if (arg == "--share-exits") {
+            opts.config.share_exits = true;
+        }
+        else if (arg == "--prof-counters") {
+            opts.config.prof_counters = true;
+        }
+        else if (arg == "--edge-counters") {
+            opts.config.edge_counters = true;
+        }
 #elif defined NANOJIT_ARM
         else if ((arg == "--arch") && (i < argc-1)) {
             char* endptr;
@@ -2816,8 +3156,35 @@ processCmdLine(int argc, char **argv, CmdLineOptions& opts)
 #endif
 }
 
+#if NJ_LAZY_EXITS_SUPPORTED
+// Throws away everything written to stdout while it is in scope, through
+// cout or stdio, helpers' output included.
+class QuietStdout {
+public:
+    QuietStdout() {
+        cout << flush;
+        fflush(stdout);
+        saved = dup(fileno(stdout));
+        int null = open(NULL_DEVICE, O_WRONLY);
+        dup2(null, fileno(stdout));
+        close(null);
+    }
+    ~QuietStdout() {
+        cout << flush;
+        fflush(stdout);
+        dup2(saved, fileno(stdout));
+        close(saved);
+    }
+private:
+    int saved;
+};
+#endif
+
 int32_t* dummy;
 
+// The runtime context every fragment is executed with.
+int32_t context[] = { 2, 3, 5, 7, 11, 13, 17, 19 };
+
 void
 executeFragment(const LirasmFragment& fragment, int skip)
 {
@@ -2830,31 +3197,31 @@ executeFragment(const LirasmFragment& fragment, int skip)
     } else {
         switch (fragment.mReturnType) {
           case RT_INT: {
-            int res = fragment.rint();
+            int res = fragment.rint(context);
             cout << "Output is: " << res << endl;
             break;
           }
 #ifdef NANOJIT_64BIT
           case RT_QUAD: {
-            int64_t res = fragment.rquad();
+            int64_t res = fragment.rquad(context);
             cout << "Output is: " << res << endl;
             break;
           }
 #endif
           case RT_DOUBLE: {
-            double res = fragment.rdouble();
+            double res = fragment.rdouble(context);
             cout << "Output is: ";
             print_double(res) << endl;
             break;
           }
           case RT_FLOAT: {
-            float res = fragment.rfloat();
+            float res = fragment.rfloat(context);
             cout << "Output is: ";
             print(res) << endl;
             break;
           }
           case RT_FLOAT4: {
-            float4_t res = fragment.rfloat4();
+            float4_t res = fragment.rfloat4(context);
             cout << "Output is: ";
             print(f4_x(res)) << ",";
             print(f4_y(res)) << ",";
@@ -2863,7 +3230,7 @@ executeFragment(const LirasmFragment& fragment, int skip)
             break;
           }
           case RT_GUARD: {
-            LasmSideExit *ls = (LasmSideExit*) fragment.rguard()->exit;
+            LasmSideExit *ls = (LasmSideExit*) fragment.rguard(context)->exit;
             cout << "Exited block on line: " << ls->line << endl;
             break;
           }
@@ -2871,6 +3238,372 @@ executeFragment(const LirasmFragment& fragment, int skip)
     }
 }
 
+// Returns the name of the fragment 'frag', or "nothing" if it is NULL.
+static string
+fragmentName(Lirasm& lasm, Fragment *frag)
+{
+    Fragments::const_iterator i;
+    for (i = lasm.mFragments.begin(); i != lasm.mFragments.end(); i++) {
+        if (i->second.fragptr == frag)
+            return i->first;
+    }
+    return "nothing";
+}
+
+// Checks the --pc-map of each fragment by printing where its entry and the
+// jumps to its exits map back to.  The jump of an exit that has been
+// materialized or unshared is in a stub added to the fragment's code
+// later, which has no entries in the map.
+void
+dumpPcMap(Lirasm& lasm)
+{
+    Fragments::const_iterator i;
+    for (i = lasm.mFragments.begin(); i != lasm.mFragments.end(); i++) {
+        Fragment *frag = i->second.fragptr;
+        Fragment *owner;
+        lasm.mAssm.lookupPc(frag->code(), owner);
+        cout << i->first << ": entry maps to " << fragmentName(lasm, owner) << endl;
+
+        vector<pair<int, int> > exits;
+        LirReader reader(frag->lastIns);
+        for (LIns *g = reader.read(); !g->isop(LIR_start); g = reader.read()) {
+            if (!g->isGuard() || !g->record()->jmp)
+                continue;
+            GuardRecord *lr = g->record();
+            LIns *ins = lasm.mAssm.lookupPc((NIns*)lr->jmp, owner);
+            int line = ins && owner == frag && ins->isGuard()
+                     ? ((LasmSideExit*)ins->record()->exit)->line : -1;
+            exits.push_back(make_pair(((LasmSideExit*)lr->exit)->line, line));
+        }
+        sort(exits.begin(), exits.end());
+        for (size_t j = 0; j < exits.size(); j++) {
+            cout << i->first << ": exit on line " << exits[j].first << " is jumped to from ";
+            if (exits[j].second < 0)
+                cout << "outside the fragment" << endl;
+            else
+                cout << "line " << exits[j].second << endl;
+        }
+    }
+}
+
+// Prints which fragment CodeAlloc::findOwner() finds at the entry of each
+// fragment, given the entries in 'entries'.
+static void
+dumpOwners(Lirasm& lasm, const vector<pair<string, NIns*> >& entries)
+{
+    for (size_t i = 0; i < entries.size(); i++) {
+        cout << entries[i].first << ": entry is in "
+             << fragmentName(lasm, lasm.mCodeAlloc.findOwner(entries[i].second)) << endl;
+    }
+}
+
+// Checks for --free-code that the index of the code allocator forgets
+// code once it is freed:  first the code of 'main', through freeAll(),
+// then all of it, through reset().  Nothing may run afterwards.
+static void
+freeCode(Lirasm& lasm)
+{
+    vector<pair<string, NIns*> > entries;
+    Fragments::iterator i;
+    for (i = lasm.mFragments.begin(); i != lasm.mFragments.end(); i++)
+        entries.push_back(make_pair(i->first, i->second.fragptr->code()));
+    dumpOwners(lasm, entries);
+
+    i = lasm.mFragments.find("main");
+    if (i != lasm.mFragments.end()) {
+        cout << "after freeing main:" << endl;
+        lasm.mCodeAlloc.freeAll(i->second.fragptr->codeList);
+        dumpOwners(lasm, entries);
+    }
+
+    cout << "after freeing all code:" << endl;
+    lasm.mCodeAlloc.reset();
+    for (i = lasm.mFragments.begin(); i != lasm.mFragments.end(); i++)
+        i->second.fragptr->codeList = NULL;
+    dumpOwners(lasm, entries);
+}
+
+#ifdef __linux__
+// Names the code of --perf-map and --jitdump after the fragment it belongs to.
+class LirasmPerfMapWriter : public PerfMapWriter {
+public:
+    LirasmPerfMapWriter(int formats, Lirasm &lasm) : PerfMapWriter(formats), mLasm(lasm) {}
+
+protected:
+    void fragName(Fragment *frag, char *buf, size_t size) {
+        Fragments::const_iterator i;
+        for (i = mLasm.mFragments.begin(); i != mLasm.mFragments.end(); i++) {
+            if (i->second.fragptr == frag) {
+                snprintf(buf, size, "lirasm %s", i->first.c_str());
+                return;
+            }
+        }
+        PerfMapWriter::fragName(frag, buf, size);
+    }
+
+private:
+    Lirasm &mLasm;
+};
+
+typedef vector<pair<uintptr_t, uintptr_t> > PerfMapLines;
+
+// Returns the number of 'lines' of the perf map within [start, end).
+static int
+perfMapLinesIn(const PerfMapLines& lines, const void* start, const void* end)
+{
+    int n = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (uintptr_t(start) <= lines[i].first && lines[i].second <= uintptr_t(end))
+            n++;
+    }
+    return n;
+}
+
+// Returns true if one of 'lines' of the perf map covers 'pc'.
+static bool
+perfMapHas(const PerfMapLines& lines, const void* pc)
+{
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (lines[i].first <= uintptr_t(pc) && uintptr_t(pc) < lines[i].second)
+            return true;
+    }
+    return false;
+}
+
+#if defined NANOJIT_X64
+// Returns where the branch at 'jmp' goes, for the branches nPatchBranch()
+// patches, or NULL.
+static NIns*
+branchTarget(NIns* jmp)
+{
+    if (jmp[0] == 0xE9)
+        return jmp + 5 + *(int32_t*)(jmp + 1);
+    if (jmp[0] == 0x0F && (jmp[1] & 0xF0) == 0x80)
+        return jmp + 6 + *(int32_t*)(jmp + 2);
+    if (jmp[0] == 0xEB || (jmp[0] & 0xF0) == 0x70)
+        return jmp + 2 + *(int8_t*)(jmp + 1);
+    if (jmp[0] == 0xFF && jmp[1] == 0x25)
+        return *(NIns**)(jmp + 6);
+    return NULL;
+}
+#endif
+
+// Checks the --check-perf-map of this run by printing whether the entry of
+// each fragment and both ends of the jumps of its exits have a line, and
+// whether each block of code has no more than one.  Exit stubs added after
+// a fragment was compiled are blocks of their own.  Removes the map
+// afterwards.
+static void
+checkPerfMap(Lirasm& lasm, LirasmPerfMapWriter& perfMap)
+{
+    perfMap.flush();
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", int(getpid()));
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        cout << "perf map: missing" << endl;
+        return;
+    }
+    PerfMapLines lines;
+    unsigned long start, size;
+    char name[256];
+    while (fscanf(f, "%lx %lx %255[^\n]\n", &start, &size, name) == 3)
+        lines.push_back(make_pair(uintptr_t(start), uintptr_t(start + size)));
+    fclose(f);
+    unlink(path);
+
+    size_t inBlocks = 0;
+    bool onePerBlock = true;
+    Fragments::const_iterator i;
+    for (i = lasm.mFragments.begin(); i != lasm.mFragments.end(); i++) {
+        Fragment *frag = i->second.fragptr;
+        for (CodeRange r(frag->codeList); !r.empty(); r.popFront()) {
+            int n = perfMapLinesIn(lines, r.frontStart(), r.frontEnd());
+            onePerBlock = onePerBlock && n <= 1;
+            inBlocks += n;
+        }
+
+        cout << i->first << ": entry is "
+             << (perfMapHas(lines, frag->code()) ? "" : "not ") << "in the perf map" << endl;
+        vector<pair<int, bool> > exits;
+        LirReader reader(frag->lastIns);
+        for (LIns *g = reader.read(); !g->isop(LIR_start); g = reader.read()) {
+            if (!g->isGuard() || !g->record()->jmp)
+                continue;
+            // The jump is in the fragment or, once a lazy exit is
+            // materialized, at the end of its stub.  It goes to a stub, a
+            // trampoline, the epilogue or another fragment.
+            NIns* jmp = (NIns*)g->record()->jmp;
+            bool mapped = perfMapHas(lines, jmp);
+#if defined NANOJIT_X64
+            NIns* to = branchTarget(jmp);
+            mapped = mapped && to && perfMapHas(lines, to);
+#endif
+            exits.push_back(make_pair(((LasmSideExit*)g->record()->exit)->line, mapped));
+        }
+        sort(exits.begin(), exits.end());
+        for (size_t j = 0; j < exits.size(); j++) {
+            cout << i->first << ": the jump of the exit on line " << exits[j].first << " is "
+                 << (exits[j].second ? "within" : "not within") << " the perf map" << endl;
+        }
+    }
+    if (onePerBlock && inBlocks == lines.size())
+        cout << "perf map: one line per block" << endl;
+    else
+        cout << "perf map: " << lines.size() << " lines, " << inBlocks
+             << " of them in blocks of code, some blocks with more than one" << endl;
+}
+#endif
+
+#ifdef __linux__
+// Calls 'fragment' once, quietly, telling the profiler it is in compiled code.
+static void
+runFragment(const LirasmFragment& fragment)
+{
+    SamplingProfiler::enterCode();
+    switch (fragment.mReturnType) {
+      case RT_INT:    fragment.rint(context);    break;
+#ifdef NANOJIT_64BIT
+      case RT_QUAD:   fragment.rquad(context);   break;
+#endif
+      case RT_DOUBLE: fragment.rdouble(context); break;
+      case RT_FLOAT:  fragment.rfloat(context);  break;
+      case RT_FLOAT4: fragment.rfloat4(context); break;
+      case RT_GUARD:  fragment.rguard(context);  break;
+    }
+    SamplingProfiler::leaveCode();
+}
+
+static string
+percent(uint64_t n, uint64_t total)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f%%", total ? 100.0 * n / total : 0.0);
+    return buf;
+}
+
+static string
+helperName(Lirasm& lasm, const CallInfo* ci)
+{
+    if (!ci)
+        return "unknown";
+    const size_t nfuns = sizeof(functions) / sizeof(functions[0]);
+    for (size_t i = 0; i < nfuns; i++) {
+        if (functions[i].callInfo._address == ci->_address)
+            return functions[i].name;
+    }
+    Fragments::const_iterator i;
+    for (i = lasm.mFragments.begin(); i != lasm.mFragments.end(); i++) {
+        if (uintptr_t(i->second.fragptr->code()) == ci->_address)
+            return i->first;
+    }
+    return "unknown";
+}
+
+// Runs 'main' for 'ms' milliseconds of CPU time under a SamplingProfiler,
+// and prints the fragments, exit stubs and helpers the time went to.
+void
+profileMain(Lirasm& lasm, const LirasmFragment& fragment, int ms)
+{
+    SamplingProfiler prof(lasm.mCodeAlloc);
+    prof.registerThread();
+    if (!prof.start(100))
+        lasm.bad("unable to start the profiler");
+    clock_t end = clock() + clock_t(ms) * (CLOCKS_PER_SEC / 1000);
+    while (clock() < end) {
+        for (int n = 0; n < 1000; n++)
+            runFragment(fragment);
+        prof.drain();
+    }
+    prof.stop();
+    prof.drain();
+    prof.unregisterThread();
+
+    const SamplingProfiler::Totals& t = prof.totals();
+    cout << "profile: " << t.samples << " samples: "
+         << percent(t.inFragments, t.samples) << " in fragments, "
+         << percent(t.inExits, t.samples) << " in exit stubs, "
+         << percent(t.inHelpers, t.samples) << " in helpers, "
+         << percent(t.elsewhere, t.samples) << " elsewhere ("
+         << t.dropped << " dropped)" << endl;
+
+    const uint32_t N = 10;
+    SamplingProfiler::FragmentProfile frags[N];
+    uint32_t n = prof.topFragments(frags, N);
+    for (uint32_t j = 0; j < n; j++)
+        cout << "profile: fragment " << fragmentName(lasm, frags[j].frag) << " "
+             << percent(frags[j].samples, t.samples) << " (exit stubs "
+             << percent(frags[j].exitSamples, t.samples) << ", helpers "
+             << percent(frags[j].helperSamples, t.samples) << ")" << endl;
+
+    SamplingProfiler::GuardProfile guards[N];
+    n = prof.topGuards(guards, N);
+    for (uint32_t j = 0; j < n; j++)
+        cout << "profile: exit stub on line " << ((LasmSideExit*)guards[j].guard->record()->exit)->line
+             << " of " << fragmentName(lasm, guards[j].frag) << " "
+             << percent(guards[j].samples, t.samples) << endl;
+
+    SamplingProfiler::HelperProfile helpers[N];
+    n = prof.topHelpers(helpers, N);
+    for (uint32_t j = 0; j < n; j++)
+        cout << "profile: helper " << helperName(lasm, helpers[j].ci) << " "
+             << percent(helpers[j].samples, t.samples) << endl;
+}
+#endif
+
+#if NJ_PROF_COUNTERS_SUPPORTED
+// Prints the --prof-counters counts fragment by fragment, with the exits of
+// each in line order.
+void
+dumpProfCounters(Lirasm& lasm)
+{
+    Fragments::const_iterator i;
+    for (i = lasm.mFragments.begin(); i != lasm.mFragments.end(); i++) {
+        vector<pair<int, uint64_t> > exits;
+        for (ProfCounter* c = i->second.fragptr->profCounters; c != NULL; c = c->next) {
+            if (c->lr)
+                exits.push_back(make_pair(((LasmSideExit*)c->lr->exit)->line, c->count));
+            else
+                cout << i->first << ": entered " << c->count << endl;
+        }
+        sort(exits.begin(), exits.end());
+        for (size_t j = 0; j < exits.size(); j++)
+            cout << i->first << ": exit on line " << exits[j].first
+                 << " taken " << exits[j].second << endl;
+    }
+}
+#endif
+
+#if NJ_EDGE_COUNTERS_SUPPORTED
+// Prints the --edge-counters counts fragment by fragment, in line order,
+// as the branch weights the assembler hands out.
+void
+dumpEdgeCounters(Lirasm& lasm)
+{
+    Fragments::const_iterator i;
+    for (i = lasm.mFragments.begin(); i != lasm.mFragments.end(); i++) {
+        BranchWeights weights(lasm.mAlloc);
+        lasm.mAssm.getBranchWeights(i->second.fragptr, weights, lasm.mAlloc);
+        const vector< pair<LIns*, size_t> > &lines = i->second.mBranchLines;
+        for (size_t j = 0; j < lines.size(); j++) {
+            LIns *ins = lines[j].first;
+            uint64_t *w = weights.get(ins);
+            if (!w)
+                continue;   // folded away, or never assembled
+            if (ins->isop(LIR_jtbl)) {
+                for (uint32_t t = 0; t < ins->getTableSize(); t++)
+                    cout << i->first << ": jtbl on line " << lines[j].second
+                         << " target " << t << " taken " << w[t] << endl;
+            } else {
+                cout << i->first << ": " << (ins->isop(LIR_jt) ? "jt" : "jf") << " on line "
+                     << lines[j].second << " taken " << w[0]
+                     << ", not taken " << w[1] << endl;
+            }
+        }
+    }
+}
+#endif
+
 int
 main(int argc, char **argv)
 {
@@ -2878,6 +3611,11 @@ main(int argc, char **argv)
     processCmdLine(argc, argv, opts);
 
     Lirasm lasm(opts.verbose, opts.config);
+#ifdef __linux__
+    LirasmPerfMapWriter perfMap(opts.perfFormats, lasm);
+    if (opts.perfFormats)
+        lasm.mAssm.setCodeMapWriter(&perfMap);
+#endif
     if (opts.random) {
         lasm.assembleRandom(opts.random, opts.optimize);
     } else {
@@ -2892,9 +3630,48 @@ main(int argc, char **argv)
         i = lasm.mFragments.find("main");
         if (i == lasm.mFragments.end())
             errMsgAndQuit(opts.progname, "error: at least one fragment must be named 'main'");
+#if NJ_LAZY_EXITS_SUPPORTED
+        if (opts.config.lazy_exits) {
+            // Take the exits through the trampoline once, quietly, so the
+            // run below goes through their materialized stubs.
+            {
+                QuietStdout quiet;
+                executeFragment(i->second, opts.stkskip);
+            }
+            for (Fragments::iterator j = lasm.mFragments.begin(); j != lasm.mFragments.end(); j++) {
+                lasm.mAssm.materializeHotExits(j->second.fragptr, 1);
+#if NJ_PROF_COUNTERS_SUPPORTED
+                lasm.mAssm.resetProfCounters(j->second.fragptr);
+#endif
+#if NJ_EDGE_COUNTERS_SUPPORTED
+                lasm.mAssm.resetEdgeCounters(j->second.fragptr);
+#endif
+            }
+        }
+#endif
         executeFragment(i->second, opts.stkskip);
+#if NJ_PROF_COUNTERS_SUPPORTED
+        if (opts.config.prof_counters)
+            dumpProfCounters(lasm);
+#endif
+#ifdef __linux__
+        if (opts.profile)
+            profileMain(lasm, i->second, opts.profile);
+#endif
+#if NJ_EDGE_COUNTERS_SUPPORTED
+        if (opts.config.edge_counters)
+            dumpEdgeCounters(lasm);
+#endif
     } else {
         for (i = lasm.mFragments.begin(); i != lasm.mFragments.end(); i++)
             dump_srecords(cout, i->second.fragptr);
     }
+    if (opts.pcMap)
+        dumpPcMap(lasm);
+#ifdef __linux__
+    if (opts.checkPerfMap)
+        checkPerfMap(lasm, perfMap);
+#endif
+    if (opts.freeCode)
+        freeCode(lasm);
 }
@@ -53,6 +53,29 @@ function runtest {
     fi
 }
 
+# Like runtest, but lirasm must fail, printing the error in the .out file.
+function runerrortest {
+    local infile=$1
+    local options=${2-}
+    local outfile=`echo $infile | sed 's/\.in/\.out/'`
+
+    if [[ ! -e "$outfile" ]] ; then
+        echo "$0: error: no out file $outfile"
+        exit 1
+    fi
+
+    if ! $LIRASM $options --execute $infile 2>testoutput.txt >/dev/null && cmp -s testoutput.txt $outfile ; then
+        echo "TEST-PASS | lirasm | lirasm $options --execute $infile"
+    else
+        echo "TEST-UNEXPECTED-FAIL | lirasm | lirasm $options --execute $infile"
+        echo "expected error"
+        cat $outfile
+        echo "actual error"
+        cat testoutput.txt
+        exitcode=1
+    fi
+}
+
 function emitasm {
     local infile=$1
     local options=${2-}
@@ -117,6 +140,26 @@ elif [[ $($LIRASM --show-arch 2>/dev/null) == "X64" ]] ; then
     runtests "littleendian"
     runtest "--random 1000000"
     runtest "--random 1000000 --optimize"
+    runtest "$TESTS_DIR/backjump.in"  "--align 32"
+    runtest "$TESTS_DIR/backjumpd.in" "--align 64"
+    runtest "$TESTS_DIR/backjump.in"  "--relax-branches"
+    runtest "$TESTS_DIR/backjumpd.in" "--relax-branches"
+    runtest "$TESTS_DIR/backjumpd.in" "--relax-branches --align 32"
+    runtest "$TESTS_DIR/64-bit/rounding.in" "--nosse41"
+    runtest "$TESTS_DIR/64-bit/contextp.in" "--pinned-context"
+    runerrortest "$TESTS_DIR/64-bit/errors/jtbltoobig.in"
+    runtest "$TESTS_DIR/64-bit/lazyexit.in" "--lazy-exits"
+    runtest "$TESTS_DIR/64-bit/profile/perfmap.in" "--lazy-exits --check-perf-map"
+    runtest "$TESTS_DIR/call1.in" "--lazy-exits"
+    runtest "$TESTS_DIR/64-bit/sharedexit.in" "--share-exits"
+    runtest "$TESTS_DIR/64-bit/profile/profcounters.in" "--prof-counters"
+    runtest "$TESTS_DIR/64-bit/profile/edgecounters.in" "--edge-counters"
+    runtest "$TESTS_DIR/64-bit/profile/pcmap.in" "--pc-map"
+    runtest "$TESTS_DIR/64-bit/profile/pcmap.in" "--pc-map --code-index"
+    runtest "$TESTS_DIR/64-bit/profile/freecode.in" "--free-code"
+    if [[ $TESTFLOAT == float ]] ; then
+        runtest "$TESTS_DIR/64-bit/float/roundf.in" "--nosse41"
+    fi
 
 elif [[ $($LIRASM --show-arch 2>/dev/null) == "arm" ]] ; then
     # ARMv7 with VFP.  We could test without VFP but such a platform seems
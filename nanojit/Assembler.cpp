@@ -157,6 +157,11 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         , _branchStateMap(alloc)
         , _patches(alloc)
         , _labels(alloc)
+        , _backEdges(alloc)
+        , _shortBackEdges(alloc)
+        , _shortBranch(false)
+        , _loops(alloc)
+        , _loopSizes(alloc)
         , _noise(NULL)
     #if NJ_USES_IMMD_POOL
         , _immDPool(alloc)
@@ -166,6 +171,22 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
     #endif
         , codeList(NULL)
         , _epilogue(NULL)
+    #if NJ_LAZY_EXITS_SUPPORTED
+        , _lazyExitTable(NULL)
+        , _newLazyExits(NULL)
+        , _lazyTrampoline(NULL)
+    #endif
+    #if NJ_SHARED_EXITS_SUPPORTED
+        , _sharedExits(alloc, 128)
+        , _newSharedGuards(NULL)
+        , _newSharedExitBytes(0)
+    #endif
+    #if NJ_PROF_COUNTERS_SUPPORTED
+        , _newProfCounters(NULL)
+    #endif
+    #if NJ_EDGE_COUNTERS_SUPPORTED
+        , _newEdgeCounters(NULL)
+    #endif
         , _err(None)
     #if PEDANTIC
         , pedanticTop(NULL)
@@ -174,6 +195,10 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         , vtuneHandle(NULL)
     #endif
         , _mdWriter(mdWriter)
+        , _cmWriter(NULL)
+        , _exitChunks(NULL)
+        , _pcEntries(NULL)
+        , _nPcEntries(0)
         , _config(config)
     {
         (void)logc;
@@ -263,6 +288,8 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         _branchStateMap.clear();
         _patches.clear();
         _labels.clear();
+        _backEdges.clear();
+        _loops.clear();
     #if NJ_USES_IMMD_POOL
         _immDPool.clear();
     #endif
@@ -276,8 +303,14 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                               , size_t byteLimit)
     {
         // save the block we just filled
-        if (start)
+        if (start) {
+            if (_inExit && _cmWriter)
+                addExitChunk(start, end);
+            // The code of currIns may go on at the bottom of this block.
+            if (_config.pc_map && eip != end)
+                addPcEntry(eip, currIns, _inExit);
             CodeAlloc::add(codeList, start, end);
+        }
 
         // CodeAlloc contract: allocations never fail
         _codeAlloc.alloc(start, end, byteLimit);
@@ -287,6 +320,24 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         verbose_only( _nInsAfter = eip; )
     }
 
+#if NJ_LAZY_EXITS_SUPPORTED || NJ_SHARED_EXITS_SUPPORTED
+    // Finishes the code assembled into a fresh chunk after 'frag' was
+    // compiled, such as the stub of an exit, and adds it to the code of
+    // 'frag', so that it is freed, and leaves the code index, with the rest.
+    void Assembler::addStubCode(Fragment* frag)
+    {
+        CodeList* blocks = NULL;
+        _codeAlloc.addRemainder(blocks, codeStart, codeEnd, _nSlot, _nIns);
+        _codeAlloc.setOwner(blocks, frag);
+        _codeAlloc.markExec(blocks);
+        CodeAlloc::flushICache(blocks);
+        CodeAlloc::append(frag->codeList, blocks);
+        // Only [_nIns, codeEnd) is code;  any [codeStart, _nSlot) holds data.
+        if (_cmWriter)
+            _cmWriter->codeRange(frag, _nIns, codeEnd, /*isExit*/true);
+    }
+#endif
+
     void Assembler::clearNInsPtrs()
     {
         _nIns = 0;
@@ -458,6 +509,11 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         }
     #else
         (void) d;
+    #endif
+    #if NJ_PINNED_CONTEXT_SUPPORTED
+        // Likewise a pinned context pointer can be used in place.
+        if (base->isop(LIR_contextp) && _config.pinned_context)
+            return ContextReg;
     #endif
         return findRegFor(base, allow);
     }
@@ -479,6 +535,13 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         }
     #else
         (void) d;
+    #endif
+    #if NJ_PINNED_CONTEXT_SUPPORTED
+        if (base->isop(LIR_contextp) && _config.pinned_context) {
+            rb = ContextReg;
+            rv = findRegFor(value, allowValue);
+            return;
+        }
     #endif
         findRegFor2(allowValue, value, rv, allowBase, base, rb);
     }
@@ -769,10 +832,26 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         // slot (if not).
     }
 
+    // Returns log2(c) if 'c' is a valid SIB scale factor (1, 2, 4 or 8), -1 otherwise.
+    static int scaleOf(uintptr_t c)
+    {
+        switch (c) {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: return -1;
+        }
+    }
+
     // If we have this:
     //
     //   W = ld(addp(B, lshp(I, k)))[d] , where int(1) <= k <= int(3)
     //
+    // or this:
+    //
+    //   W = ld(addp(B, mulp(I, 1<<k)))[d] , where int(0) <= k <= int(3)
+    //
     // then we set base=B, index=I, scale=k.
     //
     // Otherwise, we must have this:
@@ -794,6 +873,11 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         {
             *index = rhs->oprnd1();
             *scale = k;
+        } else if (rhs->opcode() == LIR_mulp && rhs->oprnd2()->isImmP() &&
+                   (k = scaleOf(uintptr_t(rhs->oprnd2()->immP()))) >= 0)
+        {
+            *index = rhs->oprnd1();
+            *scale = k;
         } else {
             *index = rhs;
             *scale = 0;
@@ -801,6 +885,28 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
     }
     void Assembler::patch(GuardRecord *lr)
     {
+    #if NJ_LAZY_EXITS_SUPPORTED
+        // A lazy exit needs a stub of its own before it can be retargeted.
+        Fragment* from = lr->exit->from;
+        if (from && from->lazyExits) {
+            LazyExitTable* t = from->lazyExits;
+            for (uint32_t i = 0; i < t->nExits; i++) {
+                LazyExit* le = &t->exits[i];
+                if (le->lr == lr && !le->materialized && !nMaterializeExit(from, le))
+                    return;
+            }
+        }
+    #endif
+    #if NJ_SHARED_EXITS_SUPPORTED
+        // So does a guard that jumps to a shared exit body.
+        if (from && from->sharedGuards) {
+            if (SharedExit* se = from->sharedGuards->get(lr)) {
+                if (!nUnshareExit(from, lr, se))
+                    return;
+                from->sharedGuards->remove(lr);
+            }
+        }
+    #endif
         if (!lr->jmp) // the guard might have been eliminated as redundant
             return;
         Fragment *frag = lr->exit->target;
@@ -821,6 +927,258 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         }
     }
 
+#if NJ_LAZY_EXITS_SUPPORTED
+    void Assembler::materializeHotExits(Fragment* frag, uint32_t minHits)
+    {
+        LazyExitTable* t = frag->lazyExits;
+        if (!t)
+            return;
+        for (uint32_t i = 0; i < t->nExits; i++) {
+            LazyExit* le = &t->exits[i];
+            if (!le->materialized && le->hits >= minHits)
+                nMaterializeExit(frag, le);
+        }
+    }
+#endif
+
+#if NJ_SHARED_EXITS_SUPPORTED
+    static uint32_t hashSharedExit(NIns* body, uint32_t size, NIns* target)
+    {
+        size_t h = murmurhash(body, size) ^ DefaultHash<NIns*>::hash(target);
+        return uint32_t(h);
+    }
+
+    // Returns the shared body holding the same 'size' bytes as 'body' and
+    // then jumping to 'target', if there is one.
+    SharedExit* Assembler::findSharedExit(NIns* body, uint32_t size, NIns* target)
+    {
+        uint32_t h = hashSharedExit(body, size, target);
+        for (Seq<SharedExit*>* p = _sharedExits.get(h); p != NULL; p = p->tail) {
+            SharedExit* se = p->head;
+            if (se->size == size && se->target == target &&
+                VMPI_memcmp(se->body, body, size) == 0)
+                return se;
+        }
+        return NULL;
+    }
+
+    // The record outlives the compilation, for the guards that share it.
+    SharedExit* Assembler::addSharedExit(NIns* body, uint32_t size, NIns* target)
+    {
+        SharedExit* se = new (_dataAlloc) SharedExit();
+        se->body = body;
+        se->size = size;
+        se->target = target;
+        uint32_t h = hashSharedExit(body, size, target);
+        _sharedExits.put(h, new (alloc) Seq<SharedExit*>(se, _sharedExits.get(h)));
+        return se;
+    }
+#endif
+
+    void Assembler::addExitChunk(NIns* start, NIns* end)
+    {
+        ExitChunk c = { start, end };
+        _exitChunks = new (alloc) Seq<ExitChunk>(c, _exitChunks);
+    }
+
+    // Tells _cmWriter about every block of the finished fragment 'frag'.
+    void Assembler::writeCodeMap(Fragment* frag)
+    {
+        for (CodeRange r(codeList); !r.empty(); r.popFront()) {
+            NIns* start = (NIns*)r.frontStart();
+            NIns* end = (NIns*)r.frontEnd();
+            bool isExit = false;
+            for (Seq<ExitChunk>* p = _exitChunks; p != NULL && !isExit; p = p->tail)
+                isExit = p->head.start <= start && start < p->head.end;
+            // Below the code of the last chunks are their slots, which hold
+            // data, and padding.
+            if (codeStart <= start && start < _nIns)
+                start = _nIns;
+            if (exitStart <= start && start < _nExitIns)
+                start = _nExitIns;
+            if (start < end)
+                _cmWriter->codeRange(frag, start, end, isExit);
+        }
+    }
+
+    void Assembler::addPcEntry(NIns* pc, LIns* ins, bool isExit)
+    {
+        PcMapEntry e = { pc, ins, isExit };
+        _pcEntries = new (alloc) Seq<PcMapEntry>(e, _pcEntries);
+        _nPcEntries++;
+    }
+
+    // Sorts the 'n' entries of 'a' by pc, keeping those for the same pc in
+    // order, with the help of 'scratch'.  Returns whichever of the two holds
+    // the result.
+    static PcMapEntry* sortPcEntries(PcMapEntry* a, PcMapEntry* scratch, uint32_t n)
+    {
+        for (uint32_t width = 1; width < n; width *= 2) {
+            for (uint32_t lo = 0; lo < n; lo += 2 * width) {
+                uint32_t mid = lo + width < n ? lo + width : n;
+                uint32_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+                uint32_t i = lo, j = mid, k = lo;
+                while (i < mid && j < hi)
+                    scratch[k++] = a[j].pc < a[i].pc ? a[j++] : a[i++];
+                while (i < mid)
+                    scratch[k++] = a[i++];
+                while (j < hi)
+                    scratch[k++] = a[j++];
+            }
+            SWAP(PcMapEntry*, a, scratch);
+        }
+        return a;
+    }
+
+    // Turns the entries gen() recorded into the PcMap of 'frag'.  An entry
+    // marks where the code of an instruction starts in a block, and the
+    // code runs on up to the next entry, so NULL entries mark where each
+    // block of codeList starts and ends too.
+    void Assembler::buildPcMap(Fragment* frag)
+    {
+        uint32_t n = _nPcEntries;
+        for (CodeRange r(codeList); !r.empty(); r.popFront())
+            n += 2;
+        PcMapEntry* a = new (alloc) PcMapEntry[n];
+        PcMapEntry* scratch = new (alloc) PcMapEntry[n];
+
+        // Recorded entries first, in the order they were recorded.
+        uint32_t i = _nPcEntries;
+        for (Seq<PcMapEntry>* p = _pcEntries; p != NULL; p = p->tail)
+            a[--i] = p->head;
+        i = _nPcEntries;
+        for (CodeRange r(codeList); !r.empty(); r.popFront()) {
+            PcMapEntry start = { (NIns*)r.frontStart(), NULL, false };
+            PcMapEntry end = { (NIns*)r.frontEnd(), NULL, false };
+            a[i++] = start;
+            a[i++] = end;
+        }
+        a = sortPcEntries(a, scratch, n);
+
+        // For each pc keep the first instruction recorded there, or NULL if
+        // there is none, and drop entries that don't change the instruction.
+        uint32_t m = 0;
+        for (i = 0; i < n; ) {
+            PcMapEntry e = a[i];
+            for (; i < n && a[i].pc == e.pc; i++) {
+                if (!e.ins)
+                    e = a[i];
+            }
+            if (m == 0 || a[m-1].ins != e.ins || a[m-1].isExit != e.isExit)
+                a[m++] = e;
+        }
+
+        frag->pcMap = PcMap::build(_dataAlloc, frag, a, m);
+        debug_only(
+            for (i = 0; i < m; i++)
+            {
+                bool isExit;
+                NanoAssert(frag->pcMap->lookup(a[i].pc, &isExit) == a[i].ins);
+                NanoAssert(isExit == a[i].isExit);
+            }
+        )
+    }
+
+    LIns* Assembler::lookupPc(NIns* pc, Fragment*& frag)
+    {
+        frag = _codeAlloc.findOwner(pc);
+        return frag && frag->pcMap ? frag->pcMap->lookup(pc) : NULL;
+    }
+
+#if NJ_PROF_COUNTERS_SUPPORTED
+    // Returns a new counter for the entries of the fragment being assembled
+    // (lr == NULL) or for the exit 'lr'.
+    uint64_t* Assembler::newProfCounter(GuardRecord* lr)
+    {
+        ProfCounter* c = new (_dataAlloc) ProfCounter();
+        c->count = 0;
+        c->lr = lr;
+        c->next = _newProfCounters;
+        _newProfCounters = c;
+        return &c->count;
+    }
+
+    void Assembler::resetProfCounters(Fragment* frag)
+    {
+        for (ProfCounter* c = frag->profCounters; c != NULL; c = c->next)
+            c->count = 0;
+    }
+
+    void Assembler::logProfCounters(Fragment* frag)
+    {
+        for (ProfCounter* c = frag->profCounters; c != NULL; c = c->next) {
+            if (c->lr)
+                avmplus::AvmLog("prof: frag %p exit %p taken %llu\n",
+                    (void*)frag, (void*)c->lr, (unsigned long long)c->count);
+            else
+                avmplus::AvmLog("prof: frag %p entered %llu\n",
+                    (void*)frag, (unsigned long long)c->count);
+        }
+    }
+#endif
+
+#if NJ_EDGE_COUNTERS_SUPPORTED
+    // Returns 'size' new zeroed counters for the branch 'ins' of the fragment
+    // being assembled.
+    uint64_t* Assembler::newEdgeCounter(LIns* ins, uint32_t size)
+    {
+        EdgeCounter* c = new (_dataAlloc) EdgeCounter();
+        c->ins = ins;
+        c->size = size;
+        c->counts = new (_dataAlloc) uint64_t[size];
+        for (uint32_t i = 0; i < size; i++)
+            c->counts[i] = 0;
+        c->next = _newEdgeCounters;
+        _newEdgeCounters = c;
+        return c->counts;
+    }
+
+    void Assembler::resetEdgeCounters(Fragment* frag)
+    {
+        for (EdgeCounter* c = frag->edgeCounters; c != NULL; c = c->next)
+            for (uint32_t i = 0; i < c->size; i++)
+                c->counts[i] = 0;
+    }
+
+    void Assembler::getBranchWeights(Fragment* frag, BranchWeights& weights, Allocator& alloc)
+    {
+        for (EdgeCounter* c = frag->edgeCounters; c != NULL; c = c->next) {
+            uint64_t* w = weights.get(c->ins);
+            if (!w) {
+                w = new (alloc) uint64_t[c->size];
+                for (uint32_t i = 0; i < c->size; i++)
+                    w[i] = 0;
+                weights.put(c->ins, w);
+            }
+            if (c->ins->isop(LIR_jtbl)) {
+                for (uint32_t i = 0; i < c->size; i++)
+                    w[i] += c->counts[i];
+            } else {
+                w[0] += c->counts[0] - c->counts[1];
+                w[1] += c->counts[1];
+            }
+        }
+    }
+
+#ifdef NJ_VERBOSE
+    // Shows the weights an earlier run left for the branch 'ins', if any.
+    void Assembler::asm_output_weights(LIns* ins)
+    {
+        uint64_t* w = _thisfrag->branchWeights ? _thisfrag->branchWeights->get(ins) : NULL;
+        if (!w)
+            return;
+        if (ins->isop(LIR_jtbl)) {
+            for (uint32_t i = ins->getTableSize(); i-- > 0;)
+                asm_output("   %u: weight %llu", i, (unsigned long long)w[i]);
+            asm_output("weights");
+        } else {
+            asm_output("weights: taken %llu, not taken %llu",
+                       (unsigned long long)w[0], (unsigned long long)w[1]);
+        }
+    }
+#endif
+#endif
+
     NIns* Assembler::asm_exit(LIns* guard)
     {
         SideExit *exit = guard->record()->exit;
@@ -842,6 +1200,13 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
 
     NIns* Assembler::asm_leave_trace(LIns* guard)
     {
+    #if NJ_LAZY_EXITS_SUPPORTED
+        if (_config.lazy_exits) {
+            if (NIns* stub = nLazyExit(guard))
+                return stub;
+        }
+    #endif
+
         verbose_only( verbose_outputf("----------------------------------- ## END exit block %p", guard);)
 
         // This point is unreachable.  So free all the registers.  If an
@@ -858,13 +1223,20 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         debug_only( _sv_fpuStkDepth = _fpuStkDepth; _fpuStkDepth = 0; )
 #endif
 
-        nFragExit(guard);
+    #if NJ_SHARED_EXITS_SUPPORTED
+        if (_config.share_exits verbose_only(&& !(_logc->lcbits & LC_FragProfile))) {
+            nSharedExit(guard, capture);
+        } else
+    #endif
+        {
+            nFragExit(guard);
 
-        // Restore the callee-saved register and parameters.
-        assignSavedRegs();
-        assignParamRegs();
+            // Restore the callee-saved register and parameters.
+            assignSavedRegs();
+            assignParamRegs();
 
-        intersectRegisterState(capture);
+            intersectRegisterState(capture);
+        }
 
         // this can be useful for breaking whenever an exit is taken
         //INT3();
@@ -925,6 +1297,9 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         verbose_only( StringList asmOutput(alloc); )
         verbose_only( _outputCache = &asmOutput; )
 
+        _shortBackEdges.clear();
+        _loopSizes.clear();
+
         beginAssembly(frag);
         if (error())
             return;
@@ -974,6 +1349,34 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
 
         assemble(frag, lir);
 
+    #if NJ_RELAX_BRANCHES_SUPPORTED || NJ_CODE_ALIGNMENT_SUPPORTED
+        // If some back edges fit in short branches, or there are small loops
+        // to align, assemble the fragment once more doing both.  The loop
+        // sizes come from the pass with long branches, so they are upper
+        // bounds.  The padding can push a short back edge out of range, in
+        // which case go back to long branches, which always reach.
+        bool again = false;
+    #if NJ_RELAX_BRANCHES_SUPPORTED
+        if (_config.relax_branches && !error() && findShortBackEdges())
+            again = true;
+    #endif
+    #if NJ_CODE_ALIGNMENT_SUPPORTED
+        if (_config.code_align && !error() && findLoopSizes())
+            again = true;
+    #endif
+        if (again) {
+            verbose_only( asmOutput.clear(); )
+            reassemble(frag, alloc, optimize);
+            if (error() == BranchTooFar) {
+                _shortBackEdges.clear();
+                verbose_only( asmOutput.clear(); )
+                reassemble(frag, alloc, optimize);
+            }
+        }
+    #endif
+        _shortBackEdges.clear();
+        _loopSizes.clear();
+
         // If we were accumulating debug info in the various ReverseListers,
         // call finish() to emit whatever contents they have accumulated.
         verbose_only(
@@ -1025,6 +1428,24 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         /* END decorative postamble */
     }
 
+    // Throws away the code from a previous assemble() of 'frag' and assembles
+    // it again.  The ReverseListers in compile() have already printed the LIR,
+    // so this pipeline doesn't include them.
+    void Assembler::reassemble(Fragment* frag, Allocator& alloc, bool optimize)
+    {
+        cleanupAfterError();
+        verbose_only( frag->nStaticExits = 0; )
+
+        beginAssembly(frag);
+        if (error())
+            return;
+
+        LirFilter* lir = new (alloc) LirReader(frag->lastIns);
+        if (optimize)
+            lir = new (alloc) StackFilter(lir, alloc, frag->lirbuf->sp);
+        assemble(frag, lir);
+    }
+
     void Assembler::beginAssembly(Fragment *frag)
     {
         verbose_only( codeBytes = 0; )
@@ -1042,6 +1463,9 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
 
         _thisfrag = frag;
         _inExit = false;
+        _exitChunks = NULL;
+        _pcEntries = NULL;
+        _nPcEntries = 0;
 
         setError(None);
 
@@ -1052,6 +1476,24 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         if (error()) return;
 
         _epilogue = NULL;
+    #if NJ_LAZY_EXITS_SUPPORTED
+        _lazyExitTable = NULL;
+        _newLazyExits = NULL;
+        _lazyTrampoline = NULL;
+    #endif
+    #if NJ_SHARED_EXITS_SUPPORTED
+        // Guards only share the bodies of their own fragment, which go when
+        // it does, and a pass thrown away takes its bodies with it.
+        _sharedExits.clear();
+        _newSharedGuards = NULL;
+        _newSharedExitBytes = 0;
+    #endif
+    #if NJ_PROF_COUNTERS_SUPPORTED
+        _newProfCounters = NULL;
+    #endif
+    #if NJ_EDGE_COUNTERS_SUPPORTED
+        _newEdgeCounters = NULL;
+    #endif
         verbose_only( _nInsAfter = _nIns; )
 
         nBeginAssembly();
@@ -1093,12 +1535,23 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 if (target->isop(LIR_jtbl)) {
                     // Need to patch up a whole jump table, 'where' is the table.
                     LIns *jtbl = target;
+#if NJ_USES_REL_JTBL
+                    int32_t* rel_table = (int32_t*) (void *) where;
+#else
                     NIns** native_table = (NIns**) (void *) where;
+#endif
                     for (uint32_t i = 0, n = jtbl->getTableSize(); i < n; i++) {
                         LabelState* lstate = _labels.get(jtbl->getTarget(i));
                         NIns* ntarget = lstate->addr;
                         if (ntarget) {
-#ifdef NANOJIT_THUMB2
+#if NJ_USES_REL_JTBL
+                            intptr_t offset = intptr_t(ntarget) - intptr_t(where);
+                            if (int32_t(offset) != offset) {
+                                setError(BranchTooFar);
+                                break;
+                            }
+                            rel_table[i] = int32_t(offset);
+#elif defined(NANOJIT_THUMB2)
                             native_table[i] = (NIns*)((uintptr_t)ntarget | 0x1);
 #else
                             native_table[i] = ntarget;
@@ -1146,15 +1599,26 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
             return NULL;
         }
 
+    #if NJ_PROF_COUNTERS_SUPPORTED
+        // Without a loop label, count the entries where the code starts.
+        if (_config.prof_counters && !frag->loopLabel)
+            asm_inc_m64(newProfCounter(NULL));
+    #endif
+
         NIns* fragEntry = genPrologue();
         verbose_only( asm_output("[prologue]"); )
+        // The prologue goes with LIR_start, where gen() left currIns.
+        if (_config.pc_map)
+            addPcEntry(_nIns, currIns, false);
 
         debug_only(_activation.checkForResourceLeaks());
 
         NanoAssert(!_inExit);
+        if (_nExitIns && _cmWriter)
+            addExitChunk(exitStart, exitEnd);
         // save used parts of current block on fragment's code list, free the rest
         //### FIXME: NANOJIT_THUMB2 is presently a dirty hack.
-#if (defined(NANOJIT_ARM) && !defined(NANOJIT_THUMB2)) || defined(NANOJIT_MIPS)
+#if (defined(NANOJIT_ARM) && !defined(NANOJIT_THUMB2)) || defined(NANOJIT_MIPS) || defined(NANOJIT_X64)
         // [codeStart, _nSlot) ... gap ... [_nIns, codeEnd)
         if (_nExitIns) {
             _codeAlloc.addRemainder(codeList, exitStart, exitEnd, _nExitSlot, _nExitIns);
@@ -1172,6 +1636,11 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         verbose_only( codeBytes -= (_nIns - codeStart) * sizeof(NIns); )
 #endif
 
+        frag->codeList = codeList;
+        if (_config.pc_map)
+            buildPcMap(frag);
+        _codeAlloc.setOwner(codeList, frag);
+
         // note: the code pages are no longer writable from this point onwards
         _codeAlloc.markExec(codeList);
 
@@ -1179,6 +1648,29 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         // so flush the i-cache on cpu's that need it.
         CodeAlloc::flushICache(codeList);
 
+    #if NJ_LAZY_EXITS_SUPPORTED
+        // The fragment's code is final, so its lazy exits can be materialized.
+        // The stubs were numbered in the order they were assembled.
+        if (LazyExitTable* t = _lazyExitTable) {
+            t->exits = new (_dataAlloc) LazyExit[t->nExits];
+            uint32_t i = t->nExits;
+            for (Seq<LazyExit>* p = _newLazyExits; p != NULL; p = p->tail)
+                t->exits[--i] = p->head;
+            NanoAssert(i == 0);
+        }
+        frag->lazyExits = _lazyExitTable;
+    #endif
+    #if NJ_SHARED_EXITS_SUPPORTED
+        frag->sharedGuards = _newSharedGuards;
+        _codeAlloc.addSharedExitBytes(_newSharedExitBytes);
+    #endif
+    #if NJ_PROF_COUNTERS_SUPPORTED
+        frag->profCounters = _newProfCounters;
+    #endif
+    #if NJ_EDGE_COUNTERS_SUPPORTED
+        frag->edgeCounters = _newEdgeCounters;
+    #endif
+
         // save entry point pointers
         frag->fragEntry = fragEntry;
         frag->setCode(_nIns);
@@ -1187,6 +1679,9 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         if (_mdWriter)
             _mdWriter->endAssembly(this, (uint8_t*)_nIns);
 
+        if (_cmWriter)
+            writeCodeMap(frag);
+
 #ifdef VMCFG_VTUNE
         if (vtuneHandle)
         {
@@ -1257,6 +1752,9 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
 #define countlir_x() _nvprof("lir-x",1)
 #define countlir_call() _nvprof("lir-call",1)
 #define countlir_jtbl() _nvprof("lir-jtbl",1)
+#define countlir_atomic() _nvprof("lir-atomic",1)
+#define countlir_cachectl() _nvprof("lir-cachectl",1)
+#define countlir_bulkmem() _nvprof("lir-bulkmem",1)
 #else
 #define countlir_live()
 #define countlir_ret()
@@ -1285,6 +1783,9 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
 #define countlir_x()
 #define countlir_call()
 #define countlir_jtbl()
+#define countlir_atomic()
+#define countlir_cachectl()
+#define countlir_bulkmem()
 #endif
 
     void Assembler::asm_jmp(LIns* ins, InsList& pending_lives)
@@ -1342,6 +1843,7 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
             if (!label) {
                 // save empty register state at loop header
                 _labels.add(to, 0, _allocator);
+                markLoopEnd(to);
             }
             else {
                 intersectRegisterState(label->regs);
@@ -1349,8 +1851,11 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 debug_only( _fpuStkDepth = (_allocator.getActive(FST0) ? -1 : 0); )
 #endif
             }
+            _shortBranch = _shortBackEdges.get(ins);
             JMP(0);
+            _shortBranch = false;
             _patches.put(_nIns, to);
+            addBackEdge(_nIns, ins);
         }
     }
 
@@ -1370,6 +1875,13 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         // Changes to the logic below will likely need to be propagated to Assembler::asm_jov().
 
         countlir_jcc();
+    #if NJ_EDGE_COUNTERS_SUPPORTED
+        // The first counter is bumped before the compare and the second on
+        // the fall-through path, so neither sits between compare and branch.
+        uint64_t* counts = _config.edge_counters ? newEdgeCounter(ins, 2) : NULL;
+        if (counts)
+            asm_inc_m64(&counts[1]);
+    #endif
         LIns* to = ins->getTarget();
         LabelState *label = _labels.get(to);
         if (label && label->addr) {
@@ -1384,19 +1896,29 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 // Evict all registers, most conservative approach.
                 evictAllActiveRegs();
                 _labels.add(to, 0, _allocator);
+                markLoopEnd(to);
             }
             else {
                 // Evict all registers, most conservative approach.
                 intersectRegisterState(label->regs);
             }
+            _shortBranch = _shortBackEdges.get(ins);
             Branches branches = asm_branch(branchOnFalse, cond, 0);
+            _shortBranch = false;
             if (branches.branch1) {
                 _patches.put(branches.branch1,to);
+                addBackEdge(branches.branch1, ins);
             }
             if (branches.branch2) {
                 _patches.put(branches.branch2,to);
+                addBackEdge(branches.branch2, ins);
             }
         }
+    #if NJ_EDGE_COUNTERS_SUPPORTED
+        if (counts)
+            asm_inc_m64(&counts[0]);
+        verbose_only( asm_output_weights(ins); )
+    #endif
     }
 
     void Assembler::asm_jov(LIns* ins, InsList& pending_lives)
@@ -1420,16 +1942,104 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 // evict all registers, most conservative approach.
                 evictAllActiveRegs();
                 _labels.add(to, 0, _allocator);
+                markLoopEnd(to);
             }
             else {
                 // evict all registers, most conservative approach.
                 intersectRegisterState(label->regs);
             }
+            _shortBranch = _shortBackEdges.get(ins);
             NIns *branch = asm_branch_ov(op, 0);
+            _shortBranch = false;
             _patches.put(branch,to);
+            addBackEdge(branch, ins);
         }
     }
 
+    void Assembler::addBackEdge(NIns* branch, LIns* ins)
+    {
+    #if NJ_RELAX_BRANCHES_SUPPORTED
+        if (_config.relax_branches)
+            _backEdges.put(branch, ins);
+    #else
+        (void)branch;
+        (void)ins;
+    #endif
+    }
+
+    // Called when gen() reaches the first back edge to 'label', i.e. the end
+    // of its loop, just before the branch itself is generated.
+    void Assembler::markLoopEnd(LIns* label)
+    {
+    #if NJ_CODE_ALIGNMENT_SUPPORTED
+        if (uint32_t size = _loopSizes.get(label))
+            nAlignLoop(size);
+    #endif
+        _labels.get(label)->loopEnd = _nIns;
+        _loops.add(label);
+    }
+
+#if NJ_CODE_ALIGNMENT_SUPPORTED
+    // Called after a successful assemble().  Records the size of each small
+    // innermost loop in _loopSizes, and returns true if there are any.
+    // Larger loops don't fit in the loop buffer or a few fetch blocks
+    // anyway, and padding inside an outer loop would move its header.
+    bool Assembler::findLoopSizes()
+    {
+        static const uintptr_t maxAlignedLoopSize = 256;
+        bool found = false;
+        for (Seq<LIns*>* p = _loops.get(); p != NULL; p = p->tail) {
+            LabelState* loop = _labels.get(p->head);
+            // Also rules out loops split across code chunks, mostly.
+            if (loop->loopEnd <= loop->addr || uintptr_t(loop->loopEnd - loop->addr) > maxAlignedLoopSize)
+                continue;
+            bool innermost = true;
+            for (Seq<LIns*>* q = _loops.get(); q != NULL; q = q->tail) {
+                NIns* addr = _labels.get(q->head)->addr;
+                if (loop->addr < addr && addr < loop->loopEnd) {
+                    innermost = false;
+                    break;
+                }
+            }
+            if (innermost) {
+                _loopSizes.put(p->head, uint32_t(loop->loopEnd - loop->addr));
+                found = true;
+            }
+        }
+        return found;
+    }
+#endif
+
+#if NJ_RELAX_BRANCHES_SUPPORTED
+    // Called after a successful assemble().  Collects the jumps whose back
+    // edges could all have used the short branch form into _shortBackEdges,
+    // and returns true if there are any.  Shortening a branch never moves a
+    // label further away from a branch that jumps to it, so every collected
+    // jump still reaches when the fragment is reassembled -- unless chunk
+    // boundaries move, which nPatchBranch() reports as BranchTooFar.
+    bool Assembler::findShortBackEdges()
+    {
+        bool found = false;
+        InsSet tooFar(alloc);
+        NInsMap::Iter check(_backEdges);
+        while (check.next()) {
+            LIns* ins = check.value();
+            NIns* target = _labels.get(ins->getTarget())->addr;
+            if (!nCanShortenBranch(check.key(), target))
+                tooFar.put(ins, true);
+        }
+        NInsMap::Iter collect(_backEdges);
+        while (collect.next()) {
+            LIns* ins = collect.value();
+            if (!tooFar.get(ins)) {
+                _shortBackEdges.put(ins, true);
+                found = true;
+            }
+        }
+        return found;
+    }
+#endif
+
     void Assembler::asm_x(LIns* ins)
     {
         verbose_only( _thisfrag->nStaticExits++; )
@@ -1558,7 +2168,16 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 priorIns = _nIns;
             }
 
+            NIns* nInsBefore = _nIns;
+            NIns* nExitInsBefore = _nExitIns;
+
             LOpcode op = ins->opcode();
+#if !NJ_CACHE_CONTROL_SUPPORTED
+            // Non-temporal stores are only a hint; without backend support
+            // they are compiled as the corresponding ordinary store.
+            if (isNonTemporalStoreOpcode(op))
+                op = getTemporalStoreOpcode(op);
+#endif
             switch (op)
             {
                 default:
@@ -1585,6 +2204,13 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     evictAllActiveRegs();
                     break;
 
+#if defined NANOJIT_X64
+                case LIR_fence:
+                    countlir_atomic();
+                    asm_fence();
+                    break;
+#endif
+
                case LIR_pushstate:
                    asm_pushstate();
                    break;
@@ -1687,12 +2313,26 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                    break;
 
                 case LIR_paramp:
+#if defined NANOJIT_X64
+                case LIR_paramd:
+                case LIR_paramf:
+                case LIR_paramf4:
+#endif
                     countlir_param();
                     if (ins->isExtant()) {
                         asm_param(ins);
                     }
                     break;
 
+#if NJ_PINNED_CONTEXT_SUPPORTED
+                case LIR_contextp:
+                    countlir_param();
+                    if (ins->isExtant()) {
+                        asm_contextp(ins);
+                    }
+                    break;
+#endif
+
 #if NJ_SOFTFLOAT_SUPPORTED
                 case LIR_hcalli: {
                     LIns* op1 = ins->oprnd1();
@@ -1756,6 +2396,7 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 case LIR_ldc2i:
                 case LIR_lds2i:
                 case LIR_ldi:
+                CASEX64(LIR_ldacqi:)
                     countlir_ld();
                     ins->oprnd1()->setResultLive();
                     if (ins->isExtant()) {
@@ -1764,6 +2405,7 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     break;
 
                 CASE64(LIR_ldq:)
+                CASEX64(LIR_ldacqq:)
                 case LIR_ldd:
                 case LIR_ldf2d:
                 case LIR_ldf: // Ok, ldf is not really 64-bits, but it's still more natural to
@@ -1795,6 +2437,8 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
 #if defined NANOJIT_64BIT
                 case LIR_addq:
                 case LIR_subq:
+                case LIR_mulq:
+                CASEX64(LIR_divq:)
                 case LIR_andq:
                 case LIR_lshq:
                 case LIR_rshuq:
@@ -1838,6 +2482,37 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     break;
 #endif
 
+#if defined NANOJIT_X64
+                case LIR_modq:
+                    countlir_alu();
+                    ins->oprnd1()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_qbinop(ins);
+                    }
+                    break;
+
+                case LIR_casi:
+                case LIR_casq:
+                    countlir_atomic();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    ins->oprnd3()->setResultLive();
+                    // Always generated, the store must happen even if the
+                    // result is unused.
+                    asm_cas(ins);
+                    break;
+
+                case LIR_xaddi:
+                case LIR_xaddq:
+                case LIR_xchgi:
+                case LIR_xchgq:
+                    countlir_atomic();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    asm_xadd_xchg(ins);
+                    break;
+#endif
+
                 case LIR_negd:
                 case LIR_negf:
                 case LIR_negf4:
@@ -1851,6 +2526,36 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     }
                     break;
 
+#if NJ_ROUNDING_SUPPORTED
+                case LIR_floord:
+                case LIR_ceild:
+                case LIR_truncd:
+                case LIR_roundd:
+                case LIR_floorf:
+                case LIR_ceilf:
+                case LIR_truncf:
+                case LIR_roundf:
+                case LIR_floorf4:
+                case LIR_ceilf4:
+                case LIR_truncf4:
+                case LIR_roundf4:
+                    countlir_fpu();
+                    ins->oprnd1()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_round(ins);
+                    }
+                    break;
+
+                case LIR_copysignd:
+                    countlir_fpu();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_copysign(ins);
+                    }
+                    break;
+#endif
+
                 case LIR_recipf:
                 case LIR_recipf4:
                 case LIR_rsqrtf:
@@ -2037,6 +2742,7 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 case LIR_sti2c:
                 case LIR_sti2s:
                 case LIR_sti:
+                CASEX64(LIR_streli:)
                     countlir_st();
                     ins->oprnd1()->setResultLive();
                     ins->oprnd2()->setResultLive();
@@ -2044,6 +2750,7 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     break;
 
                 CASE64(LIR_stq:)
+                CASEX64(LIR_strelq:)
                 case LIR_std:
                 case LIR_stf:
                 case LIR_std2f: {
@@ -2079,6 +2786,38 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     break;
                 }
 
+                case LIR_prefetch:
+                    countlir_cachectl();
+#if NJ_CACHE_CONTROL_SUPPORTED
+                    ins->oprnd1()->setResultLive();
+                    asm_prefetch(ins);
+#endif
+                    break;
+
+#if NJ_CACHE_CONTROL_SUPPORTED
+                case LIR_stnti:
+                CASE64(LIR_stntq:)
+                case LIR_stntd:
+                case LIR_stntf4:
+                    countlir_cachectl();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    asm_store_nt(ins);
+                    break;
+#endif
+
+#if NJ_BULK_MEMORY_SUPPORTED
+                case LIR_memcpy:
+                case LIR_memset:
+                case LIR_memcmp:
+                    countlir_bulkmem();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    ins->oprnd3()->setResultLive();
+                    asm_memop(ins);
+                    break;
+#endif
+
                 case LIR_j:
                     asm_jmp(ins, pending_lives);
                     break;
@@ -2158,10 +2897,25 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     }
 
                     // Emit the jump instruction, which allocates 1 register for the jump index.
+#if NJ_USES_REL_JTBL
+                    // The backend places the table itself, and bumps the
+                    // counter of the target taken if there are counters.
+                    uint64_t* counts = NULL;
+                #if NJ_EDGE_COUNTERS_SUPPORTED
+                    if (_config.edge_counters)
+                        counts = newEdgeCounter(ins, count);
+                #endif
+                    if (NIns* native_table = asm_jtbl(count, indexreg, counts))
+                        _patches.put(native_table, ins);
+                #if NJ_EDGE_COUNTERS_SUPPORTED
+                    verbose_only( asm_output_weights(ins); )
+                #endif
+#else
                     NIns** native_table = new (_dataAlloc) NIns*[count];
                     asm_output("[%p]:", (void*)native_table);
                     _patches.put((NIns*)native_table, ins);
                     asm_jtbl(native_table, indexreg);
+#endif
                     break;
                 }
                 #endif
@@ -2177,6 +2931,10 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                         if (ins == _thisfrag->loopLabel)
                             asm_inc_m32(& _thisfrag->profCount);
                     })
+                #if NJ_PROF_COUNTERS_SUPPORTED
+                    if (_config.prof_counters && ins == _thisfrag->loopLabel)
+                        asm_inc_m64(newProfCounter(NULL));
+                #endif
                     if (!label) {
                         // label seen first, normal target of forward jump, save addr & allocator
                         _labels.add(ins, _nIns, _allocator);
@@ -2224,6 +2982,23 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     }
                     break;
 
+#ifdef NANOJIT_64BIT
+                case LIR_addxovq:
+                case LIR_subxovq:
+                case LIR_mulxovq:
+                    verbose_only( _thisfrag->nStaticExits++; )
+                    countlir_xcc();
+                    countlir_alu();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    if (ins->isExtant()) {
+                        NIns* exit = asm_exit(ins); // does intersectRegisterState()
+                        asm_branch_ov(op, exit);
+                        asm_qbinop(ins);
+                    }
+                    break;
+#endif
+
                 case LIR_addjovi:
                 case LIR_subjovi:
                 case LIR_muljovi:
@@ -2240,6 +3015,7 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
 #ifdef NANOJIT_64BIT
                 case LIR_addjovq:
                 case LIR_subjovq:
+                case LIR_muljovq:
                     countlir_jcc();
                     countlir_alu();
                     ins->oprnd1()->setResultLive();
@@ -2383,19 +3159,38 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
             if (error())
                 return;
 
+            if (_config.pc_map) {
+                if (_nIns != nInsBefore)
+                    addPcEntry(_nIns, ins, false);
+                if (_nExitIns != nExitInsBefore)
+                    addPcEntry(_nExitIns, ins, true);
+            }
+
             // check that all is well (don't check in exit paths since its more complicated)
             debug_only( pageValidate(); )
             debug_only( resourceConsistencyCheck();  )
         }
     }
 
+    // The prologue and epilogue preserve a pinned context register
+    // themselves, so its saved-register param is left alone.
+    bool Assembler::isPinnedSavedReg(int i)
+    {
+    #if NJ_PINNED_CONTEXT_SUPPORTED
+        return _config.pinned_context && RegAlloc::savedRegs[i] == ContextReg;
+    #else
+        (void) i;
+        return false;
+    #endif
+    }
+
     void Assembler::assignSavedRegs()
     {
         // Restore saved regsters.
         LirBuffer *b = _thisfrag->lirbuf;
         for (int i=0, n = NumSavedRegs; i < n; i++) {
             LIns *p = b->savedRegs[i];
-            if (p)
+            if (p && !isPinnedSavedReg(i))
                 findSpecificRegForUnallocated(p, RegAlloc::savedRegs[p->paramArg()]);
         }
     }
@@ -2405,7 +3200,7 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         LirBuffer *b = _thisfrag->lirbuf;
         for (int i = 0, n = NumSavedRegs; i < n; i++) {
             LIns *ins = b->savedRegs[i];
-            if (ins)
+            if (ins && !isPinnedSavedReg(i))
                 findMemFor(ins);
 
             #ifdef NANOJIT_EAGER_REGSAVE
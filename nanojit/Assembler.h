@@ -32,6 +32,7 @@ namespace nanojit
     #define STACK_GRANULARITY        sizeof(void *)
 
     class MetaDataWriter;
+    class CodeMapWriter;
 
     // Basics:
     // - 'entry' records the state of the native machine stack at particular
@@ -168,10 +169,12 @@ namespace nanojit
         ,StackFull
         ,UnknownBranch
         ,BranchTooFar
+        ,StackParam
     };
 
     typedef SeqBuilder<NIns*> NInsList;
     typedef HashMap<NIns*, LIns*> NInsMap;
+    typedef HashMap<LIns*, uint32_t> LoopSizeMap;
 #if NJ_USES_IMMD_POOL
     typedef HashMap<uint64_t, uint64_t*> ImmDPoolMap;
 #endif
@@ -206,6 +209,74 @@ namespace nanojit
     #endif
 #endif //NJ_USES_IMMF4_POOL
 
+#if NJ_LAZY_EXITS_SUPPORTED
+    // A guard assembled with Config::lazy_exits.  Its stub only loads the
+    // index of this record in its fragment's LazyExitTable and jumps to a
+    // trampoline shared by the fragment, which bumps 'hits' (kept first for
+    // the trampoline's sake), reloads the saved registers 'restore' has a
+    // bit for and leaves with 'lr'.  Until the exit is materialized,
+    // lr->jmp is the stub's jump to the trampoline.
+    struct LazyExit
+    {
+        uint32_t        hits;
+        uint16_t        restore;
+        bool            materialized;   // it has a full stub of its own
+        GuardRecord*    lr;
+    };
+
+    // The lazy exits of a fragment, see Fragment::lazyExits.
+    struct LazyExitTable
+    {
+        LazyExit*       exits;
+        uint32_t        nExits;
+        intptr_t        restore[NumSavedRegs];  // FP offset of each saved register's value
+        NIns*           epilogue;               // the fragment's epilogue
+        bool            nonTemporal;            // the fragment has non-temporal stores to fence
+    };
+#endif
+
+#if NJ_SHARED_EXITS_SUPPORTED
+    // The body of an exit stub assembled with Config::share_exits: the
+    // register reloads and the jump out of the fragment.  Any guard of the
+    // same fragment that would reload the same registers and leave the same
+    // way loads its GuardRecord and jumps here.
+    struct SharedExit
+    {
+        NIns*           body;
+        uint32_t        size;           // bytes before the jump that ends the body
+        NIns*           target;         // where that jump goes
+    };
+    typedef HashMap<uint32_t, Seq<SharedExit*>*> SharedExitMap;    // keyed by hashSharedExit()
+#endif
+
+#if NJ_PROF_COUNTERS_SUPPORTED
+    // A counter of Config::prof_counters, on the list of its fragment, see
+    // Fragment::profCounters.  It counts the entries of the fragment if
+    // 'lr' is NULL, and the times the exit 'lr' is taken otherwise.
+    struct ProfCounter
+    {
+        uint64_t        count;
+        GuardRecord*    lr;
+        ProfCounter*    next;
+    };
+#endif
+
+#if NJ_EDGE_COUNTERS_SUPPORTED
+    // The counters of Config::edge_counters for the branch 'ins', on the
+    // list of its fragment, see Fragment::edgeCounters.
+    // A LIR_jt or LIR_jf has two:  counts[0] counts the times the branch was
+    // reached and counts[1] the times it fell through, which takes one add
+    // less than counting the taken edge.  A LIR_jtbl has one per target.
+    // getBranchWeights() turns them into taken counts.
+    struct EdgeCounter
+    {
+        LIns*           ins;
+        uint32_t        size;
+        uint64_t*       counts;
+        EdgeCounter*    next;
+    };
+#endif
+
 #ifdef VMCFG_VTUNE
     class avmplus::CodegenLIR;
 #endif
@@ -215,7 +286,8 @@ namespace nanojit
     public:
         RegAlloc regs;
         NIns *addr;
-        LabelState(NIns *a, RegAlloc &r) : regs(r), addr(a)
+        NIns *loopEnd;      // for loop headers: the end of the loop, after its last back edge
+        LabelState(NIns *a, RegAlloc &r) : regs(r), addr(a), loopEnd(NULL)
         {}
     };
 
@@ -312,6 +384,16 @@ namespace nanojit
             Assembler(CodeAlloc& codeAlloc, Allocator& dataAlloc, Allocator& alloc,
                       LogControl* logc, const Config& config, MetaDataWriter* mdWriter = NULL);
 
+            // Reports the code of every fragment assembled from now on to
+            // 'cmWriter', or to no one if it is NULL.
+            void        setCodeMapWriter(CodeMapWriter* cmWriter) { _cmWriter = cmWriter; }
+
+            // Returns the LIR instruction the native code at 'pc' was generated
+            // from, and its fragment in 'frag', as CodeAlloc::findOwner() finds
+            // it, for fragments assembled with Config::pc_map.  Returns NULL if
+            // 'pc' is in none of their instructions' code.
+            LIns*       lookupPc(NIns* pc, Fragment*& frag);
+
             void        compile(Fragment *frag, Allocator& alloc, bool optimize
                                 verbose_only(, LInsPrinter*));
 
@@ -324,6 +406,25 @@ namespace nanojit
             void        releaseRegisters();
             void        patch(GuardRecord *lr);
             void        patch(SideExit *exit);
+        #if NJ_LAZY_EXITS_SUPPORTED
+            // Gives each lazy exit of 'frag' taken at least 'minHits' times
+            // its own stub.  Nothing calls this by itself:  the counts only
+            // grow, so it is up to the embedder to call it now and then,
+            // between compilations, for fragments whose code is still around.
+            void        materializeHotExits(Fragment* frag, uint32_t minHits);
+        #endif
+        #if NJ_PROF_COUNTERS_SUPPORTED
+            // Zero or log the counters of 'frag', see Fragment::profCounters.
+            void        resetProfCounters(Fragment* frag);
+            void        logProfCounters(Fragment* frag);
+        #endif
+        #if NJ_EDGE_COUNTERS_SUPPORTED
+            // Zeroes the edge counters of 'frag', see Fragment::edgeCounters.
+            void        resetEdgeCounters(Fragment* frag);
+            // Adds the taken counts of the branches of 'frag' to 'weights',
+            // allocating new entries from 'alloc'.
+            void        getBranchWeights(Fragment* frag, BranchWeights& weights, Allocator& alloc);
+        #endif
             AssmError   error()               { return _err; }
             void        setError(AssmError e) { _err = e; }
             void        cleanupAfterError();
@@ -391,6 +492,9 @@ namespace nanojit
             void        codeAlloc(NIns *&start, NIns *&end, NIns *&eip
                                   verbose_only(, size_t &nBytes)
                                   , size_t byteLimit=0);
+        #if NJ_LAZY_EXITS_SUPPORTED || NJ_SHARED_EXITS_SUPPORTED
+            void        addStubCode(Fragment* frag);
+        #endif
 
 
             bool deprecated_isKnownReg(Register r) {
@@ -404,6 +508,18 @@ namespace nanojit
             RegAllocMap         _branchStateMap;
             NInsMap             _patches;
             LabelStateMap       _labels;
+            // Back edges are emitted before their target label, so they get a
+            // full-size placeholder.  compile() records them in _backEdges and,
+            // if some turn out to be within short-branch range, reassembles
+            // the fragment with those jumps in _shortBackEdges.  _shortBranch
+            // asks the backend for the short form of the branch being emitted.
+            NInsMap             _backEdges;         // branch -> jump instruction
+            InsSet              _shortBackEdges;
+            bool                _shortBranch;
+            // Loop headers, in the order gen() reaches their loop's end, and
+            // the sizes of the loops that compile() wants aligned.
+            InsList             _loops;
+            LoopSizeMap         _loopSizes;
             Noise*              _noise;             // object to generate random noise used when hardening enabled.
         #if NJ_USES_IMMD_POOL
             ImmDPoolMap         _immDPool;
@@ -440,6 +556,30 @@ namespace nanojit
             void        swapCodeChunks();
 
             NIns*       _epilogue;
+        #if NJ_LAZY_EXITS_SUPPORTED
+            LazyExitTable*  _lazyExitTable;     // of the fragment being assembled, once it has a lazy exit
+            Seq<LazyExit>*  _newLazyExits;      // its lazy exits, newest first
+            NIns*           _lazyTrampoline;
+        #endif
+        #if NJ_SHARED_EXITS_SUPPORTED
+            SharedExitMap   _sharedExits;       // bodies the guards of the fragment being assembled can share
+            SharedGuardMap* _newSharedGuards;   // its guards sharing a body, once there is one
+            size_t          _newSharedExitBytes;// exit bytes it saved
+
+            SharedExit* findSharedExit(NIns* body, uint32_t size, NIns* target);
+            SharedExit* addSharedExit(NIns* body, uint32_t size, NIns* target);
+        #endif
+        #if NJ_PROF_COUNTERS_SUPPORTED
+            ProfCounter*    _newProfCounters;   // counters of the fragment being assembled
+
+            uint64_t*   newProfCounter(GuardRecord* lr);
+        #endif
+        #if NJ_EDGE_COUNTERS_SUPPORTED
+            EdgeCounter*    _newEdgeCounters;   // counters of the fragment being assembled
+
+            uint64_t*   newEdgeCounter(LIns* ins, uint32_t size);
+            verbose_only( void asm_output_weights(LIns* ins); )
+        #endif
             AssmError   _err;           // 0 = means assemble() appears ok, otherwise it failed
         #if PEDANTIC
             NIns*       pedanticTop;
@@ -453,7 +593,25 @@ namespace nanojit
 
             MetaDataWriter* _mdWriter;
 
+            // The exit chunks filled by the fragment being assembled, kept
+            // only for _cmWriter so that it can tell exit code apart.
+            struct ExitChunk { NIns* start; NIns* end; };
+            CodeMapWriter*      _cmWriter;
+            Seq<ExitChunk>*     _exitChunks;
+
+            void        addExitChunk(NIns* start, NIns* end);
+            void        writeCodeMap(Fragment* frag);
+
+            Seq<PcMapEntry>*    _pcEntries;     // of the fragment being assembled, newest first
+            uint32_t            _nPcEntries;
+
+            void        addPcEntry(NIns* pc, LIns* ins, bool isExit);
+            void        buildPcMap(Fragment* frag);
+
             verbose_only( void asm_inc_m32(uint32_t*); )
+        #if NJ_PROF_COUNTERS_SUPPORTED
+            void        asm_inc_m64(uint64_t*);
+        #endif
             void        asm_mmq(Register rd, int dd, Register rs, int ds);
             void        asm_jmp(LIns* ins, InsList& pending_lives);
             void        asm_jcc(LIns* ins, InsList& pending_lives);
@@ -531,18 +689,46 @@ namespace nanojit
             Register    asm_binop_rhs_reg(LIns* ins);
             Branches    asm_branch(bool branchOnFalse, LIns* cond, NIns* targ);
             NIns*       asm_branch_ov(LOpcode op, NIns* targ);
+#if NJ_USES_REL_JTBL
+            NIns*       asm_jtbl(uint32_t count, Register indexreg, uint64_t* counts);
+#else
             void        asm_jtbl(NIns** table, Register indexreg);
+#endif
             void        asm_insert_random_nop();
             void        asm_label();
             void        assignSavedRegs();
             void        reserveSavedRegs();
+            bool        isPinnedSavedReg(int i);
             void        assignParamRegs();
             void        handleLoopCarriedExprs(InsList& pending_lives, RegisterMask reserved);
+            void        addBackEdge(NIns* branch, LIns* ins);
+            void        markLoopEnd(LIns* label);
+            void        reassemble(Fragment* frag, Allocator& alloc, bool optimize);
+        #if NJ_RELAX_BRANCHES_SUPPORTED
+            bool        findShortBackEdges();
+        #endif
+        #if NJ_CODE_ALIGNMENT_SUPPORTED
+            bool        findLoopSizes();
+        #endif
 
             // platform specific implementation (see NativeXXX.cpp file)
             void        nBeginAssembly();
             void        nPatchBranch(NIns* branch, NIns* location);
+        #if NJ_RELAX_BRANCHES_SUPPORTED
+            bool        nCanShortenBranch(NIns* branch, NIns* location);
+        #endif
+        #if NJ_CODE_ALIGNMENT_SUPPORTED
+            void        nAlignLoop(uint32_t size);
+        #endif
             void        nFragExit(LIns* guard);
+        #if NJ_LAZY_EXITS_SUPPORTED
+            NIns*       nLazyExit(LIns* guard);
+            bool        nMaterializeExit(Fragment* frag, LazyExit* le);
+        #endif
+        #if NJ_SHARED_EXITS_SUPPORTED
+            void        nSharedExit(LIns* guard, RegAlloc& capture);
+            bool        nUnshareExit(Fragment* frag, GuardRecord* lr, SharedExit* se);
+        #endif
 
             // platform specific methods
         public:
@@ -592,5 +778,18 @@ namespace nanojit
         virtual ~MetaDataWriter() {}
     };
 
+    /** Abstract class for telling profilers and other tools where the code
+        of each fragment ended up, see Assembler::setCodeMapWriter(). */
+    class CodeMapWriter {
+    public:
+        // Report that [start, end) holds code of 'frag', called for every
+        // block of it once assembly has succeeded, and for the code of exit
+        // stubs added to it later.  'isExit' is true for the blocks of exit
+        // chunks and for those stubs.
+        virtual void codeRange(Fragment* frag, const void* start, const void* end, bool isExit) = 0;
+
+        virtual ~CodeMapWriter() {}
+    };
+
 }
 #endif // __nanojit_Assembler__
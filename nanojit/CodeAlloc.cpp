@@ -29,6 +29,22 @@ namespace nanojit
     // Sanity checks that should remain enabled in release builds.
     #define ABORT_UNLESS(cond) do { NanoAssert(cond); if (!(cond)) VMPI_abort(); } while(0)
 
+    // Sequentially consistent accesses to the index and its reader count,
+    // see findOwner().
+#ifdef _MSC_VER
+    #define INDEX_LOAD(p)       ((CodeIndex*)InterlockedCompareExchangePointer((PVOID volatile*)&(p), NULL, NULL))
+    #define INDEX_STORE(p, v)   InterlockedExchangePointer((PVOID volatile*)&(p), (v))
+    #define READERS_LOAD(n)     InterlockedCompareExchange(&(n), 0, 0)
+    #define READERS_INC(n)      InterlockedIncrement(&(n))
+    #define READERS_DEC(n)      InterlockedDecrement(&(n))
+#else
+    #define INDEX_LOAD(p)       __atomic_load_n(&(p), __ATOMIC_SEQ_CST)
+    #define INDEX_STORE(p, v)   __atomic_store_n(&(p), (v), __ATOMIC_SEQ_CST)
+    #define READERS_LOAD(n)     __atomic_load_n(&(n), __ATOMIC_SEQ_CST)
+    #define READERS_INC(n)      __atomic_add_fetch(&(n), 1, __ATOMIC_SEQ_CST)
+    #define READERS_DEC(n)      __atomic_sub_fetch(&(n), 1, __ATOMIC_SEQ_CST)
+#endif
+
     CodeAlloc::CodeAlloc(const Config* config)
         : heapblocks(0)
         , availblocks(0)
@@ -36,6 +52,12 @@ namespace nanojit
         , bytesPerPage(VMPI_getVMPageSize())
         , bytesPerAlloc(pagesPerAlloc * bytesPerPage)
         , _config(config)
+        , nearHint(NULL)
+        , sharedExitBytes(0)
+        , codeIndex(NULL)
+        , indexReaders(0)
+        , retiredIndexes(NULL)
+        , spareIndexes(NULL)
     {
     }
 
@@ -57,6 +79,8 @@ namespace nanojit
         }
         NanoAssert(!totalAllocated);
         heapblocks = availblocks = 0;
+        if (codeIndex)
+            publishIndex(NULL);
     }
 
     CodeList* CodeAlloc::firstBlock(CodeList* term) {
@@ -87,11 +111,16 @@ namespace nanojit
         }
     }
 
-    void CodeAlloc::logStats() {
-        size_t total, frag_size, free_size;
+    void CodeAlloc::getStats(size_t& total, size_t& frag_size, size_t& free_size, size_t& shared_exit_size) {
         getStats(total, frag_size, free_size);
-        avmplus::AvmLog("code-heap: %dk free %dk fragmented %d\n",
-            round(total), round(free_size), frag_size);
+        shared_exit_size = sharedExitBytes;
+    }
+
+    void CodeAlloc::logStats() {
+        size_t total, frag_size, free_size, shared_exit_size;
+        getStats(total, frag_size, free_size, shared_exit_size);
+        avmplus::AvmLog("code-heap: %dk free %dk fragmented %d shared-exits %d\n",
+            round(total), round(free_size), frag_size, (int)shared_exit_size);
     }
 
     inline void CodeAlloc::markBlockWrite(CodeList* b) {
@@ -163,6 +192,9 @@ namespace nanojit
         if (verbose)
             avmplus::AvmLog("free %p-%p %d\n", start, end, (int)blk->size());
 
+        if (codeIndex)
+            unindex(blk);
+
         NanoAssert(!blk->isFree);
 
         // coalesce adjacent blocks.
@@ -224,6 +256,8 @@ namespace nanojit
     }
 
     void CodeAlloc::freeAll(CodeList* &code) {
+        if (codeIndex)
+            unindex(code);
         while (code) {
             CodeList *b = removeBlock(code);
             free(b->start(), b->end);
@@ -403,6 +437,13 @@ extern  "C" void sync_instruction_memory(caddr_t v, u_int len);
         addBlock(blocks, getBlock(start, end));
     }
 
+    void CodeAlloc::append(CodeList* code, CodeList* more) {
+        NanoAssert(code);
+        while (code->next)
+            code = code->next;
+        code->next = more;
+    }
+
     /**
      * split a block by freeing the hole in the middle defined by [holeStart,holeEnd),
      * and adding the used prefix and suffix parts to the blocks CodeList.
@@ -480,6 +521,127 @@ extern  "C" void sync_instruction_memory(caddr_t v, u_int len);
         return totalAllocated;
     }
 
+    int32_t CodeAlloc::findEntry(const CodeIndex* ix, const void* pc) {
+        int32_t lo = 0, hi = int32_t(ix->n) - 1;
+        while (lo <= hi) {
+            int32_t mid = (lo + hi) >> 1;
+            if ((const void*)ix->entries[mid].start <= pc)
+                lo = mid + 1;
+            else
+                hi = mid - 1;
+        }
+        return hi;
+    }
+
+    // Versions of the index are retired rather than reused at once, since
+    // findOwner() may be looking at one in a signal handler or on another
+    // thread.  Once no findOwner() is running, none can be looking at a
+    // retired version:  a later one reads codeIndex after it counts itself
+    // in indexReaders, so it gets a version published since.
+    CodeAlloc::CodeIndex* CodeAlloc::newIndex(uint32_t n) {
+        if (retiredIndexes && READERS_LOAD(indexReaders) == 0) {
+            CodeIndex* last = retiredIndexes;
+            while (last->next)
+                last = last->next;
+            last->next = spareIndexes;
+            spareIndexes = retiredIndexes;
+            retiredIndexes = NULL;
+        }
+        for (CodeIndex** p = &spareIndexes; *p; p = &(*p)->next) {
+            CodeIndex* ix = *p;
+            if (ix->capacity >= n) {
+                *p = ix->next;
+                ix->next = NULL;
+                ix->n = 0;
+                return ix;
+            }
+        }
+        // Leave room to grow, so that few versions end up too small to reuse.
+        uint32_t capacity = n < 8 ? 16 : 2 * n;
+        CodeIndex* ix = (CodeIndex*) indexAlloc.alloc(sizeof(CodeIndex) +
+                                                      (capacity - 1) * sizeof(CodeIndex::Entry));
+        ix->next = NULL;
+        ix->n = 0;
+        ix->capacity = capacity;
+        return ix;
+    }
+
+    void CodeAlloc::publishIndex(CodeIndex* ix) {
+        CodeIndex* old = codeIndex;
+        INDEX_STORE(codeIndex, ix);
+        if (old) {
+            old->next = retiredIndexes;
+            retiredIndexes = old;
+        }
+    }
+
+    void CodeAlloc::setOwner(CodeList* code, Fragment* owner) {
+        if (!(_config->code_index || _config->pc_map) || !owner || !code)
+            return;
+        CodeIndex* old = codeIndex;
+        uint32_t n = old ? old->n : 0;
+        for (CodeList* b = code; b != 0; b = b->next)
+            n++;
+        CodeIndex* ix = newIndex(n);
+        if (old) {
+            memcpy(ix->entries, old->entries, old->n * sizeof(CodeIndex::Entry));
+            ix->n = old->n;
+        }
+        // A code list rarely has more than a few blocks, so insert them one
+        // at a time.
+        for (CodeList* b = code; b != 0; b = b->next) {
+            int32_t i = findEntry(ix, b->start()) + 1;
+            NanoAssert(i == 0 || ix->entries[i-1].end <= b->start());
+            NanoAssert(i == int32_t(ix->n) || b->end <= ix->entries[i].start);
+            memmove(&ix->entries[i+1], &ix->entries[i], (ix->n - i) * sizeof(CodeIndex::Entry));
+            ix->entries[i].start = b->start();
+            ix->entries[i].end = b->end;
+            ix->entries[i].owner = owner;
+            ix->n++;
+        }
+        publishIndex(ix);
+    }
+
+    void CodeAlloc::unindex(CodeList* code) {
+        CodeIndex* old = codeIndex;
+        uint32_t found = 0;
+        for (CodeList* b = code; b != 0; b = b->next) {
+            int32_t i = findEntry(old, b->start());
+            if (i >= 0 && old->entries[i].start == b->start())
+                found++;
+        }
+        if (found == 0)
+            return;
+
+        CodeIndex* ix = NULL;
+        if (found < old->n) {
+            ix = newIndex(old->n);
+            memcpy(ix->entries, old->entries, old->n * sizeof(CodeIndex::Entry));
+            ix->n = old->n;
+            for (CodeList* b = code; b != 0; b = b->next) {
+                int32_t i = findEntry(ix, b->start());
+                if (i >= 0 && ix->entries[i].start == b->start()) {
+                    memmove(&ix->entries[i], &ix->entries[i+1], (ix->n - i - 1) * sizeof(CodeIndex::Entry));
+                    ix->n--;
+                }
+            }
+        }
+        publishIndex(ix);
+    }
+
+    Fragment* CodeAlloc::findOwner(const void* pc) {
+        READERS_INC(indexReaders);
+        CodeIndex* ix = INDEX_LOAD(codeIndex);
+        Fragment* owner = NULL;
+        if (ix) {
+            int32_t i = findEntry(ix, pc);
+            if (i >= 0 && pc < (const void*)ix->entries[i].end)
+                owner = ix->entries[i].owner;
+        }
+        READERS_DEC(indexReaders);
+        return owner;
+    }
+
     // check that all block neighbors are correct
     #ifdef _DEBUG
     void CodeAlloc::sanity_check() {
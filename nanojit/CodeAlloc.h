@@ -9,6 +9,8 @@
 
 namespace nanojit
 {
+    class Fragment;
+
     /**
      * CodeList is a single block of code.  The next field is used to
      * form linked lists of non-contiguous blocks of code.  Clients use CodeList*
@@ -110,6 +112,54 @@ namespace nanojit
 
         const Config* _config;
 
+        /** Where code would best be placed, see setNearHint() */
+        const void* nearHint;
+
+        /** Exit stub bytes not emitted because a stub was shared, see addSharedExitBytes() */
+        size_t sharedExitBytes;
+
+        /** One version of the index searched by findOwner(): the blocks that
+            belong to fragments, sorted by address.  A version is never
+            changed once it is published; an update builds a new one. */
+        struct CodeIndex {
+            struct Entry {
+                const NIns* start;
+                const NIns* end;
+                Fragment*   owner;
+            };
+            CodeIndex*  next;           // on retiredIndexes or spareIndexes
+            uint32_t    n;
+            uint32_t    capacity;
+            Entry       entries[1];     // more follow
+        };
+
+        /** The published index, NULL if it is empty */
+        CodeIndex* volatile codeIndex;
+
+        /** Number of findOwner() calls looking at a version of the index */
+        volatile long indexReaders;
+
+        /** Versions replaced while findOwner() may still be looking at them */
+        CodeIndex* retiredIndexes;
+
+        /** Versions no findOwner() can be looking at, for reuse */
+        CodeIndex* spareIndexes;
+
+        /** Where the versions of the index come from */
+        Allocator indexAlloc;
+
+        /** return the position of the last entry of 'ix' starting at or below 'pc', or -1 */
+        static int32_t findEntry(const CodeIndex* ix, const void* pc);
+
+        /** return a version of the index with room for 'n' entries */
+        CodeIndex* newIndex(uint32_t n);
+
+        /** make 'ix' the index findOwner() searches, retiring the old one */
+        void publishIndex(CodeIndex* ix);
+
+        /** drop the blocks of 'code' from the index */
+        void unindex(CodeList* code);
+
         /** remove one block from a list */
         static CodeList* removeBlock(CodeList* &list);
 
@@ -131,7 +181,8 @@ namespace nanojit
         // or longjmp; nanojit intentionally does not check for null.
         //
 
-        /** allocate nbytes of memory to hold code.  Never return null! */
+        /** allocate nbytes of memory to hold code.  Never return null!  If
+         *  nearHint is set, memory within +/-2GB of it is preferred. */
         void* allocCodeChunk(size_t nbytes);
 
         /** free a block previously allocated by allocCodeMem.  nbytes will
@@ -165,6 +216,11 @@ namespace nanojit
         /** return all the memory allocated through this allocator to the gcheap. */
         void reset();
 
+        /** ask for code to be placed within rel32 range of 'addr', e.g. the
+         *  helpers it calls.  Only a hint to allocCodeChunk(); calls that
+         *  end up out of range still work, just less cheaply. */
+        void setNearHint(const void* addr) { nearHint = addr; }
+
         /** allocate some memory (up to 'byteLimit' bytes) for code returning pointers to the region.  A zero 'byteLimit' means no limit */
         void alloc(NIns* &start, NIns* &end, size_t byteLimit);
 
@@ -187,6 +243,10 @@ namespace nanojit
         /** add a block previously returned by alloc(), to code */
         static void add(CodeList* &code, NIns* start, NIns* end);
 
+        /** add the blocks of 'more' to the end of 'code', which must not be
+            empty, so that whoever holds 'code' frees them along with it */
+        static void append(CodeList* code, CodeList* more);
+
         /** return the number of bytes in all the code blocks in "code", including block overhead */
 #ifdef PERFM
         static size_t size(const CodeList* code);
@@ -198,6 +258,24 @@ namespace nanojit
         /** get stats about heap usage */
         void getStats(size_t& total, size_t& frag_size, size_t& free_size);
 
+        /** as above, also returning the exit stub bytes saved by sharing stubs */
+        void getStats(size_t& total, size_t& frag_size, size_t& free_size, size_t& shared_exit_size);
+
+        /** count 'nbytes' of exit stub code that guards shared instead of emitting */
+        void addSharedExitBytes(size_t nbytes) { sharedExitBytes += nbytes; }
+
+        /** record that the blocks of 'code' belong to 'owner', for findOwner().
+            Does nothing unless Config::code_index or Config::pc_map is set.
+            The blocks leave the index again when they are freed, so 'code'
+            must end up in the code list that is freed with 'owner'. */
+        void setOwner(CodeList* code, Fragment* owner);
+
+        /** return the fragment whose code holds 'pc', or NULL if there is
+            none.  This takes O(log n) for n blocks, takes no locks and is
+            async-signal-safe, so it may be called from a signal handler or
+            from another thread while the index is being updated. */
+        Fragment* findOwner(const void* pc);
+
         /** print out stats about heap usage */
         void logStats();
 
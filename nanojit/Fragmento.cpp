@@ -23,7 +23,22 @@ namespace nanojit
           ip(_ip),
           recordAttempts(0),
           fragEntry(NULL),
-          verbose_only( loopLabel(NULL), )
+          loopLabel(NULL),
+          codeList(NULL),
+    #if NJ_LAZY_EXITS_SUPPORTED
+          lazyExits(NULL),
+    #endif
+    #if NJ_SHARED_EXITS_SUPPORTED
+          sharedGuards(NULL),
+    #endif
+    #if NJ_PROF_COUNTERS_SUPPORTED
+          profCounters(NULL),
+    #endif
+    #if NJ_EDGE_COUNTERS_SUPPORTED
+          branchWeights(NULL),
+          edgeCounters(NULL),
+    #endif
+          pcMap(NULL),
           verbose_only( profFragID(profFragID), )
           verbose_only( profCount(0), )
           verbose_only( nStaticExits(0), )
@@ -39,6 +54,137 @@ namespace nanojit
         // that here since there's no way to determine whether frag
         // profiling is enabled.
     }
+
+    //
+    // PcMap
+    //
+    static uint32_t putVarint(uint8_t* p, uint64_t v)
+    {
+        uint32_t n = 0;
+        do {
+            uint8_t b = uint8_t(v & 0x7f);
+            v >>= 7;
+            if (p)
+                p[n] = v ? (b | 0x80) : b;
+            n++;
+        } while (v);
+        return n;
+    }
+
+    static uint64_t getVarint(const uint8_t*& p)
+    {
+        uint64_t v = 0;
+        int shift = 0;
+        uint8_t b;
+        do {
+            b = *p++;
+            v |= uint64_t(b & 0x7f) << shift;
+            shift += 7;
+        } while (b & 0x80);
+        return v;
+    }
+
+    // NULL is 0, any other LIns is odd, holding isExit in bit 1 and the
+    // zigzag-encoded delta from 'base' above it.
+    static uint64_t packIns(LIns* ins, bool isExit, LIns* base)
+    {
+        if (!ins)
+            return 0;
+        int64_t d = int64_t(intptr_t(ins) - intptr_t(base));
+        return ((uint64_t(d) << 1) ^ uint64_t(d >> 63)) << 2 | (isExit ? 2 : 0) | 1;
+    }
+
+    static LIns* unpackIns(uint64_t v, LIns* base, bool& isExit)
+    {
+        isExit = (v & 2) != 0;
+        if (!v)
+            return NULL;
+        v >>= 2;
+        int64_t d = int64_t(v >> 1) ^ -int64_t(v & 1);
+        return (LIns*)(intptr_t(base) + intptr_t(d));
+    }
+
+    // Packs the entries in between the checkpoints into 'p', or just
+    // returns their size if 'p' is NULL.  Fills in the checkpoints if
+    // 'checkpoints' is not NULL.
+    static uint32_t packPcEntries(uint8_t* p, const PcMapEntry* entries, uint32_t n,
+                                  uint32_t interval, PcMap::Checkpoint* checkpoints)
+    {
+        uint32_t size = 0;
+        LIns* base = NULL;      // last non-NULL LIns before entries[i]
+        for (uint32_t i = 0; i < n; i++) {
+            if (i % interval != 0) {
+                size += putVarint(p ? p + size : NULL, uint64_t(entries[i].pc - entries[i-1].pc));
+                size += putVarint(p ? p + size : NULL, packIns(entries[i].ins, entries[i].isExit, base));
+            }
+            if (entries[i].ins)
+                base = entries[i].ins;
+            if (i % interval == 0 && checkpoints) {
+                PcMap::Checkpoint& c = checkpoints[i / interval];
+                c.pc = entries[i].pc;
+                c.ins = entries[i].ins;
+                c.base = base;
+                c.offset = size;
+                c.isExit = entries[i].isExit;
+            }
+        }
+        return size;
+    }
+
+    PcMap* PcMap::build(Allocator& alloc, Fragment* frag, const PcMapEntry* entries, uint32_t n)
+    {
+        NanoAssert(n >= 2 && !entries[n-1].ins);
+        PcMap* m = new (alloc) PcMap();
+        m->frag = frag;
+        m->start = entries[0].pc;
+        m->end = entries[n-1].pc;
+        m->nEntries = n;
+        m->nCheckpoints = (n + CHECKPOINT_INTERVAL - 1) / CHECKPOINT_INTERVAL;
+        m->checkpoints = new (alloc) Checkpoint[m->nCheckpoints];
+        m->nBytes = packPcEntries(NULL, entries, n, CHECKPOINT_INTERVAL, m->checkpoints);
+        m->bytes = new (alloc) uint8_t[m->nBytes ? m->nBytes : 1];
+        packPcEntries(m->bytes, entries, n, CHECKPOINT_INTERVAL, NULL);
+        return m;
+    }
+
+    LIns* PcMap::lookup(NIns* pc, bool* isExit) const
+    {
+        if (isExit)
+            *isExit = false;
+        if (pc < start || pc >= end)
+            return NULL;
+
+        // Find the last checkpoint at or below 'pc'.
+        uint32_t lo = 0, hi = nCheckpoints;
+        while (hi - lo > 1) {
+            uint32_t mid = (lo + hi) / 2;
+            if (checkpoints[mid].pc <= pc)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        const Checkpoint& c = checkpoints[lo];
+
+        // Then the last entry at or below 'pc' among those that follow it.
+        NIns* at = c.pc;
+        LIns* ins = c.ins;
+        bool exit = c.isExit;
+        LIns* base = c.base;
+        const uint8_t* p = bytes + c.offset;
+        uint32_t last = lo * CHECKPOINT_INTERVAL + CHECKPOINT_INTERVAL;
+        for (uint32_t i = lo * CHECKPOINT_INTERVAL + 1; i < last && i < nEntries; i++) {
+            NIns* next = at + getVarint(p);
+            if (next > pc)
+                break;
+            at = next;
+            ins = unpackIns(getVarint(p), base, exit);
+            if (ins)
+                base = ins;
+        }
+        if (isExit)
+            *isExit = exit;
+        return ins;
+    }
     #endif /* FEATURE_NANOJIT */
 }
 
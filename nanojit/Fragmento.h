@@ -11,6 +11,84 @@
 namespace nanojit
 {
     struct GuardRecord;
+#if NJ_LAZY_EXITS_SUPPORTED
+    struct LazyExitTable;
+#endif
+#if NJ_PROF_COUNTERS_SUPPORTED
+    struct ProfCounter;
+#endif
+#if NJ_EDGE_COUNTERS_SUPPORTED
+    struct EdgeCounter;
+#endif
+#if NJ_SHARED_EXITS_SUPPORTED
+    struct SharedExit;
+    typedef HashMap<GuardRecord*, SharedExit*> SharedGuardMap;
+#endif
+
+    class Fragment;
+
+    // One entry of a PcMap:  the code from 'pc' up to the pc of the next
+    // entry was generated from 'ins', or is no instruction's if 'ins' is
+    // NULL (the gaps between code blocks, constant slots).  'isExit' says
+    // whether that code is exit code, which is always false for NULL.
+    struct PcMapEntry
+    {
+        NIns*   pc;
+        LIns*   ins;
+        bool    isExit;
+    };
+
+    /**
+     * PcMap maps the native code of a fragment back to the LIR instructions
+     * it was generated from, see Config::pc_map.  The entries are sorted by
+     * pc and packed as pairs of variable-length numbers:  the pc delta from
+     * the previous entry, and the LIns delta from the last non-NULL LIns,
+     * which stays small since code is laid out in LIR order, along with the
+     * isExit bit.  Every
+     * CHECKPOINT_INTERVAL'th entry is also kept unpacked, for lookup() to
+     * binary search before decoding the few entries after it.
+     */
+    class PcMap
+    {
+    public:
+        // 'entries' must be sorted by pc, with no two for the same pc.
+        static PcMap* build(Allocator& alloc, Fragment* frag, const PcMapEntry* entries, uint32_t n);
+
+        // Returns the instruction whose code holds 'pc', or NULL if there is
+        // none in this fragment.  Sets '*isExit', if it is given, to whether
+        // 'pc' is in exit code.
+        LIns*       lookup(NIns* pc, bool* isExit = NULL) const;
+
+        Fragment*   frag;
+        NIns*       start;          // pc of the first entry
+        NIns*       end;            // pc of the last entry, which is always a NULL one
+        uint32_t    nEntries;
+        uint32_t    nBytes;         // size of the packed entries
+
+        struct Checkpoint
+        {
+            NIns*       pc;
+            LIns*       ins;
+            LIns*       base;       // last non-NULL LIns up to here
+            uint32_t    offset;     // of the packed entry after this one
+            bool        isExit;
+        };
+
+    private:
+        static const uint32_t CHECKPOINT_INTERVAL = 16;
+
+        Checkpoint* checkpoints;
+        uint32_t    nCheckpoints;
+        uint8_t*    bytes;
+    };
+
+#if NJ_EDGE_COUNTERS_SUPPORTED
+    // How often the edges of each branch of a fragment were taken, as
+    // gathered by Assembler::getBranchWeights().  For a LIR_jt or LIR_jf
+    // there are two weights, taken and not taken;  for a LIR_jtbl there
+    // is one per target.
+    typedef HashMap<LIns*, uint64_t*> BranchWeights;
+#endif
 
     /**
      * Fragments are linear sequences of native code that have a single entry
@@ -42,7 +120,22 @@ namespace nanojit
 
             // for fragment entry and exit profiling.  See detailed
             // how-to-use comment below.
-            verbose_only( LIns*          loopLabel; ) // where's the loop top?
+            LIns*          loopLabel;                 // where's the loop top?
+            CodeList*      codeList;                  // the code, as Assembler::codeList was after compile()
+        #if NJ_LAZY_EXITS_SUPPORTED
+            LazyExitTable* lazyExits;                 // if Config::lazy_exits is set, or NULL
+        #endif
+        #if NJ_SHARED_EXITS_SUPPORTED
+            SharedGuardMap* sharedGuards;             // guards jumping to a shared exit body, or NULL
+        #endif
+        #if NJ_PROF_COUNTERS_SUPPORTED
+            ProfCounter*   profCounters;              // if Config::prof_counters is set, or NULL
+        #endif
+        #if NJ_EDGE_COUNTERS_SUPPORTED
+            BranchWeights* branchWeights;             // weights from an earlier run, or NULL
+            EdgeCounter*   edgeCounters;              // if Config::edge_counters is set, or NULL
+        #endif
+            PcMap*         pcMap;                     // if Config::pc_map is set
             verbose_only( uint32_t       profFragID; )
             verbose_only( uint32_t       profCount; )
             verbose_only( uint32_t       nStaticExits; )
@@ -99,6 +192,23 @@ namespace nanojit
  * sizes.  It also has a ::guardsForFrag field, which is a linked list
  * of GuardRecords, and by traversing them you can get hold of the
  * exit counts.
+ *
+ * Release builds can count entries and exits too, by setting
+ * Config::prof_counters (x64 only).  The counts are 64-bit and live
+ * in ProfCounter records rather than in the Fragment and GuardRecord;
+ * Fragment::profCounters lists them, so they go away with the
+ * fragment.  Fragment::loopLabel is used the same way, except that a
+ * fragment without one counts its entries where its code starts.
+ *
+ * Config::edge_counters goes a step further and counts the edges of
+ * every LIR_jt, LIR_jf and LIR_jtbl in EdgeCounter records, keyed by
+ * the branch's LIns, which Fragment::edgeCounters lists.  As long as the
+ * LirBuffer is kept, those keys stay valid, so
+ * Assembler::getBranchWeights() can collect the counts into
+ * BranchWeights for the front end to lay out and specialize code by,
+ * and hang them off Fragment::branchWeights for the next compile of the
+ * same LIR, which replaces the fragment's counters.  Verbose output then
+ * shows the weights at each branch.
  */
 
 #endif // __nanojit_Fragmento__
@@ -160,6 +160,7 @@ namespace nanojit
         case LIR_muljovi:
         CASE64(LIR_addjovq:)
         CASE64(LIR_subjovq:)
+        CASE64(LIR_muljovq:)
             target = ins->getTarget();
             addEdge(ins, target);
             _vertices.put(target, true);
@@ -492,6 +493,8 @@ namespace nanojit
         _unused = 0;
         _limit = 0;
         _stats.lir = 0;
+        hasNonTemporalStores = false;
+        hasAllocs = false;
         for (int i = 0; i < NumSavedRegs; ++i)
             savedRegs[i] = NULL;
         chunkAlloc();
@@ -576,6 +579,8 @@ namespace nanojit
 
     LIns* LirBufWriter::insStore(LOpcode op, LIns* val, LIns* base, int32_t d, AccSet accSet)
     {
+        if (isNonTemporalStoreOpcode(op))
+            _buf->hasNonTemporalStores = true;
         if (isS16(d)) {
             LInsSt* insSt = (LInsSt*)_buf->makeRoom(sizeof(LInsSt));
             LIns*   ins   = insSt->getLIns();
@@ -677,6 +682,7 @@ namespace nanojit
 
     LIns* LirBufWriter::insAlloc(int32_t size)
     {
+        _buf->hasAllocs = true;
         size = (size+3)>>2; // # of required 32bit words
         LInsIorF* insIorF = (LInsIorF*)_buf->makeRoom(sizeof(LInsIorF));
         LIns*  ins  = insIorF->getLIns();
@@ -688,7 +694,7 @@ namespace nanojit
     {
         LInsP* insP = (LInsP*)_buf->makeRoom(sizeof(LInsP));
         LIns*  ins  = insP->getLIns();
-        ins->initLInsP(arg, kind);
+        ins->initLInsP(LIR_paramp, arg, kind);
         if (kind) {
             NanoAssert(arg < NumSavedRegs);
             _buf->savedRegs[arg] = ins;
@@ -696,6 +702,16 @@ namespace nanojit
         return ins;
     }
 
+#ifdef NANOJIT_X64
+    LIns* LirBufWriter::insFpParam(LOpcode op, int32_t arg)
+    {
+        LInsP* insP = (LInsP*)_buf->makeRoom(sizeof(LInsP));
+        LIns*  ins  = insP->getLIns();
+        ins->initLInsP(op, arg, 0);
+        return ins;
+    }
+#endif
+
     LIns* LirBufWriter::insImmI(int32_t imm)
     {
         LInsIorF* insIorF = (LInsIorF*)_buf->makeRoom(sizeof(LInsIorF));
@@ -781,6 +797,22 @@ namespace nanojit
         return ins;
     }
 
+    LIns* LirBufWriter::insPrefetch(LIns* addr, PrefetchHint hint)
+    {
+        LInsOp1b* ins1b = (LInsOp1b*)_buf->makeRoom(sizeof(LInsOp1b));
+        LIns*  ins  = ins1b->getLIns();
+        ins->initLInsOp1b(LIR_prefetch, addr, uint8_t(hint));
+        return ins;
+    }
+
+    LIns* LirBufWriter::insMem(LOpcode op, LIns* a, LIns* b, LIns* len, AccSet accSet)
+    {
+        LInsMem* insMem = (LInsMem*)_buf->makeRoom(sizeof(LInsMem));
+        LIns*    ins    = insMem->getLIns();
+        ins->initLInsMem(op, a, b, len, accSet);
+        return ins;
+    }
+
     LOpcode arithOpcodeD2I(LOpcode op)
     {
         switch (op) {
@@ -849,6 +881,7 @@ namespace nanojit
         NanoStaticAssert(sizeof(LInsOp3)  == 4*sizeof(void*));
         NanoStaticAssert(sizeof(LInsLd)   == 3*sizeof(void*));
         NanoStaticAssert(sizeof(LInsSt)   == 4*sizeof(void*));
+        NanoStaticAssert(sizeof(LInsMem)  == 5*sizeof(void*));
         NanoStaticAssert(sizeof(LInsSk)   == 2*sizeof(void*));
         NanoStaticAssert(sizeof(LInsC)    == 3*sizeof(void*));
         NanoStaticAssert(sizeof(LInsP)    == 2*sizeof(void*));
@@ -862,20 +895,27 @@ namespace nanojit
     #endif
         NanoStaticAssert(sizeof(LInsJtbl) == 4*sizeof(void*));
 
-        // oprnd_1 must be in the same position in LIns{Op1,Op2,Op3,Ld,St,Jtbl}
+        // oprnd_1 must be in the same position in LIns{Op1,Op2,Op3,Ld,St,Mem,Jtbl}
         // because oprnd1() is used for all of them.
         #define OP1OFFSET (offsetof(LInsOp1,  ins) - offsetof(LInsOp1,  oprnd_1))
         NanoStaticAssert( OP1OFFSET == (offsetof(LInsOp2,  ins) - offsetof(LInsOp2,  oprnd_1)) );
         NanoStaticAssert( OP1OFFSET == (offsetof(LInsOp3,  ins) - offsetof(LInsOp3,  oprnd_1)) );
         NanoStaticAssert( OP1OFFSET == (offsetof(LInsLd,   ins) - offsetof(LInsLd,   oprnd_1)) );
         NanoStaticAssert( OP1OFFSET == (offsetof(LInsSt,   ins) - offsetof(LInsSt,   oprnd_1)) );
+        NanoStaticAssert( OP1OFFSET == (offsetof(LInsMem,  ins) - offsetof(LInsMem,  oprnd_1)) );
         NanoStaticAssert( OP1OFFSET == (offsetof(LInsJtbl, ins) - offsetof(LInsJtbl, oprnd_1)) );
 
-        // oprnd_2 must be in the same position in LIns{Op2,Op3,St}
+        // oprnd_2 must be in the same position in LIns{Op2,Op3,St,Mem}
         // because oprnd2() is used for all of them.
         #define OP2OFFSET (offsetof(LInsOp2, ins) - offsetof(LInsOp2, oprnd_2))
         NanoStaticAssert( OP2OFFSET == (offsetof(LInsOp3, ins) - offsetof(LInsOp3, oprnd_2)) );
         NanoStaticAssert( OP2OFFSET == (offsetof(LInsSt,  ins) - offsetof(LInsSt,  oprnd_2)) );
+        NanoStaticAssert( OP2OFFSET == (offsetof(LInsMem, ins) - offsetof(LInsMem, oprnd_2)) );
+
+        // oprnd_3 must be in the same position in LIns{Op3,Mem}
+        // because oprnd3() is used for both of them.
+        NanoStaticAssert( (offsetof(LInsOp3, ins) - offsetof(LInsOp3, oprnd_3)) ==
+                          (offsetof(LInsMem, ins) - offsetof(LInsMem, oprnd_3)) );
         NanoStaticAssert(LIR_eqf==LIR_eqd+6);
         NanoStaticAssert(LIR_ltf==LIR_ltd+6);
         NanoStaticAssert(LIR_gtf==LIR_gtd+6);
@@ -905,6 +945,57 @@ namespace nanojit
         return false;
     }
 
+    static double copySign(double mag, double sgn)
+    {
+        union {
+            double d;
+            uint64_t q;
+        } m, s;
+        m.d = mag;
+        s.d = sgn;
+        m.q = (m.q & ~(uint64_t(1) << 63)) | (s.q & (uint64_t(1) << 63));
+        return m.d;
+    }
+
+    // Rounds the way the rounding opcodes do.  This doesn't use libm, so the
+    // result doesn't depend on the host's rounding mode.
+    static double roundToIntegral(double d, RoundingMode mode)
+    {
+        // Every double of magnitude 2^52 or more is integral.  This also
+        // passes infinities and NaNs through.
+        if (!(d > -4503599627370496.0 && d < 4503599627370496.0))
+            return d;
+        double t = double(int64_t(d));      // rounded towards zero
+        double frac = d - t;                // exact
+        bool odd = (int64_t(t) & 1) != 0;
+        switch (mode) {
+        case ROUND_FLOOR:
+            if (frac < 0)
+                t -= 1;
+            break;
+        case ROUND_CEIL:
+            if (frac > 0)
+                t += 1;
+            break;
+        case ROUND_TRUNC:
+            break;
+        case ROUND_NEAREST:
+            if (frac > 0.5 || (frac == 0.5 && odd))
+                t += 1;
+            else if (frac < -0.5 || (frac == -0.5 && odd))
+                t -= 1;
+            break;
+        }
+        // A zero result keeps the operand's sign, eg. ceil(-0.5) is -0.
+        return t == 0 ? copySign(0, d) : t;
+    }
+
+    static float roundToIntegral(float f, RoundingMode mode)
+    {
+        // Exact: every float rounds to a double that converts back exactly.
+        return float(roundToIntegral(double(f), mode));
+    }
+
     LIns* ExprFilter::ins1(LOpcode v, LIns* oprnd)
     {
         switch (v) {
@@ -1009,6 +1100,41 @@ namespace nanojit
             if (oprnd->opcode() == v)
                 return oprnd; // abs(abs(x)) = abs(x)
             break;
+        case LIR_floord:
+        case LIR_ceild:
+        case LIR_truncd:
+        case LIR_roundd:
+            if (oprnd->isImmD())
+                return insImmD(roundToIntegral(oprnd->immD(), getRoundingMode(v)));
+            if (oprnd->isop(LIR_i2d) || oprnd->isop(LIR_ui2d))
+                return oprnd;
+            goto integral;
+        case LIR_floorf:
+        case LIR_ceilf:
+        case LIR_truncf:
+        case LIR_roundf:
+            if (oprnd->isImmF())
+                return insImmF(roundToIntegral(oprnd->immF(), getRoundingMode(v)));
+            if (oprnd->isop(LIR_i2f) || oprnd->isop(LIR_ui2f))
+                return oprnd;
+            goto integral;
+        case LIR_floorf4:
+        case LIR_ceilf4:
+        case LIR_truncf4:
+        case LIR_roundf4:
+            if (oprnd->isImmF4()) {
+                RoundingMode mode = getRoundingMode(v);
+                float4_t c = oprnd->immF4();
+                float4_t r = { roundToIntegral(f4_x(c), mode), roundToIntegral(f4_y(c), mode),
+                               roundToIntegral(f4_z(c), mode), roundToIntegral(f4_w(c), mode) };
+                return insImmF4(r);
+            }
+        integral:
+            // Rounding an integral value of the same type leaves it unchanged,
+            // eg. floor(ceil(x)) = ceil(x).
+            if (isRoundingOpcode(oprnd->opcode()) && oprnd->retType() == retTypes[v])
+                return oprnd;
+            break;
         default:
             ;
         }
@@ -1034,6 +1160,10 @@ namespace nanojit
     {
         NanoAssert(oprnd1 && oprnd2);
 
+        // Atomic operations touch memory, so none of the folding below applies.
+        if (isAtomicRmwOpcode(v))
+            return out->ins2(v, oprnd1, oprnd2);
+
         //-------------------------------------------------------------------
         // Folding where the two operands are equal
         //-------------------------------------------------------------------
@@ -1058,6 +1188,9 @@ namespace nanojit
             case LIR_geui:
                 return insImmI(1);      // (x <= x) == 1; (x >= x) == 1
 
+            case LIR_copysignd:
+                return oprnd1;
+
             default:
                 break;
             }
@@ -1181,6 +1314,13 @@ namespace nanojit
                 }
                 return insImmQ(c1 - c2);
 
+            case LIR_mulq:
+                // Overflow is impossible if both values fit in 32 bits.  We
+                // don't bother folding the other cases.
+                if (isS32(c1) && isS32(c2))
+                    return insImmQ(c1 * c2);
+                break;
+
             default:
                 break;
             }
@@ -1216,6 +1356,8 @@ namespace nanojit
             case LIR_muld:  return insImmD(c1 * c2);
             case LIR_divd:  return insImmD(c1 / c2);
 
+            case LIR_copysignd: return insImmD(copySign(c1, c2));
+
             default:        break;
             }
         } 
@@ -1270,6 +1412,7 @@ namespace nanojit
             case LIR_addf:
             case LIR_addf4:
             case LIR_muli:
+            CASE64(LIR_mulq:)
             case LIR_muld:
             case LIR_mulf:
             case LIR_mulf4:
@@ -1407,6 +1550,7 @@ namespace nanojit
                     return oprnd1;
 
                 case LIR_andq:
+                case LIR_mulq:
                     return oprnd2;
 
                 case LIR_ltuq: // unsigned < 0 -> always false
@@ -1436,6 +1580,8 @@ namespace nanojit
                     case LIR_gtuq:  return insImmI(0);  // 0or1 > 1 -> always false
                     default:        break;
                     }
+                } else if (v == LIR_mulq) {
+                    return oprnd1;          // x * 1 = x
                 }
             }
 #endif  // NANOJIT_64BIT
@@ -1463,6 +1609,8 @@ namespace nanojit
     LIns* ExprFilter::ins3(LOpcode v, LIns* oprnd1, LIns* oprnd2, LIns* oprnd3)
     {
         NanoAssert(oprnd1 && oprnd2 && oprnd3);
+        if (isAtomicRmwOpcode(v))
+            return out->ins3(v, oprnd1, oprnd2, oprnd3);
         NanoAssert(isCmovOpcode(v));
         if (oprnd2 == oprnd3) {
             // c ? a : a => a
@@ -1526,6 +1674,11 @@ namespace nanojit
         LIns* oprnd1 = *opnd1;
         LIns* oprnd2 = *opnd2;
 
+#ifdef NANOJIT_64BIT
+        if (oprnd1->isQ())
+            return simplifyOverflowArithQ(op, opnd1, opnd2);
+#endif
+
         if (oprnd1->isImmI() && oprnd2->isImmI()) {
             int32_t c1 = oprnd1->immI();
             int32_t c2 = oprnd2->immI();
@@ -1595,6 +1748,55 @@ namespace nanojit
         return NULL;
     }
 
+#ifdef NANOJIT_64BIT
+    // The quad version of simplifyOverflowArith().  Rather than folding
+    // immediates with explicit overflow checks it relies on interval
+    // analysis:  if both operands fit in 32 bits the 64-bit add/sub/mul
+    // cannot overflow, so the check can be dropped.  This also covers the
+    // common case where both operands are small immediates.
+    LIns* ExprFilter::simplifyOverflowArithQ(LOpcode op, LIns** opnd1, LIns** opnd2)
+    {
+        LIns* oprnd1 = *opnd1;
+        LIns* oprnd2 = *opnd2;
+
+        LOpcode plainOp;
+        switch (op) {
+        case LIR_addjovq:
+        case LIR_addxovq:    plainOp = LIR_addq;    break;
+        case LIR_subjovq:
+        case LIR_subxovq:    plainOp = LIR_subq;    break;
+        case LIR_muljovq:
+        case LIR_mulxovq:    plainOp = LIR_mulq;    break;
+        default:             NanoAssert(0);         return NULL;
+        }
+
+        if (oprnd1->isImmQ() && !oprnd2->isImmQ() && plainOp != LIR_subq) {
+            // swap operands, moving immediate to RHS
+            LIns* t = oprnd2;
+            oprnd2 = oprnd1;
+            oprnd1 = t;
+            // swap actual arguments in caller as well
+            *opnd1 = oprnd1;
+            *opnd2 = oprnd2;
+        }
+
+        if (oprnd2->isImmQ()) {
+            int64_t c = oprnd2->immQ();
+            if (c == 0)
+                return plainOp == LIR_mulq ? oprnd2 : oprnd1;
+            if (c == 1 && plainOp == LIR_mulq)
+                return oprnd1;
+        }
+
+        Interval x = Interval::ofQ(oprnd1, 3);
+        Interval y = Interval::ofQ(oprnd2, 3);
+        if (!x.hasOverflowed && !y.hasOverflowed)
+            return ins2(plainOp, oprnd1, oprnd2);
+
+        return NULL;
+    }
+#endif
+
     LIns* ExprFilter::insGuardXov(LOpcode op, LIns* oprnd1, LIns* oprnd2, GuardRecord *gr)
     {
         LIns* simplified = simplifyOverflowArith(op, &oprnd1, &oprnd2);
@@ -1711,6 +1913,185 @@ namespace nanojit
                     ins2(LIR_andi, iffalse, ins1(LIR_noti, ncond)));
     }
 
+    SwitchTargets::SwitchTargets(Allocator& alloc, uint32_t ndests)
+        : alloc(alloc), ndests(ndests), jumpTable(false)
+    {
+        patches = new (alloc) Patch*[ndests + 1];
+        VMPI_memset(patches, 0, (ndests + 1) * sizeof(Patch*));
+    }
+
+    void SwitchTargets::add(uint32_t dest, LIns* ins, uint32_t slot)
+    {
+        NanoAssert(dest <= ndests);
+        // ExprFilter drops branches that can never be taken.
+        if (!ins)
+            return;
+        Patch* p = new (alloc) Patch;
+        p->ins = ins;
+        p->slot = slot;
+        p->next = patches[dest];
+        patches[dest] = p;
+        if (ins->isop(LIR_jtbl))
+            jumpTable = true;
+    }
+
+    void SwitchTargets::setTarget(uint32_t dest, LIns* label)
+    {
+        NanoAssert(dest <= ndests);
+        for (Patch* p = patches[dest]; p; p = p->next) {
+            if (p->ins->isop(LIR_jtbl))
+                p->ins->setTarget(p->slot, label);
+            else
+                p->ins->setTarget(label);
+        }
+    }
+
+    // Lowers a range of a switch's cases, sorted by value, given that the
+    // switch value is known to lie in [lo, hi].  A range is lowered to a
+    // chain of compares if it has few cases, to a bit test if its cases span
+    // at most 32 values and go to few destinations, or to a jump table if
+    // its cases are dense.  Otherwise it is split in two by a compare.
+    class SwitchLowering
+    {
+        static const uint32_t MAX_LINEAR_CASES = 3;
+        static const uint32_t MAX_BIT_TEST_DESTS = 3;
+        static const uint32_t MIN_JTBL_CASES = 4;
+        static const uint32_t MIN_JTBL_DENSITY = 40;    // percent
+
+        LirWriter*      lir;
+        LIns*           value;
+        const SwitchCase* cases;
+        SwitchTargets*  targets;
+        uint32_t        ndests;     // also the default's destination number
+
+        LIns* jumpToDefaultIfOutside(LIns* index, int64_t lo, int64_t hi, int32_t first, int32_t last) {
+            // One unsigned compare checks both ends of the range.
+            if (lo < first || hi > last) {
+                LIns* inRange = lir->ins2(LIR_ltui, index, lir->insImmI(last - first + 1));
+                targets->add(ndests, lir->insBranch(LIR_jf, inRange, NULL));
+            }
+            return index;
+        }
+
+        void linear(uint32_t i, uint32_t n) {
+            for (uint32_t k = i; k < i + n; k++) {
+                LIns* cond = lir->ins2(LIR_eqi, value, lir->insImmI(cases[k].value));
+                targets->add(cases[k].target, lir->insBranch(LIR_jt, cond, NULL));
+            }
+            targets->add(ndests, lir->insBranch(LIR_j, NULL, NULL));
+        }
+
+        void bitTest(uint32_t i, uint32_t n, int64_t lo, int64_t hi, const uint32_t* dests, uint32_t ndests_) {
+            int32_t first = cases[i].value;
+            int32_t last = cases[i + n - 1].value;
+            LIns* index = lir->ins2(LIR_subi, value, lir->insImmI(first));
+            jumpToDefaultIfOutside(index, lo, hi, first, last);
+            LIns* bit = lir->ins2(LIR_lshi, lir->insImmI(1), index);
+            for (uint32_t d = 0; d < ndests_; d++) {
+                uint32_t mask = 0;
+                for (uint32_t k = i; k < i + n; k++)
+                    if (cases[k].target == dests[d])
+                        mask |= 1u << (cases[k].value - first);
+                LIns* hit = lir->ins2(LIR_andi, bit, lir->insImmI(int32_t(mask)));
+                targets->add(dests[d], lir->insBranch(LIR_jf, lir->insEqI_0(hit), NULL));
+            }
+            targets->add(ndests, lir->insBranch(LIR_j, NULL, NULL));
+        }
+
+        void jumpTable(uint32_t i, uint32_t n, int64_t lo, int64_t hi) {
+            int32_t first = cases[i].value;
+            int32_t last = cases[i + n - 1].value;
+            LIns* index = lir->ins2(LIR_subi, value, lir->insImmI(first));
+            jumpToDefaultIfOutside(index, lo, hi, first, last);
+            uint32_t size = uint32_t(last - first) + 1;
+            LIns* jtbl = lir->insJtbl(index, size);
+            uint32_t k = i;
+            for (uint32_t slot = 0; slot < size; slot++) {
+                if (k < i + n && cases[k].value == int32_t(first + slot))
+                    targets->add(cases[k++].target, jtbl, slot);
+                else
+                    targets->add(ndests, jtbl, slot);
+            }
+        }
+
+    public:
+        SwitchLowering(LirWriter* lir, LIns* value, const SwitchCase* cases,
+                       SwitchTargets* targets, uint32_t ndests)
+            : lir(lir), value(value), cases(cases), targets(targets), ndests(ndests)
+        {}
+
+        void lower(uint32_t i, uint32_t n, int64_t lo, int64_t hi) {
+            if (n <= MAX_LINEAR_CASES) {
+                linear(i, n);
+                return;
+            }
+
+            int64_t span = int64_t(cases[i + n - 1].value) - cases[i].value + 1;
+            if (span <= 32) {
+                uint32_t dests[MAX_BIT_TEST_DESTS];
+                uint32_t nd = 0;
+                for (uint32_t k = i; k < i + n && nd <= MAX_BIT_TEST_DESTS; k++) {
+                    uint32_t d = 0;
+                    while (d < nd && dests[d] != cases[k].target)
+                        d++;
+                    if (d == nd) {
+                        if (nd == MAX_BIT_TEST_DESTS) {
+                            nd++;   // too many
+                            break;
+                        }
+                        dests[nd++] = cases[k].target;
+                    }
+                }
+                if (nd <= MAX_BIT_TEST_DESTS) {
+                    bitTest(i, n, lo, hi, dests, nd);
+                    return;
+                }
+            }
+
+#if NJ_JTBL_SUPPORTED
+            if (n >= MIN_JTBL_CASES && int64_t(n) * 100 >= span * MIN_JTBL_DENSITY) {
+                jumpTable(i, n, lo, hi);
+                return;
+            }
+#endif
+
+            // Values below the pivot go left, the rest go right.
+            uint32_t nleft = n / 2;
+            int32_t pivot = cases[i + nleft].value;
+            LIns* toLeft = lir->insBranch(LIR_jt, lir->ins2(LIR_lti, value, lir->insImmI(pivot)), NULL);
+            lower(i + nleft, n - nleft, pivot, hi);
+            if (toLeft) {
+                toLeft->setTarget(lir->ins0(LIR_label));
+                lower(i, nleft, lo, int64_t(pivot) - 1);
+            }
+        }
+    };
+
+    SwitchTargets* LirWriter::insSwitch(LIns* value, const SwitchCase* cases, uint32_t ncases,
+                                        uint32_t ndests, Allocator& alloc)
+    {
+        NanoAssert(value->isI());
+
+        // Sort a copy of the cases by value.  Switches are small enough that
+        // an insertion sort does fine.
+        SwitchCase* sorted = new (alloc) SwitchCase[ncases ? ncases : 1];
+        for (uint32_t i = 0; i < ncases; i++) {
+            NanoAssert(cases[i].target < ndests);
+            uint32_t j = i;
+            while (j > 0 && sorted[j - 1].value > cases[i].value) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            NanoAssert(j == 0 || sorted[j - 1].value != cases[i].value);
+            sorted[j] = cases[i];
+        }
+
+        SwitchTargets* targets = new (alloc) SwitchTargets(alloc, ndests);
+        SwitchLowering lowering(this, value, sorted, targets, ndests);
+        lowering.lower(0, ncases, INT32_MIN, INT32_MAX);
+        return targets;
+    }
+
     LIns* LirBufWriter::insCall(const CallInfo *ci, LIns* args[])
     {
         LOpcode op = getCallOpcode(ci);
@@ -1905,6 +2286,11 @@ namespace nanojit
 
                 case LIR_start:
                 case LIR_regfence:
+                CASEX64(LIR_fence:)
+                CASEX64(LIR_contextp:)
+                CASEX64(LIR_paramd:)
+                CASEX64(LIR_paramf:)
+                CASEX64(LIR_paramf4:)
                 case LIR_pushstate:
                 case LIR_popstate:
                 case LIR_savepc:
@@ -1935,6 +2321,8 @@ namespace nanojit
                 case LIR_ldc2i:
                 case LIR_lds2i:
                 case LIR_ldf2d:
+                CASEX64(LIR_ldacqi:)
+                CASEX64(LIR_ldacqq:)
                 case LIR_reti:
                 CASE64(LIR_retq:)
                 case LIR_retd:
@@ -1965,6 +2353,18 @@ namespace nanojit
                 case LIR_sqrtf:
                 case LIR_sqrtf4:
                 case LIR_sqrtd:
+                case LIR_floord:
+                case LIR_ceild:
+                case LIR_truncd:
+                case LIR_roundd:
+                case LIR_floorf:
+                case LIR_ceilf:
+                case LIR_truncf:
+                case LIR_roundf:
+                case LIR_floorf4:
+                case LIR_ceilf4:
+                case LIR_truncf4:
+                case LIR_roundf4:
                 CASESF(LIR_dlo2i:)
                 CASESF(LIR_dhi2i:)
                 CASESF(LIR_hcalli:)
@@ -1983,11 +2383,13 @@ namespace nanojit
                 case LIR_f4z:
                 case LIR_f4w:
                 case LIR_swzf4:
+                case LIR_prefetch:
                 CASE64(LIR_q2i:)
                 case LIR_d2i:
                 CASE64(LIR_dasq:)
                 CASE64(LIR_qasd:)
                 CASE86(LIR_modi:)
+                CASEX64(LIR_modq:)
                     live.add(ins->oprnd1(), 0);
                     break;
 
@@ -1999,6 +2401,12 @@ namespace nanojit
                 case LIR_sti2c:
                 case LIR_sti2s:
                 case LIR_std2f:
+                CASEX64(LIR_streli:)
+                CASEX64(LIR_strelq:)
+                case LIR_stnti:
+                CASE64(LIR_stntq:)
+                case LIR_stntd:
+                case LIR_stntf4:
                 case LIR_eqi:
                 case LIR_lti:
                 case LIR_gti:
@@ -2067,10 +2475,21 @@ namespace nanojit
                 case LIR_cmplef4:
                 case LIR_cmpeqf4:
                 case LIR_cmpnef4:
+                case LIR_copysignd:
                 CASE64(LIR_addq:)
                 CASE64(LIR_subq:)
+                CASE64(LIR_mulq:)
+                CASEX64(LIR_divq:)
+                CASEX64(LIR_xaddi:)
+                CASEX64(LIR_xaddq:)
+                CASEX64(LIR_xchgi:)
+                CASEX64(LIR_xchgq:)
+                CASE64(LIR_addxovq:)
+                CASE64(LIR_subxovq:)
+                CASE64(LIR_mulxovq:)
                 CASE64(LIR_addjovq:)
                 CASE64(LIR_subjovq:)
+                CASE64(LIR_muljovq:)
                 case LIR_andi:
                 case LIR_ori:
                 case LIR_xori:
@@ -2089,6 +2508,11 @@ namespace nanojit
                 case LIR_cmovd:
                 case LIR_cmovf:
                 case LIR_cmovf4:
+                CASEX64(LIR_casi:)
+                CASEX64(LIR_casq:)
+                case LIR_memcpy:
+                case LIR_memset:
+                case LIR_memcmp:
                     live.add(ins->oprnd1(), 0);
                     live.add(ins->oprnd2(), 0);
                     live.add(ins->oprnd3(), 0);
@@ -2381,8 +2805,21 @@ namespace nanojit
                 VMPI_snprintf(s, n, "%s = %s %d", formatRef(&b1, i), lirNames[op], i->size());
                 break;
 
+#ifdef NANOJIT_X64
+            case LIR_contextp:
+                VMPI_snprintf(s, n, "%s = %s", formatRef(&b1, i), lirNames[op]);
+                break;
+
+            case LIR_paramd:
+            case LIR_paramf:
+            case LIR_paramf4:
+                VMPI_snprintf(s, n, "%s = %s %d", formatRef(&b1, i), lirNames[op], i->paramArg());
+                break;
+#endif
+
             case LIR_start:
             case LIR_regfence:
+            CASEX64(LIR_fence:)
             case LIR_savepc:
 	        case LIR_pushstate:
 	        case LIR_popstate:
@@ -2493,6 +2930,18 @@ namespace nanojit
             case LIR_rsqrtf4:
             case LIR_recipf:
             case LIR_recipf4:
+            case LIR_floord:
+            case LIR_ceild:
+            case LIR_truncd:
+            case LIR_roundd:
+            case LIR_floorf:
+            case LIR_ceilf:
+            case LIR_truncf:
+            case LIR_roundf:
+            case LIR_floorf4:
+            case LIR_ceilf4:
+            case LIR_truncf4:
+            case LIR_roundf4:
             case LIR_i2d:
             CASE64(LIR_q2d:)
             case LIR_ui2d:
@@ -2507,6 +2956,7 @@ namespace nanojit
             CASESF(LIR_dhi2i:)
             case LIR_noti:
             CASE86(LIR_modi:)
+            CASEX64(LIR_modq:)
             CASE64(LIR_i2q:)
             CASE64(LIR_ui2uq:)
             CASE64(LIR_q2i:)
@@ -2530,6 +2980,9 @@ namespace nanojit
             case LIR_addxovi:
             case LIR_subxovi:
             case LIR_mulxovi:
+            CASE64(LIR_addxovq:)
+            CASE64(LIR_subxovq:)
+            CASE64(LIR_mulxovq:)
                 formatGuardXov(buf, i);
                 break;
 
@@ -2538,6 +2991,7 @@ namespace nanojit
             case LIR_muljovi:
             CASE64(LIR_addjovq:)
             CASE64(LIR_subjovq:)
+            CASE64(LIR_muljovq:)
                 VMPI_snprintf(s, n, "%s = %s %s, %s ; ovf -> %s", formatRef(&b1, i), lirNames[op],
                     formatRef(&b2, i->oprnd1()),
                     formatRef(&b3, i->oprnd2()),
@@ -2546,8 +3000,8 @@ namespace nanojit
 
             case LIR_addi:       CASE64(LIR_addq:)
             case LIR_subi:       CASE64(LIR_subq:)
-            case LIR_muli:
-            CASE86(LIR_divi:)
+            case LIR_muli:       CASE64(LIR_mulq:)
+            CASE86(LIR_divi:)    CASEX64(LIR_divq:)
             case LIR_addd:
             case LIR_subd:
             case LIR_muld:
@@ -2571,6 +3025,7 @@ namespace nanojit
             case LIR_cmplef4:
             case LIR_cmpeqf4:
             case LIR_cmpnef4:
+            case LIR_copysignd:
             case LIR_andi:       CASE64(LIR_andq:)
             case LIR_ori:        CASE64(LIR_orq:)
             case LIR_xori:       CASE64(LIR_xorq:)
@@ -2600,6 +3055,10 @@ namespace nanojit
 #if NJ_SOFTFLOAT_SUPPORTED
             case LIR_ii2d:
 #endif
+            CASEX64(LIR_xaddi:)
+            CASEX64(LIR_xaddq:)
+            CASEX64(LIR_xchgi:)
+            CASEX64(LIR_xchgq:)
                 VMPI_snprintf(s, n, "%s = %s %s, %s", formatRef(&b1, i), lirNames[op],
                     formatRef(&b2, i->oprnd1()),
                     formatRef(&b3, i->oprnd2()));
@@ -2616,6 +3075,31 @@ namespace nanojit
                     formatRef(&b4, i->oprnd3()));
                 break;
 
+            CASEX64(LIR_casi:)
+            CASEX64(LIR_casq:)
+                VMPI_snprintf(s, n, "%s = %s %s, %s, %s", formatRef(&b1, i), lirNames[op],
+                    formatRef(&b2, i->oprnd1()),
+                    formatRef(&b3, i->oprnd2()),
+                    formatRef(&b4, i->oprnd3()));
+                break;
+
+            case LIR_memcpy:
+            case LIR_memset:
+                VMPI_snprintf(s, n, "%s%s %s, %s, %s", lirNames[op],
+                    formatAccSet(&b1, i->accSet()),
+                    formatRef(&b2, i->oprnd1()),
+                    formatRef(&b3, i->oprnd2()),
+                    formatRef(&b4, i->oprnd3()));
+                break;
+
+            case LIR_memcmp:
+                VMPI_snprintf(s, n, "%s = %s%s %s, %s, %s", formatRef(&b1, i), lirNames[op],
+                    formatAccSet(&b2, i->accSet()),
+                    formatRef(&b3, i->oprnd1()),
+                    formatRef(&b4, i->oprnd2()),
+                    formatRef(&b5, i->oprnd3()));
+                break;
+
             case LIR_ffff2f4:
                 VMPI_snprintf(s, n, "%s =(%s)= %s %s %s %s", formatRef(&b1, i), lirNames[op],
                               formatRef(&b2, i->oprnd1()),
@@ -2633,7 +3117,9 @@ namespace nanojit
             case LIR_ldus2ui:
             case LIR_ldc2i:
             case LIR_lds2i:
-            case LIR_ldf2d: {
+            case LIR_ldf2d:
+            CASEX64(LIR_ldacqi:)
+            CASEX64(LIR_ldacqq:) {
                 const char* qualStr;
                 switch (i->loadQual()) {
                 case LOAD_CONST:        qualStr = "/c"; break;
@@ -2655,6 +3141,12 @@ namespace nanojit
             case LIR_sti2c:
             case LIR_sti2s:
             case LIR_std2f:
+            CASEX64(LIR_streli:)
+            CASEX64(LIR_strelq:)
+            case LIR_stnti:
+            CASE64(LIR_stntq:)
+            case LIR_stntd:
+            case LIR_stntf4:
                 VMPI_snprintf(s, n, "%s%s %s[%d] = %s", lirNames[op],
                     formatAccSet(&b1, i->accSet()),
                     formatRef(&b2, i->oprnd2()),
@@ -2675,6 +3167,14 @@ namespace nanojit
                               i->mask() >> 6 & 3);
                 break;
 
+            case LIR_prefetch: {
+                static const char* hintNames[] = { "nta", "t0", "t1", "t2" };
+                NanoAssert(i->mask() < sizeof(hintNames) / sizeof(hintNames[0]));
+                VMPI_snprintf(s, n, "%s %s %s", lirNames[op],
+                              formatRef(&b1, i->oprnd1()), hintNames[i->mask()]);
+                break;
+            }
+
             case LIR_safe:
             case LIR_endsafe:
                 VMPI_snprintf(s, n, "%s", (char*)lirNames[op]);
@@ -3407,6 +3907,11 @@ namespace nanojit
     {
         if (op == LIR_label && !suspended)
             clearAll();
+#ifdef NANOJIT_X64
+        // No load may be CSE'd across a fence.
+        if (op == LIR_fence)
+            storesSinceLastLoad = ACCSET_ALL;
+#endif
         return out->ins0(op);
     }
 
@@ -3430,6 +3935,13 @@ namespace nanojit
     LIns* CseFilter::ins2(LOpcode op, LIns* a, LIns* b)
     {
         LIns* ins;
+        if (isAtomicRmwOpcode(op)) {
+            // Atomics are never CSE'd.  We don't know what other threads do
+            // with the memory, so treat the operation like a store to every
+            // region.
+            storesSinceLastLoad = ACCSET_ALL;
+            return out->ins2(op, a, b);
+        }
         NanoAssert(isCseOpcode(op));
         uint32_t k;
         ins = find2(op, a, b, k);
@@ -3452,6 +3964,11 @@ namespace nanojit
 
     LIns* CseFilter::ins3(LOpcode op, LIns* a, LIns* b, LIns* c)
     {
+        if (isAtomicRmwOpcode(op)) {
+            // See ins2().
+            storesSinceLastLoad = ACCSET_ALL;
+            return out->ins3(op, a, b, c);
+        }
         NanoAssert(isCseOpcode(op));
         uint32_t k;
         LIns* ins = find3(op, a, b, c, k);
@@ -3505,6 +4022,11 @@ namespace nanojit
                 // Volatile loads are never CSE'd, don't bother looking for
                 // them or inserting them in the table.
                 ins = out->insLoad(op, base, disp, accSet, loadQual);
+            } else if (isAcquireLoadOpcode(op)) {
+                // Acquire loads are never CSE'd either, and no later load may
+                // reuse a value loaded before them.
+                ins = out->insLoad(op, base, disp, accSet, loadQual);
+                storesSinceLastLoad = ACCSET_ALL;
             } else {
                 uint32_t k;
                 ins = findLoad(op, base, disp, compressAccSet(accSet), loadQual, k);
@@ -3625,6 +4147,17 @@ namespace nanojit
         return ins;
     }
 
+    LIns* CseFilter::insMem(LOpcode op, LIns* a, LIns* b, LIns* len, AccSet accSet) {
+        // memcmp only reads memory, like a non-CSE'd load;  the others write
+        // all of 'accSet', like a store.
+        if (op != LIR_memcmp)
+            storesSinceLastLoad |= accSet;
+        LIns* ins = out->insMem(op, a, b, len, accSet);
+        NanoAssert(ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b &&
+                   ins->oprnd3() == len && ins->accSet() == accSet);
+        return ins;
+    }
+
     LIns* CseFilter::insSwz(LIns* a, uint8_t mask) {
         NanoAssert(isCseOpcode(LIR_swzf4));
         // todo: add hashtable for swizzle ops.
@@ -3796,6 +4329,108 @@ namespace nanojit
         return Interval(I32_MIN, I32_MAX);
     }
 
+#ifdef NANOJIT_64BIT
+    // As with of(), we only handle the easy (but common!) cases.  In
+    // particular, quads produced by LIR_i2q always fit in 32 bits, even if
+    // the int operation that produced them may have overflowed.
+    Interval Interval::ofQ(LIns* ins, int lim)
+    {
+        switch (ins->opcode()) {
+        case LIR_immq: {
+            int64_t q = ins->immQ();
+            return Interval(q, q);      // overflows if 'q' doesn't fit in 32 bits
+        }
+
+        case LIR_i2q:
+            if (lim > 0) {
+                Interval x = of(ins->oprnd1(), lim-1);
+                NanoAssert(x.isSane());
+                if (!x.hasOverflowed)
+                    return x;
+            }
+            return Interval(I32_MIN, I32_MAX);
+
+        case LIR_ui2uq:
+            if (lim > 0) {
+                Interval x = of(ins->oprnd1(), lim-1);
+                NanoAssert(x.isSane());
+                if (!x.hasOverflowed && x.lo >= 0)
+                    return x;
+            }
+            goto overflow;
+
+        case LIR_addq:
+        case LIR_addxovq:
+        case LIR_addjovq:
+            if (lim > 0)
+                return add(ofQ(ins->oprnd1(), lim-1), ofQ(ins->oprnd2(), lim-1));
+            goto overflow;
+
+        case LIR_subq:
+        case LIR_subxovq:
+        case LIR_subjovq:
+            if (lim > 0)
+                return sub(ofQ(ins->oprnd1(), lim-1), ofQ(ins->oprnd2(), lim-1));
+            goto overflow;
+
+        case LIR_mulq:
+        case LIR_mulxovq:
+        case LIR_muljovq:
+            if (lim > 0)
+                return mul(ofQ(ins->oprnd1(), lim-1), ofQ(ins->oprnd2(), lim-1));
+            goto overflow;
+
+        case LIR_andq: {
+            // Only handle one common case accurately, for speed and simplicity.
+            LIns* b = ins->oprnd2();
+            if (b->isImmQ() && b->immQ() <= I32_MAX) {
+                // Example:  andq [lo,hi], 0xffff --> [0, 0xffff]
+                return Interval(0, b->immQ());
+            }
+            goto overflow;
+        }
+
+        case LIR_rshuq: {
+            // Example:  rshuq [lo,hi], 40 --> [0, 0xffffff]
+            if (ins->oprnd2()->isImmI()) {
+                int32_t y = ins->oprnd2()->immI() & 0x3f;   // we only use the bottom 6 bits
+                if (y >= 33)
+                    return Interval(0, int64_t(~uint64_t(0) >> y));
+            }
+            goto overflow;
+        }
+
+        case LIR_rshq: {
+            // Example:  rshq [lo,hi], 48 --> [-32768, 32767]
+            if (ins->oprnd2()->isImmI()) {
+                int32_t y = ins->oprnd2()->immI() & 0x3f;   // we only use the bottom 6 bits
+                if (y >= 32)
+                    return Interval(-(int64_t(1) << (63 - y)),
+                                     (int64_t(1) << (63 - y)) - 1);
+            }
+            goto overflow;
+        }
+
+        case LIR_cmovq: {
+            if (lim > 0) {
+                Interval x = ofQ(ins->oprnd2(), lim-1);
+                Interval y = ofQ(ins->oprnd3(), lim-1);
+                NanoAssert(x.isSane() && y.isSane());
+                if (!x.hasOverflowed && !y.hasOverflowed)
+                    return Interval(NJ_MIN(x.lo, y.lo), NJ_MAX(x.hi, y.hi));
+            }
+            goto overflow;
+        }
+
+        default:
+            goto overflow;
+        }
+
+      overflow:
+        return OverflowInterval();
+    }
+#endif
+
     Interval Interval::add(Interval x, Interval y) {
         NanoAssert(x.isSane() && y.isSane());
 
@@ -4155,6 +4790,8 @@ namespace nanojit
         case LIR_ldf:
         case LIR_ldf4:
         CASE64(LIR_ldq:)
+        CASEX64(LIR_ldacqi:)
+        CASEX64(LIR_ldacqq:)
             break;
         default:
             NanoAssert(0);
@@ -4177,11 +4814,15 @@ namespace nanojit
         case LIR_sti2c:
         case LIR_sti2s:
         case LIR_sti:
+        CASEX64(LIR_streli:)
+        case LIR_stnti:
             formals[0] = LTy_I;
             break;
 
 #ifdef NANOJIT_64BIT
         case LIR_stq:
+        CASEX64(LIR_strelq:)
+        case LIR_stntq:
             formals[0] = LTy_Q;
             break;
 #endif
@@ -4190,11 +4831,13 @@ namespace nanojit
             break;
 
         case LIR_stf4:
+        case LIR_stntf4:
             formals[0] = LTy_F4;
             break;
 
         case LIR_std:
         case LIR_std2f:
+        case LIR_stntd:
             formals[0] = LTy_D;
             break;
 
@@ -4212,6 +4855,8 @@ namespace nanojit
         switch (op) {
         case LIR_start:
         case LIR_regfence:
+        CASEX64(LIR_fence:)
+        CASEX64(LIR_contextp:)
         case LIR_label:
         case LIR_pushstate:
         case LIR_popstate:
@@ -4268,6 +4913,13 @@ namespace nanojit
             break;
 #endif
 
+#if defined NANOJIT_X64
+        case LIR_modq:       // see LIRopcode.tbl for why 'mod' is unary
+            checkLInsHasOpcode(op, 1, a, LIR_divq);
+            formals[0] = LTy_Q;
+            break;
+#endif
+
 #if NJ_SOFTFLOAT_SUPPORTED
         case LIR_dlo2i:
         case LIR_dhi2i:
@@ -4285,6 +4937,10 @@ namespace nanojit
         case LIR_negd:
         case LIR_absd:
         case LIR_sqrtd:
+        case LIR_floord:
+        case LIR_ceild:
+        case LIR_truncd:
+        case LIR_roundd:
         case LIR_retd:
         case LIR_lived:
         case LIR_d2i:
@@ -4298,6 +4954,10 @@ namespace nanojit
         case LIR_recipf4:
         case LIR_rsqrtf4:
         case LIR_sqrtf4:
+        case LIR_floorf4:
+        case LIR_ceilf4:
+        case LIR_truncf4:
+        case LIR_roundf4:
         case LIR_retf4:
         case LIR_livef4:
         case LIR_f4x:
@@ -4312,6 +4972,10 @@ namespace nanojit
         case LIR_recipf:
         case LIR_rsqrtf:
         case LIR_sqrtf:
+        case LIR_floorf:
+        case LIR_ceilf:
+        case LIR_truncf:
+        case LIR_roundf:
         case LIR_retf:
         case LIR_livef:
         case LIR_f2i:
@@ -4379,6 +5043,8 @@ namespace nanojit
         case LIR_xorq:
         case LIR_addq:
         case LIR_subq:
+        case LIR_mulq:
+        CASEX64(LIR_divq:)
         case LIR_eqq:
         case LIR_ltq:
         case LIR_gtq:
@@ -4400,10 +5066,25 @@ namespace nanojit
             break;
 #endif
 
+#ifdef NANOJIT_X64
+        case LIR_xaddi:
+        case LIR_xchgi:
+            formals[0] = LTy_P;
+            formals[1] = LTy_I;
+            break;
+
+        case LIR_xaddq:
+        case LIR_xchgq:
+            formals[0] = LTy_P;
+            formals[1] = LTy_Q;
+            break;
+#endif
+
         case LIR_addd:
         case LIR_subd:
         case LIR_muld:
         case LIR_divd:
+        case LIR_copysignd:
         case LIR_eqd:
         case LIR_gtd:
         case LIR_ltd:
@@ -4494,6 +5175,20 @@ namespace nanojit
             formals[2] = LTy_F4;
             break;
 
+#ifdef NANOJIT_X64
+        case LIR_casi:
+            formals[0] = LTy_P;
+            formals[1] = LTy_I;
+            formals[2] = LTy_I;
+            break;
+
+        case LIR_casq:
+            formals[0] = LTy_P;
+            formals[1] = LTy_Q;
+            formals[2] = LTy_Q;
+            break;
+#endif
+
         default:
             NanoAssert(0);
         }
@@ -4518,6 +5213,26 @@ namespace nanojit
         return out->insParam(arg, kind);
     }
 
+#ifdef NANOJIT_X64
+    LIns* ValidateWriter::insFpParam(LOpcode op, int32_t arg)
+    {
+        switch (op) {
+        case LIR_paramd:
+        case LIR_paramf:
+        case LIR_paramf4:
+            break;
+        default:
+            NanoAssert(0);
+        }
+        // They are only ever passed in registers.
+        NanoAssertMsgf(arg >= 0 && arg < NumInternalFpArgRegs,
+            "LIR structure error (%s): '%s' reads floating-point argument %d, "
+            "but only %d are passed in registers",
+            whereInPipeline, lirNames[op], arg, NumInternalFpArgRegs);
+        return out->insFpParam(op, arg);
+    }
+#endif
+
     LIns* ValidateWriter::insImmI(int32_t imm)
     {
         return out->insImmI(imm);
@@ -4652,15 +5367,26 @@ namespace nanojit
     LIns* ValidateWriter::insGuardXov(LOpcode op, LIns* a, LIns* b, GuardRecord* gr)
     {
         int nArgs = 2;
-        LTy formals[2] = { LTy_I, LTy_I };
+        LTy formals[2];
         LIns* args[2] = { a, b };
 
         switch (op) {
         case LIR_addxovi:
         case LIR_subxovi:
         case LIR_mulxovi:
+            formals[0] = LTy_I;
+            formals[1] = LTy_I;
             break;
 
+#ifdef NANOJIT_64BIT
+        case LIR_addxovq:
+        case LIR_subxovq:
+        case LIR_mulxovq:
+            formals[0] = LTy_Q;
+            formals[1] = LTy_Q;
+            break;
+#endif
+
         default:
             NanoAssert(0);
         }
@@ -4719,6 +5445,7 @@ namespace nanojit
 #ifdef NANOJIT_64BIT
         case LIR_addjovq:
         case LIR_subjovq:
+        case LIR_muljovq:
             formals[0] = LTy_Q;
             formals[1] = LTy_Q;
             break;
@@ -4772,6 +5499,7 @@ namespace nanojit
         case LIR_muljovi:
         CASE64(LIR_addjovq:)
         CASE64(LIR_subjovq:)
+        CASE64(LIR_muljovq:)
             NanoAssert(ins->getTarget() && ins->oprnd3()->isop(LIR_label));
             break;
 
@@ -4798,6 +5526,41 @@ namespace nanojit
         typeCheckArgs(LIR_swzf4, 1, formals, args);
         return out->insSwz(a, mask);
     }
+
+    LIns* ValidateWriter::insMem(LOpcode op, LIns* a, LIns* b, LIns* len, AccSet accSet)
+    {
+        checkAccSet(op, a, 0, accSet);
+
+        LTy formals[3] = { LTy_P, LTy_P, LTy_P };
+        LIns* args[3] = { a, b, len };
+
+        switch (op) {
+        case LIR_memcpy:
+        case LIR_memcmp:
+            checkAccSet(op, b, 0, accSet);
+            break;
+
+        case LIR_memset:
+            formals[1] = LTy_I;
+            break;
+
+        default:
+            NanoAssert(0);
+        }
+
+        typeCheckArgs(op, 3, formals, args);
+
+        return out->insMem(op, a, b, len, accSet);
+    }
+
+    LIns* ValidateWriter::insPrefetch(LIns* addr, PrefetchHint hint)
+    {
+        NanoAssert(hint <= PREFETCH_T2);
+        LTy formals[] = { LTy_P };
+        LIns* args[] = { addr };
+        typeCheckArgs(LIR_prefetch, 1, formals, args);
+        return out->insPrefetch(addr, hint);
+    }
 #endif
 #endif
 
@@ -49,7 +49,13 @@ namespace nanojit
 
         LIR_addp    = PTR_SIZE(LIR_addi,    LIR_addq),
         LIR_subp    = PTR_SIZE(LIR_subi,    LIR_subq),
+        LIR_mulp    = PTR_SIZE(LIR_muli,    LIR_mulq),
+        LIR_addxovp = PTR_SIZE(LIR_addxovi, LIR_addxovq),
+        LIR_subxovp = PTR_SIZE(LIR_subxovi, LIR_subxovq),
+        LIR_mulxovp = PTR_SIZE(LIR_mulxovi, LIR_mulxovq),
         LIR_addjovp = PTR_SIZE(LIR_addjovi, LIR_addjovq),
+        LIR_subjovp = PTR_SIZE(LIR_subjovi, LIR_subjovq),
+        LIR_muljovp = PTR_SIZE(LIR_muljovi, LIR_muljovq),
 
         LIR_andp    = PTR_SIZE(LIR_andi,    LIR_andq),
         LIR_orp     = PTR_SIZE(LIR_ori,     LIR_orq),
@@ -126,6 +132,14 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
     NanoStaticAssert(LIR_dotf3 == LIR_dotf4 + 1);
     NanoStaticAssert(LIR_dotf2 == LIR_dotf4 + 2);
 
+    // The rounding opcodes come in groups of four, one per RoundingMode.
+    NanoStaticAssert(LIR_ceild  == LIR_floord + 1 &&
+                     LIR_truncd == LIR_floord + 2 &&
+                     LIR_roundd == LIR_floord + 3);
+    NanoStaticAssert(LIR_floorf  == LIR_floord + 4 &&
+                     LIR_floorf4 == LIR_floord + 8 &&
+                     LIR_roundf4 == LIR_floord + 11);
+
     struct GuardRecord;
     struct SideExit;
 
@@ -133,7 +147,16 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         ABI_FASTCALL,
         ABI_THISCALL,
         ABI_STDCALL,
-        ABI_CDECL
+        ABI_CDECL,
+        // For calls between fragments.  More arguments are passed in
+        // registers, floating-point ones included (see LIR_paramd), and a
+        // fragment that returns an internal call's result straight away can
+        // tail-call it.  The callee preserves the callee-saved registers
+        // through its saved-register params as usual, which costs nothing
+        // for the registers it doesn't use.  The fragment's LirBuffer::abi
+        // must be set to match.  Back-ends that don't distinguish it treat
+        // it as ABI_FASTCALL.
+        ABI_INTERNAL
     };
 
     // This is much the same as LTy, but we need to distinguish signed and
@@ -319,6 +342,21 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LOAD_VOLATILE = 2
     };
 
+    // Locality hints for LIR_prefetch, from least to most temporal.  The
+    // values match the x86 PREFETCHh encodings, other backends map them as
+    // they see fit.
+    //
+    // - PREFETCH_NTA: the data will be used once; minimise cache pollution.
+    // - PREFETCH_T2, PREFETCH_T1, PREFETCH_T0: the data will be reused;
+    //   fetch it into successively closer levels of the cache hierarchy.
+    //
+    enum PrefetchHint {
+        PREFETCH_NTA  = 0,
+        PREFETCH_T0   = 1,
+        PREFETCH_T1   = 2,
+        PREFETCH_T2   = 3
+    };
+
     struct CallInfo
     {
     private:
@@ -331,10 +369,18 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
     public:
         uintptr_t   _address;
         uint32_t    _typesig:27;     // 9 3-bit fields indicating arg type, by ARGTYPE above (including ret type): a1 a2 a3 a4 a5 ret
-        AbiKind     _abi:3;
+        AbiKind     _abi:4;
         uint32_t    _isPure:1;      // _isPure=1 means no side-effects, result only depends on args
         AccSet      _storeAccSet;   // access regions stored by the function
         verbose_only ( const char* _name; )
+        // Registers the callee may clobber.  0 (the default for aggregate
+        // initializers that omit it) means the callee follows the platform
+        // ABI and may clobber every scratch register.  A non-zero mask
+        // describes a helper hand-written to preserve everything else, so
+        // only live values in these registers are evicted around the call.
+        // The back-end always adds the argument and return registers, and
+        // back-ends that don't support clobber masks ignore the field.
+        RegisterMask _clobbers;
 
         // The following encode 'r func()' through to 'r func(a1, a2, a3, a4, a5, a6, a7, a8)'.
         static inline uint32_t typeSig0(ArgType r) {
@@ -428,6 +474,54 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             op == LIR_cmovi ||
             op == LIR_cmovd;
     }
+    inline bool isAtomicRmwOpcode(LOpcode op) {
+#if defined NANOJIT_X64
+        return LIR_casi <= op && op <= LIR_xchgq;
+#else
+        (void)op;
+        return false;
+#endif
+    }
+    inline bool isAcquireLoadOpcode(LOpcode op) {
+#if defined NANOJIT_X64
+        return op == LIR_ldacqi || op == LIR_ldacqq;
+#else
+        (void)op;
+        return false;
+#endif
+    }
+    inline bool isNonTemporalStoreOpcode(LOpcode op) {
+        return
+#if defined NANOJIT_64BIT
+            op == LIR_stntq ||
+#endif
+            op == LIR_stnti || op == LIR_stntd || op == LIR_stntf4;
+    }
+    // The ordinary store that a non-temporal store falls back to.
+    inline LOpcode getTemporalStoreOpcode(LOpcode op) {
+        switch (op) {
+        case LIR_stnti:  return LIR_sti;
+#if defined NANOJIT_64BIT
+        case LIR_stntq:  return LIR_stq;
+#endif
+        case LIR_stntd:  return LIR_std;
+        case LIR_stntf4: return LIR_stf4;
+        default:         NanoAssert(0); return LIR_skip;
+        }
+    }
+    inline bool isRoundingOpcode(LOpcode op) {
+        return LIR_floord <= op && op <= LIR_roundf4;
+    }
+    enum RoundingMode {
+        ROUND_FLOOR = 0,    // towards -infinity
+        ROUND_CEIL = 1,     // towards +infinity
+        ROUND_TRUNC = 2,    // towards zero
+        ROUND_NEAREST = 3   // to nearest, ties to even
+    };
+    inline RoundingMode getRoundingMode(LOpcode op) {
+        NanoAssert(isRoundingOpcode(op));
+        return RoundingMode((op - LIR_floord) & 3);
+    }
     inline bool isCmpIOpcode(LOpcode op) {
         return LIR_eqi <= op && op <= LIR_geui;
     }
@@ -618,6 +712,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LRK_Op4,
         LRK_Ld,
         LRK_St,
+        LRK_Mem,
         LRK_Sk,
         LRK_C,
         LRK_P,
@@ -637,6 +732,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
     class LInsOp4;
     class LInsLd;
     class LInsSt;
+    class LInsMem;
     class LInsSk;
     class LInsC;
     class LInsP;
@@ -701,6 +797,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         inline LInsOp4*  toLInsOp4()  const;
         inline LInsLd*   toLInsLd()   const;
         inline LInsSt*   toLInsSt()   const;
+        inline LInsMem*  toLInsMem()  const;
         inline LInsSk*   toLInsSk()   const;
         inline LInsC*    toLInsC()    const;
         inline LInsP*    toLInsP()    const;
@@ -722,11 +819,12 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         inline void initLInsOp4(LOpcode opcode, LIns* oprnd1, LIns* oprnd2, LIns* oprnd3, LIns* oprnd4);
         inline void initLInsLd(LOpcode opcode, LIns* val, int32_t d, AccSet accSet, LoadQual loadQual);
         inline void initLInsSt(LOpcode opcode, LIns* val, LIns* base, int32_t d, AccSet accSet);
+        inline void initLInsMem(LOpcode opcode, LIns* a, LIns* b, LIns* len, AccSet accSet);
         inline void initLInsSk(LIns* prevLIns);
         // Nb: args[] must be allocated and initialised before being passed in;
         // initLInsC() just copies the pointer into the LInsC.
         inline void initLInsC(LOpcode opcode, LIns** args, const CallInfo* ci);
-        inline void initLInsP(int32_t arg, int32_t kind);
+        inline void initLInsP(LOpcode opcode, int32_t arg, int32_t kind);
         inline void initLInsIorF(LOpcode opcode, int32_t immIorF);
         inline void initLInsQorD(LOpcode opcode, uint64_t immQorD);
         inline void initLInsJtbl(LIns* index, uint32_t size, LIns** table);
@@ -749,6 +847,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             return isV() ||
                    sharedFields.isResultLive ||
                    (isCall() && !callInfo()->_isPure) ||    // impure calls are always live
+                   isAtomicRmwOpcode(opcode()) ||           // so are atomic read-modify-writes
                    isop(LIR_paramp);                        // LIR_paramp is always live
         }
         void setResultLive() {
@@ -842,7 +941,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         // For loads.
         inline LoadQual loadQual() const;
 
-        // For loads/stores.
+        // For loads/stores.  miniAccSet() and accSet() also work for LInsMem.
         inline int32_t  disp() const;
         inline MiniAccSet miniAccSet() const;
         inline AccSet   accSet() const;
@@ -931,6 +1030,10 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             NanoAssert(LRK_None != repKinds[opcode()]);
             return LRK_St == repKinds[opcode()];
         }
+        bool isLInsMem() const {
+            NanoAssert(LRK_None != repKinds[opcode()]);
+            return LRK_Mem == repKinds[opcode()];
+        }
         bool isLInsSk() const {
             NanoAssert(LRK_None != repKinds[opcode()]);
             return LRK_Sk == repKinds[opcode()];
@@ -995,12 +1098,15 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         }
         bool isGuard() const {
             return isop(LIR_x) || isop(LIR_xf) || isop(LIR_xt) || isop(LIR_xbarrier) ||
+#ifdef NANOJIT_64BIT
+                   isop(LIR_addxovq) || isop(LIR_subxovq) || isop(LIR_mulxovq) ||
+#endif
                    isop(LIR_addxovi) || isop(LIR_subxovi) || isop(LIR_mulxovi);
         }
         bool isJov() const {
             return
 #ifdef NANOJIT_64BIT
-                isop(LIR_addjovq) || isop(LIR_subjovq) ||
+                isop(LIR_addjovq) || isop(LIR_subjovq) || isop(LIR_muljovq) ||
 #endif
                 isop(LIR_addjovi) || isop(LIR_subjovi) || isop(LIR_muljovi);
         }
@@ -1161,7 +1267,8 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
     };
 
     // 1-operand form, plus an immediate byte.  Used for LIR_swzf4, which
-    // is a unary operator with an immediate byte specifying a shuffle operation.
+    // is a unary operator with an immediate byte specifying a shuffle operation,
+    // and for LIR_prefetch, whose immediate byte is a PrefetchHint.
     class LInsOp1b
     {
     private:
@@ -1280,6 +1387,27 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* getLIns() { return &ins; };
     };
 
+    // Used for the bulk memory operations LIR_memcpy, LIR_memset and
+    // LIR_memcmp.  The third operand is the length in bytes.
+    class LInsMem
+    {
+    private:
+        friend class LIns;
+
+        MiniAccSetVal miniAccSetVal;
+
+        LIns*       oprnd_3;
+
+        LIns*       oprnd_2;
+
+        LIns*       oprnd_1;
+
+        LIns        ins;
+
+    public:
+        LIns* getLIns() { return &ins; };
+    };
+
     // Used for LIR_skip.
     class LInsSk
     {
@@ -1313,7 +1441,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* getLIns() { return &ins; };
     };
 
-    // Used for LIR_paramp.
+    // Used for LIR_paramp, and LIR_paramd, LIR_paramf and LIR_paramf4.
     class LInsP
     {
     private:
@@ -1418,6 +1546,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
     LInsOp4*  LIns::toLInsOp4()  const { return (LInsOp4* )(uintptr_t(this+1) - sizeof(LInsOp4 )); }
     LInsLd*   LIns::toLInsLd()   const { return (LInsLd*  )(uintptr_t(this+1) - sizeof(LInsLd  )); }
     LInsSt*   LIns::toLInsSt()   const { return (LInsSt*  )(uintptr_t(this+1) - sizeof(LInsSt  )); }
+    LInsMem*  LIns::toLInsMem()  const { return (LInsMem* )(uintptr_t(this+1) - sizeof(LInsMem )); }
     LInsSk*   LIns::toLInsSk()   const { return (LInsSk*  )(uintptr_t(this+1) - sizeof(LInsSk  )); }
     LInsC*    LIns::toLInsC()    const { return (LInsC*   )(uintptr_t(this+1) - sizeof(LInsC   )); }
     LInsP*    LIns::toLInsP()    const { return (LInsP*   )(uintptr_t(this+1) - sizeof(LInsP   )); }
@@ -1482,6 +1611,14 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         toLInsSt()->miniAccSetVal = compressAccSet(accSet).val;
         NanoAssert(isLInsSt());
     }
+    void LIns::initLInsMem(LOpcode opcode, LIns* a, LIns* b, LIns* len, AccSet accSet) {
+        initSharedFields(opcode);
+        toLInsMem()->oprnd_1 = a;
+        toLInsMem()->oprnd_2 = b;
+        toLInsMem()->oprnd_3 = len;
+        toLInsMem()->miniAccSetVal = compressAccSet(accSet).val;
+        NanoAssert(isLInsMem());
+    }
     void LIns::initLInsSk(LIns* prevLIns) {
         initSharedFields(LIR_skip);
         toLInsSk()->prevLIns = prevLIns;
@@ -1493,8 +1630,8 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         toLInsC()->ci = ci;
         NanoAssert(isLInsC());
     }
-    void LIns::initLInsP(int32_t arg, int32_t kind) {
-        initSharedFields(LIR_paramp);
+    void LIns::initLInsP(LOpcode opcode, int32_t arg, int32_t kind) {
+        initSharedFields(opcode);
         NanoAssert(isU8(arg) && isU8(kind));
         toLInsP()->arg = arg;
         toLInsP()->kind = kind;
@@ -1534,15 +1671,15 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
     }
     LIns* LIns::oprnd1() const {
         NanoAssert(isLInsOp1() || isLInsOp1b() || isLInsOp2() || isLInsOp3() ||
-                   isLInsOp4() || isLInsLd() || isLInsSt() || isLInsJtbl());
+                   isLInsOp4() || isLInsLd() || isLInsSt() || isLInsMem() || isLInsJtbl());
         return toLInsOp2()->oprnd_1;
     }
     LIns* LIns::oprnd2() const {
-        NanoAssert(isLInsOp2() || isLInsOp3() || isLInsOp4() || isLInsSt());
+        NanoAssert(isLInsOp2() || isLInsOp3() || isLInsOp4() || isLInsSt() || isLInsMem());
         return toLInsOp2()->oprnd_2;
     }
     LIns* LIns::oprnd3() const {
-        NanoAssert(isLInsOp3() || isLInsOp4());
+        NanoAssert(isLInsOp3() || isLInsOp4() || isLInsMem());
         return toLInsOp3()->oprnd_3;
     }
     LIns* LIns::oprnd4() const {
@@ -1592,6 +1729,9 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         case LIR_addxovi:
         case LIR_subxovi:
         case LIR_mulxovi:
+        CASE64(LIR_addxovq:)
+        CASE64(LIR_subxovq:)
+        CASE64(LIR_mulxovq:)
             return (GuardRecord*)oprnd3();
 
         default:
@@ -1618,6 +1758,8 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         MiniAccSet miniAccSet;
         if (isLInsSt()) {
             miniAccSet.val = toLInsSt()->miniAccSetVal;
+        } else if (isLInsMem()) {
+            miniAccSet.val = toLInsMem()->miniAccSetVal;
         } else {
             NanoAssert(isLInsLd());
             miniAccSet.val = toLInsLd()->miniAccSetVal;
@@ -1634,7 +1776,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         return toLInsSk()->prevLIns;
     }
 
-    inline uint8_t LIns::paramArg()  const { NanoAssert(isop(LIR_paramp)); return toLInsP()->arg; }
+    inline uint8_t LIns::paramArg()  const { NanoAssert(isLInsP()); return toLInsP()->arg; }
     inline uint8_t LIns::paramKind() const { NanoAssert(isop(LIR_paramp)); return toLInsP()->kind; }
 
     inline int32_t LIns::immI()     const { NanoAssert(isImmI()); return toLInsIorF()->immIorF; }
@@ -1730,6 +1872,46 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         return toLInsOp1b()->mask;
     }
 
+    // One case of a switch lowered by LirWriter::insSwitch().
+    struct SwitchCase
+    {
+        int32_t     value;      // the case's value
+        uint32_t    target;     // the case's destination, see SwitchTargets
+    };
+
+    // The branches and jump table slots of a switch lowered by
+    // LirWriter::insSwitch(), grouped by destination.  The frontend numbers
+    // its destinations 0..n-1;  destination n is the default.  Once the
+    // LIR_label for a destination has been inserted, setTarget() points every
+    // branch to that destination at it.  Labels inserted before the switch
+    // (ie. back edges) can be set straight away.
+    class SwitchTargets
+    {
+        struct Patch
+        {
+            LIns*       ins;        // a branch or LIR_jtbl
+            uint32_t    slot;       // the jump table slot, for LIR_jtbl
+            Patch*      next;
+        };
+
+        Allocator&  alloc;
+        uint32_t    ndests;
+        Patch**     patches;        // one list per destination, plus the default
+        bool        jumpTable;
+
+    public:
+        SwitchTargets(Allocator& alloc, uint32_t ndests);
+
+        void add(uint32_t dest, LIns* ins, uint32_t slot = 0);
+
+        void setTarget(uint32_t dest, LIns* label);
+        void setDefault(LIns* label) { setTarget(ndests, label); }
+
+        // As with any LIR_jtbl, if the switch used a jump table then every
+        // destination label must be followed by a LIR_regfence.
+        bool hasJumpTable() const { return jumpTable; }
+    };
+
     class LirWriter
     {
     public:
@@ -1771,6 +1953,13 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         virtual LIns* insParam(int32_t arg, int32_t kind) {
             return out->insParam(arg, kind);
         }
+#ifdef NANOJIT_X64
+        // op: LIR_paramd, LIR_paramf or LIR_paramf4
+        // arg: 0=first floating-point arg, 1=second, ...
+        virtual LIns* insFpParam(LOpcode op, int32_t arg) {
+            return out->insFpParam(op, arg);
+        }
+#endif
         virtual LIns* insImmI(int32_t imm) {
             return out->insImmI(imm);
         }
@@ -1817,6 +2006,12 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         virtual LIns* insSwz(LIns* a, uint8_t mask) {
             return out->insSwz(a, mask);
         }
+        virtual LIns* insPrefetch(LIns* addr, PrefetchHint hint) {
+            return out->insPrefetch(addr, hint);
+        }
+        virtual LIns* insMem(LOpcode op, LIns* a, LIns* b, LIns* len, AccSet accSet) {
+            return out->insMem(op, a, b, len, accSet);
+        }
 
         // convenience functions
 
@@ -1824,6 +2019,13 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         // the condition is true and false respectively.
         LIns* insChoose(LIns* cond, LIns* iftrue, LIns* iffalse, bool use_cmov);
 
+        // Dispatches on the int 'value':  control goes to the destination of
+        // the case whose value matches, or else to the default.  The case
+        // values must be distinct.  Ends with an unconditional jump or a
+        // LIR_jtbl, so the next instruction should be a label.
+        SwitchTargets* insSwitch(LIns* value, const SwitchCase* cases, uint32_t ncases,
+                                 uint32_t ndests, Allocator& alloc);
+
         // Inserts an integer comparison to 0
         LIns* insEqI_0(LIns* oprnd1) {
             return ins2ImmI(LIR_eqi, oprnd1, 0);
@@ -2126,6 +2328,11 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* insParam(int32_t i, int32_t kind) {
             return add(out->insParam(i, kind));
         }
+#ifdef NANOJIT_X64
+        LIns* insFpParam(LOpcode op, int32_t i) {
+            return add(out->insFpParam(op, i));
+        }
+#endif
         LIns* insLoad(LOpcode v, LIns* base, int32_t disp, AccSet accSet, LoadQual loadQual) {
             return add(out->insLoad(v, base, disp, accSet, loadQual));
         }
@@ -2161,6 +2368,12 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* insSwz(LIns* a, uint8_t mask) {
             return add(out->insSwz(a, mask));
         }
+        LIns* insPrefetch(LIns* addr, PrefetchHint hint) {
+            return add_flush(out->insPrefetch(addr, hint));
+        }
+        LIns* insMem(LOpcode op, LIns* a, LIns* b, LIns* len, AccSet accSet) {
+            return add_flush(out->insMem(op, a, b, len, accSet));
+        }
     };
 #endif /* NJ_VERBOSE */
 
@@ -2179,6 +2392,9 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* insLoad(LOpcode op, LIns* base, int32_t off, AccSet accSet, LoadQual loadQual);
     private:
         LIns* simplifyOverflowArith(LOpcode op, LIns** opnd1, LIns** opnd2);
+#ifdef NANOJIT_64BIT
+        LIns* simplifyOverflowArithQ(LOpcode op, LIns** opnd1, LIns** opnd2);
+#endif
     };
 
     class CseFilter: public LirWriter
@@ -2369,6 +2585,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* insGuard(LOpcode op, LIns* cond, GuardRecord *gr);
         LIns* insGuardXov(LOpcode op, LIns* a, LIns* b, GuardRecord *gr);
         LIns* insSwz(LIns* a, uint8_t mask);
+        LIns* insMem(LOpcode op, LIns* a, LIns* b, LIns* len, AccSet accSet);
 
         // These functions provide control over CSE in the face of control
         // flow.  A suspend()/resume() pair may be put around a synthetic
@@ -2402,6 +2619,14 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             LIns *state, *param1, *sp, *rp;
             LIns* savedRegs[NumSavedRegs+1]; // Allocate an extra element in case NumSavedRegs == 0
 
+            // Set when a non-temporal store is written, so the backend knows
+            // to fence them at the fragment's exits.
+            bool hasNonTemporalStores;
+
+            // Set when a LIR_allocp is written.  Arguments may then point into
+            // the fragment's frame, so its calls can't be made tail calls.
+            bool hasAllocs;
+
             /** Each chunk is just a raw area of LIns instances, with no header
                 and no more than 8-byte alignment.  The chunk size is somewhat arbitrary. */
             static const size_t CHUNK_SZB = 8000;
@@ -2437,6 +2662,9 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             LIns*   ins3(LOpcode op, LIns* o1, LIns* o2, LIns* o3);
             LIns*   ins4(LOpcode op, LIns* o1, LIns* o2, LIns* o3, LIns* o4);
             LIns*   insParam(int32_t i, int32_t kind);
+#ifdef NANOJIT_X64
+            LIns*   insFpParam(LOpcode op, int32_t i);
+#endif
             LIns*   insImmI(int32_t imm);
             LIns*   insSafe(LOpcode op, void *payload);
 #ifdef NANOJIT_64BIT
@@ -2455,6 +2683,8 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             LIns*   insComment(const char* str);
             LIns*   insSkip(LIns* skipTo);
             LIns*   insSwz(LIns* a, uint8_t mask);
+            LIns*   insPrefetch(LIns* addr, PrefetchHint hint);
+            LIns*   insMem(LOpcode op, LIns* a, LIns* b, LIns* len, AccSet accSet);
     };
 
     class LirFilter
@@ -2560,7 +2790,10 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
     };
 
     // This type is used to perform a simple interval analysis of 32-bit
-    // add/sub/mul.  It lets us avoid overflow checks in some cases.
+    // add/sub/mul.  It lets us avoid overflow checks in some cases.  It is
+    // also used for 64-bit add/sub/mul via ofQ():  a quad whose value is
+    // known to lie within I32_MIN..I32_MAX can be added to, subtracted from
+    // or multiplied by another such quad without any 64-bit overflow.
     struct Interval
     {
         // The bounds are 64-bit integers so that any overflow from a 32-bit
@@ -2614,6 +2847,11 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         }
 
         static Interval of(LIns* ins, int32_t lim);
+#ifdef NANOJIT_64BIT
+        // Like of(), but for quad-typed instructions.  Any quad that isn't
+        // known to fit in I32_MIN..I32_MAX gets the overflow interval.
+        static Interval ofQ(LIns* ins, int32_t lim);
+#endif
 
         static Interval add(Interval x, Interval y);
         static Interval sub(Interval x, Interval y);
@@ -2704,6 +2942,9 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* ins3(LOpcode v, LIns* a, LIns* b, LIns* c);
         LIns* ins4(LOpcode v, LIns* a, LIns* b, LIns* c, LIns* d);
         LIns* insParam(int32_t arg, int32_t kind);
+#ifdef NANOJIT_X64
+        LIns* insFpParam(LOpcode op, int32_t arg);
+#endif
         LIns* insImmI(int32_t imm);
         LIns* insSafe(LOpcode op, void *payload);
 #ifdef NANOJIT_64BIT
@@ -2720,6 +2961,8 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* insAlloc(int32_t size);
         LIns* insJtbl(LIns* index, uint32_t size);
         LIns* insSwz(LIns* a, uint8_t mask);
+        LIns* insPrefetch(LIns* addr, PrefetchHint hint);
+        LIns* insMem(LOpcode op, LIns* a, LIns* b, LIns* len, AccSet accSet);
     };
 
     // This just checks things that aren't possible to check in
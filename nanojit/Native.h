@@ -53,10 +53,60 @@
 #  define NJ_JTBL_SUPPORTED 0
 #endif
 
+// Jump tables hold 32-bit offsets and are emitted into the code chunk by
+// the backend, instead of holding absolute addresses in data memory.
+#ifndef NJ_USES_REL_JTBL
+#  define NJ_USES_REL_JTBL 0
+#endif
+
+#ifndef NJ_LAZY_EXITS_SUPPORTED
+#  define NJ_LAZY_EXITS_SUPPORTED 0
+#endif
+
+#ifndef NJ_SHARED_EXITS_SUPPORTED
+#  define NJ_SHARED_EXITS_SUPPORTED 0
+#endif
+
+#ifndef NJ_PROF_COUNTERS_SUPPORTED
+#  define NJ_PROF_COUNTERS_SUPPORTED 0
+#endif
+
+#ifndef NJ_EDGE_COUNTERS_SUPPORTED
+#  define NJ_EDGE_COUNTERS_SUPPORTED 0
+#endif
+
 #ifndef NJ_EXPANDED_LOADSTORE_SUPPORTED
 #  define NJ_EXPANDED_LOADSTORE_SUPPORTED 0
 #endif
 
+#ifndef NJ_RELAX_BRANCHES_SUPPORTED
+#  define NJ_RELAX_BRANCHES_SUPPORTED 0
+#endif
+
+#ifndef NJ_CODE_ALIGNMENT_SUPPORTED
+#  define NJ_CODE_ALIGNMENT_SUPPORTED 0
+#endif
+
+#ifndef NJ_CACHE_CONTROL_SUPPORTED
+#  define NJ_CACHE_CONTROL_SUPPORTED 0
+#endif
+
+#ifndef NJ_BULK_MEMORY_SUPPORTED
+#  define NJ_BULK_MEMORY_SUPPORTED 0
+#endif
+
+#ifndef NJ_ROUNDING_SUPPORTED
+#  define NJ_ROUNDING_SUPPORTED 0
+#endif
+
+#ifndef NJ_CALL_CLOBBERS_SUPPORTED
+#  define NJ_CALL_CLOBBERS_SUPPORTED 0
+#endif
+
+#ifndef NJ_PINNED_CONTEXT_SUPPORTED
+#  define NJ_PINNED_CONTEXT_SUPPORTED 0
+#endif
+
 #ifndef NJ_F2I_SUPPORTED
 #  define NJ_F2I_SUPPORTED 0
 #endif
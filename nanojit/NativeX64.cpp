@@ -35,14 +35,36 @@ namespace nanojit
 {
 #ifdef _WIN64
     const Register RegAlloc::argRegs[] = { RCX, RDX, R8, R9 };
-    const static int maxArgRegs = 4;
     const Register RegAlloc::savedRegs[] = { RBX, RSI, RDI, R12, R13, R14, R15 };
 #else
     const Register RegAlloc::argRegs[] = { RDI, RSI, RDX, RCX, R8, R9 };
-    const static int maxArgRegs = 6;
     const Register RegAlloc::savedRegs[] = { RBX, R12, R13, R14, R15 };
 #endif
 
+    // ABI_INTERNAL passes integer arguments in the C argument registers and
+    // then in R10 and R11, which are scratch registers too.  Floating-point
+    // arguments are counted apart and go in the scratch XMM registers, in
+    // order.
+#ifdef _WIN64
+    static const Register internalArgRegs[] = { RCX, RDX, R8, R9, R10, R11 };
+#else
+    static const Register internalArgRegs[] = { RDI, RSI, RDX, RCX, R8, R9, R10, R11 };
+#endif
+
+    // Returns the register the 'a'th integer argument of a fragment with
+    // the ABI 'abi' comes in, or UnspecifiedReg if it comes on the stack.
+    static Register intArgReg(AbiKind abi, uint32_t a) {
+        if (abi == ABI_INTERNAL)
+            return a < uint32_t(NumInternalArgRegs) ? internalArgRegs[a] : UnspecifiedReg;
+        return a < uint32_t(NumArgRegs) ? RegAlloc::argRegs[a] : UnspecifiedReg;
+    }
+
+    // Likewise for the 'a'th floating-point argument of an ABI_INTERNAL
+    // fragment.
+    static Register fpArgReg(uint32_t a) {
+        return a < uint32_t(NumInternalFpArgRegs) ? XMM0 + a : UnspecifiedReg;
+    }
+
     const char *regNames[] = {
         "rax",  "rcx",  "rdx",   "rbx",   "rsp",   "rbp",   "rsi",   "rdi",
         "r8",   "r9",   "r10",   "r11",   "r12",   "r13",   "r14",   "r15",
@@ -134,6 +156,15 @@ namespace nanojit
             ((op & ~(255LL<<shift)) | (op>>(shift-8)&255) << shift) - 1;
     }
 
+    // encode 3-register rex prefix that follows a manditory prefix (66,F2,F3)
+    // [prefix][rex][opcode]
+    static inline uint64_t rexprxb(uint64_t op, Register r, Register x, Register b) {
+        int shift = 64 - 8*oplen(op) + 8;
+        uint64_t rex = ((op >> shift) & 255) | ((REGNUM(r)&8)>>1) | ((REGNUM(x)&8)>>2) | ((REGNUM(b)&8)>>3);
+        return rex != 0x40 ? op | rex << shift :
+            ((op & ~(255LL<<shift)) | (op>>(shift-8)&255) << shift) - 1;
+    }
+
     // [rex][opcode][mod-rr]
     static inline uint64_t mod_rr(uint64_t op, Register r, Register b) {
         return op | uint64_t((REGNUM(r)&7)<<3 | (REGNUM(b)&7))<<56;
@@ -181,7 +212,7 @@ namespace nanojit
     void Assembler::emit_target8(size_t underrun, uint64_t op, NIns* target) {
         underrunProtect(underrun); // must do this before calculating offset
         // Nb: see emit_target32() for why we use _nIns here.
-        int64_t offset = target - _nIns;
+        int64_t offset = target ? target - _nIns : 0;
         NanoAssert(isS8(offset));
         emit(op | uint64_t(offset)<<56);
     }
@@ -340,6 +371,50 @@ namespace nanojit
         emitrxb(op, r, x, b);
     }
 
+    // disp32 modrm+sib form [b+x*(1<<s)+d32].  op is [rex][opcode][modrm][sib]
+    // with mod=2 and rm=100, and the disp is written separately.
+    void Assembler::emitrxbm(uint64_t op, Register r, int32_t d, Register b, Register x, int s) {
+        NanoAssert(IsGpReg(b) && IsGpReg(x));
+        NanoAssert(REGNUM(x) != REGNUM(RSP)); // an index of 100 means "no index"
+        NanoAssert(0 <= s && s <= 3);
+        op = emit_disp32_sib(op, d);
+        emit(rexrxb(mod_rxb(op | uint64_t(s)<<62, r, x, b), r, x, b));
+    }
+
+    // same as emitrxbm, but with a prefix byte
+    void Assembler::emitprxbm(uint64_t op, Register r, int32_t d, Register b, Register x, int s) {
+        NanoAssert(IsGpReg(b) && IsGpReg(x));
+        NanoAssert(REGNUM(x) != REGNUM(RSP)); // an index of 100 means "no index"
+        NanoAssert(0 <= s && s <= 3);
+        op = emit_disp32_sib(op, d);
+        emit(rexprxb(mod_rxb(op | uint64_t(s)<<62, r, x, b), r, x, b));
+    }
+
+    // disp32 modrm+sib form with 32-bit immediate value
+    void Assembler::emitrxbm_imm32(uint64_t op, int32_t d, Register b, Register x, int s, int32_t imm) {
+        underrunProtect(4+4+8); // room for imm plus disp plus fullsize op
+        *((int32_t*)(_nIns -= 4)) = imm;
+        _nvprof("x86-bytes", 4);
+        emitrxbm(op, RZero, d, b, x, s);
+    }
+
+    // disp32 modrm+sib form with 16-bit immediate value
+    // p = prefix -- opcode must have a 66, F2, or F3 prefix
+    void Assembler::emitprxbm_imm16(uint64_t op, int32_t d, Register b, Register x, int s, int32_t imm) {
+        underrunProtect(2+4+8); // room for imm plus disp plus fullsize op
+        *((int16_t*)(_nIns -= 2)) = (int16_t) imm;
+        _nvprof("x86-bytes", 2);
+        emitprxbm(op, RZero, d, b, x, s);
+    }
+
+    // disp32 modrm+sib form with 8-bit immediate value
+    void Assembler::emitrxbm_imm8(uint64_t op, int32_t d, Register b, Register x, int s, int32_t imm) {
+        underrunProtect(1+4+8); // room for imm plus disp plus fullsize op
+        *((int8_t*)(_nIns -= 1)) = (int8_t) imm;
+        _nvprof("x86-bytes", 1);
+        emitrxbm(op, RZero, d, b, x, s);
+    }
+
     // op = [rex][opcode][modrm][imm8]
     void Assembler::emitr_imm8(uint64_t op, Register b, int32_t imm8) {
         NanoAssert(IsGpReg(b) && isS8(imm8));
@@ -367,6 +442,17 @@ namespace nanojit
         emitrr(op, r, RZero);
     }
 
+    // RIP-relative form of an emitprm() op, for ops with a 66, F2 or F3 prefix.
+    void Assembler::emitpxm_rel(uint64_t op, Register r, NIns* addr64)
+    {
+        underrunProtect(4+8);
+        int32_t d = (int32_t)(addr64 - _nIns);
+        *((int32_t*)(_nIns -= 4)) = d;
+        _nvprof("x64-bytes", 4);
+        op = (op & ~(0xC7LL<<56)) | 0x05LL<<56;    // mod=00 rm=101: [rip+disp32]
+        emitprr(op, r, RZero);
+    }
+
     // Succeeds if 'target' is within a signed 8-bit offset from the current
     // instruction's address.
     bool Assembler::isTargetWithinS8(NIns* target)
@@ -378,6 +464,14 @@ namespace nanojit
         return isS8(target - _nIns);
     }
 
+    // Succeeds if a branch to 'target' should use an 8-bit offset.  A NULL
+    // 'target' is a back edge that will be patched later;  compile() sets
+    // _shortBranch if it found that the branch reaches its label.
+    bool Assembler::isShortBranch(NIns* target)
+    {
+        return target ? isTargetWithinS8(target) : _shortBranch;
+    }
+
     // Like isTargetWithinS8(), but for signed 32-bit offsets.
     bool Assembler::isTargetWithinS32(NIns* target,int32_t maxInstSize)
     {
@@ -404,6 +498,13 @@ namespace nanojit
     void Assembler::NOT(  R r)  { emitr(X64_not,  r); asm_output("notl %s", RL(r)); }
     void Assembler::NEG(  R r)  { emitr(X64_neg,  r); asm_output("negl %s", RL(r)); }
     void Assembler::IDIV( R r)  { emitr(X64_idiv, r); asm_output("idivl edx:eax, %s",RL(r)); }
+    void Assembler::IDIVQ(R r)  { emitr(X64_idivq,r); asm_output("idivq rdx:rax, %s",RQ(r)); }
+    void Assembler::CQO()       { emit(X64_cqo);      asm_output("cqo"); }
+    void Assembler::MFENCE()    { emit(X64_mfence);   asm_output("mfence"); }
+    void Assembler::SFENCE()    { emit(X64_sfence);   asm_output("sfence"); }
+    void Assembler::REP_MOVSB() { emit(X64_repmovsb); asm_output("rep movsb"); }
+    void Assembler::REP_STOSB() { emit(X64_repstosb); asm_output("rep stosb"); }
+    void Assembler::REPE_CMPSB(){ emit(X64_repecmpsb);asm_output("repe cmpsb"); }
 
     void Assembler::SHR( R r)   { emitr(X64_shr,  r); asm_output("shrl %s, ecx", RL(r)); }
     void Assembler::SAR( R r)   { emitr(X64_sar,  r); asm_output("sarl %s, ecx", RL(r)); }
@@ -436,6 +537,7 @@ namespace nanojit
     void Assembler::ORLRR(R l, R r)     { emitrr(X64_orlrr,l,r); asm_output("orl %s, %s",  RL(l),RL(r)); }
     void Assembler::XORRR(R l, R r)     { emitrr(X64_xorrr,l,r); asm_output("xorl %s, %s", RL(l),RL(r)); }
     void Assembler::IMUL( R l, R r)     { emitrr(X64_imul, l,r); asm_output("imull %s, %s",RL(l),RL(r)); }
+    void Assembler::IMULQ(R l, R r)     { emitrr(X64_imulq,l,r); asm_output("imulq %s, %s",RQ(l),RQ(r)); }
     void Assembler::CMPLR(R l, R r)     { emitrr(X64_cmplr,l,r); asm_output("cmpl %s, %s", RL(l),RL(r)); }
     void Assembler::MOVLR(R l, R r)     { emitrr(X64_movlr,l,r); asm_output("movl %s, %s", RL(l),RL(r)); }
 
@@ -510,6 +612,15 @@ namespace nanojit
     void Assembler::MOVLHPS( R l, R r)  { emitrr(X64_movlhps, l,r);  asm_output("movlhps %s, %s", RQ(l),RQ(r)); }
     void Assembler::PMOVMSKB(R l, R r)  { emitprr(X64_pmovmskb,l,r); asm_output("pmovmskb %s, %s",RQ(l),RQ(r)); }
     void Assembler::CMPNEQPS(R l, R r)  { emitrr_imm8(X64_cmppsr,l,r,4); asm_output("cmpneqps %s, %s", RL(l),RL(r)); }
+    void Assembler::CMPLTPS( R l, R r)  { emitrr_imm8(X64_cmppsr,l,r,1); asm_output("cmpltps %s, %s", RQ(l),RQ(r)); }
+    void Assembler::CMPLTSD( R l, R r)  { emitprr_imm8(X64_cmpsdr,l,r,1); asm_output("cmpltsd %s, %s", RQ(l),RQ(r)); }
+    void Assembler::CMPLTSS( R l, R r)  { emitprr_imm8(X64_cmpssr,l,r,1); asm_output("cmpltss %s, %s", RQ(l),RQ(r)); }
+    void Assembler::ANDPS(   R l, R r)  { emitrr(X64_andps,   l,r); asm_output("andps %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::ANDNPS(  R l, R r)  { emitrr(X64_andnps,  l,r); asm_output("andnps %s, %s",  RQ(l),RQ(r)); }
+    void Assembler::ORPS(    R l, R r)  { emitrr(X64_orps,    l,r); asm_output("orps %s, %s",    RQ(l),RQ(r)); }
+    void Assembler::ROUNDSD(R l, R r, I m) { emitprr_imm8(X64_roundsd,l,r,uint8_t(m)); asm_output("roundsd %s, %s, %d", RQ(l),RQ(r),m); }
+    void Assembler::ROUNDSS(R l, R r, I m) { emitprr_imm8(X64_roundss,l,r,uint8_t(m)); asm_output("roundss %s, %s, %d", RQ(l),RQ(r),m); }
+    void Assembler::ROUNDPS(R l, R r, I m) { emitprr_imm8(X64_roundps,l,r,uint8_t(m)); asm_output("roundps %s, %s, %d", RQ(l),RQ(r),m); }
 
     inline uint8_t PSHUFD_MASK(int x, int y, int z, int w) { 
         NanoAssert(x>=0 && x<=3);
@@ -564,6 +675,7 @@ namespace nanojit
     void Assembler::CMPQR8(R r, I32 i8)     { emitr_imm8(X64_cmpqr8,r,i8); asm_output("cmpq %s, %d",RQ(r),i8); }
 
     void Assembler::IMULI(R l, R r, I32 i32)    { emitrr_imm(X64_imuli,l,r,i32); asm_output("imuli %s, %s, %d",RL(l),RL(r),i32); }
+    void Assembler::IMULQI(R l, R r, I32 i32)   { emitrr_imm(X64_imulqi,l,r,i32); asm_output("imulqi %s, %s, %d",RQ(l),RQ(r),i32); }
 
     void Assembler::MOVQI(R r, U64 u64)         { emitr_imm64(X64_movqi,r,u64); asm_output("movq %s, %p",RQ(r),(void*)u64); }
 
@@ -590,9 +702,97 @@ namespace nanojit
     void Assembler::MOVSSMR(R r, I d, R b)      { emitprm(X64_movssmr,r,d,b); asm_output("movss %d(%s), %s",d,RQ(b),RQ(r)); }
     void Assembler::MOVUPSRM(R r, I d, R b)     { emitrm_wide(X64_movupsrm,r,d,b); asm_output("movups %s, %d(%s)",RQ(r),d,RQ(b)); }
     void Assembler::MOVUPSMR(R r, I d, R b)     { emitrm_wide(X64_movupsmr,r,d,b); asm_output("movups %d(%s), %s",d,RQ(b),RQ(r)); }
-    void Assembler::MOVUPSRMRIP(R r, I d)       { emitrm_wide(X64_movupsrip,r,d,RZero); asm_output("movups %s, %d(rip)",RQ(r),d); }
+    void Assembler::MOVUPSRMRIP(R r, NIns* a64) { emitxm_rel(X64_movupsrip,r,a64); asm_output("movups %s, (%p)",RQ(r),a64); }
     void Assembler::MOVAPSRM(R r, I d, R b)     { emitrm_wide(X64_movapsrm,r,d,b); asm_output("movaps %s, %d(%s)",RQ(r),d,RQ(b)); }
-    void Assembler::MOVAPSRMRIP(R r, I d)       { emitrm_wide(X64_movapsrip,r,d,RZero); asm_output("movaps %s, %d(rip)",RQ(r),d); }
+    void Assembler::MOVAPSRMRIP(R r, NIns* a64) { emitxm_rel(X64_movapsrip,r,a64); asm_output("movaps %s, (%p)",RQ(r),a64); }
+    void Assembler::MOVSDM(R r, NIns* a64)      { emitpxm_rel(X64_movsdrm,r,a64); asm_output("movsd %s, (%p)",RQ(r),a64); }
+    void Assembler::MOVSSM(R r, NIns* a64)      { emitpxm_rel(X64_movssrm,r,a64); asm_output("movss %s, (%p)",RQ(r),a64); }
+
+    void Assembler::ADDLRM( R r, I d, R b)      { emitrm(X64_addlrm, r,d,b); asm_output("addl %s, %d(%s)",RL(r),d,RQ(b)); }
+    void Assembler::SUBLRM( R r, I d, R b)      { emitrm(X64_sublrm, r,d,b); asm_output("subl %s, %d(%s)",RL(r),d,RQ(b)); }
+    void Assembler::ANDLRM( R r, I d, R b)      { emitrm(X64_andlrm, r,d,b); asm_output("andl %s, %d(%s)",RL(r),d,RQ(b)); }
+    void Assembler::ORLRM(  R r, I d, R b)      { emitrm(X64_orlrm,  r,d,b); asm_output("orl %s, %d(%s)", RL(r),d,RQ(b)); }
+    void Assembler::XORLRM( R r, I d, R b)      { emitrm(X64_xorlrm, r,d,b); asm_output("xorl %s, %d(%s)",RL(r),d,RQ(b)); }
+    void Assembler::IMULLRM(R r, I d, R b)      { emitrm_wide(X64_imullrm,r,d,b); asm_output("imull %s, %d(%s)",RL(r),d,RQ(b)); }
+    void Assembler::CMPLRM( R r, I d, R b)      { emitrm(X64_cmplrm, r,d,b); asm_output("cmpl %s, %d(%s)",RL(r),d,RQ(b)); }
+    void Assembler::CMPLMR( R r, I d, R b)      { emitrm(X64_cmplmr, r,d,b); asm_output("cmpl %d(%s), %s",d,RQ(b),RL(r)); }
+    void Assembler::CMPLMI( R b, I d, I32 imm)  { emitrm_imm32(X64_cmplmi, b,d,imm); asm_output("cmpl %d(%s), %d",d,RQ(b),imm); }
+    void Assembler::CMPLMI8(R b, I d, I32 imm)  { emitrm_imm8(X64_cmplmi8, b,d,imm); asm_output("cmpl %d(%s), %d",d,RQ(b),imm); }
+
+    void Assembler::ADDQRM( R r, I d, R b)      { emitrm(X64_addqrm, r,d,b); asm_output("addq %s, %d(%s)",RQ(r),d,RQ(b)); }
+    void Assembler::SUBQRM( R r, I d, R b)      { emitrm(X64_subqrm, r,d,b); asm_output("subq %s, %d(%s)",RQ(r),d,RQ(b)); }
+    void Assembler::ANDQRM( R r, I d, R b)      { emitrm(X64_andqrm, r,d,b); asm_output("andq %s, %d(%s)",RQ(r),d,RQ(b)); }
+    void Assembler::ORQRM(  R r, I d, R b)      { emitrm(X64_orqrm,  r,d,b); asm_output("orq %s, %d(%s)", RQ(r),d,RQ(b)); }
+    void Assembler::XORQRM( R r, I d, R b)      { emitrm(X64_xorqrm, r,d,b); asm_output("xorq %s, %d(%s)",RQ(r),d,RQ(b)); }
+    void Assembler::IMULQRM(R r, I d, R b)      { emitrm_wide(X64_imulqrm,r,d,b); asm_output("imulq %s, %d(%s)",RQ(r),d,RQ(b)); }
+    void Assembler::CMPQRM( R r, I d, R b)      { emitrm(X64_cmpqrm, r,d,b); asm_output("cmpq %s, %d(%s)",RQ(r),d,RQ(b)); }
+    void Assembler::CMPQMR( R r, I d, R b)      { emitrm(X64_cmpqmr, r,d,b); asm_output("cmpq %d(%s), %s",d,RQ(b),RQ(r)); }
+    void Assembler::CMPQMI( R b, I d, I32 imm)  { emitrm_imm32(X64_cmpqmi, b,d,imm); asm_output("cmpq %d(%s), %d",d,RQ(b),imm); }
+    void Assembler::CMPQMI8(R b, I d, I32 imm)  { emitrm_imm8(X64_cmpqmi8, b,d,imm); asm_output("cmpq %d(%s), %d",d,RQ(b),imm); }
+
+    void Assembler::ADDSDRM(  R r, I d, R b)    { emitprm(X64_addsdrm,  r,d,b); asm_output("addsd %s, %d(%s)",  RQ(r),d,RQ(b)); }
+    void Assembler::SUBSDRM(  R r, I d, R b)    { emitprm(X64_subsdrm,  r,d,b); asm_output("subsd %s, %d(%s)",  RQ(r),d,RQ(b)); }
+    void Assembler::MULSDRM(  R r, I d, R b)    { emitprm(X64_mulsdrm,  r,d,b); asm_output("mulsd %s, %d(%s)",  RQ(r),d,RQ(b)); }
+    void Assembler::DIVSDRM(  R r, I d, R b)    { emitprm(X64_divsdrm,  r,d,b); asm_output("divsd %s, %d(%s)",  RQ(r),d,RQ(b)); }
+    void Assembler::ADDSSRM(  R r, I d, R b)    { emitprm(X64_addssrm,  r,d,b); asm_output("addss %s, %d(%s)",  RQ(r),d,RQ(b)); }
+    void Assembler::SUBSSRM(  R r, I d, R b)    { emitprm(X64_subssrm,  r,d,b); asm_output("subss %s, %d(%s)",  RQ(r),d,RQ(b)); }
+    void Assembler::MULSSRM(  R r, I d, R b)    { emitprm(X64_mulssrm,  r,d,b); asm_output("mulss %s, %d(%s)",  RQ(r),d,RQ(b)); }
+    void Assembler::DIVSSRM(  R r, I d, R b)    { emitprm(X64_divssrm,  r,d,b); asm_output("divss %s, %d(%s)",  RQ(r),d,RQ(b)); }
+    void Assembler::UCOMISDRM(R r, I d, R b)    { emitprm(X64_ucomisdrm,r,d,b); asm_output("ucomisd %s, %d(%s)",RQ(r),d,RQ(b)); }
+    void Assembler::UCOMISSRM(R r, I d, R b)    { emitrm_wide(X64_ucomissrm,r,d,b); asm_output("ucomiss %s, %d(%s)",RQ(r),d,RQ(b)); }
+
+    void Assembler::ADDSDM(R r, NIns* a64)      { emitpxm_rel(X64_addsdrm,r,a64); asm_output("addsd %s, (%p)",RQ(r),a64); }
+    void Assembler::SUBSDM(R r, NIns* a64)      { emitpxm_rel(X64_subsdrm,r,a64); asm_output("subsd %s, (%p)",RQ(r),a64); }
+    void Assembler::MULSDM(R r, NIns* a64)      { emitpxm_rel(X64_mulsdrm,r,a64); asm_output("mulsd %s, (%p)",RQ(r),a64); }
+    void Assembler::DIVSDM(R r, NIns* a64)      { emitpxm_rel(X64_divsdrm,r,a64); asm_output("divsd %s, (%p)",RQ(r),a64); }
+    void Assembler::ADDSSM(R r, NIns* a64)      { emitpxm_rel(X64_addssrm,r,a64); asm_output("addss %s, (%p)",RQ(r),a64); }
+    void Assembler::SUBSSM(R r, NIns* a64)      { emitpxm_rel(X64_subssrm,r,a64); asm_output("subss %s, (%p)",RQ(r),a64); }
+    void Assembler::MULSSM(R r, NIns* a64)      { emitpxm_rel(X64_mulssrm,r,a64); asm_output("mulss %s, (%p)",RQ(r),a64); }
+    void Assembler::DIVSSM(R r, NIns* a64)      { emitpxm_rel(X64_divssrm,r,a64); asm_output("divss %s, (%p)",RQ(r),a64); }
+
+    // The underrunProtect() keeps the lock prefix on the same page as the
+    // instruction it applies to:  room for the disp, the op and the prefix.
+    void Assembler::LOCK_CMPXCHGLMR(R r, I d, R b) { underrunProtect(4+4+8); emitrm_wide(X64_cmpxchglmr,r,d,b); emit(X64_lock); asm_output("lock cmpxchgl %d(%s), %s",d,RQ(b),RL(r)); }
+    void Assembler::LOCK_CMPXCHGQMR(R r, I d, R b) { underrunProtect(4+4+8); emitrm_wide(X64_cmpxchgqmr,r,d,b); emit(X64_lock); asm_output("lock cmpxchgq %d(%s), %s",d,RQ(b),RQ(r)); }
+    void Assembler::LOCK_XADDLMR(R r, I d, R b)    { underrunProtect(4+4+8); emitrm_wide(X64_xaddlmr,r,d,b); emit(X64_lock); asm_output("lock xaddl %d(%s), %s",d,RQ(b),RL(r)); }
+    void Assembler::LOCK_XADDQMR(R r, I d, R b)    { underrunProtect(4+4+8); emitrm_wide(X64_xaddqmr,r,d,b); emit(X64_lock); asm_output("lock xaddq %d(%s), %s",d,RQ(b),RQ(r)); }
+    void Assembler::XCHGLMR(R r, I d, R b)         { emitrm(X64_xchglmr,r,d,b); asm_output("xchgl %d(%s), %s",d,RQ(b),RL(r)); }
+    void Assembler::XCHGQMR(R r, I d, R b)         { emitrm(X64_xchgqmr,r,d,b); asm_output("xchgq %d(%s), %s",d,RQ(b),RQ(r)); }
+
+#ifdef NJ_VERBOSE
+    static const char* prefetchNames[] = { "nta", "t0", "t1", "t2" };
+#endif
+
+    void Assembler::PREFETCHM(PrefetchHint h, I d, R b)            { emitrm_wide(X64_prefetchm | U64(h) << 59, RZero, d, b); asm_output("prefetch%s %d(%s)",prefetchNames[h],d,RQ(b)); }
+    void Assembler::PREFETCHMX(PrefetchHint h, I d, R b, R x, I s) { emitrxbm(X64_prefetchmx | U64(h) << 51, RZero, d, b, x, s); asm_output("prefetch%s %d(%s,%s,%d)",prefetchNames[h],d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVNTILMR(R r, I d, R b)            { emitrm_wide(X64_movntilmr,r,d,b); asm_output("movntil %d(%s), %s",d,RQ(b),RL(r)); }
+    void Assembler::MOVNTIQMR(R r, I d, R b)            { emitrm_wide(X64_movntiqmr,r,d,b); asm_output("movntiq %d(%s), %s",d,RQ(b),RQ(r)); }
+    void Assembler::MOVNTILMRX(R r, I d, R b, R x, I s) { emitrxbm(X64_movntilmrx,r,d,b,x,s); asm_output("movntil %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RL(r)); }
+    void Assembler::MOVNTIQMRX(R r, I d, R b, R x, I s) { emitrxbm(X64_movntiqmrx,r,d,b,x,s); asm_output("movntiq %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RQ(r)); }
+    void Assembler::MOVNTPSMR(R r, I d, R b)            { emitrm_wide(X64_movntpsmr,r,d,b); asm_output("movntps %d(%s), %s",d,RQ(b),RQ(r)); }
+    void Assembler::MOVNTPSMRX(R r, I d, R b, R x, I s) { emitrxbm(X64_movntpsmrx,r,d,b,x,s); asm_output("movntps %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RQ(r)); }
+
+    void Assembler::MOVLRMX(R r, I d, R b, R x, I s)   { emitrxbm(X64_movlrmx,r,d,b,x,s); asm_output("movl %s, %d(%s,%s,%d)",RL(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVQRMX(R r, I d, R b, R x, I s)   { emitrxbm(X64_movqrmx,r,d,b,x,s); asm_output("movq %s, %d(%s,%s,%d)",RQ(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVBMRX(R r, I d, R b, R x, I s)   { emitrxbm(X64_movbmrx,r,d,b,x,s); asm_output("movb %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RB(r)); }
+    void Assembler::MOVSMRX(R r, I d, R b, R x, I s)   { emitprxbm(X64_movsmrx,r,d,b,x,s); asm_output("movs %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RS(r)); }
+    void Assembler::MOVLMRX(R r, I d, R b, R x, I s)   { emitrxbm(X64_movlmrx,r,d,b,x,s); asm_output("movl %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RL(r)); }
+    void Assembler::MOVQMRX(R r, I d, R b, R x, I s)   { emitrxbm(X64_movqmrx,r,d,b,x,s); asm_output("movq %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RQ(r)); }
+
+    void Assembler::MOVZX8MX( R r, I d, R b, R x, I s) { emitrxbm(X64_movzx8mx, r,d,b,x,s); asm_output("movzxb %s, %d(%s,%s,%d)",RQ(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVZX16MX(R r, I d, R b, R x, I s) { emitrxbm(X64_movzx16mx,r,d,b,x,s); asm_output("movzxs %s, %d(%s,%s,%d)",RQ(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVSX8MX( R r, I d, R b, R x, I s) { emitrxbm(X64_movsx8mx, r,d,b,x,s); asm_output("movsxb %s, %d(%s,%s,%d)",RQ(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVSX16MX(R r, I d, R b, R x, I s) { emitrxbm(X64_movsx16mx,r,d,b,x,s); asm_output("movsxs %s, %d(%s,%s,%d)",RQ(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVSXDRMX(R r, I d, R b, R x, I s) { emitrxbm(X64_movsxdrmx,r,d,b,x,s); asm_output("movsxd %s, %d(%s,%s,%d)",RQ(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::INCQMX(I d, R b, R x, I s)         { emitrxbm(X64_incqmx, RZero,d,b,x,s); asm_output("incq %d(%s,%s,%d)",d,RQ(b),RQ(x),1<<s); }
+
+    void Assembler::MOVSDRMX(R r, I d, R b, R x, I s)  { emitprxbm(X64_movsdrmx,r,d,b,x,s); asm_output("movsd %s, %d(%s,%s,%d)",RQ(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVSDMRX(R r, I d, R b, R x, I s)  { emitprxbm(X64_movsdmrx,r,d,b,x,s); asm_output("movsd %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RQ(r)); }
+    void Assembler::MOVSSRMX(R r, I d, R b, R x, I s)  { emitprxbm(X64_movssrmx,r,d,b,x,s); asm_output("movss %s, %d(%s,%s,%d)",RQ(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVSSMRX(R r, I d, R b, R x, I s)  { emitprxbm(X64_movssmrx,r,d,b,x,s); asm_output("movss %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RQ(r)); }
+    void Assembler::MOVUPSRMX(R r, I d, R b, R x, I s) { emitrxbm(X64_movupsrmx,r,d,b,x,s); asm_output("movups %s, %d(%s,%s,%d)",RQ(r),d,RQ(b),RQ(x),1<<s); }
+    void Assembler::MOVUPSMRX(R r, I d, R b, R x, I s) { emitrxbm(X64_movupsmrx,r,d,b,x,s); asm_output("movups %d(%s,%s,%d), %s",d,RQ(b),RQ(x),1<<s,RQ(r)); }
+
     void Assembler::MOVSSSPR(R r, I d)          { 
                                                   uint64_t op = emit_disp32_sib(X64_movssspr,d); 
                                                   emit( op | U64((REGNUM(r)&7)<<3) << 48 | U64((REGNUM(r)&8)>>1) << 24);
@@ -615,14 +815,7 @@ namespace nanojit
     void Assembler::JMP32(S n, NIns* t)    { emit_target32(n,X64_jmp, t); asm_output("jmp %p", t); }
     void Assembler::JMP64(S n, NIns* t)    { emit_target64(n,X64_jmpi, t); asm_output("jmp %p", t); }
 
-    void Assembler::JMPX(R indexreg, NIns** table)
-    {
-        Register R5 = { 5 };
-        emitrxb_imm(X64_jmpx, RZero, indexreg, R5, (int32_t)(uintptr_t)table);
-        asm_output("jmpq [%s*8 + %p]", RQ(indexreg), (void*)table);
-    }
-
-    void Assembler::JMPXB(R indexreg, R tablereg)   { emitxb(X64_jmpxb, indexreg, tablereg); asm_output("jmp [%s*8 + %s]", RQ(indexreg), RQ(tablereg)); }
+    void Assembler::JMPR(R r)   { emitr(X64_jmpr, r); asm_output("jmp *%s", RQ(r)); }
 
     void Assembler::JO( S n, NIns* t)      { emit_target32(n,X64_jo,  t); asm_output("jo %p", t); }
     void Assembler::JE( S n, NIns* t)      { emit_target32(n,X64_je,  t); asm_output("je %p", t); }
@@ -680,6 +873,11 @@ namespace nanojit
     void Assembler::MOVSMI(R r, I d, I32 imm) { emitprm_imm16(X64_movsmi,r,d,imm); asm_output("movs %d(%s), %d",d,RQ(r),imm); }
     void Assembler::MOVBMI(R r, I d, I32 imm) { emitrm_imm8(X64_movbmi,r,d,imm); asm_output("movb %d(%s), %d",d,RQ(r),imm); }
 
+    void Assembler::MOVQMIX(R b, I d, R x, I s, I32 imm) { emitrxbm_imm32(X64_movqmix,d,b,x,s,imm); asm_output("movq %d(%s,%s,%d), %d",d,RQ(b),RQ(x),1<<s,imm); }
+    void Assembler::MOVLMIX(R b, I d, R x, I s, I32 imm) { emitrxbm_imm32(X64_movlmix,d,b,x,s,imm); asm_output("movl %d(%s,%s,%d), %d",d,RQ(b),RQ(x),1<<s,imm); }
+    void Assembler::MOVSMIX(R b, I d, R x, I s, I32 imm) { emitprxbm_imm16(X64_movsmix,d,b,x,s,imm); asm_output("movs %d(%s,%s,%d), %d",d,RQ(b),RQ(x),1<<s,imm); }
+    void Assembler::MOVBMIX(R b, I d, R x, I s, I32 imm) { emitrxbm_imm8(X64_movbmix,d,b,x,s,imm); asm_output("movb %d(%s,%s,%d), %d",d,RQ(b),RQ(x),1<<s,imm); }
+
     void Assembler::MOVQSPR(I d, R r)   { emit(X64_movqspr | U64(d) << 56 | U64((REGNUM(r)&7)<<3) << 40 | U64((REGNUM(r)&8)>>1) << 24); asm_output("movq %d(rsp), %s", d, RQ(r)); }    // insert r into mod/rm and rex bytes
     void Assembler::MOVQSPX(I d, R r)   { emit(rexprb(X64_movqspx,RSP,r) | U64(d) << 56 | U64((REGNUM(r)&7)<<3) << 40); asm_output("movq %d(rsp), %s", d, RQ(r)); }
 
@@ -714,7 +912,7 @@ namespace nanojit
 
     void Assembler::JMP(NIns *target) {
         if (!target || isTargetWithinS32(target)) {
-            if (target && isTargetWithinS8(target)) {
+            if (isShortBranch(target)) {
                 JMP8(8, target);
             } else {
                 JMP32(8, target);
@@ -789,6 +987,18 @@ namespace nanojit
         endOpRegs(ins, rr, ra);
     }
 
+    // The subtractions handled by asm_arith();  unlike its other ops they
+    // aren't commutative.
+    static bool isSubOpcode(LOpcode op) {
+        switch (op) {
+        case LIR_subi: case LIR_subjovi: case LIR_subxovi:
+        case LIR_subq: case LIR_subjovq: case LIR_subxovq:
+            return true;
+        default:
+            return false;
+        }
+    }
+
     static bool isImm32(LIns *ins) {
         return ins->isImmI() || (ins->isImmQ() && isS32(ins->immQ()));
     }
@@ -810,6 +1020,13 @@ namespace nanojit
             endOpRegs(ins, rr, ra);
             return;
         }
+        if (op == LIR_mulq || op == LIR_muljovq || op == LIR_mulxovq) {
+            // Likewise for the 64-bit form.
+            beginOp1Regs(ins, GpRegs, rr, ra);
+            IMULQI(rr, ra, imm);
+            endOpRegs(ins, rr, ra);
+            return;
+        }
 
         beginOp1Regs(ins, GpRegs, rr, ra);
         if (isS8(imm)) {
@@ -825,9 +1042,11 @@ namespace nanojit
             case LIR_subxovi:    SUBLR8(rr, imm);   break;
             case LIR_xori:       XORLR8(rr, imm);   break;
             case LIR_addq:
-            case LIR_addjovq:    ADDQR8(rr, imm);   break;
+            case LIR_addjovq:
+            case LIR_addxovq:    ADDQR8(rr, imm);   break;
             case LIR_subq:
-            case LIR_subjovq:    SUBQR8(rr, imm);   break;
+            case LIR_subjovq:
+            case LIR_subxovq:    SUBQR8(rr, imm);   break;
             case LIR_andq:       ANDQR8(rr, imm);   break;
             case LIR_orq:        ORQR8( rr, imm);   break;
             case LIR_xorq:       XORQR8(rr, imm);   break;
@@ -845,9 +1064,11 @@ namespace nanojit
             case LIR_subxovi:    SUBLRI(rr, imm);   break;
             case LIR_xori:       XORLRI(rr, imm);   break;
             case LIR_addq:
-            case LIR_addjovq:    ADDQRI(rr, imm);   break;
+            case LIR_addjovq:
+            case LIR_addxovq:    ADDQRI(rr, imm);   break;
             case LIR_subq:
-            case LIR_subjovq:    SUBQRI(rr, imm);   break;
+            case LIR_subjovq:
+            case LIR_subxovq:    SUBQRI(rr, imm);   break;
             case LIR_andq:       ANDQRI(rr, imm);   break;
             case LIR_orq:        ORQRI( rr, imm);   break;
             case LIR_xorq:       XORQRI(rr, imm);   break;
@@ -859,9 +1080,10 @@ namespace nanojit
         endOpRegs(ins, rr, ra);
     }
 
-    // Generates code for a LIR_divi that doesn't have a subsequent LIR_modi.
+    // Generates code for a LIR_divi/LIR_divq that doesn't have a subsequent
+    // LIR_modi/LIR_modq.
     void Assembler::asm_div(LIns *div) {
-        NanoAssert(div->isop(LIR_divi));
+        NanoAssert(div->isop(LIR_divi) || div->isop(LIR_divq));
         LIns *a = div->oprnd1();
         LIns *b = div->oprnd2();
 
@@ -871,9 +1093,14 @@ namespace nanojit
         Register rb = findRegFor(b, GpRegs & ~(rmask(RAX)|rmask(RDX)));
         Register ra = a->isInReg() ? a->getReg() : RAX;
 
-        IDIV(rb);
-        SARI(RDX, 31);
-        MR(RDX, RAX);
+        if (div->isop(LIR_divq)) {
+            IDIVQ(rb);
+            CQO();
+        } else {
+            IDIV(rb);
+            SARI(RDX, 31);
+            MR(RDX, RAX);
+        }
         if (RAX != ra)
             MR(RAX, ra);
 
@@ -884,12 +1111,13 @@ namespace nanojit
         }
     }
 
-    // Generates code for a LIR_modi(LIR_divi(divL, divR)) sequence.
+    // Generates code for a LIR_modi(LIR_divi(divL, divR)) or
+    // LIR_modq(LIR_divq(divL, divR)) sequence.
     void Assembler::asm_div_mod(LIns *mod) {
         LIns *div = mod->oprnd1();
 
-        NanoAssert(mod->isop(LIR_modi));
-        NanoAssert(div->isop(LIR_divi));
+        NanoAssert((mod->isop(LIR_modi) && div->isop(LIR_divi)) ||
+                   (mod->isop(LIR_modq) && div->isop(LIR_divq)));
 
         LIns *divL = div->oprnd1();
         LIns *divR = div->oprnd2();
@@ -900,9 +1128,14 @@ namespace nanojit
         Register rDivR = findRegFor(divR, GpRegs & ~(rmask(RAX)|rmask(RDX)));
         Register rDivL = divL->isInReg() ? divL->getReg() : RAX;
 
-        IDIV(rDivR);
-        SARI(RDX, 31);
-        MR(RDX, RAX);
+        if (div->isop(LIR_divq)) {
+            IDIVQ(rDivR);
+            CQO();
+        } else {
+            IDIV(rDivR);
+            SARI(RDX, 31);
+            MR(RDX, RAX);
+        }
         if (RAX != rDivL)
             MR(RAX, rDivL);
 
@@ -914,6 +1147,69 @@ namespace nanojit
         }
     }
 
+    // Generates code for LIR_casi/LIR_casq.  CMPXCHG compares [b+d] with
+    // RAX and leaves the old value of [b+d] in RAX whether or not the swap
+    // happened, so the expected value and the result both live in RAX.
+    void Assembler::asm_cas(LIns *ins) {
+        LIns *addr = ins->oprnd1();
+        LIns *expected = ins->oprnd2();
+        LIns *value = ins->oprnd3();
+
+        prepareResultReg(ins, rmask(RAX));
+
+        int32_t d = 0;
+        Register rv, rb;
+        getBaseReg2(GpRegs & ~rmask(RAX), value, rv, BaseRegs & ~rmask(RAX), addr, rb, d);
+        Register re = expected->isInReg() ? expected->getReg() : RAX;
+
+        if (ins->isop(LIR_casq))
+            LOCK_CMPXCHGQMR(rv, d, rb);
+        else
+            LOCK_CMPXCHGLMR(rv, d, rb);
+        if (RAX != re)
+            MR(RAX, re);
+
+        freeResourcesOf(ins);
+        if (!expected->isInReg()) {
+            NanoAssert(re == RAX);
+            findSpecificRegForUnallocated(expected, RAX);
+        }
+    }
+
+    // Generates code for LIR_xadd[iq] and LIR_xchg[iq].  Both instructions
+    // leave the old value of [b+d] in the register that held the operand, so
+    // the operand is copied into the result register first.
+    void Assembler::asm_xadd_xchg(LIns *ins) {
+        LIns *addr = ins->oprnd1();
+        LIns *value = ins->oprnd2();
+
+        Register rr = prepareResultReg(ins, GpRegs);
+
+        int32_t d = 0;
+        Register rb = getBaseReg(addr, d, BaseRegs & ~rmask(rr));
+        Register rv = value->isInReg() ? value->getReg() : rr;
+
+        switch (ins->opcode()) {
+        case LIR_xaddi: LOCK_XADDLMR(rr, d, rb); break;
+        case LIR_xaddq: LOCK_XADDQMR(rr, d, rb); break;
+        case LIR_xchgi: XCHGLMR(rr, d, rb);      break;     // xchg with memory is always locked
+        case LIR_xchgq: XCHGQMR(rr, d, rb);      break;
+        default:        NanoAssert(0);           break;
+        }
+        if (rr != rv)
+            MR(rr, rv);
+
+        freeResourcesOf(ins);
+        if (!value->isInReg()) {
+            NanoAssert(rv == rr);
+            findSpecificRegForUnallocated(value, rr);
+        }
+    }
+
+    void Assembler::asm_fence() {
+        MFENCE();
+    }
+
     // binary op with integer registers
     void Assembler::asm_arith(LIns *ins) {
         Register rr, ra, rb = UnspecifiedReg;   // init to shut GCC up
@@ -925,9 +1221,11 @@ namespace nanojit
             asm_shift(ins);
             return;
         case LIR_modi:
+        case LIR_modq:
             asm_div_mod(ins);
             return;
         case LIR_divi:
+        case LIR_divq:
             // Nb: if the div feeds into a mod it will be handled by
             // asm_div_mod() rather than here.
             asm_div(ins);
@@ -936,11 +1234,25 @@ namespace nanojit
             break;
         }
 
+        LIns *a = ins->oprnd1();
         LIns *b = ins->oprnd2();
         if (isImm32(b)) {
             asm_arith_imm(ins);
             return;
         }
+        if (a != b) {
+            // Use the reg-mem form if either operand is a single-use load
+            // (only the second one for subtraction, which isn't commutative).
+            LOpcode ldop = ins->isQ() ? LIR_ldq : LIR_ldi;
+            if (b->isop(ldop) && canFoldLoad(ins, b)) {
+                asm_arith_mem(ins, a, b);
+                return;
+            }
+            if (a->isop(ldop) && !isSubOpcode(ins->opcode()) && canFoldLoad(ins, a)) {
+                asm_arith_mem(ins, b, a);
+                return;
+            }
+        }
         beginOp2Regs(ins, GpRegs, rr, ra, rb);
         switch (ins->opcode()) {
         default:           TODO(asm_arith);
@@ -960,9 +1272,14 @@ namespace nanojit
         case LIR_orq:      ORQRR(rr, rb);  break;
         case LIR_andq:     ANDQRR(rr, rb); break;
         case LIR_addq:
-        case LIR_addjovq:  ADDQRR(rr, rb); break;
+        case LIR_addjovq:
+        case LIR_addxovq:  ADDQRR(rr, rb); break;
         case LIR_subq:
-        case LIR_subjovq:  SUBQRR(rr, rb); break;
+        case LIR_subjovq:
+        case LIR_subxovq:  SUBQRR(rr, rb); break;
+        case LIR_mulq:
+        case LIR_muljovq:
+        case LIR_mulxovq:  IMULQ(rr, rb);  break;
         }
         if (rr != ra)
             MR(rr, ra);
@@ -970,9 +1287,76 @@ namespace nanojit
         endOpRegs(ins, rr, ra);
     }
 
+    // Generates 'ins' as rr = a (op) [ld], where 'ld' is a load that
+    // canFoldLoad() has accepted.  'a' may be either operand of 'ins'.
+    void Assembler::asm_arith_mem(LIns *ins, LIns *a, LIns *ld) {
+        int d = ld->disp();
+        Register rb = getBaseReg(ld->oprnd1(), d, BaseRegs);
+        Register rr = prepareResultReg(ins, GpRegs & ~rmask(rb));
+
+        // If 'a' isn't in a register, it can be clobbered by 'ins'.
+        Register ra = a->isInReg() ? a->getReg() : rr;
+
+        switch (ins->opcode()) {
+        default:           TODO(asm_arith_mem);
+        case LIR_ori:      ORLRM(rr, d, rb);   break;
+        case LIR_subi:
+        case LIR_subjovi:
+        case LIR_subxovi:  SUBLRM(rr, d, rb);  break;
+        case LIR_addi:
+        case LIR_addjovi:
+        case LIR_addxovi:  ADDLRM(rr, d, rb);  break;
+        case LIR_andi:     ANDLRM(rr, d, rb);  break;
+        case LIR_xori:     XORLRM(rr, d, rb);  break;
+        case LIR_muli:
+        case LIR_muljovi:
+        case LIR_mulxovi:  IMULLRM(rr, d, rb); break;
+        case LIR_xorq:     XORQRM(rr, d, rb);  break;
+        case LIR_orq:      ORQRM(rr, d, rb);   break;
+        case LIR_andq:     ANDQRM(rr, d, rb);  break;
+        case LIR_addq:
+        case LIR_addjovq:
+        case LIR_addxovq:  ADDQRM(rr, d, rb);  break;
+        case LIR_subq:
+        case LIR_subjovq:
+        case LIR_subxovq:  SUBQRM(rr, d, rb);  break;
+        case LIR_mulq:
+        case LIR_muljovq:
+        case LIR_mulxovq:  IMULQRM(rr, d, rb); break;
+        }
+        if (rr != ra)
+            MR(rr, ra);
+
+        freeResourcesOf(ins);
+        if (!a->isInReg()) {
+            NanoAssert(ra == rr);
+            findSpecificRegForUnallocated(a, ra);
+        }
+    }
+
     // Binary op with fp registers.
     void Assembler::asm_fop(LIns *ins) {
         Register rr, ra, rb = UnspecifiedReg;   // init to shut GCC up
+        LIns *a = ins->oprnd1();
+        LIns *b = ins->oprnd2();
+        if (a != b && (ins->isD() || ins->isF())) {
+            // Use the reg-mem form if either operand is a single-use load
+            // (only the second one for sub/div).  Not done for float4, as
+            // the legacy SSE encodings require aligned memory operands.
+            // Likewise for an immediate that isn't already in a register,
+            // which is read from the constant pool.
+            LOpcode op = ins->opcode();
+            LOpcode ldop = ins->isD() ? LIR_ldd : LIR_ldf;
+            bool commutes = op == LIR_addd || op == LIR_muld || op == LIR_addf || op == LIR_mulf;
+            if ((b->isop(ldop) && canFoldLoad(ins, b)) || isFoldableImm(b)) {
+                asm_fop_mem(ins, a, b);
+                return;
+            }
+            if (commutes && ((a->isop(ldop) && canFoldLoad(ins, a)) || isFoldableImm(a))) {
+                asm_fop_mem(ins, b, a);
+                return;
+            }
+        }
         beginOp2Regs(ins, FpRegs, rr, ra, rb);
         switch (ins->opcode()) {
         default:        TODO(asm_fop);
@@ -996,6 +1380,64 @@ namespace nanojit
         endOpRegs(ins, rr, ra);
     }
 
+    // Generates 'ins' as rr = a (op) [ld], where 'ld' is a load that
+    // canFoldLoad() has accepted or an immediate that isFoldableImm() has.
+    // 'a' may be either operand of 'ins'.
+    void Assembler::asm_fop_mem(LIns *ins, LIns *a, LIns *ld) {
+        int d = 0;
+        Register rb = UnspecifiedReg;
+        if (!ld->isImmAny()) {
+            d = ld->disp();
+            rb = getBaseReg(ld->oprnd1(), d, BaseRegs);
+        }
+        Register rr = prepareResultReg(ins, FpRegs);
+
+        // If 'a' isn't in a register, it can be clobbered by 'ins'.
+        Register ra = a->isInReg() ? a->getReg() : rr;
+
+        if (ld->isImmD()) {
+            uint64_t v = ld->immDasQ();
+            NIns* c = findConstSlot(&v, sizeof(v));
+            switch (ins->opcode()) {
+            default:        TODO(asm_fop_mem);
+            case LIR_divd:  DIVSDM(rr, c); break;
+            case LIR_muld:  MULSDM(rr, c); break;
+            case LIR_addd:  ADDSDM(rr, c); break;
+            case LIR_subd:  SUBSDM(rr, c); break;
+            }
+        } else if (ld->isImmF()) {
+            uint32_t v = ld->immFasI();
+            NIns* c = findConstSlot(&v, sizeof(v));
+            switch (ins->opcode()) {
+            default:        TODO(asm_fop_mem);
+            case LIR_divf:  DIVSSM(rr, c); break;
+            case LIR_mulf:  MULSSM(rr, c); break;
+            case LIR_addf:  ADDSSM(rr, c); break;
+            case LIR_subf:  SUBSSM(rr, c); break;
+            }
+        } else {
+            switch (ins->opcode()) {
+            default:        TODO(asm_fop_mem);
+            case LIR_divd:  DIVSDRM(rr, d, rb); break;
+            case LIR_muld:  MULSDRM(rr, d, rb); break;
+            case LIR_addd:  ADDSDRM(rr, d, rb); break;
+            case LIR_subd:  SUBSDRM(rr, d, rb); break;
+            case LIR_divf:  DIVSSRM(rr, d, rb); break;
+            case LIR_mulf:  MULSSRM(rr, d, rb); break;
+            case LIR_addf:  ADDSSRM(rr, d, rb); break;
+            case LIR_subf:  SUBSSRM(rr, d, rb); break;
+            }
+        }
+        if (rr != ra)
+            asm_nongp_copy(rr, ra);
+
+        freeResourcesOf(ins);
+        if (!a->isInReg()) {
+            NanoAssert(ra == rr);
+            findSpecificRegForUnallocated(a, ra);
+        }
+    }
+
     void Assembler::asm_neg_not(LIns *ins) {
         Register rr, ra;
         beginOp1Regs(ins, GpRegs, rr, ra);
@@ -1010,86 +1452,199 @@ namespace nanojit
         endOpRegs(ins, rr, ra);
     }
 
-    void Assembler::asm_call(LIns *ins) {
-        if (!ins->isop(LIR_callv)) {
-            Register rr = (ins->isop(LIR_calld) || ins->isop(LIR_callf) || ins->isop(LIR_callf4)) ? XMM0 : RAX;
-            prepareResultReg(ins, rmask(rr));
-            evictScratchRegsExcept(rmask(rr));
-        } else {
-            evictScratchRegsExcept(0);
+    // Returns the register the next argument of type 'ty' is passed in, or
+    // UnspecifiedReg if it goes on the stack.  'arg_index' and 'fr' track the
+    // registers used so far, and start at 0 and XMM0.  On Windows a float4
+    // argument's register holds a pointer to it, except for internal calls.
+    Register Assembler::nextArgReg(ArgType ty, bool internal, int &arg_index, Register &fr) {
+        bool isInt = ty == ARGTYPE_I || ty == ARGTYPE_UI || ty == ARGTYPE_Q;
+        if (internal) {
+            Register r = isInt ? intArgReg(ABI_INTERNAL, arg_index) : fpArgReg(REGNUM(fr) - REGNUM(XMM0));
+            if (r != UnspecifiedReg) {
+                if (isInt)
+                    arg_index++;
+                else
+                    fr = fr + 1;
+            }
+            return r;
+        }
+        if (isInt && arg_index < NumArgRegs)
+            return RegAlloc::argRegs[arg_index++];
+    #if defined(_WIN64)
+        (void) fr;
+        if ((ty == ARGTYPE_D || ty == ARGTYPE_F) && arg_index < NumArgRegs) {
+            // double and float go in XMM register # based on overall arg_index
+            Register rxi = XMM0 + arg_index;
+            arg_index++;
+            return rxi;
+        }
+        if (ty == ARGTYPE_F4 && arg_index < NumArgRegs) {
+            // first 4 parameters passed as pointers
+            return RegAlloc::argRegs[arg_index++];
+        }
+    #else
+        if ((ty == ARGTYPE_D || ty == ARGTYPE_F || ty == ARGTYPE_F4) && fr < XMM8) {
+            // double, float, and float4 go in next available XMM register
+            Register r = fr;
+            fr = fr + 1;
+            return r;
+        }
+    #endif
+        return UnspecifiedReg;
+    }
+
+    // Returns the registers a call to 'call' may clobber: the callee's
+    // declared clobbers plus every register the call sequence itself writes,
+    // ie. RAX (return value, far and indirect call target), XMM0 for FP
+    // results, and the registers the arguments are passed in.
+    RegisterMask Assembler::callClobbers(const CallInfo* call, ArgType* argTypes, int argc) {
+        NanoAssert(call->_clobbers);
+        RegisterMask clobbers = call->_clobbers | rmask(RAX);
+        ArgType rty = call->returnType();
+        if (rty == ARGTYPE_D || rty == ARGTYPE_F || rty == ARGTYPE_F4)
+            clobbers |= rmask(XMM0);
+
+        if (call->isIndirect())
+            argc--;
+        bool internal = call->_abi == ABI_INTERNAL;
+        int arg_index = 0;
+        Register fr = XMM0;
+        for (int i = 0; i < argc; i++) {
+            Register r = nextArgReg(argTypes[argc - i - 1], internal, arg_index, fr);
+            if (r != UnspecifiedReg)
+                clobbers |= rmask(r);
         }
+        return clobbers;
+    }
+
+    // A fragment that returns the result of an ABI_INTERNAL call made just
+    // before can jump to the callee instead, which then returns straight to
+    // our caller.  The callee-saved registers are restored before the jump,
+    // and all the arguments must be in registers as it tears down our frame.
+    // Our caller must use the internal ABI too, since the callee returns to
+    // it, and we must have no LIR_allocp that an argument could point into.
+    bool Assembler::canTailCall(LIns* ret) {
+        if (_thisfrag->lirbuf->abi != ABI_INTERNAL || _thisfrag->lirbuf->hasAllocs)
+            return false;
+
+        // The call must come right before the return in the buffer.
+        LIns* call = ret->oprnd1();
+        if (!call->isCall() || (LIns*)(uintptr_t(ret) - insSizes[ret->opcode()]) != call)
+            return false;
+        const CallInfo* ci = call->callInfo();
+        if (ci->_abi != ABI_INTERNAL || ci->isIndirect())
+            return false;
 
+        ArgType argTypes[MAXARGS];
+        int argc = ci->getArgTypes(argTypes);
+        int arg_index = 0;
+        Register fr = XMM0;
+        for (int i = 0; i < argc; i++) {
+            if (nextArgReg(argTypes[argc - i - 1], true, arg_index, fr) == UnspecifiedReg)
+                return false;
+        }
+        return true;
+    }
+
+    void Assembler::asm_call(LIns *ins) {
         const CallInfo *call = ins->callInfo();
         ArgType argTypes[MAXARGS];
         int argc = call->getArgTypes(argTypes);
+        bool internal = call->_abi == ABI_INTERNAL;
 
-        if (!call->isIndirect()) {
+        _needFrame = true;
+
+        if (ins == _tailCall) {
+            // asm_ret() has released every register but the saved ones and
+            // the result goes straight back to our caller, so just tear down
+            // our frame and jump.  Our caller's context register is restored
+            // as well, so the callee's prologue sees the same state ours did.
+            _tailCall = NULL;
             verbose_only(if (_logc->lcbits & LC_Native)
                 outputf("        %p:", _nIns);
             )
-            NIns *target = (NIns*)call->_address;
-            if (isTargetWithinS32(target)) {
-                CALL(8, target);
-            } else {
-                // can't reach target from here, load imm64 and do an indirect jump
-                CALLRAX();
-                asm_immq(RAX, (uint64_t)target, /*canClobberCCs*/true);
-            }
-            // Call this now so that the arg setup can involve 'rr'.
+            JMP((NIns*)call->_address);
+            if (_config.pinned_context)
+                POPR(ContextReg);
+            POPR(RBP);
+            MR(RSP, FP);
+            asm_sfence_nt();
             freeResourcesOf(ins);
         } else {
-            // Indirect call: we assign the address arg to RAX since it's not
-            // used for regular arguments, and is otherwise scratch since it's
-            // clobberred by the call.
-            CALLRAX();
+            // A callee with a clobber mask preserves the remaining scratch
+            // registers, so values live in them can stay put across the call.
+            // Any callee, internal-ABI ones included, preserves the saved
+            // registers.
+            RegisterMask preserved = 0;
+            if (call->_clobbers)
+                preserved = ~callClobbers(call, argTypes, argc) & ~SavedRegs;
+
+            RegisterMask rrmask = 0;
+            if (!ins->isop(LIR_callv)) {
+                Register rr = (ins->isop(LIR_calld) || ins->isop(LIR_callf) || ins->isop(LIR_callf4)) ? XMM0 : RAX;
+                prepareResultReg(ins, rmask(rr));
+                rrmask = rmask(rr);
+            }
+            evictScratchRegsExcept(rrmask | preserved);
+
+            if (!call->isIndirect()) {
+                verbose_only(if (_logc->lcbits & LC_Native)
+                    outputf("        %p:", _nIns);
+                )
+                NIns *target = (NIns*)call->_address;
+                if (isTargetWithinS32(target)) {
+                    CALL(8, target);
+                } else {
+                    // can't reach target from here, call it through a veneer
+                    CALL(8, veneerFor(target));
+                }
+                // Call this now so that the arg setup can involve 'rr'.
+                freeResourcesOf(ins);
+            } else {
+                // Indirect call: we assign the address arg to RAX since it's not
+                // used for regular arguments, and is otherwise scratch since it's
+                // clobberred by the call.
+                CALLRAX();
 
-            // Call this now so that the arg setup can involve 'rr'.
-            freeResourcesOf(ins);
+                // Call this now so that the arg setup can involve 'rr'.
+                freeResourcesOf(ins);
 
-            // Assign the call address to RAX.  Must happen after freeResourcesOf()
-            // since RAX is usually the return value and will be allocated until that point.
-            asm_regarg(ARGTYPE_P, ins->arg(--argc), RAX);
+                // Assign the call address to RAX.  Must happen after freeResourcesOf()
+                // since RAX is usually the return value and will be allocated until that point.
+                asm_regarg(ARGTYPE_P, ins->arg(--argc), RAX);
+            }
         }
 
     #ifdef _WIN64
-        int stk_used = 32; // always reserve 32byte shadow area
+        // Always reserve the 32 byte shadow area, except for internal calls.
+        int stk_used = internal ? 0 : 32;
     #else
         int stk_used = 0;
-        Register fr = XMM0;
     #endif
         int arg_index = 0;
+        Register fr = XMM0;
         for (int i = 0; i < argc; i++) {
             int j = argc - i - 1;
             ArgType ty = argTypes[j];
             LIns* arg = ins->arg(j);
-            if ((ty == ARGTYPE_I || ty == ARGTYPE_UI || ty == ARGTYPE_Q) && arg_index < NumArgRegs) {
-                // gp arg
-                asm_regarg(ty, arg, RegAlloc::argRegs[arg_index]);
-                arg_index++;
+            Register r = nextArgReg(ty, internal, arg_index, fr);
+            if (r == UnspecifiedReg && internal &&
+                (ty == ARGTYPE_D || ty == ARGTYPE_F || ty == ARGTYPE_F4)) {
+                // The callee could only read it from the stack, see asm_param().
+                setError(StackParam);
             }
-        #if defined(_WIN64)
-            else if ((ty == ARGTYPE_D || ty == ARGTYPE_F) && arg_index < NumArgRegs) {
-                // double and float go in XMM register # based on overall arg_index
-                Register rxi = XMM0 + arg_index;
-                asm_regarg(ty, arg, rxi);
-                arg_index++;
-            }
-            else if ((ty == ARGTYPE_F4) && arg_index < NumArgRegs) {
-                // first 4 parameters passed as pointers
-                asm_ptrarg(ty, arg, RegAlloc::argRegs[arg_index]);
-                arg_index++;
+            else if (r == UnspecifiedReg) {
+                asm_stkarg(ty, arg, stk_used);
+                /* float4 is passed as a pointer to the value, so it still takes up as much space as "void*" */
+                stk_used += sizeof(void*);
             }
-        #else
-            else if ((ty == ARGTYPE_D || ty == ARGTYPE_F || ty == ARGTYPE_F4) && fr < XMM8) {
-                // double, float, and float4 go in next available XMM register
-                asm_regarg(ty, arg, fr);
-                fr = fr + 1;
+        #if defined(_WIN64)
+            else if (ty == ARGTYPE_F4 && !internal) {
+                asm_ptrarg(ty, arg, r);
             }
         #endif
             else {
-                asm_stkarg(ty, arg, stk_used);
-                /* float4 is passed as a pointer to the value, so it still takes up as much space as "void*" */
-                stk_used += sizeof(void*);
+                asm_regarg(ty, arg, r);
             }
         }
 
@@ -1101,13 +1656,9 @@ namespace nanojit
         NanoAssert(ty==ARGTYPE_F4);(void)ty;
         NanoAssert(IsGpReg(r));
         if(p->isImmF4()){
-            const float4_t* vaddr = findImmF4FromPool(p->immF4());
-            if( isTargetWithinS32((NIns*)vaddr) ) {
-                int32_t d = int32_t(int64_t(vaddr)-int64_t(_nIns));
-                LEARIP(r, d);
-            } else {
-                MOVQI(r, (U64) vaddr);
-            }
+            float4_t v = p->immF4();
+            NIns* c = findConstSlot(&v, sizeof(v));
+            LEARIP(r, int32_t(c - _nIns));
         } else {
             int d = findMemFor(p);
             LEAQRM(r, d, FP);
@@ -1501,7 +2052,7 @@ namespace nanojit
         // We must ensure there's room for the instruction before calculating
         // the offset.  And the offset determines the opcode (8bit or 32bit).
         LOpcode condop = cond->opcode();
-        if (target && isTargetWithinS8(target)) {
+        if (isShortBranch(target)) {
             if (onFalse) {
                 switch (condop) {
                 case LIR_eqf4:
@@ -1568,7 +2119,7 @@ namespace nanojit
     NIns* Assembler::asm_branch_ov(LOpcode, NIns* target) {
         // We must ensure there's room for the instr before calculating
         // the offset.  And the offset determines the opcode (8bit or 32bit).
-        if (target && isTargetWithinS8(target))
+        if (isShortBranch(target))
             JO8(8, target);
         else
             JO( 8, target);
@@ -1651,6 +2202,8 @@ namespace nanojit
     // condition codes prior to the generation of the test/cmp.  See
     // Nativei386.cpp:asm_cmpi() for details.
     void Assembler::asm_cmpi(LIns *cond) {
+        if (asm_cmpi_mem(cond))
+            return;
         LIns *b = cond->oprnd2();
         if (isImm32(b)) {
             asm_cmpi_imm(cond);
@@ -1674,6 +2227,55 @@ namespace nanojit
         }
     }
 
+    // Compares against memory directly if one operand of 'cond' is a load
+    // that canFoldLoad() accepts.  Returns false (generating nothing) if not.
+    bool Assembler::asm_cmpi_mem(LIns *cond) {
+        LIns *a = cond->oprnd1();
+        LIns *b = cond->oprnd2();
+        if (a == b)
+            return false;
+
+        bool isQ = isCmpQOpcode(cond->opcode());
+        LOpcode ldop = isQ ? LIR_ldq : LIR_ldi;
+        if (isImm32(b)) {
+            if (!a->isop(ldop) || !canFoldLoad(cond, a))
+                return false;
+            int d = a->disp();
+            Register rb = getBaseReg(a->oprnd1(), d, BaseRegs);
+            int32_t imm = getImm32(b);
+            if (isQ) {
+                if (isS8(imm))
+                    CMPQMI8(rb, d, imm);
+                else
+                    CMPQMI(rb, d, imm);
+            } else {
+                if (isS8(imm))
+                    CMPLMI8(rb, d, imm);
+                else
+                    CMPLMI(rb, d, imm);
+            }
+        } else if (b->isop(ldop) && canFoldLoad(cond, b)) {
+            int d = b->disp();
+            Register ra, rb;
+            getBaseReg2(GpRegs, a, ra, BaseRegs, b->oprnd1(), rb, d);
+            if (isQ)
+                CMPQRM(ra, d, rb);
+            else
+                CMPLRM(ra, d, rb);
+        } else if (a->isop(ldop) && canFoldLoad(cond, a)) {
+            int d = a->disp();
+            Register rv, rb;
+            getBaseReg2(GpRegs, b, rv, BaseRegs, a->oprnd1(), rb, d);
+            if (isQ)
+                CMPQMR(rv, d, rb);
+            else
+                CMPLMR(rv, d, rb);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
     void Assembler::asm_cmpi_imm(LIns *cond) {
         LOpcode condop = cond->opcode();
         LIns *a = cond->oprnd1();
@@ -1719,12 +2321,21 @@ namespace nanojit
         if (isCmpFOpcode(condop))
             condop = getCmpDOpcode(condop);
         NanoAssert(condop != LIR_eqf4); // handled in asm_branchi_helper
+        // Only back edges (NULL target) get the 8-bit forms here;  a known
+        // target would need both branches of the LIR_eqd case checked.
+        bool isShort = !target && _shortBranch;
         if (condop == LIR_eqd) {
             if (onFalse) {
                 // branch if unordered or !=
-                JP(16, target);     // underrun of 12 needed, round up for overhang --> 16
-                patch1 = _nIns;
-                JNE(0, target);     // no underrun needed, previous was enough
+                if (isShort) {
+                    JP8(16, target);
+                    patch1 = _nIns;
+                    JNE8(0, target);
+                } else {
+                    JP(16, target);     // underrun of 12 needed, round up for overhang --> 16
+                    patch1 = _nIns;
+                    JNE(0, target);     // no underrun needed, previous was enough
+                }
                 patch2 = _nIns;
             } else {
                 // jp skip (2byte)
@@ -1732,7 +2343,10 @@ namespace nanojit
                 // skip: ...
                 underrunProtect(16); // underrun of 7 needed but we write 2 instr --> 16
                 NIns *skip = _nIns;
-                JE(0, target);      // no underrun needed, previous was enough
+                if (isShort)
+                    JE8(0, target);
+                else
+                    JE(0, target);  // no underrun needed, previous was enough
                 patch1 = _nIns;
                 JP8(0, skip);       // ditto
             }
@@ -1743,10 +2357,18 @@ namespace nanojit
             // LIR_led/LIR_ged.
             switch (condop) {
             case LIR_ltd:
-            case LIR_gtd: if (onFalse) JBE(8, target); else JA(8, target);  break;
+            case LIR_gtd:
+                if (isShort) { if (onFalse) JBE8(8, target); else JA8(8, target); }
+                else         { if (onFalse) JBE(8, target);  else JA(8, target);  }
+                break;
             case LIR_led:
-            case LIR_ged: if (onFalse) JB(8, target);  else JAE(8, target); break;
-            default:      NanoAssert(0);                                    break;
+            case LIR_ged:
+                if (isShort) { if (onFalse) JB8(8, target);  else JAE8(8, target); }
+                else         { if (onFalse) JB(8, target);   else JAE(8, target);  }
+                break;
+            default:
+                NanoAssert(0);
+                break;
             }
             patch1 = _nIns;
         }
@@ -1806,6 +2428,15 @@ namespace nanojit
             LIns* t = a; a = b; b = t;
         }
         Register ra, rb;
+        if (a != b && b->isop(singlePrecision ? LIR_ldf : LIR_ldd) && canFoldLoad(cond, b)) {
+            int d = b->disp();
+            getBaseReg2(FpRegs, a, ra, BaseRegs, b->oprnd1(), rb, d);
+            if (singlePrecision)
+                UCOMISSRM(ra, d, rb);
+            else
+                UCOMISDRM(ra, d, rb);
+            return;
+        }
         findRegFor2(FpRegs, a, ra, FpRegs, b, rb);
         if (singlePrecision)
             UCOMISS(ra, rb);
@@ -1878,7 +2509,11 @@ namespace nanojit
     }
 
     bool RegAlloc::canRemat(LIns* ins) {
-        return ins->isImmAny() || ins->isop(LIR_allocp) || canRematLEA(ins);
+        // A LIR_contextp is only rematerializable when the context is pinned,
+        // but asm_restore() checks that, and at worst an unpinned one is
+        // spilled a little more eagerly.
+        return ins->isImmAny() || ins->isop(LIR_allocp) || ins->isop(LIR_contextp) ||
+               canRematLEA(ins);
     }
 
     // WARNING: the code generated by this function must not affect the
@@ -1888,6 +2523,9 @@ namespace nanojit
             int d = arDisp(ins);
             LEAQRM(r, d, FP);
         }
+        else if (ins->isop(LIR_contextp) && _config.pinned_context) {
+            MR(r, ContextReg);
+        }
         else if (ins->isImmI()) {
             asm_immi(r, ins->immI(), /*canClobberCCs*/false);
         }
@@ -1967,10 +2605,20 @@ namespace nanojit
     }
 
     void Assembler::asm_ret(LIns *ins) {
+        if (canTailCall(ins)) {
+            // asm_call() emits the jump in place of our epilogue.
+            releaseRegisters();
+            assignSavedRegs();
+            _tailCall = ins->oprnd1();
+            return;
+        }
+
         genEpilogue();
 
         // Restore RSP from RBP, undoing SUB(RSP,amt) in the prologue
         MR(RSP,FP);
+        _retSites = new (alloc) Seq<NIns*>(_nIns, _retSites);
+        asm_sfence_nt();
 
         releaseRegisters();
         assignSavedRegs();
@@ -1998,12 +2646,75 @@ namespace nanojit
         }
     }
 
-    // Register setup for load ops.  Pairs with endLoadRegs().
-    void Assembler::beginLoadRegs(LIns *ins, RegisterMask allow, Register &rr, int32_t &dr, Register &rb) {
+    // An FP immediate that hasn't been put in a register can be read
+    // straight from the constant pool by the instruction using it.
+    bool Assembler::isFoldableImm(LIns *imm) {
+        return (imm->isImmD() || imm->isImmF()) && !imm->isInReg();
+    }
+
+    // Returns true if the load 'ld' can be folded, as a memory operand, into
+    // the code generated for 'user' (one of its users) at currIns.  That
+    // requires 'user' to be the only use of 'ld' and nothing that could
+    // write memory to lie between 'ld' and currIns, where the folded access
+    // will happen.  We only look past immediates and other loads, e.g.:
+    //
+    //   ld = ldi p[8]
+    //   k  = immi 5
+    //   c  = lti ld, k     # user
+    //   xt c               # currIns
+    //
+    bool Assembler::canFoldLoad(LIns *user, LIns *ld) {
+        // If a later use has already been generated, 'ld' has a register
+        // or spill slot and must be computed anyway.
+        if (ld->isExtant())
+            return false;
+
+        LirReader lookahead(currIns);
+        for (LIns *p = lookahead.read(); p != ld; p = lookahead.read()) {
+            if (p->isop(LIR_start))
+                return false;
+            if (p != user && !p->isImmAny() && !(p->isLoad() && p->oprnd1() != ld))
+                return false;
+        }
+        return true;
+    }
+
+    // Looks through the address 'base'+'d' of a load or store for parts that
+    // can be folded into a [b+x*s+d32] operand.  A constant added to the
+    // address, ie. addp(X, c), is folded into 'd' and 'base' becomes X.  If
+    // what remains is an addp (see getBaseIndexScale() for the shapes that
+    // are recognised) we return true and set 'base', 'index' and 'scale'.
+    // An addp that is already in a register is left alone, as using that
+    // register directly is cheaper than tying up two.
+    bool Assembler::getBaseIndexScaleDisp(LIns*& base, int32_t& d, LIns*& index, int& scale) {
+        if (base->isop(LIR_addp) && !base->isInReg() && base->oprnd2()->isImmQ()) {
+            int64_t c = int64_t(base->oprnd2()->immQ()) + d;
+            if (isS32(c)) {
+                d = int32_t(c);
+                base = base->oprnd1();
+            }
+        }
+        if (!base->isop(LIR_addp) || base->isInReg())
+            return false;
+        getBaseIndexScale(base, &base, &index, &scale);
+        return true;
+    }
+
+    // Register setup for load ops.  Pairs with endLoadRegs().  'rx' is set
+    // to UnspecifiedReg unless the address is [rb+rx*scale+dr].
+    void Assembler::beginLoadRegs(LIns *ins, RegisterMask allow, Register &rr, int32_t &dr, Register &rb,
+                                  Register &rx, int &scale) {
         dr = ins->disp();
         LIns *base = ins->oprnd1();
-        rb = getBaseReg(base, dr, BaseRegs);
-        rr = prepareResultReg(ins, allow & ~rmask(rb));
+        LIns *index;
+        if (getBaseIndexScaleDisp(base, dr, index, scale)) {
+            getBaseReg2(GpRegs, index, rx, GpRegs, base, rb, dr);
+            rr = prepareResultReg(ins, allow & ~(rmask(rb) | rmask(rx)));
+        } else {
+            rx = UnspecifiedReg;
+            rb = getBaseReg(base, dr, BaseRegs);
+            rr = prepareResultReg(ins, allow & ~rmask(rb));
+        }
     }
 
     // Register clean-up for load ops.  Pairs with beginLoadRegs().
@@ -2012,29 +2723,43 @@ namespace nanojit
     }
 
     void Assembler::asm_load64(LIns *ins) {
-        Register rr, rb;
+        Register rr, rb, rx;
         int32_t dr;
+        int s;
         switch (ins->opcode()) {
             case LIR_ldq:
-                beginLoadRegs(ins, GpRegs, rr, dr, rb);
+            case LIR_ldacqq:    // x64 loads already have acquire semantics
+                beginLoadRegs(ins, GpRegs, rr, dr, rb, rx, s);
                 NanoAssert(IsGpReg(rr));
-                MOVQRM(rr, dr, rb);     // general 64bit load, 32bit const displacement
+                if (rx != UnspecifiedReg)
+                    MOVQRMX(rr, dr, rb, rx, s);
+                else
+                    MOVQRM(rr, dr, rb);     // general 64bit load, 32bit const displacement
                 break;
             case LIR_ldd:
-                beginLoadRegs(ins, FpRegs, rr, dr, rb);
+                beginLoadRegs(ins, FpRegs, rr, dr, rb, rx, s);
                 NanoAssert(IsFpReg(rr));
-                MOVSDRM(rr, dr, rb);    // load 64bits into XMM
+                if (rx != UnspecifiedReg)
+                    MOVSDRMX(rr, dr, rb, rx, s);
+                else
+                    MOVSDRM(rr, dr, rb);    // load 64bits into XMM
                 break;
             case LIR_ldf:
-                beginLoadRegs(ins, FpRegs, rr, dr, rb);
+                beginLoadRegs(ins, FpRegs, rr, dr, rb, rx, s);
                 NanoAssert(IsFpReg(rr));
-                MOVSSRM(rr, dr, rb);
+                if (rx != UnspecifiedReg)
+                    MOVSSRMX(rr, dr, rb, rx, s);
+                else
+                    MOVSSRM(rr, dr, rb);
                 break;
             case LIR_ldf2d:
-                beginLoadRegs(ins, FpRegs, rr, dr, rb);
+                beginLoadRegs(ins, FpRegs, rr, dr, rb, rx, s);
                 NanoAssert(IsFpReg(rr));
                 CVTSS2SD(rr, rr);
-                MOVSSRM(rr, dr, rb);
+                if (rx != UnspecifiedReg)
+                    MOVSSRMX(rr, dr, rb, rx, s);
+                else
+                    MOVSSRM(rr, dr, rb);
                 break;
             default:
                 NanoAssertMsg(0, "asm_load64 should never receive this LIR opcode");
@@ -2044,41 +2769,61 @@ namespace nanojit
     }
 
     void Assembler::asm_load128(LIns *ins) {
-        Register rr, rb;
+        Register rr, rb, rx;
         int32_t dr;
+        int s;
         NanoAssert(ins->opcode() == LIR_ldf4);
         
-        beginLoadRegs(ins, FpRegs, rr, dr, rb);
+        beginLoadRegs(ins, FpRegs, rr, dr, rb, rx, s);
         NanoAssert(IsFpReg(rr));
-        MOVUPSRM(rr,dr,rb);
+        if (rx != UnspecifiedReg)
+            MOVUPSRMX(rr, dr, rb, rx, s);
+        else
+            MOVUPSRM(rr,dr,rb);
         endLoadRegs(ins);
     }
 
     void Assembler::asm_load32(LIns *ins) {
         NanoAssert(ins->isI());
-        Register r, b;
+        Register r, b, x;
         int32_t d;
-        beginLoadRegs(ins, GpRegs, r, d, b);
+        int s;
+        beginLoadRegs(ins, GpRegs, r, d, b, x, s);
         LOpcode op = ins->opcode();
-        switch (op) {
-            case LIR_lduc2ui:
-                MOVZX8M( r, d, b);
-                break;
-            case LIR_ldus2ui:
-                MOVZX16M(r, d, b);
-                break;
-            case LIR_ldi:
-                MOVLRM(  r, d, b);
-                break;
-            case LIR_ldc2i:
-                MOVSX8M( r, d, b);
-                break;
-            case LIR_lds2i:
-                MOVSX16M( r, d, b);
-                break;
-            default:
-                NanoAssertMsg(0, "asm_load32 should never receive this LIR opcode");
-                break;
+        if (x != UnspecifiedReg) {
+            switch (op) {
+                case LIR_lduc2ui: MOVZX8MX( r, d, b, x, s); break;
+                case LIR_ldus2ui: MOVZX16MX(r, d, b, x, s); break;
+                case LIR_ldi:
+                case LIR_ldacqi:  MOVLRMX(  r, d, b, x, s); break;
+                case LIR_ldc2i:   MOVSX8MX( r, d, b, x, s); break;
+                case LIR_lds2i:   MOVSX16MX(r, d, b, x, s); break;
+                default:
+                    NanoAssertMsg(0, "asm_load32 should never receive this LIR opcode");
+                    break;
+            }
+        } else {
+            switch (op) {
+                case LIR_lduc2ui:
+                    MOVZX8M( r, d, b);
+                    break;
+                case LIR_ldus2ui:
+                    MOVZX16M(r, d, b);
+                    break;
+                case LIR_ldi:
+                case LIR_ldacqi:    // x64 loads already have acquire semantics
+                    MOVLRM(  r, d, b);
+                    break;
+                case LIR_ldc2i:
+                    MOVSX8M( r, d, b);
+                    break;
+                case LIR_lds2i:
+                    MOVSX16M( r, d, b);
+                    break;
+                default:
+                    NanoAssertMsg(0, "asm_load32 should never receive this LIR opcode");
+                    break;
+            }
         }
         endLoadRegs(ins);
     }
@@ -2088,13 +2833,8 @@ namespace nanojit
         if (v == 0 && canClobberCCs) {
             XORPS(r);
         } else {
-            // There's no general way to load an immediate into an XMM reg.
-            // For non-zero floats the best thing is to put the equivalent
-            // 64-bit integer into a scratch GpReg and then move it into the
-            // appropriate FpReg.
-            Register rt = _allocator.allocTempReg(GpRegs);
-            MOVDXR(r, rt);
-            asm_immi(rt, v, canClobberCCs);
+            // There's no immediate form, so load it from the constant pool.
+            MOVSSM(r, findConstSlot(&v, sizeof(v)));
         }
     }
     
@@ -2112,31 +2852,253 @@ namespace nanojit
             if(v1==0){
                 asm_immd(r, v0, canClobberCCs);
             } else {
-                const float4_t* vaddr = findImmF4FromPool(v);
-                bool is_aligned = ( ((uintptr_t)vaddr) & 0xf ) == 0;
-                /* 
-                    We must be sure that MOVAPSRMRIP/MOVAPSRMRIP does NOT cross into a new page.
-                    Hence - isTargetWithinS32 has to make room for 12 bytes (not 8), because
-                    emit_disp32() makes room for displacement (4 bytes) + full-size op (8 bytes)
-                */
-                if( isTargetWithinS32((NIns*)vaddr, 12 ) ) {
-                    int32_t d = int32_t(int64_t(vaddr)-int64_t(_nIns));
-                    is_aligned? MOVAPSRMRIP(r, d):MOVUPSRMRIP(r, d);
-                } else {
-                    Register gp = _allocator.allocTempReg(GpRegs);
-                    is_aligned? MOVAPSRM(r, 0, gp): MOVUPSRM(r,0,gp);
-                    asm_immq(gp, (uint64_t) vaddr, canClobberCCs);
-                }
+                // Pool slots are 16-byte aligned.
+                MOVAPSRMRIP(r, findConstSlot(&v, sizeof(v)));
             }
         }
     }
 
+    // Register setup for a store of 'value' to [rb+rx*scale+d].
+    void Assembler::getBaseIndexReg3(RegisterMask allowValue, LIns* value, Register& rv,
+                                     LIns* base, Register& rb, LIns* index, Register& rx, int32_t& d) {
+        if (!(allowValue & GpRegs)) {
+            // An XMM value can't share a register with the address.
+            getBaseReg2(GpRegs, index, rx, GpRegs, base, rb, d);
+            rv = findRegFor(value, allowValue);
+            return;
+        }
+        getBaseReg2(allowValue, value, rv, GpRegs, base, rb, d);
+        rx = (index == value) ? rv
+           : (index == base)  ? rb
+           : findRegFor(index, GpRegs & ~(rmask(rb) | rmask(rv)));
+    }
+
     void Assembler::asm_store128(LOpcode op, LIns *value, int d, LIns *base) {
         NanoAssert((value->isF4() && (op==LIR_stf4)) ); (void) op;
 
-        Register b = getBaseReg(base, d, BaseRegs);
-        Register r = findRegFor(value, FpRegs);
-        MOVUPSMR(r, d, b);
+        LIns *index;
+        int s;
+        if (getBaseIndexScaleDisp(base, d, index, s)) {
+            Register r, b, x;
+            getBaseIndexReg3(FpRegs, value, r, base, b, index, x, d);
+            MOVUPSMRX(r, d, b, x, s);
+        } else {
+            Register b = getBaseReg(base, d, BaseRegs);
+            Register r = findRegFor(value, FpRegs);
+            MOVUPSMR(r, d, b);
+        }
+    }
+
+    void Assembler::asm_prefetch(LIns *ins) {
+        PrefetchHint h = PrefetchHint(ins->mask());
+        LIns *base = ins->oprnd1();
+        int32_t d = 0;
+        LIns *index;
+        int s;
+        if (getBaseIndexScaleDisp(base, d, index, s)) {
+            Register b, x;
+            getBaseReg2(GpRegs, index, x, GpRegs, base, b, d);
+            PREFETCHMX(h, d, b, x, s);
+        } else {
+            Register b = getBaseReg(base, d, BaseRegs);
+            PREFETCHM(h, d, b);
+        }
+    }
+
+    // Non-temporal stores write around the cache.  They are weakly ordered
+    // with respect to other stores, so asm_sfence_nt() fences them at every
+    // exit of a fragment that contains any.
+    void Assembler::asm_store_nt(LIns *ins) {
+        LOpcode op = ins->opcode();
+        LIns *value = ins->oprnd1();
+        LIns *base = ins->oprnd2();
+        int32_t d = ins->disp();
+        RegisterMask allow = op == LIR_stnti || op == LIR_stntq ? GpRegs : FpRegs;
+
+        LIns *index;
+        int s;
+        Register r, b, x;
+        bool sib = getBaseIndexScaleDisp(base, d, index, s);
+        RegisterMask addrRegs;
+        if (sib) {
+            getBaseIndexReg3(allow, value, r, base, b, index, x, d);
+            addrRegs = rmask(b) | rmask(x);
+        } else {
+            getBaseReg2(allow, value, r, BaseRegs, base, b, d);
+            addrRegs = rmask(b);
+        }
+
+        switch (op) {
+        case LIR_stnti:
+            if (sib) MOVNTILMRX(r, d, b, x, s); else MOVNTILMR(r, d, b);
+            break;
+        case LIR_stntq:
+            if (sib) MOVNTIQMRX(r, d, b, x, s); else MOVNTIQMR(r, d, b);
+            break;
+        case LIR_stntd: {
+            // MOVNTSD is AMD-only, so the double goes through a GpReg.
+            Register t = _allocator.allocTempReg(GpRegs & ~addrRegs);
+            if (sib) MOVNTIQMRX(t, d, b, x, s); else MOVNTIQMR(t, d, b);
+            MOVQRX(t, r);
+            break;
+        }
+        case LIR_stntf4:
+            if (sib) MOVNTPSMRX(r, d, b, x, s); else MOVNTPSMR(r, d, b);
+            break;
+        default:
+            NanoAssertMsg(0, "asm_store_nt should never receive this LIR opcode");
+            break;
+        }
+    }
+
+    // LIR_memcpy and LIR_memset with a constant length up to this many bytes
+    // are expanded inline;  longer or variable lengths use the string
+    // instructions, which fast-string microcode makes competitive.
+    static const int32_t MAX_INLINE_MEMOP = 128;
+
+    void Assembler::asm_memop(LIns *ins) {
+        LOpcode op = ins->opcode();
+        LIns *len = ins->oprnd3();
+        if (op != LIR_memcmp && len->isImmQ() && uint64_t(len->immQ()) <= MAX_INLINE_MEMOP &&
+            (op == LIR_memcpy || ins->oprnd2()->isImmI())) {
+            asm_memop_inline(ins, int32_t(len->immQ()));
+            return;
+        }
+
+        evictIfActive(RDI);
+        evictIfActive(RSI);
+        evictIfActive(RCX);
+
+        LIns *args[3] = { ins->oprnd1(), ins->oprnd2(), len };
+        Register regs[3] = { RDI, RSI, RCX };
+        switch (op) {
+        case LIR_memcpy:
+            REP_MOVSB();
+            break;
+        case LIR_memset:
+            evictIfActive(RAX);
+            regs[1] = RAX;
+            REP_STOSB();
+            break;
+        case LIR_memcmp: {
+            // The result is the difference of the first mismatched bytes,
+            // or zero if there are none.  The XOR sets ZF for a zero length.
+            prepareResultReg(ins, rmask(RAX));
+            underrunProtect(32);
+            NIns *done = _nIns;
+            SUBRR(RAX, RCX);
+            MOVZX8M(RCX, -1, RSI);
+            MOVZX8M(RAX, -1, RDI);
+            JE8(0, done);
+            REPE_CMPSB();
+            XORRR(RAX, RAX);
+            freeResourcesOf(ins);
+            break;
+        }
+        default:
+            NanoAssertMsg(0, "asm_memop should never receive this LIR opcode");
+            break;
+        }
+        asm_memop_args(3, args, regs);
+    }
+
+    // Puts the operands of a string instruction into their fixed registers,
+    // which the caller must have evicted.  An operand that appears twice is
+    // copied from its first register.
+    void Assembler::asm_memop_args(int n, LIns* args[], Register regs[]) {
+        bool dup[3] = { false, false, false };
+        NanoAssert(n <= 3);
+        for (int i = n-1; i > 0; i--) {
+            for (int j = 0; j < i; j++) {
+                if (args[i] == args[j] && !args[i]->isImmAny()) {
+                    MR(regs[i], regs[j]);
+                    dup[i] = true;
+                    break;
+                }
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            if (dup[i])
+                continue;
+            if (args[i]->isImmI())
+                asm_immi(regs[i], args[i]->immI(), /*canClobberCCs*/true);
+            else if (args[i]->isImmQ())
+                asm_immq(regs[i], args[i]->immQ(), /*canClobberCCs*/true);
+            else
+                findSpecificRegFor(args[i], regs[i]);
+        }
+    }
+
+    // Expands a short LIR_memcpy or LIR_memset into 16-byte XMM moves.  A
+    // tail shorter than 16 bytes overlaps the previous move when there is
+    // one, and otherwise uses the two widest GpReg moves that cover it.
+    void Assembler::asm_memop_inline(LIns *ins, int32_t len) {
+        if (len == 0)
+            return;
+
+        int32_t offs[MAX_INLINE_MEMOP/16 + 2];
+        int32_t size;
+        int n = 0;
+        if (len >= 16) {
+            size = 16;
+            for (int32_t off = 0; off + 16 <= len; off += 16)
+                offs[n++] = off;
+            if (len % 16)
+                offs[n++] = len - 16;
+        } else {
+            size = len >= 8 ? 8 : len >= 4 ? 4 : len >= 2 ? 2 : 1;
+            offs[n++] = 0;
+            if (len != size)
+                offs[n++] = len - size;
+        }
+
+        bool isSet = ins->isop(LIR_memset);
+        LIns *dst = ins->oprnd1();
+        LIns *src = ins->oprnd2();
+        int32_t dd = 0;
+        Register rd, rs = UnspecifiedReg;
+        RegisterMask used;
+        if (isSet) {
+            rd = getBaseReg(dst, dd, BaseRegs);
+            used = rmask(rd);
+        } else {
+            getBaseReg2(GpRegs, src, rs, BaseRegs, dst, rd, dd);
+            used = rmask(rd) | rmask(rs);
+        }
+        uint64_t pattern = isSet ? uint64_t(uint8_t(src->immI())) * 0x0101010101010101ULL : 0;
+        Register rt = (size < 16 || pattern != 0) ? _allocator.allocTempReg(GpRegs & ~used) : UnspecifiedReg;
+        Register rx = size == 16 ? _allocator.allocTempReg(FpRegs) : UnspecifiedReg;
+
+        for (int i = n-1; i >= 0; i--) {
+            int32_t off = offs[i];
+            switch (size) {
+            case 16: MOVUPSMR(rx, dd+off, rd); if (!isSet) MOVUPSRM(rx, off, rs);  break;
+            case 8:  MOVQMR(rt, dd+off, rd);   if (!isSet) MOVQRM(rt, off, rs);    break;
+            case 4:  MOVLMR(rt, dd+off, rd);   if (!isSet) MOVLRM(rt, off, rs);    break;
+            case 2:  MOVSMR(rt, dd+off, rd);   if (!isSet) MOVZX16M(rt, off, rs);  break;
+            default: MOVBMR(rt, dd+off, rd);   if (!isSet) MOVZX8M(rt, off, rs);   break;
+            }
+        }
+        if (isSet) {
+            if (size == 16) {
+                if (pattern == 0) {
+                    XORPS(rx);
+                } else {
+                    MOVLHPS(rx, rx);
+                    MOVQXR(rx, rt);
+                }
+            }
+            if (rt != UnspecifiedReg)
+                asm_immq(rt, pattern, /*canClobberCCs*/true);
+        }
+    }
+
+    // Called where code leaves the fragment.  Nb: code is generated
+    // backwards, so the SFENCE executes before whatever was emitted just
+    // before this call.
+    void Assembler::asm_sfence_nt() {
+        if (_thisfrag->lirbuf->hasNonTemporalStores)
+            SFENCE();
     }
 
     void Assembler::asm_store64(LOpcode op, LIns *value, int d, LIns *base) {
@@ -2144,8 +3106,50 @@ namespace nanojit
         // convenient to do it here than asm_store32, which only handles GP registers.
         NanoAssert(op == LIR_stf ? value->isF() : value->isQorD());
 
+        LIns *index;
+        int s;
+        if (getBaseIndexScaleDisp(base, d, index, s)) {
+            Register r, b, x;
+            switch (op) {
+                case LIR_stq:
+                case LIR_strelq: {
+                    uint64_t c;
+                    if (value->isImmQ() && (c = value->immQ(), isS32(c))) {
+                        getBaseReg2(GpRegs, index, x, GpRegs, base, b, d);
+                        MOVQMIX(b, d, x, s, int32_t(c));
+                    } else {
+                        getBaseIndexReg3(GpRegs, value, r, base, b, index, x, d);
+                        MOVQMRX(r, d, b, x, s);
+                    }
+                    break;
+                }
+                case LIR_std:
+                    getBaseIndexReg3(FpRegs, value, r, base, b, index, x, d);
+                    MOVSDMRX(r, d, b, x, s);
+                    break;
+                case LIR_stf:
+                    getBaseIndexReg3(FpRegs, value, r, base, b, index, x, d);
+                    MOVSSMRX(r, d, b, x, s);
+                    break;
+                case LIR_std2f: {
+                    getBaseIndexReg3(FpRegs, value, r, base, b, index, x, d);
+                    Register t = _allocator.allocTempReg(FpRegs & ~rmask(r));
+
+                    MOVSSMRX(t, d, b, x, s);
+                    CVTSD2SS(t, r);     // cvt to single-precision
+                    XORPS(t);           // break dependency chains
+                    break;
+                }
+                default:
+                    NanoAssertMsg(0, "asm_store64 should never receive this LIR opcode");
+                    break;
+            }
+            return;
+        }
+
         switch (op) {
-            case LIR_stq: {
+            case LIR_stq:
+            case LIR_strelq: {  // x64 stores already have release semantics
                 uint64_t c;
                 if (value->isImmQ() && (c = value->immQ(), isS32(c))) {
                     uint64_t c = value->immQ();
@@ -2187,22 +3191,53 @@ namespace nanojit
         }
     }
 
+    // LIR_streli is handled like LIR_sti:  x64 stores already have release
+    // semantics.
     void Assembler::asm_store32(LOpcode op, LIns *value, int d, LIns *base) {
+        // Quirk of x86-64: reg cannot appear to be ah/bh/ch/dh for
+        // single-byte stores with REX prefix.
+        const RegisterMask SrcRegs = (op == LIR_sti2c) ? SingleByteStoreRegs : GpRegs;
+
+        LIns *index;
+        int s;
+        if (getBaseIndexScaleDisp(base, d, index, s)) {
+            Register r, b, x;
+            if (value->isImmI()) {
+                getBaseReg2(GpRegs, index, x, GpRegs, base, b, d);
+                int c = value->immI();
+                switch (op) {
+                    case LIR_sti2c: MOVBMIX(b, d, x, s, c); break;
+                    case LIR_sti2s: MOVSMIX(b, d, x, s, c); break;
+                    case LIR_sti:
+                    case LIR_streli: MOVLMIX(b, d, x, s, c); break;
+                    default:        NanoAssert(0);          break;
+                }
+            } else {
+                NanoAssert(value->isI());
+                getBaseIndexReg3(SrcRegs, value, r, base, b, index, x, d);
+                switch (op) {
+                    case LIR_sti2c: MOVBMRX(r, d, b, x, s); break;
+                    case LIR_sti2s: MOVSMRX(r, d, b, x, s); break;
+                    case LIR_sti:
+                    case LIR_streli: MOVLMRX(r, d, b, x, s); break;
+                    default:        NanoAssert(0);          break;
+                }
+            }
+            return;
+        }
+
         if (value->isImmI()) {
             Register rb = getBaseReg(base, d, BaseRegs);
             int c = value->immI();
             switch (op) {
                 case LIR_sti2c: MOVBMI(rb, d, c); break;
                 case LIR_sti2s: MOVSMI(rb, d, c); break;
-                case LIR_sti:   MOVLMI(rb, d, c); break;
+                case LIR_sti:
+                case LIR_streli: MOVLMI(rb, d, c); break;
                 default:        NanoAssert(0);    break;
             }
 
         } else {
-            // Quirk of x86-64: reg cannot appear to be ah/bh/ch/dh for
-            // single-byte stores with REX prefix.
-            const RegisterMask SrcRegs = (op == LIR_sti2c) ? SingleByteStoreRegs : GpRegs;
-
             NanoAssert(value->isI());
             Register b = getBaseReg(base, d, BaseRegs);
             Register r = findRegFor(value, SrcRegs & ~rmask(b));
@@ -2210,7 +3245,8 @@ namespace nanojit
             switch (op) {
                 case LIR_sti2c: MOVBMR(r, d, b); break;
                 case LIR_sti2s: MOVSMR(r, d, b); break;
-                case LIR_sti:   MOVLMR(r, d, b); break;
+                case LIR_sti:
+                case LIR_streli: MOVLMR(r, d, b); break;
                 default:        NanoAssert(0);   break;
             }
         }
@@ -2276,24 +3312,34 @@ namespace nanojit
         if (v == 0 && canClobberCCs) {
             XORPS(r);
         } else {
-            // There's no general way to load an immediate into an XMM reg.
-            // For non-zero floats the best thing is to put the equivalent
-            // 64-bit integer into a scratch GpReg and then move it into the
-            // appropriate FpReg.
-            Register rt = _allocator.allocTempReg(GpRegs);
-            MOVQXR(r, rt);
-            asm_immq(rt, v, canClobberCCs);
+            // There's no immediate form, so load it from the constant pool.
+            MOVSDM(r, findConstSlot(&v, sizeof(v)));
         }
     }
 
     void Assembler::asm_param(LIns *ins) {
         uint32_t a = ins->paramArg();
+        if (!ins->isop(LIR_paramp)) {
+            // Floating-point param, only passed in registers to internal-ABI
+            // fragments.  There is no way to read one from the stack, so
+            // ValidateWriter rejects those beyond the registers.
+            NanoAssert(_thisfrag->lirbuf->abi == ABI_INTERNAL);
+            Register r = fpArgReg(a);
+            if (r != UnspecifiedReg)
+                prepareResultReg(ins, rmask(r));
+            else
+                setError(StackParam);
+            freeResourcesOf(ins);
+            return;
+        }
         uint32_t kind = ins->paramKind();
         if (kind == 0) {
-            // Ordinary param.  First four or six args always in registers for x86_64 ABI.
-            if (a < (uint32_t)NumArgRegs) {
+            // Ordinary param.  First four or six args always in registers for
+            // x86_64 ABI, and two more for the internal ABI.
+            Register r = intArgReg(_thisfrag->lirbuf->abi, a);
+            if (r != UnspecifiedReg) {
                 // incoming arg in register
-                prepareResultReg(ins, rmask(RegAlloc::argRegs[a]));
+                prepareResultReg(ins, rmask(r));
                 // No code to generate.
             } else {
                 // todo: support stack based args, arg 0 is at [FP+off] where off
@@ -2303,12 +3349,26 @@ namespace nanojit
         }
         else {
             // Saved param.
+            NanoAssert(!isPinnedSavedReg(a));
             prepareResultReg(ins, rmask(RegAlloc::savedRegs[a]));
             // No code to generate.
         }
         freeResourcesOf(ins);
     }
 
+    void Assembler::asm_contextp(LIns *ins) {
+        if (_config.pinned_context) {
+            // Copy out of the pinned register; loads and stores based on the
+            // context use it directly (see getBaseReg()).
+            Register rr = prepareResultReg(ins, GpRegs);
+            MR(rr, ContextReg);
+        } else {
+            // An ordinary first parameter.
+            prepareResultReg(ins, rmask(RegAlloc::argRegs[0]));
+        }
+        freeResourcesOf(ins);
+    }
+
     // Register setup for 2-address style unary ops of the form R = (op) R.
     // Pairs with endOpRegs().
     void Assembler::beginOp1Regs(LIns* ins, RegisterMask allow, Register &rr, Register &ra) {
@@ -2380,40 +3440,9 @@ namespace nanojit
         if (isS32(mask)) {
             // builtin code is in bottom or top 2GB addr space, use absolute addressing
             XORPSA(rr, (int32_t)mask);
-        } else if (isTargetWithinS32((NIns*)mask)) {
-            // jit code is within +/-2GB of builtin code, use rip-relative
-            XORPSM(rr, (NIns*)mask);
         } else {
-            // This is just hideous - can't use RIP-relative load, can't use
-            // absolute-address load, and cant move imm64 const to XMM.
-            // Solution: move negateMaskD into a temp GP register, then copy to
-            // a temp XMM register.
-            // Nb: we don't want any F64 values to end up in a GpReg, nor any
-            // I64 values to end up in an FpReg.
-            //
-            //   # 'gt' and 'ga' are temporary GpRegs.
-            //   # ins->oprnd1() is in 'rr' (FpRegs)
-            //   mov   gt, 0x8000000000000000
-            //   mov   rt, gt
-            //   xorps rr, rt
-
-            // NOTE: we can use allocTempReg, since we allocate from different classes,
-            // AND all the called functions (asm_immq, asm_immi) don't alloc/inspect the regstate
-            // But this is arguably dangerous (some called function may change in the future), 
-            Register rt = _allocator.allocTempReg(FpRegs & ~(rmask(ra)|rmask(rr)));
-            Register gt = _allocator.allocTempReg(GpRegs);
-            XORPS(rr, rt);
-
-            if (ins->isop(LIR_negf) || ins->isop(LIR_negf4)) {
-                if (ins->isop(LIR_negf4))
-                    PSHUFD(rt,rt,PSHUFD_MASK(0, 0, 0, 0));    // copy mask in all 4 components of the float4 vector 
-                MOVDXR(rt, gt);
-                asm_immi(gt, negateMaskF[0], /*canClobberCCs*/true); 
-            } else {
-                // LIR_negd
-                MOVQXR(rt, gt);
-                asm_immq(gt, negateMaskD[0], /*canClobberCCs*/true);
-            }
+            // use a copy in the constant pool
+            XORPSM(rr, findSlot((const void*)mask, 12));
         }
         if (ra != rr)
             asm_nongp_copy(rr,ra);
@@ -2424,6 +3453,129 @@ namespace nanojit
         NanoAssert(!"not implemented");
     }
 
+    // Loads a floating-point constant, given as its bits, into 'r' via 'gt'.
+    // For float4 the constant is copied into all four lanes.
+    void Assembler::asm_round_const(Register r, Register gt, LTy ty, uint32_t bitsF, uint64_t bitsD) {
+        if (ty == LTy_D) {
+            MOVQXR(r, gt);
+            asm_immq(gt, bitsD, /*canClobberCCs*/true);
+        } else {
+            if (ty == LTy_F4)
+                PSHUFD(r, r, PSHUFD_MASK(0, 0, 0, 0));
+            MOVDXR(r, gt);
+            asm_immi(gt, bitsF, /*canClobberCCs*/true);
+        }
+    }
+
+    void Assembler::asm_round(LIns *ins) {
+        LOpcode op = ins->opcode();
+        LTy ty = ins->retType();
+        RoundingMode mode = getRoundingMode(op);
+
+        if (_config.i386_sse41) {
+            // Bit 3 of the immediate suppresses the inexact exception, as
+            // C's floor() and friends do.
+            static const int roundImm[] = { 1|8, 2|8, 3|8, 0|8 };   // indexed by RoundingMode
+            Register rr, ra;
+            beginOp1Regs(ins, FpRegs, rr, ra);
+            switch (ty) {
+            case LTy_D:  ROUNDSD(rr, ra, roundImm[mode]); break;
+            case LTy_F:  ROUNDSS(rr, ra, roundImm[mode]); break;
+            default:     ROUNDPS(rr, ra, roundImm[mode]); break;
+            }
+            endOpRegs(ins, rr, ra);
+            return;
+        }
+
+        // Without SSE4.1 we round |x| to nearest by adding and subtracting
+        // 2^52 (2^23 for floats), fix that up for the other modes and put
+        // the sign back.  Values too big for that are already integral, as
+        // are infinities, and are passed through along with NaNs:
+        //
+        //   s = x & SIGN
+        //   a = x ^ s                  # |x|
+        //   t = MAGIC
+        //   r = a + t - t              # rint(|x|)
+        //   u = a < t                  # mask of lanes that needed rounding
+        //   trunc:  t = a < r;  r -= t & 1.0
+        //   floor:  r |= s;  t = x < r;  r -= t & 1.0
+        //   ceil:   r |= s;  t = r < x;  r += t & 1.0
+        //   r |= s                     # zero results keep x's sign
+        //   r = (r & u) | (x & ~u)
+        Register rr = prepareResultReg(ins, FpRegs);
+        Register ra = findRegFor(ins->oprnd1(), FpRegs & ~rmask(rr));
+        RegisterMask free = FpRegs & ~rmask(rr) & ~rmask(ra);
+        Register rs = _allocator.allocTempReg(free);
+        free &= ~rmask(rs);
+        Register rabs = _allocator.allocTempReg(free);
+        free &= ~rmask(rabs);
+        Register rt = _allocator.allocTempReg(free);
+        free &= ~rmask(rt);
+        Register ru = _allocator.allocTempReg(free);
+        Register gt = _allocator.allocTempReg(GpRegs);
+
+        const uint32_t oneF = 0x3F800000, magicF = 0x4B000000, signF = 0x80000000;
+        const uint64_t oneD = 0x3FF0000000000000LL, magicD = 0x4330000000000000LL,
+                       signD = 0x8000000000000000LL;
+
+        // The code is generated backwards.
+        ORPS(rr, ru);
+        ANDNPS(ru, ra);
+        ANDPS(rr, ru);
+        ORPS(rr, rs);
+        if (mode != ROUND_NEAREST) {
+            if (ty == LTy_D)         mode == ROUND_CEIL ? ADDSD(rr, rt) : SUBSD(rr, rt);
+            else if (ty == LTy_F)    mode == ROUND_CEIL ? ADDSS(rr, rt) : SUBSS(rr, rt);
+            else                     mode == ROUND_CEIL ? ADDPS(rr, rt) : SUBPS(rr, rt);
+            ANDPS(rt, rabs);
+            asm_round_const(rabs, gt, ty, oneF, oneD);      // |x| is no longer needed
+            Register lhs = mode == ROUND_CEIL ? rr : (mode == ROUND_FLOOR ? ra : rabs);
+            Register rhs = mode == ROUND_CEIL ? ra : rr;
+            if (ty == LTy_D)         CMPLTSD(rt, rhs);
+            else if (ty == LTy_F)    CMPLTSS(rt, rhs);
+            else                     CMPLTPS(rt, rhs);
+            asm_nongp_copy(rt, lhs);
+            if (mode != ROUND_TRUNC)
+                ORPS(rr, rs);
+        }
+        if (ty == LTy_D)         CMPLTSD(ru, rt);
+        else if (ty == LTy_F)    CMPLTSS(ru, rt);
+        else                     CMPLTPS(ru, rt);
+        asm_nongp_copy(ru, rabs);
+        if (ty == LTy_D)         { SUBSD(rr, rt); ADDSD(rr, rt); }
+        else if (ty == LTy_F)    { SUBSS(rr, rt); ADDSS(rr, rt); }
+        else                     { SUBPS(rr, rt); ADDPS(rr, rt); }
+        asm_nongp_copy(rr, rabs);
+        asm_round_const(rt, gt, ty, magicF, magicD);
+        XORPS(rabs, rs);
+        asm_nongp_copy(rabs, ra);
+        ANDPS(rs, ra);
+        asm_round_const(rs, gt, ty, signF, signD);
+
+        freeResourcesOf(ins);
+    }
+
+    void Assembler::asm_copysign(LIns *ins) {
+        //   r = SIGN
+        //   t = r & b
+        //   r = ~r & a
+        //   r |= t
+        Register rr = prepareResultReg(ins, FpRegs);
+        Register ra, rb;
+        findRegFor2(FpRegs & ~rmask(rr), ins->oprnd1(), ra, FpRegs & ~rmask(rr), ins->oprnd2(), rb);
+        Register rt = _allocator.allocTempReg(FpRegs & ~(rmask(rr) | rmask(ra) | rmask(rb)));
+        Register gt = _allocator.allocTempReg(GpRegs);
+
+        // The code is generated backwards.
+        ORPS(rr, rt);
+        ANDNPS(rr, ra);
+        ANDPS(rt, rb);
+        asm_nongp_copy(rt, rr);
+        asm_round_const(rr, gt, LTy_D, 0, 0x8000000000000000LL);
+
+        freeResourcesOf(ins);
+    }
+
     void Assembler::asm_spill(Register rr, int d, int8_t nWords) {
         NanoAssert(d);
         if (!IsFpReg(rr)) {
@@ -2449,13 +3601,59 @@ namespace nanojit
         }
     }
 
+    // A fragment that made no calls, took no exits and never touched its
+    // activation record has nothing addressed off RBP, so it can run on
+    // its caller's stack pointer.  (Slot 0 of the AR is never used.)  With
+    // a pinned context the prologue has to set up ContextReg regardless.
+    bool Assembler::isLeafFrame() {
+        return !_needFrame && !_config.pinned_context &&
+               max_stk_used == 0 && _activation.stackSlotsNeeded() == 1;
+    }
+
     NIns* Assembler::genPrologue() {
+        if (isLeafFrame()) {
+            // Every return was generated as "mov rsp, rbp; pop rbp; ret"
+            // before we knew we were a leaf.  Overwrite the first byte of
+            // each with a ret; the rest of the sequence is never reached.
+            for (Seq<NIns*>* p = _retSites; p != NULL; p = p->tail) {
+                NanoAssert(p->head[0] == 0x48);
+                p->head[0] = 0xC3;
+                verbose_only( if (_logc->lcbits & LC_Native)
+                    outputf("        %p: patched to ret", p->head); )
+            }
+
+            if (_config.code_align) {
+                underrunProtect(_config.code_align);
+                asm_nop_pad(uint32_t(uintptr_t(_nIns)) & (_config.code_align - 1));
+            }
+
+            // Fragments jump to fragEntry with the saved RBP of the frame
+            // they are giving up still pushed, so pop it on the way in.
+            // That's off the path native callers take, so put it with the
+            // exits.
+            NIns *body = _nIns;
+            swapCodeChunks();
+            _inExit = true;
+            verbose_only( _nInsAfter = _nIns; )
+            JMP(body);
+            POPR(RBP);
+            verbose_only( asm_output("[patch entry]"); )
+            NIns *patchEntry = _nIns;
+            swapCodeChunks();
+            _inExit = false;
+            verbose_only( _nInsAfter = _nIns; )
+            verbose_only( asm_output("[frameless]"); )
+            return patchEntry;
+        }
+
         // activation frame is 4 bytes per entry even on 64bit machines
         uint32_t stackNeeded = max_stk_used + _activation.stackSlotsNeeded() * 4;
 
         uint32_t stackPushed =
             sizeof(void*) + // returnaddr
             sizeof(void*); // ebp
+        if (_config.pinned_context)
+            stackPushed += sizeof(void*); // caller's ContextReg
         uint32_t aligned = alignUp(stackNeeded + stackPushed, NJ_ALIGN_STACK);
         uint32_t amt = aligned - stackPushed;
 
@@ -2486,18 +3684,39 @@ namespace nanojit
                 SUBQRI(RSP, amt);
         }
 
+        if (_config.code_align) {
+            // Align the entry point, which is 4 bytes (push + mov) further on,
+            // or 9 bytes if the context register is loaded as well.
+            uint32_t align = _config.code_align;
+            uint32_t entryBytes = _config.pinned_context ? 9 : 4;
+            NanoAssert(align == 16 || align == 32 || align == 64);
+            underrunProtect(align + entryBytes);
+            asm_nop_pad(uint32_t(uintptr_t(_nIns) - entryBytes) & (align - 1));
+        }
+
         verbose_only( asm_output("[patch entry]"); )
         NIns *patchEntry = _nIns;
         MR(FP, RSP);    // Establish our own FP.
         PUSHR(FP);      // Save caller's FP.
+        if (_config.pinned_context) {
+            // Fragments jumping here have already set up ContextReg, but
+            // native callers pass the context as the first argument and
+            // expect their ContextReg back.
+            MR(ContextReg, RegAlloc::argRegs[0]);
+            PUSHR(ContextReg);
+        }
+        NanoAssert(!_config.code_align || (uintptr_t(_nIns) & (_config.code_align - 1)) == 0);
 
         return patchEntry;
     }
 
     NIns* Assembler::genEpilogue() {
         // pop rbp
+        // pop r15 (if the context is pinned)
         // ret
         RET();
+        if (_config.pinned_context)
+            POPR(ContextReg);
         POPR(RBP);
         return _nIns;
     }
@@ -2505,10 +3724,13 @@ namespace nanojit
     RegisterMask RegAlloc::nInitManagedRegisters() {
         // add scratch registers to our free list for the allocator
 #ifdef _WIN64
-        return 0x001fffcf; // rax-rbx, rsi, rdi, r8-r15, xmm0-xmm5
+        RegisterMask managed = 0x001fffcf; // rax-rbx, rsi, rdi, r8-r15, xmm0-xmm5
 #else
-        return 0xffffffff & ~(1<<REGNUM(RSP) | 1<<REGNUM(RBP));
+        RegisterMask managed = 0xffffffff & ~(1<<REGNUM(RSP) | 1<<REGNUM(RBP));
 #endif
+        if (_assembler->_config.pinned_context)
+            managed &= ~rmask(ContextReg);
+        return managed;
     }
 
     void Assembler::nPatchBranch(NIns *patch, NIns *target) {
@@ -2519,6 +3741,15 @@ namespace nanojit
         } else if (patch[0] == 0x0F && (patch[1] & 0xF0) == 0x80) {
             // jcc disp32
             next = patch+6;
+        } else if (patch[0] == 0xEB || (patch[0] & 0xF0) == 0x70) {
+            // jmp disp8, jcc disp8 (back edges shortened by compile())
+            next = patch+2;
+            if (!isS8(target - next)) {
+                setError(BranchTooFar);
+                return;
+            }
+            ((int8_t*)next)[-1] = int8_t(target - next);
+            return;
         } else if ((patch[0] == 0xFF) && (patch[1] == 0x25)) {
             // jmp 64bit target
             // This uses RIP-relative addressing, the 4 bytes after FF 25 is an offset of 0.
@@ -2538,11 +3769,25 @@ namespace nanojit
         ((int32_t*)next)[-1] = int32_t(target - next);
     }
 
+    bool Assembler::nCanShortenBranch(NIns *branch, NIns *target) {
+        // Shortening the branch only brings 'target' closer, so if the
+        // displacement fits in 8 bits now it still will afterwards.
+        NIns *next;
+        if (branch[0] == 0xE9)
+            next = branch+5;
+        else if (branch[0] == 0x0F && (branch[1] & 0xF0) == 0x80)
+            next = branch+6;
+        else
+            return false;
+        return isS8(target - next);
+    }
+
     void Assembler::nFragExit(LIns *guard) {
         SideExit *exit = guard->record()->exit;
         Fragment *frag = exit->target;
         GuardRecord *lr = 0;
         bool destKnown = (frag && frag->fragEntry);
+        _needFrame = true;
         // Generate jump to epilog and initialize lr.
         // If the guard already exists, use a simple jump.
         if (destKnown) {
@@ -2562,13 +3807,307 @@ namespace nanojit
               asm_inc_m32( &guard->record()->profCount );
            }
         )
+        if (_config.prof_counters)
+            asm_inc_m64(newProfCounter(guard->record()));
 
         MR(RSP, RBP);
+        asm_sfence_nt();
 
         // return value is GuardRecord*
         asm_immq(RAX, uintptr_t(lr), /*canClobberCCs*/true);
     }
 
+    // Lazy exits (see Config::lazy_exits).  The stub of a lazy exit is
+    //     movl   eax, <index in LazyExitTable>
+    //     jmp    trampoline
+    // and the trampoline, emitted once per fragment, does what the full stub
+    // would have done, driven by the LazyExit:
+    //     movq   r10, <LazyExitTable*>
+    //     shlq   rax, 4
+    //     addq   rax, exits(r10)
+    //     incl   (rax)                         ; hits
+    //     movl   r11, restore(rax)             ; for each saved register
+    //     andl   r11, 1 << i
+    //     je     1f
+    //     movq   r11, restore[i](r10)
+    //     movq   savedreg[i], 0(rbp,r11,1)
+    //  1: movq   rax, lr(rax)
+    //     movq   rsp, rbp
+    //     jmp    epilogue
+    NIns* Assembler::nLazyExit(LIns* guard)
+    {
+        NanoStaticAssert(sizeof(LazyExit) == 16);     // see the shlq above
+
+        GuardRecord* lr = guard->record();
+        Fragment* frag = lr->exit->target;
+        if (frag && frag->fragEntry)
+            return 0;   // the full stub just jumps to the target
+        verbose_only( if (_logc->lcbits & LC_FragProfile)
+                          return 0; )
+
+        LirBuffer* b = _thisfrag->lirbuf;
+        LazyExitTable* t = _lazyExitTable;
+        if (!t) {
+            t = _lazyExitTable = new (_dataAlloc) LazyExitTable();
+            VMPI_memset(t, 0, sizeof(LazyExitTable));
+            t->nonTemporal = b->hasNonTemporalStores;
+        }
+
+        // Record what intersectRegisterState() would reload in a full stub;
+        // everything else is left as the mainline has it.  A saved register's
+        // value has the same stack slot at every exit.
+        LazyExit le;
+        le.hits = 0;
+        le.restore = 0;
+        le.materialized = false;
+        le.lr = lr;
+        for (int i = 0; i < NumSavedRegs; i++) {
+            LIns* p = b->savedRegs[i];
+            if (p && !isPinnedSavedReg(i) && _allocator.getActive(RegAlloc::savedRegs[i]) != p) {
+                int32_t d = findMemFor(p);
+                NanoAssert(t->restore[i] == 0 || t->restore[i] == d);
+                t->restore[i] = d;
+                le.restore |= uint16_t(1 << i);
+            }
+        }
+        _needFrame = true;
+
+        swapCodeChunks();
+        _inExit = true;
+        verbose_only( _nInsAfter = _nIns; )
+        if (!_lazyTrampoline) {
+            if (!_epilogue)
+                _epilogue = genEpilogue();
+            t->epilogue = _epilogue;
+            _lazyTrampoline = genLazyTrampoline();
+        }
+        JMPl(_lazyTrampoline);
+        lr->jmp = _nIns;
+        MOVI(RAX, int32_t(t->nExits));
+        if (_config.prof_counters)
+            asm_inc_m64(newProfCounter(lr));
+        NIns* stub = _nIns;
+        swapCodeChunks();
+        _inExit = false;
+        verbose_only( _nInsAfter = _nIns; )
+        verbose_only( verbose_outputf("%p: lazy exit", stub); )
+
+        _newLazyExits = new (alloc) Seq<LazyExit>(le, _newLazyExits);
+        t->nExits++;
+        return stub;
+    }
+
+    NIns* Assembler::genLazyTrampoline()
+    {
+        JMP(_epilogue);
+        MR(RSP, RBP);
+        MOVQRM(RAX, int32_t(offsetof(LazyExit, lr)), RAX);
+        LirBuffer* b = _thisfrag->lirbuf;
+        for (int i = 0; i < NumSavedRegs; i++) {
+            if (!b->savedRegs[i] || isPinnedSavedReg(i))
+                continue;
+            NIns* skip = _nIns;
+            MOVQRMX(RegAlloc::savedRegs[i], 0, FP, R11, 0);
+            MOVQRM(R11, int32_t(offsetof(LazyExitTable, restore) + i * sizeof(intptr_t)), R10);
+            JE(8, skip);
+            ANDLR8(R11, 1 << i);
+            MOVLRM(R11, int32_t(offsetof(LazyExit, restore)), RAX);
+        }
+        asm_sfence_nt();
+        emit(X64_inclmRAX);
+        asm_output("incl (rax)");
+        ADDQRM(RAX, int32_t(offsetof(LazyExitTable, exits)), R10);
+        SHLQI(RAX, 4);
+        asm_immq(R10, uintptr_t(_lazyExitTable), /*canClobberCCs*/true);
+        verbose_only( verbose_outputf("%p: lazy exit trampoline", _nIns); )
+        return _nIns;
+    }
+
+    // Assembles the full stub of a lazy exit of 'frag' into a chunk of its
+    // own, adds it to the code of 'frag' and points the lazy stub at it.
+    // Only valid between compilations.
+    bool Assembler::nMaterializeExit(Fragment* frag, LazyExit* le)
+    {
+        LazyExitTable* t = frag->lazyExits;
+        NIns* stubJmp = (NIns*)le->lr->jmp;
+        CodeList* fragCode = codeList;
+        clearNInsPtrs();
+        nativePageReset();
+        nativePageSetup();
+        verbose_only( StringList asmOutput(alloc); )
+        verbose_only( _outputCache = &asmOutput; )
+
+        JMPl(t->epilogue);
+        NIns* jmp = _nIns;
+        MR(RSP, RBP);
+        if (t->nonTemporal)
+            SFENCE();
+        asm_immq(RAX, uintptr_t(le->lr), /*canClobberCCs*/true);
+        for (int i = NumSavedRegs - 1; i >= 0; i--) {
+            if (le->restore & (1 << i))
+                MOVQRM(RegAlloc::savedRegs[i], int32_t(t->restore[i]), FP);
+        }
+        NIns* stub = _nIns;
+
+        bool ok = isS32(stub - (stubJmp + 5));
+        if (ok) {
+            addStubCode(frag);
+            nPatchBranch(stubJmp, stub);
+            CodeAlloc::flushICache(stubJmp, LARGEST_BRANCH_PATCH);
+            le->lr->jmp = jmp;
+            le->materialized = true;
+        } else {
+            _codeAlloc.free(codeStart, codeEnd);
+        }
+
+        verbose_only(
+            _outputCache = 0;
+            if (ok && (_logc->lcbits & LC_Native)) {
+                outputf("=== materialized exit %p:", (void*)le->lr);
+                for (Seq<char*>* p = asmOutput.get(); p != NULL; p = p->tail)
+                    outputf("  %s", p->head);
+            }
+        )
+        clearNInsPtrs();
+        nativePageReset();
+        codeList = fragCode;
+        return ok;
+    }
+
+    // Shared exits (see Config::share_exits).  The stub of a guard is
+    //     movq   rax, <GuardRecord*>
+    //     jmp    body
+    // and the body, which other guards may jump to as well, is
+    //     movq   savedreg, disp(rbp)           ; for each register to reload
+    //     sfence                               ; if there are non-temporal stores
+    //     movq   rsp, rbp
+    //     jmp    epilogue or target
+    // The reloads are all FP-relative, so two bodies with the same bytes do
+    // the same thing.  Only guards of the same fragment share a body, so no
+    // fragment jumps into the code of another one, which could be freed
+    // before it.
+    void Assembler::nSharedExit(LIns* guard, RegAlloc& capture)
+    {
+        GuardRecord* lr = guard->record();
+        Fragment* frag = lr->exit->target;
+        bool destKnown = (frag && frag->fragEntry);
+        _needFrame = true;
+        if (!destKnown && !_epilogue)
+            _epilogue = genEpilogue();
+        NIns* target = destKnown ? frag->fragEntry : _epilogue;
+
+        // Assemble the body, then drop it again if there is one like it.
+        NIns* chunk = codeStart;
+        NIns* end = _nIns;
+        verbose_only( StringList* outer = _outputCache; )
+        verbose_only( StringList bodyOutput(alloc); )
+        verbose_only( if (outer) _outputCache = &bodyOutput; )
+        if (destKnown)
+            JMP(target);
+        else
+            JMPl(target);
+        NIns* tail = _nIns;
+        MR(RSP, RBP);
+        asm_sfence_nt();
+        assignSavedRegs();
+        assignParamRegs();
+        intersectRegisterState(capture);
+        NIns* body = _nIns;
+        verbose_only( _outputCache = outer; )
+
+        SharedExit* se = NULL;
+        bool reused = false;
+        if (codeStart == chunk) {
+            // The body didn't have to continue in a new chunk.
+            uint32_t size = uint32_t(tail - body);
+            se = findSharedExit(body, size, target);
+            if (se) {
+                _nIns = end;
+                verbose_only( _nInsAfter = _nIns; )
+                reused = true;
+            } else {
+                se = addSharedExit(body, size, target);
+            }
+        }
+        verbose_only(
+            if (outer && !reused) {
+                Seq<char*>* lines = NULL;
+                for (Seq<char*>* p = bodyOutput.get(); p != NULL; p = p->tail)
+                    lines = new (alloc) Seq<char*>(p->head, lines);
+                for (; lines != NULL; lines = lines->tail)
+                    outer->insert(lines->head);
+            }
+        )
+
+        // A guard with a known target is never patched, so it can simply
+        // fall into a body of its own.
+        if (se && (reused || !destKnown)) {
+            NIns* headEnd = _nIns;
+            JMPl(se->body);
+            if (!destKnown) {
+                lr->jmp = _nIns;
+                if (!_newSharedGuards)
+                    _newSharedGuards = new (_dataAlloc) SharedGuardMap(_dataAlloc);
+                _newSharedGuards->put(lr, se);
+            }
+            if (reused)
+                _newSharedExitBytes += (end - body) - (headEnd - _nIns);
+        } else if (!destKnown) {
+            lr->jmp = tail;
+        }
+
+        // return value is GuardRecord*
+        asm_immq(RAX, destKnown ? 0 : uintptr_t(lr), /*canClobberCCs*/true);
+        if (_config.prof_counters)
+            asm_inc_m64(newProfCounter(lr));
+    }
+
+    // Gives a guard of 'frag' that jumps to a shared exit body a copy of the
+    // body of its own, added to the code of 'frag', so that it can be
+    // retargeted.  Only valid between compilations.
+    bool Assembler::nUnshareExit(Fragment* frag, GuardRecord* lr, SharedExit* se)
+    {
+        CodeList* fragCode = codeList;
+        clearNInsPtrs();
+        nativePageReset();
+        nativePageSetup();
+        verbose_only( StringList asmOutput(alloc); )
+        verbose_only( _outputCache = &asmOutput; )
+
+        JMPl(se->target);
+        NIns* jmp = _nIns;
+        underrunProtect(se->size);
+        IF_PEDANTIC( pedanticTop = _nIns - se->size; )
+        _nIns -= se->size;
+        memcpy(_nIns, se->body, se->size);
+        NIns* copy = _nIns;
+
+        NIns* stubJmp = (NIns*)lr->jmp;
+        bool ok = !(stubJmp[0] == 0xE9 && !isS32(copy - (stubJmp + 5)));
+        if (ok) {
+            addStubCode(frag);
+            nPatchBranch(stubJmp, copy);
+            CodeAlloc::flushICache(stubJmp, LARGEST_BRANCH_PATCH);
+            lr->jmp = jmp;
+        } else {
+            _codeAlloc.free(codeStart, codeEnd);
+        }
+
+        verbose_only(
+            _outputCache = 0;
+            if (ok && (_logc->lcbits & LC_Native)) {
+                outputf("=== unshared exit %p:", (void*)lr);
+                outputf("  %p: [%u bytes of %p]", (void*)copy, se->size, (void*)se->body);
+                for (Seq<char*>* p = asmOutput.get(); p != NULL; p = p->tail)
+                    outputf("  %s", p->head);
+            }
+        )
+        clearNInsPtrs();
+        nativePageReset();
+        codeList = fragCode;
+        return ok;
+    }
+
     const RegisterMask PREFER_SPECIAL = ~ ((RegisterMask)0);
 
     // Init per-opcode register hint table.  
@@ -2579,18 +4118,32 @@ namespace nanojit
         Hints[LIR_callf]  = rmask(XMM0);
         Hints[LIR_callf4] = rmask(XMM0);
         Hints[LIR_paramp] = PREFER_SPECIAL;
+        Hints[LIR_contextp] = PREFER_SPECIAL;
+        Hints[LIR_paramd] = PREFER_SPECIAL;
+        Hints[LIR_paramf] = PREFER_SPECIAL;
+        Hints[LIR_paramf4] = PREFER_SPECIAL;
         return true;
     }
 
     void Assembler::nBeginAssembly() {
         max_stk_used = 0;
+        _tailCall = NULL;
+        _needFrame = false;
+        _retSites = NULL;
+    }
+
+    // Size and alignment of the slots at the bottom of a chunk, see findSlot().
+    static const size_t SlotSize = 16;
+
+    static inline NIns* slotBase(NIns* start) {
+        return (NIns*)alignUp(start, SlotSize);
     }
 
     // This should only be called from within emit() et al.
     void Assembler::underrunProtect(ptrdiff_t bytes) {
         NanoAssertMsg(bytes<=LARGEST_UNDERRUN_PROT, "constant LARGEST_UNDERRUN_PROT is too small");
         NIns *pc = _nIns;
-        NIns *top = codeStart;  // this may be in a normal code chunk or an exit code chunk
+        NIns *top = _nSlot;  // this may be in a normal code chunk or an exit code chunk
 
     #if PEDANTIC
         // pedanticTop is based on the last call to underrunProtect; any time we call
@@ -2607,6 +4160,7 @@ namespace nanojit
                 verbose_only(if (_logc->lcbits & LC_Native) outputf("newpage %p:", pc);)
                 // This may be in a normal code chunk or an exit code chunk.
                 codeAlloc(codeStart, codeEnd, _nIns verbose_only(, codeBytes));
+                _nSlot = slotBase(codeStart);
             }
             // now emit the jump, but make sure we won't need another page break.
             // we're pedantic, but not *that* pedantic.
@@ -2619,6 +4173,7 @@ namespace nanojit
             verbose_only(if (_logc->lcbits & LC_Native) outputf("newpage %p:", pc);)
             // This may be in a normal code chunk or an exit code chunk.
             codeAlloc(codeStart, codeEnd, _nIns verbose_only(, codeBytes));
+            _nSlot = slotBase(codeStart);
             // This jump will call underrunProtect again, but since we're on a new
             // page, nothing will happen.
             JMP(pc);
@@ -2636,11 +4191,18 @@ namespace nanojit
         if (prefer != PREFER_SPECIAL)
           return prefer;
 
-        NanoAssert(ins->isop(LIR_paramp));
+        if (ins->isop(LIR_contextp))
+            return _assembler->_config.pinned_context ? 0 : rmask(argRegs[0]);
+
         uint8_t arg = ins->paramArg();
-        if (ins->paramKind() == 0) {
-            if (arg < maxArgRegs)
-                prefer = rmask(argRegs[arg]);
+        if (!ins->isop(LIR_paramp)) {
+            Register r = fpArgReg(arg);
+            if (r != UnspecifiedReg)
+                prefer = rmask(r);
+        } else if (ins->paramKind() == 0) {
+            Register r = intArgReg(_assembler->_thisfrag->lirbuf->abi, arg);
+            if (r != UnspecifiedReg)
+                prefer = rmask(r);
         } else {
             if (arg < NumSavedRegs)
                 prefer = rmask(savedRegs[arg]);
@@ -2654,10 +4216,58 @@ namespace nanojit
             codeAlloc(codeStart, codeEnd, _nIns verbose_only(, codeBytes));
             IF_PEDANTIC( pedanticTop = _nIns; )
         }
+        if (!_nSlot)
+            _nSlot = slotBase(codeStart);
     }
 
     void Assembler::nativePageReset()
-    {}
+    {
+        _nSlot = 0;
+        _nExitSlot = 0;
+    }
+
+    // The bottom of each chunk holds 16-byte slots, growing up from
+    // codeStart (rounded up) to _nSlot, for veneers and constants that code
+    // in the same chunk reaches RIP-relative.  Returns the slot holding the
+    // 16 bytes at 'bits', adding it if no slot in this chunk does already.
+    // Room is left for an instruction of up to 'insSize' bytes, which the
+    // caller emits next, so that it lands in the same chunk.
+    NIns* Assembler::findSlot(const void* bits, int insSize) {
+        underrunProtect(SlotSize + insSize);
+        for (NIns* p = slotBase(codeStart); p < _nSlot; p += SlotSize) {
+            if (VMPI_memcmp(p, bits, SlotSize) == 0)
+                return p;
+        }
+        NIns* p = _nSlot;
+        _nSlot += SlotSize;
+        memcpy(p, bits, SlotSize);
+        return p;
+    }
+
+    // Returns a slot holding the 'size' bytes at 'v', zero-padded, for an
+    // instruction to read as a RIP-relative memory operand.
+    NIns* Assembler::findConstSlot(const void* v, size_t size) {
+        NanoAssert(size <= SlotSize);
+        AVMPLUS_ALIGN16(uint8_t) bits[SlotSize] = { 0 };
+        memcpy(bits, v, size);
+        return findSlot(bits, 12);          // the disp plus a full-size op
+    }
+
+    // Calls that can't reach their target with a rel32 go through a veneer
+    // in a slot, "jmp [rip+2]" and the 64-bit target.  Calls to the same
+    // target from one chunk share a veneer.
+    NIns* Assembler::veneerFor(NIns* target) {
+        AVMPLUS_ALIGN16(uint8_t) v[SlotSize];
+        v[0] = 0xFF;                        // jmp [rip+2]
+        v[1] = 0x25;
+        *(int32_t*)(v + 2) = 2;
+        v[6] = v[7] = 0xCC;                 // int3 padding
+        *(NIns**)(v + 8) = target;
+        NIns* p = findSlot(v, 8);           // the call to it
+        verbose_only(if (_logc->lcbits & LC_Native)
+            outputf("        %p: veneer to %p", p, target);)
+        return p;
+    }
 
     // Increment the 32-bit profiling counter at pCtr, without
     // changing any registers.
@@ -2676,32 +4286,110 @@ namespace nanojit
     }
     )
 
-    void Assembler::asm_jtbl(NIns** table, Register indexreg)
+    // Increment the 64-bit profile counter at pCtr without changing any
+    // registers.  That is a single incq if the counter is within reach of
+    // RIP, as it usually is with code allocated near the helpers.
+    void Assembler::asm_inc_m64(uint64_t* pCtr)
     {
-        if (isS32((intptr_t)table)) {
-            // table is in low 2GB or high 2GB, can use absolute addressing
-            // jmpq [indexreg*8 + table]
-            JMPX(indexreg, table);
+        if (isTargetWithinS32((NIns*)pCtr, 4+8)) {
+            emitxm_rel(X64_incqmrip, RZero, (NIns*)pCtr);
+            asm_output("incq (%p)", (void*)pCtr);
         } else {
-            // don't use R13 for base because we want to use mod=00, i.e. [index*8+base + 0]
-            Register tablereg =  _allocator.allocTempReg(GpRegs & ~(rmask(indexreg)|rmask(R13)));
-            // jmp [indexreg*8 + tablereg]
-            JMPXB(indexreg, tablereg);
-            // tablereg <- #table
-            asm_immq(tablereg, (uint64_t)table, /*canClobberCCs*/true);
+            // As in asm_inc_m32().
+            emitr(X64_popr, RAX);
+            emit(X64_incqmRAX);
+            asm_output("incq (rax)");
+            asm_immq(RAX, (uint64_t)pCtr, /*canClobberCCs*/true);
+            emitr(X64_pushr, RAX);
+        }
+    }
+
+    // The table lives in the code chunk right after the dispatch (nothing
+    // falls through a jtbl) and holds 32-bit offsets from its own start,
+    // so it shares the cache lines and TLB page of the code using it and
+    // needs no absolute addresses:
+    //     lea     tablereg, table(%rip)
+    //     movsxd  indexreg, 0(tablereg,indexreg,4)
+    //     add     tablereg, indexreg
+    //     jmp     *tablereg
+    //   table:
+    //     .long   target0-table, target1-table, ...
+    // With edge counters, the dispatch starts by bumping the counter of
+    // the target taken, using tablereg to address the counters:
+    //     movabs  tablereg, counts
+    //     incq    0(tablereg,indexreg,8)
+    NIns* Assembler::asm_jtbl(uint32_t count, Register indexreg, uint64_t* counts)
+    {
+        const size_t dispatchBytes = 7 + 8 + 3 + 3;
+        size_t bytes = count * sizeof(int32_t) + dispatchBytes;
+
+        // The table and the lea addressing it must share a chunk.  No jump
+        // back to the old chunk is needed since control never falls through.
+        if (size_t(_nIns - _nSlot) < bytes) {
+            verbose_only(if (_logc->lcbits & LC_Native) outputf("newpage %p:", _nIns);)
+            codeAlloc(codeStart, codeEnd, _nIns verbose_only(, codeBytes));
+            _nSlot = slotBase(codeStart);
+            if (size_t(_nIns - _nSlot) < bytes) {
+                // Not even a fresh chunk can hold this table.
+                setError(BranchTooFar);
+                return 0;
+            }
+        }
+        IF_PEDANTIC( pedanticTop = _nIns - bytes; )
+
+        _nIns -= count * sizeof(int32_t);
+        NIns* table = _nIns;
+        verbose_only( _nInsAfter = _nIns; )
+        asm_output("[%p]: %u x rel32", (void*)table, count);
+
+        Register tablereg = _allocator.allocTempReg(GpRegs & ~rmask(indexreg));
+        JMPR(tablereg);
+        ADDQRR(tablereg, indexreg);
+        MOVSXDRMX(indexreg, 0, tablereg, indexreg, 2);
+        LEARIP(tablereg, int32_t(table - _nIns));
+        if (counts) {
+            INCQMX(0, tablereg, indexreg, 3);
+            asm_immq(tablereg, (uint64_t)counts, /*canClobberCCs*/true);
         }
+        return table;
     }
 
     void Assembler::swapCodeChunks() {
         if (!_nExitIns) {
             codeAlloc(exitStart, exitEnd, _nExitIns verbose_only(, exitBytes));
         }
+        if (!_nExitSlot)
+            _nExitSlot = slotBase(exitStart);
         SWAP(NIns*, _nIns, _nExitIns);
+        SWAP(NIns*, _nSlot, _nExitSlot);
         SWAP(NIns*, codeStart, exitStart);
         SWAP(NIns*, codeEnd, exitEnd);
         verbose_only( SWAP(size_t, codeBytes, exitBytes); )
     }
 
+    // Emits 'bytes' bytes of padding using the longest NOPs available.
+    void Assembler::asm_nop_pad(uint32_t bytes) {
+        static const uint64_t nops[] = {
+            0, X64_nop1, X64_nop2, X64_nop3, X64_nop4, X64_nop5, X64_nop6, X64_nop7
+        };
+        underrunProtect(bytes);
+        while (bytes > 0) {
+            uint32_t n = bytes < 7 ? bytes : 7;
+            emit(nops[n]);
+            asm_output("nop%u", n);
+            bytes -= n;
+        }
+    }
+
+    void Assembler::nAlignLoop(uint32_t size) {
+        uint32_t align = _config.code_align;
+        NanoAssert(align == 16 || align == 32 || align == 64);
+        // Reserve room for the back edge as well, so that the loop doesn't
+        // start in a new code chunk.
+        underrunProtect(align + 16);
+        asm_nop_pad(uint32_t(uintptr_t(_nIns) - size) & (align - 1));
+    }
+
     void Assembler::asm_insert_random_nop() {
         NanoAssert(0); // not supported
     }
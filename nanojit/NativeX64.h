@@ -31,12 +31,23 @@ namespace nanojit
 #define NJ_ALIGN_STACK                  16
 
 #define NJ_JTBL_SUPPORTED               1
+#define NJ_USES_REL_JTBL                1
 #define NJ_EXPANDED_LOADSTORE_SUPPORTED 1
 #define NJ_F2I_SUPPORTED                1
 #define NJ_SOFTFLOAT_SUPPORTED          0
 #define NJ_DIVI_SUPPORTED               1
+#define NJ_RELAX_BRANCHES_SUPPORTED     1
+#define NJ_CODE_ALIGNMENT_SUPPORTED     1
+#define NJ_CACHE_CONTROL_SUPPORTED      1
+#define NJ_BULK_MEMORY_SUPPORTED        1
+#define NJ_ROUNDING_SUPPORTED           1
+#define NJ_CALL_CLOBBERS_SUPPORTED      1
+#define NJ_PINNED_CONTEXT_SUPPORTED     1
+#define NJ_LAZY_EXITS_SUPPORTED         1
+#define NJ_SHARED_EXITS_SUPPORTED       1
+#define NJ_PROF_COUNTERS_SUPPORTED      1
+#define NJ_EDGE_COUNTERS_SUPPORTED      1
 #define RA_PREFERS_LSREG                1
-#define NJ_USES_IMMF4_POOL              1   // Note: doesn't use IMMD pool!
 
 // exclude R12 because ESP and R12 cannot be used as an index
 // (index=100 in SIB means "none")
@@ -167,6 +178,8 @@ namespace nanojit
         X64_cmplr   = 0xC03B400000000003LL, // 32bit compare r,b
         X64_cmpqr   = 0xC03B480000000003LL, // 64bit compare r,b
         X64_cmppsr  = 0xC0C20F4000000004LL, // 128bit compare r,b; requires an immediate to specify what kind of comparison
+        X64_cmpsdr  = 0xC0C20F40F2000005LL, // compare scalar double r,b; requires an immediate like cmpps
+        X64_cmpssr  = 0xC0C20F40F3000005LL, // compare scalar single-precision r,b; requires an immediate like cmpps
         X64_cmplri  = 0xF881400000000003LL, // 32bit compare r,immI
         X64_cmpqri  = 0xF881480000000003LL, // 64bit compare r,int64(immI)
         X64_cmplr8  = 0x00F8834000000004LL, // 32bit compare r,imm8
@@ -189,9 +202,13 @@ namespace nanojit
         X64_divps   = 0xC05E0F4000000004LL, // divide float4 vector single-precision r[i] /= b[i]
         X64_mulps   = 0xC0590F4000000004LL, // multiply float4 vector single-precision r[i] *= b[i]
         X64_addps   = 0xC0580F4000000004LL, // add float4 vector single-precision r[i] += b[i]
+        X64_cqo     = 0x9948000000000002LL, // sign-extend rax into rdx:rax
         X64_idiv    = 0xF8F7400000000003LL, // 32bit signed div (rax = rdx:rax/r, rdx=rdx:rax%r)
+        X64_idivq   = 0xF8F7480000000003LL, // 64bit signed div (rax = rdx:rax/r, rdx=rdx:rax%r)
         X64_imul    = 0xC0AF0F4000000004LL, // 32bit signed mul r *= b
+        X64_imulq   = 0xC0AF0F4800000004LL, // 64bit signed mul r *= b
         X64_imuli   = 0xC069400000000003LL, // 32bit signed mul r = b * immI
+        X64_imulqi  = 0xC069480000000003LL, // 64bit signed mul r = b * int64(immI)
         X64_imul8   = 0x00C06B4000000004LL, // 32bit signed mul r = b * imm8
         X64_jmpi    = 0x0000000025FF0006LL, // jump *0(rip)
         X64_jmp     = 0x00000000E9000005LL, // jump near rel32
@@ -280,6 +297,12 @@ namespace nanojit
         X64_pshufd  = 0xC0700F4066000005LL, // 64bit PSHUFD xmm1,xmm2,imm
         X64_shufpd  = 0xC0C60F4066000005LL, // 64bit SHUFPD xmm1,xmm2,imm
         X64_pxor    = 0xC0EF0F4066000005LL, // 128bit xor xmm-r ^= xmm-b
+        X64_andps   = 0xC0540F4000000004LL, // 128bit and xmm-r &= xmm-b
+        X64_andnps  = 0xC0550F4000000004LL, // 128bit and-not xmm-r = ~xmm-r & xmm-b
+        X64_orps    = 0xC0560F4000000004LL, // 128bit or xmm-r |= xmm-b
+        X64_roundsd = 0xC00B3A0F40660006LL, // SSE4.1 round scalar double r = round(b); requires an immediate rounding mode
+        X64_roundss = 0xC00A3A0F40660006LL, // SSE4.1 round scalar single-precision r = round(b); likewise
+        X64_roundps = 0xC0083A0F40660006LL, // SSE4.1 round float4 r[i] = round(b[i]); likewise
         X64_ret     = 0xC300000000000001LL, // near return from called procedure
         X64_sete    = 0xC0940F4000000004LL, // set byte if equal (ZF == 1)
         X64_seto    = 0xC0900F4000000004LL, // set byte if overflow (OF == 1)
@@ -320,14 +343,97 @@ namespace nanojit
         X64_xorpsm  = 0x05570F4000000004LL, // 128bit xor xmm, [rip+disp32]
         X64_xorpsa  = 0x2504570F40000005LL, // 128bit xor xmm, [disp32]
         X64_inclmRAX= 0x00FF000000000002LL, // incl (%rax)
-        X64_jmpx    = 0xC524ff4000000004LL, // jmp [d32+x*8]
-        X64_jmpxb   = 0xC024ff4000000004LL, // jmp [b+x*8]
+        X64_incqmRAX= 0x00FF480000000003LL, // incq (%rax)
+        X64_incqmrip= 0x05FF480000000003LL, // incq [rip+disp32]
+        X64_incqmx  = 0x0084FF4800000004LL, // incq [b+x*s+d32]
+        X64_jmpr    = 0xE0FF400000000003LL, // jmp *r
 
         X64_movqmi  = 0x80C7480000000003LL, // 32bit signed extended to 64-bit store imm -> qword ptr[b+disp32]
         X64_movlmi  = 0x80C7400000000003LL, // 32bit store imm -> dword ptr[b+disp32]
         X64_movsmi  = 0x80C7406600000004LL, // 16bit store imm -> word ptr[b+disp32]
         X64_movbmi  = 0x80C6400000000003LL, // 8bit store imm -> byte ptr[b+disp32]
 
+        // reg op [b+d32] forms, used when a single-use load is folded into its user.
+        X64_addlrm  = 0x0000000080034007LL, // 32bit add r += [b+d32]
+        X64_sublrm  = 0x00000000802B4007LL, // 32bit sub r -= [b+d32]
+        X64_andlrm  = 0x0000000080234007LL, // 32bit and r &= [b+d32]
+        X64_orlrm   = 0x00000000800B4007LL, // 32bit or  r |= [b+d32]
+        X64_xorlrm  = 0x0000000080334007LL, // 32bit xor r ^= [b+d32]
+        X64_imullrm = 0x80AF0F4000000004LL, // 32bit signed mul r *= [b+d32]
+        X64_cmplrm  = 0x00000000803B4007LL, // 32bit compare r,[b+d32]
+        X64_cmplmr  = 0x0000000080394007LL, // 32bit compare [b+d32],r
+        X64_cmplmi  = 0xB881400000000003LL, // 32bit compare [b+d32],immI
+        X64_cmplmi8 = 0xB883400000000003LL, // 32bit compare [b+d32],imm8
+        X64_addqrm  = 0x0000000080034807LL, // 64bit add r += [b+d32]
+        X64_subqrm  = 0x00000000802B4807LL, // 64bit sub r -= [b+d32]
+        X64_andqrm  = 0x0000000080234807LL, // 64bit and r &= [b+d32]
+        X64_orqrm   = 0x00000000800B4807LL, // 64bit or  r |= [b+d32]
+        X64_xorqrm  = 0x0000000080334807LL, // 64bit xor r ^= [b+d32]
+        X64_imulqrm = 0x80AF0F4800000004LL, // 64bit signed mul r *= [b+d32]
+        X64_cmpqrm  = 0x00000000803B4807LL, // 64bit compare r,[b+d32]
+        X64_cmpqmr  = 0x0000000080394807LL, // 64bit compare [b+d32],r
+        X64_cmpqmi  = 0xB881480000000003LL, // 64bit compare [b+d32],int64(immI)
+        X64_cmpqmi8 = 0xB883480000000003LL, // 64bit compare [b+d32],int64(imm8)
+        X64_addsdrm = 0x80580F40F2000005LL, // add scalar double r += [b+d32]
+        X64_subsdrm = 0x805C0F40F2000005LL, // subtract scalar double r -= [b+d32]
+        X64_mulsdrm = 0x80590F40F2000005LL, // multiply scalar double r *= [b+d32]
+        X64_divsdrm = 0x805E0F40F2000005LL, // divide scalar double r /= [b+d32]
+        X64_addssrm = 0x80580F40F3000005LL, // add scalar single-precision r += [b+d32]
+        X64_subssrm = 0x805C0F40F3000005LL, // subtract scalar single-precision r -= [b+d32]
+        X64_mulssrm = 0x80590F40F3000005LL, // multiply scalar single-precision r *= [b+d32]
+        X64_divssrm = 0x805E0F40F3000005LL, // divide scalar single-precision r /= [b+d32]
+        X64_ucomisdrm=0x802E0F4066000005LL, // unordered compare scalar double r,[b+d32]
+        X64_ucomissrm=0x802E0F4000000004LL, // unordered compare scalar single-precision r,[b+d32]
+
+        // [b+x*s+d32] forms.  modrm=0x84 (mod=2, rm=100) is followed by the sib byte.
+        X64_movbmrx = 0x0084884000000004LL, // 8bit store r -> [b+x*s+d32]
+        X64_movsmrx = 0x0084894066000005LL, // 16bit store r -> [b+x*s+d32]
+        X64_movlmrx = 0x0084894000000004LL, // 32bit store r -> [b+x*s+d32]
+        X64_movqmrx = 0x0084894800000004LL, // 64bit store gpr -> [b+x*s+d32]
+        X64_movlrmx = 0x00848B4000000004LL, // 32bit load r <- [b+x*s+d32]
+        X64_movqrmx = 0x00848B4800000004LL, // 64bit load r <- [b+x*s+d32]
+        X64_movzx8mx= 0x0084B60F40000005LL, // zero extend i8 load to i32 r <- [b+x*s+d32]
+        X64_movzx16mx=0x0084B70F40000005LL, // zero extend i16 load to i32 r <- [b+x*s+d32]
+        X64_movsx8mx= 0x0084BE0F40000005LL, // sign extend i8 load to i32 r <- [b+x*s+d32]
+        X64_movsx16mx=0x0084BF0F40000005LL, // sign extend i16 load to i32 r <- [b+x*s+d32]
+        X64_movsxdrmx=0x0084634800000004LL, // sign extend i32 load to i64 r <- [b+x*s+d32]
+        X64_movsdrmx= 0x0084100F40F20006LL, // 64bit load xmm-r <- [b+x*s+d32] (upper 64 cleared)
+        X64_movsdmrx= 0x0084110F40F20006LL, // 64bit store xmm-r -> [b+x*s+d32]
+        X64_movssrmx= 0x0084100F40F30006LL, // 32bit load xmm-r <- [b+x*s+d32] (upper 96 cleared)
+        X64_movssmrx= 0x0084110F40F30006LL, // 32bit store xmm-r -> [b+x*s+d32]
+        X64_movupsrmx=0x0084100F40000005LL, // 128bit load xmm-r <- [b+x*s+d32]
+        X64_movupsmrx=0x0084110F40000005LL, // 128bit store xmm-r -> [b+x*s+d32]
+        X64_movqmix = 0x0084C74800000004LL, // 32bit signed extended to 64-bit store imm -> qword ptr[b+x*s+d32]
+        X64_movlmix = 0x0084C74000000004LL, // 32bit store imm -> dword ptr[b+x*s+d32]
+        X64_movsmix = 0x0084C74066000005LL, // 16bit store imm -> word ptr[b+x*s+d32]
+        X64_movbmix = 0x0084C64000000004LL, // 8bit store imm -> byte ptr[b+x*s+d32]
+
+        // atomics.  X64_lock is emitted on its own, just before the instruction it applies to.
+        X64_lock    = 0xF000000000000001LL, // lock prefix
+        X64_cmpxchglmr=0x80B10F4000000004LL, // 32bit compare eax with [b+d32], if equal [b+d32] = r; eax = old [b+d32]
+        X64_cmpxchgqmr=0x80B10F4800000004LL, // 64bit compare rax with [b+d32], if equal [b+d32] = r; rax = old [b+d32]
+        X64_xaddlmr = 0x80C10F4000000004LL, // 32bit exchange and add [b+d32] += r; r = old [b+d32]
+        X64_xaddqmr = 0x80C10F4800000004LL, // 64bit exchange and add [b+d32] += r; r = old [b+d32]
+        X64_xchglmr = 0x0000000080874007LL, // 32bit exchange [b+d32] <-> r (always locked)
+        X64_xchgqmr = 0x0000000080874807LL, // 64bit exchange [b+d32] <-> r (always locked)
+        X64_mfence  = 0xF0AE0F0000000003LL, // full memory fence
+
+        // cache control.  The PrefetchHint is OR'd into the modrm reg field.
+        X64_prefetchm=0x80180F4000000004LL, // prefetch [b+d32]
+        X64_prefetchmx=0x0084180F40000005LL,// prefetch [b+x*s+d32]
+        X64_movntilmr=0x80C30F4000000004LL, // 32bit non-temporal store r -> [b+d32]
+        X64_movntiqmr=0x80C30F4800000004LL, // 64bit non-temporal store r -> [b+d32]
+        X64_movntilmrx=0x0084C30F40000005LL,// 32bit non-temporal store r -> [b+x*s+d32]
+        X64_movntiqmrx=0x0084C30F48000005LL,// 64bit non-temporal store r -> [b+x*s+d32]
+        X64_movntpsmr=0x802B0F4000000004LL, // 128bit non-temporal store xmm-r -> [b+d32] (must be 16-byte aligned)
+        X64_movntpsmrx=0x00842B0F40000005LL,// 128bit non-temporal store xmm-r -> [b+x*s+d32] (must be 16-byte aligned)
+        X64_sfence  = 0xF8AE0F0000000003LL, // store fence
+
+        // string instructions, on rdi/rsi/rcx/al.
+        X64_repmovsb= 0xA4F3000000000002LL, // copy rcx bytes from [rsi] to [rdi]
+        X64_repstosb= 0xAAF3000000000002LL, // set rcx bytes at [rdi] to al
+        X64_repecmpsb=0xA6F3000000000002LL, // compare [rsi] and [rdi] while equal, up to rcx bytes
+
         X86_and8r   = 0xC022000000000002LL, // and rl,rh
         X86_sete    = 0xC0940F0000000003LL, // no-rex version of X64_sete
         X86_setnp   = 0xC09B0F0000000003LL  // no-rex set byte if odd parity (ordered fcmp result) (PF == 0)
@@ -347,11 +453,15 @@ namespace nanojit
                                           1<<REGNUM(R15);
     static const int NumSavedRegs = 7; // rbx, rsi, rdi, r12-15
     static const int NumArgRegs = 4;
+    static const int NumInternalArgRegs = 6;    // rcx, rdx, r8-r11
+    static const int NumInternalFpArgRegs = 6;  // xmm0-xmm5
 #else
     static const RegisterMask SavedRegs = 1<<REGNUM(RBX) | 1<<REGNUM(R12) | 1<<REGNUM(R13) |
                                           1<<REGNUM(R14) | 1<<REGNUM(R15);
     static const int NumSavedRegs = 5; // rbx, r12-15
     static const int NumArgRegs = 6;
+    static const int NumInternalArgRegs = 8;    // rdi, rsi, rdx, rcx, r8-r11
+    static const int NumInternalFpArgRegs = 16; // xmm0-xmm15
 #endif
     // Warning:  when talking about single byte registers, RSP/RBP/RSI/RDI are
     // actually synonyms for AH/CH/DH/BH.  So this value means "any
@@ -359,6 +469,10 @@ namespace nanojit
     static const RegisterMask SingleByteStoreRegs = GpRegs & ~(1<<REGNUM(RSP) | 1<<REGNUM(RBP) |
                                                                1<<REGNUM(RSI) | 1<<REGNUM(RDI));
 
+    // Holds the runtime context pointer when Config::pinned_context is set;
+    // the register allocator never hands it out then.
+    static const Register ContextReg = R15;
+
     static inline bool IsFpReg(Register r) {
         return ((1<<REGNUM(r)) & FpRegs) != 0;
     }
@@ -410,16 +524,28 @@ namespace nanojit
         void emitprm_imm16(uint64_t op, Register r, int32_t d, int32_t imm);\
         void emitrm_imm8(uint64_t op, Register r, int32_t d, int32_t imm);\
         void emitrxb_imm(uint64_t op, Register r, Register x, Register b, int32_t imm);\
+        void emitrxbm(uint64_t op, Register r, int32_t d, Register b, Register x, int s);\
+        void emitprxbm(uint64_t op, Register r, int32_t d, Register b, Register x, int s);\
+        void emitrxbm_imm32(uint64_t op, int32_t d, Register b, Register x, int s, int32_t imm);\
+        void emitprxbm_imm16(uint64_t op, int32_t d, Register b, Register x, int s, int32_t imm);\
+        void emitrxbm_imm8(uint64_t op, int32_t d, Register b, Register x, int s, int32_t imm);\
         void emitr_imm(uint64_t op, Register r, int32_t imm) { emitrr_imm(op, RZero, r, imm); }\
         void emitr_imm8(uint64_t op, Register b, int32_t imm8);\
         void emitxm_abs(uint64_t op, Register r, int32_t addr32);\
         void emitxm_rel(uint64_t op, Register r, NIns* addr64);\
+        void emitpxm_rel(uint64_t op, Register r, NIns* addr64);\
         bool isTargetWithinS8(NIns* target);\
+        bool isShortBranch(NIns* target);\
+        void asm_nop_pad(uint32_t bytes);\
         bool isTargetWithinS32(NIns* target, int32_t maxInstSize=8);\
         void asm_immi(Register r, int32_t v, bool canClobberCCs);\
         void asm_immq(Register r, uint64_t v, bool canClobberCCs);\
         void asm_immd(Register r, uint64_t v, bool canClobberCCs);\
         void asm_regarg(ArgType, LIns*, Register);\
+        Register nextArgReg(ArgType ty, bool internal, int &arg_index, Register &fr);\
+        RegisterMask callClobbers(const CallInfo*, ArgType*, int);\
+        bool canTailCall(LIns* ret);\
+        void asm_contextp(LIns*);\
         void asm_stkarg(ArgType, LIns*, int);\
         void asm_shift(LIns*);\
         void asm_shift_imm(LIns*);\
@@ -427,7 +553,16 @@ namespace nanojit
         void beginOp1Regs(LIns *ins, RegisterMask allow, Register &rr, Register &ra);\
         void beginOp2Regs(LIns *ins, RegisterMask allow, Register &rr, Register &ra, Register &rb);\
         void endOpRegs(LIns *ins, Register rr, Register ra);\
-        void beginLoadRegs(LIns *ins, RegisterMask allow, Register &rr, int32_t &d, Register &rb);\
+        bool canFoldLoad(LIns* user, LIns* ld);\
+        bool isFoldableImm(LIns* imm);\
+        void asm_arith_mem(LIns* ins, LIns* a, LIns* ld);\
+        void asm_fop_mem(LIns* ins, LIns* a, LIns* ld);\
+        bool asm_cmpi_mem(LIns* cond);\
+        bool getBaseIndexScaleDisp(LIns*& base, int32_t& d, LIns*& index, int& scale);\
+        void getBaseIndexReg3(RegisterMask allowValue, LIns* value, Register& rv,\
+                              LIns* base, Register& rb, LIns* index, Register& rx, int32_t& d);\
+        void beginLoadRegs(LIns *ins, RegisterMask allow, Register &rr, int32_t &d, Register &rb,\
+                           Register &rx, int &scale);\
         void endLoadRegs(LIns *ins);\
         void dis(NIns *p, int bytes);\
         void asm_pushstate(); \
@@ -445,12 +580,55 @@ namespace nanojit
         Branches asm_branchd_helper(bool, LIns*, NIns*);\
         void asm_div(LIns *ins);\
         void asm_div_mod(LIns *ins);\
+        void asm_cas(LIns *ins);\
+        void asm_xadd_xchg(LIns *ins);\
+        void asm_fence();\
+        void asm_prefetch(LIns *ins);\
+        void asm_store_nt(LIns *ins);\
+        void asm_sfence_nt();\
+        void asm_memop(LIns *ins);\
+        void asm_memop_inline(LIns *ins, int32_t len);\
+        void asm_memop_args(int n, LIns* args[], Register regs[]);\
+        void asm_round(LIns *ins);\
+        void asm_round_const(Register r, Register gt, LTy ty, uint32_t bitsF, uint64_t bitsD);\
+        void asm_copysign(LIns *ins);\
         int max_stk_used;\
+        LIns* _tailCall;    /* the call asm_ret() turned into a tail call */\
+        bool _needFrame;    /* a call or exit needs RBP-based frame */\
+        Seq<NIns*>* _retSites; /* "mov rsp, rbp" of each return, see genPrologue() */\
+        bool isLeafFrame();\
+        NIns* _nSlot;       /* slots fill [codeStart, _nSlot) of the code chunk */\
+        NIns* _nExitSlot;   /* the same for the exit chunk */\
+        NIns* findSlot(const void* bits, int insSize);\
+        NIns* findConstSlot(const void* v, size_t size);\
+        NIns* veneerFor(NIns* target);\
+        NIns* genLazyTrampoline();\
         void PUSHR(Register r);\
         void POPR(Register r);\
         void NOT(Register r);\
         void NEG(Register r);\
         void IDIV(Register r);\
+        void IDIVQ(Register r);\
+        void CQO();\
+        void MFENCE();\
+        void LOCK_CMPXCHGLMR(Register r, int d, Register b);\
+        void LOCK_CMPXCHGQMR(Register r, int d, Register b);\
+        void LOCK_XADDLMR(Register r, int d, Register b);\
+        void LOCK_XADDQMR(Register r, int d, Register b);\
+        void XCHGLMR(Register r, int d, Register b);\
+        void XCHGQMR(Register r, int d, Register b);\
+        void SFENCE();\
+        void REP_MOVSB();\
+        void REP_STOSB();\
+        void REPE_CMPSB();\
+        void PREFETCHM(PrefetchHint h, int d, Register b);\
+        void PREFETCHMX(PrefetchHint h, int d, Register b, Register x, int s);\
+        void MOVNTILMR(Register r, int d, Register b);\
+        void MOVNTIQMR(Register r, int d, Register b);\
+        void MOVNTILMRX(Register r, int d, Register b, Register x, int s);\
+        void MOVNTIQMRX(Register r, int d, Register b, Register x, int s);\
+        void MOVNTPSMR(Register r, int d, Register b);\
+        void MOVNTPSMRX(Register r, int d, Register b, Register x, int s);\
         void SHR(Register r);\
         void SAR(Register r);\
         void SHL(Register r);\
@@ -479,8 +657,18 @@ namespace nanojit
         void ORLRR(Register l, Register r);\
         void XORRR(Register l, Register r);\
         void IMUL(Register l, Register r);\
+        void IMULQ(Register l, Register r);\
         void CMPLR(Register l, Register r);\
         void CMPNEQPS(Register l, Register r);\
+        void CMPLTPS(Register l, Register r);\
+        void CMPLTSD(Register l, Register r);\
+        void CMPLTSS(Register l, Register r);\
+        void ANDPS(Register l, Register r);\
+        void ANDNPS(Register l, Register r);\
+        void ORPS(Register l, Register r);\
+        void ROUNDSD(Register l, Register r, int mode);\
+        void ROUNDSS(Register l, Register r, int mode);\
+        void ROUNDPS(Register l, Register r, int mode);\
         void MOVLR(Register l, Register r);\
         void PMOVMSKB(Register l, Register r);\
         void ADDQRR(Register l, Register r);\
@@ -570,6 +758,7 @@ namespace nanojit
         void XORQR8(Register r, int32_t i8);\
         void CMPQR8(Register r, int32_t i8);\
         void IMULI(Register l, Register r, int32_t i32);\
+        void IMULQI(Register l, Register r, int32_t i32);\
         void MOVQI(Register r, uint64_t u64);\
         void LEARIP(Register r, int32_t d);\
         void LEALRM(Register r, int d, Register b);\
@@ -594,13 +783,70 @@ namespace nanojit
         void MOVUPSRM(Register r, int d, Register b);\
         void MOVUPSSPR(Register r, int d);\
         void MOVAPSRM(Register r, int d, Register b);\
-        void MOVUPSRMRIP(Register r, int d);\
-        void MOVAPSRMRIP(Register r, int d);\
+        void MOVUPSRMRIP(Register r, NIns* a64);\
+        void MOVAPSRMRIP(Register r, NIns* a64);\
+        void MOVSDM(Register r, NIns* a64);\
+        void MOVSSM(Register r, NIns* a64);\
+        void ADDLRM(Register r, int d, Register b);\
+        void SUBLRM(Register r, int d, Register b);\
+        void ANDLRM(Register r, int d, Register b);\
+        void ORLRM(Register r, int d, Register b);\
+        void XORLRM(Register r, int d, Register b);\
+        void IMULLRM(Register r, int d, Register b);\
+        void CMPLRM(Register r, int d, Register b);\
+        void CMPLMR(Register r, int d, Register b);\
+        void CMPLMI(Register b, int d, int32_t imm);\
+        void CMPLMI8(Register b, int d, int32_t imm);\
+        void ADDQRM(Register r, int d, Register b);\
+        void SUBQRM(Register r, int d, Register b);\
+        void ANDQRM(Register r, int d, Register b);\
+        void ORQRM(Register r, int d, Register b);\
+        void XORQRM(Register r, int d, Register b);\
+        void IMULQRM(Register r, int d, Register b);\
+        void CMPQRM(Register r, int d, Register b);\
+        void CMPQMR(Register r, int d, Register b);\
+        void CMPQMI(Register b, int d, int32_t imm);\
+        void CMPQMI8(Register b, int d, int32_t imm);\
+        void ADDSDRM(Register r, int d, Register b);\
+        void SUBSDRM(Register r, int d, Register b);\
+        void MULSDRM(Register r, int d, Register b);\
+        void DIVSDRM(Register r, int d, Register b);\
+        void ADDSSRM(Register r, int d, Register b);\
+        void SUBSSRM(Register r, int d, Register b);\
+        void MULSSRM(Register r, int d, Register b);\
+        void DIVSSRM(Register r, int d, Register b);\
+        void UCOMISDRM(Register r, int d, Register b);\
+        void ADDSDM(Register r, NIns* a64);\
+        void SUBSDM(Register r, NIns* a64);\
+        void MULSDM(Register r, NIns* a64);\
+        void DIVSDM(Register r, NIns* a64);\
+        void ADDSSM(Register r, NIns* a64);\
+        void SUBSSM(Register r, NIns* a64);\
+        void MULSSM(Register r, NIns* a64);\
+        void DIVSSM(Register r, NIns* a64);\
+        void UCOMISSRM(Register r, int d, Register b);\
+        void MOVLRMX(Register r, int d, Register b, Register x, int s);\
+        void MOVQRMX(Register r, int d, Register b, Register x, int s);\
+        void MOVBMRX(Register r, int d, Register b, Register x, int s);\
+        void MOVSMRX(Register r, int d, Register b, Register x, int s);\
+        void MOVLMRX(Register r, int d, Register b, Register x, int s);\
+        void MOVQMRX(Register r, int d, Register b, Register x, int s);\
+        void MOVZX8MX(Register r, int d, Register b, Register x, int s);\
+        void MOVZX16MX(Register r, int d, Register b, Register x, int s);\
+        void MOVSX8MX(Register r, int d, Register b, Register x, int s);\
+        void MOVSX16MX(Register r, int d, Register b, Register x, int s);\
+        void MOVSXDRMX(Register r, int d, Register b, Register x, int s);\
+        void INCQMX(int d, Register b, Register x, int s);\
+        void MOVSDRMX(Register r, int d, Register b, Register x, int s);\
+        void MOVSDMRX(Register r, int d, Register b, Register x, int s);\
+        void MOVSSRMX(Register r, int d, Register b, Register x, int s);\
+        void MOVSSMRX(Register r, int d, Register b, Register x, int s);\
+        void MOVUPSRMX(Register r, int d, Register b, Register x, int s);\
+        void MOVUPSMRX(Register r, int d, Register b, Register x, int s);\
         void JMP8(size_t n, NIns* t);\
         void JMP32(size_t n, NIns* t);\
         void JMP64(size_t n, NIns* t);\
-        void JMPX(Register indexreg, NIns** table);\
-        void JMPXB(Register indexreg, Register tablereg);\
+        void JMPR(Register r);\
         void JO(size_t n, NIns* t);\
         void JE(size_t n, NIns* t);\
         void JL(size_t n, NIns* t);\
@@ -657,13 +903,17 @@ namespace nanojit
         void MOVLMI(Register base, int disp, int32_t imm32); \
         void MOVSMI(Register base, int disp, int32_t imm16); \
         void MOVBMI(Register base, int disp, int32_t imm8); \
+        void MOVQMIX(Register base, int disp, Register x, int s, int32_t imm32); \
+        void MOVLMIX(Register base, int disp, Register x, int s, int32_t imm32); \
+        void MOVSMIX(Register base, int disp, Register x, int s, int32_t imm16); \
+        void MOVBMIX(Register base, int disp, Register x, int s, int32_t imm8); \
         void PSHUFD(Register l, Register r, int mode); \
         void SHUFPD(Register l, Register r, int mode); \
         void asm_ptrarg(ArgType, LIns*, Register);\
         void asm_immf(Register r, uint32_t v, bool canClobberCCs);\
         void asm_immf4(Register r, float4_t v, bool canClobberCCs);
 
-    const int LARGEST_UNDERRUN_PROT = 32;  // largest value passed to underrunProtect
+    const int LARGEST_UNDERRUN_PROT = 80;  // largest value passed to underrunProtect (64-byte loop alignment + branch)
 
     typedef uint8_t NIns;
 
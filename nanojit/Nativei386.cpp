@@ -36,7 +36,8 @@ namespace nanojit
         2, /* ABI_FASTCALL */
         1, /* ABI_THISCALL */
         0, /* ABI_STDCALL */
-        0  /* ABI_CDECL */
+        0, /* ABI_CDECL */
+        2  /* ABI_INTERNAL, as ABI_FASTCALL */
     };
 
     #define RB(r)       gpRegNames8lo[REGNUM(r)]
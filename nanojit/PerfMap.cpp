@@ -0,0 +1,189 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil; tab-width: 4 -*- */
+/* vi: set ts=4 sw=4 expandtab: (add to ~/.vimrc: set modeline modelines=5) */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "nanojit.h"
+
+#if defined FEATURE_NANOJIT && defined __linux__
+
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace nanojit
+{
+    // The jitdump format, as described in tools/perf/Documentation/jitdump-specification.txt
+    // of the Linux sources.
+    static const uint32_t JITDUMP_MAGIC = 0x4A695444;
+    static const uint32_t JITDUMP_VERSION = 1;
+    static const uint32_t JIT_CODE_LOAD = 0;
+
+    struct JitDumpHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t total_size;
+        uint32_t elf_mach;
+        uint32_t pad1;
+        uint32_t pid;
+        uint64_t timestamp;
+        uint64_t flags;
+    };
+
+    struct JitDumpCodeLoad {
+        uint32_t id;
+        uint32_t total_size;
+        uint64_t timestamp;
+        uint32_t pid;
+        uint32_t tid;
+        uint64_t vma;
+        uint64_t code_addr;
+        uint64_t code_size;
+        uint64_t code_index;
+        // followed by the name, nul-terminated, and the code
+    };
+
+    static const size_t BUFFER_SIZE = 64 * 1024;
+
+#if defined NANOJIT_X64
+    static const uint32_t ELF_MACH = EM_X86_64;
+#elif defined NANOJIT_IA32
+    static const uint32_t ELF_MACH = EM_386;
+#elif defined NANOJIT_ARM || defined NANOJIT_THUMB2
+    static const uint32_t ELF_MACH = EM_ARM;
+#elif defined NANOJIT_PPC && defined NANOJIT_64BIT
+    static const uint32_t ELF_MACH = EM_PPC64;
+#elif defined NANOJIT_PPC
+    static const uint32_t ELF_MACH = EM_PPC;
+#elif defined NANOJIT_MIPS
+    static const uint32_t ELF_MACH = EM_MIPS;
+#elif defined NANOJIT_SH4
+    static const uint32_t ELF_MACH = EM_SH;
+#else
+    static const uint32_t ELF_MACH = EM_NONE;
+#endif
+
+    // perf matches jitdump timestamps against CLOCK_MONOTONIC ('perf record -k mono').
+    static uint64_t timestamp()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    PerfMapWriter::PerfMapWriter(int formats, const char* dir)
+        : _formats(formats)
+        , _dir(dir)
+        , _opened(false)
+        , _map(NULL)
+        , _dump(NULL)
+        , _marker(NULL)
+        , _markerSize(0)
+        , _codeIndex(0)
+    {}
+
+    PerfMapWriter::~PerfMapWriter()
+    {
+        if (_map)
+            fclose(_map);
+        if (_dump)
+            fclose(_dump);
+        if (_marker)
+            munmap(_marker, _markerSize);
+    }
+
+    // Opens the files asked for.  A file that can't be opened is skipped.
+    void PerfMapWriter::open()
+    {
+        _opened = true;
+        char path[1024];
+        int pid = int(getpid());
+
+        if (_formats & PERF_MAP) {
+            VMPI_snprintf(path, sizeof(path), "/tmp/perf-%d.map", pid);
+            _map = fopen(path, "a");
+            if (_map)
+                setvbuf(_map, NULL, _IOFBF, BUFFER_SIZE);
+        }
+
+        if (_formats & JITDUMP) {
+            VMPI_snprintf(path, sizeof(path), "%s/jit-%d.dump", _dir ? _dir : ".", pid);
+            _dump = fopen(path, "w+");
+            if (_dump) {
+                // perf finds the file through this executable mapping of it.
+                _markerSize = size_t(sysconf(_SC_PAGESIZE));
+                _marker = mmap(NULL, _markerSize, PROT_READ | PROT_EXEC, MAP_PRIVATE,
+                               fileno(_dump), 0);
+                if (_marker == MAP_FAILED)
+                    _marker = NULL;
+                setvbuf(_dump, NULL, _IOFBF, BUFFER_SIZE);
+
+                JitDumpHeader h;
+                VMPI_memset(&h, 0, sizeof(h));
+                h.magic = JITDUMP_MAGIC;
+                h.version = JITDUMP_VERSION;
+                h.total_size = sizeof(h);
+                h.elf_mach = ELF_MACH;
+                h.pid = uint32_t(pid);
+                h.timestamp = timestamp();
+                fwrite(&h, sizeof(h), 1, _dump);
+            }
+        }
+    }
+
+    void PerfMapWriter::codeRange(Fragment* frag, const void* start, const void* end, bool isExit)
+    {
+        if (!_opened)
+            open();
+
+        char name[256];
+        fragName(frag, name, sizeof(name));
+        if (isExit)
+            VMPI_strncat(name, " exits", sizeof(name) - VMPI_strlen(name) - 1);
+
+        size_t size = uintptr_t(end) - uintptr_t(start);
+        if (_map)
+            fprintf(_map, "%lx %lx %s\n", (unsigned long)uintptr_t(start), (unsigned long)size, name);
+        if (_dump)
+            writeCodeLoad(name, start, size);
+    }
+
+    void PerfMapWriter::writeCodeLoad(const char* name, const void* start, size_t size)
+    {
+        size_t nameSize = VMPI_strlen(name) + 1;
+        JitDumpCodeLoad r;
+        r.id = JIT_CODE_LOAD;
+        r.total_size = uint32_t(sizeof(r) + nameSize + size);
+        r.timestamp = timestamp();
+        r.pid = uint32_t(getpid());
+        r.tid = uint32_t(syscall(SYS_gettid));
+        r.vma = uint64_t(uintptr_t(start));
+        r.code_addr = r.vma;
+        r.code_size = size;
+        r.code_index = _codeIndex++;
+        fwrite(&r, sizeof(r), 1, _dump);
+        fwrite(name, nameSize, 1, _dump);
+        fwrite(start, size, 1, _dump);
+    }
+
+    void PerfMapWriter::flush()
+    {
+        if (_map)
+            fflush(_map);
+        if (_dump)
+            fflush(_dump);
+    }
+
+    void PerfMapWriter::fragName(Fragment* frag, char* buf, size_t size)
+    {
+        if (frag->ip)
+            VMPI_snprintf(buf, size, "nanojit fragment %p", frag->ip);
+        else
+            VMPI_snprintf(buf, size, "nanojit fragment @%p", (void*)frag->code());
+    }
+}
+
+#endif // FEATURE_NANOJIT && __linux__
@@ -0,0 +1,72 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil; tab-width: 4 -*- */
+/* vi: set ts=4 sw=4 expandtab: (add to ~/.vimrc: set modeline modelines=5) */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __nanojit_PerfMap__
+#define __nanojit_PerfMap__
+
+#ifdef __linux__
+
+#include <stdio.h>
+
+namespace nanojit
+{
+    /**
+     * PerfMapWriter is a CodeMapWriter that lets Linux perf name the code of
+     * fragments, which it would otherwise show as [unknown] since it lives in
+     * anonymous memory.  It can write either or both of:
+     *
+     * - /tmp/perf-<pid>.map, one "start size name" line per block, which
+     *   perf report picks up by itself;
+     *
+     * - <dir>/jit-<pid>.dump in the jitdump format, holding a copy of the
+     *   code too, for 'perf record -k mono' followed by 'perf inject --jit'.
+     *
+     * Both files are appended to through large stdio buffers, so that a
+     * compile costs a memcpy or two;  flush() or the destructor writes them
+     * out.  The files are opened when the first block is reported.
+     *
+     * Blocks are named by fragName(), which a subclass may override.  The
+     * default names a fragment after Fragment::ip, or after its code
+     * address if it has no ip, and adds " exits" for exit chunks.
+     */
+    class PerfMapWriter : public CodeMapWriter
+    {
+    public:
+        enum {
+            PERF_MAP = 1,   // write /tmp/perf-<pid>.map
+            JITDUMP  = 2    // write <dir>/jit-<pid>.dump
+        };
+
+        // 'dir' is where the jitdump file goes, the current directory if NULL.
+        PerfMapWriter(int formats, const char* dir = NULL);
+        virtual ~PerfMapWriter();
+
+        void codeRange(Fragment* frag, const void* start, const void* end, bool isExit);
+
+        // Writes out everything buffered so far.
+        void flush();
+
+    protected:
+        // Writes the name of 'frag' into 'buf', which holds 'size' bytes.
+        virtual void fragName(Fragment* frag, char* buf, size_t size);
+
+    private:
+        void open();
+        void writeCodeLoad(const char* name, const void* start, size_t size);
+
+        const int   _formats;
+        const char* _dir;
+        bool        _opened;
+        FILE*       _map;
+        FILE*       _dump;
+        void*       _marker;        // the mapping of the jitdump file perf looks for
+        size_t      _markerSize;
+        uint64_t    _codeIndex;
+    };
+}
+
+#endif // __linux__
+#endif // __nanojit_PerfMap__
@@ -0,0 +1,389 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil; tab-width: 4 -*- */
+/* vi: set ts=4 sw=4 expandtab: (add to ~/.vimrc: set modeline modelines=5) */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "nanojit.h"
+
+#if defined FEATURE_NANOJIT && defined __linux__
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <ucontext.h>
+
+namespace nanojit
+{
+    // How far up the stack the handler looks for the return address of a
+    // helper, in words.
+    static const uint32_t MAX_STACK_SCAN = 1024;
+
+    // A ring of samples, written by the signal handler of its thread and
+    // read by drain().  The handler owns 'head' and the counters, drain()
+    // owns 'tail'.
+    struct SamplingProfiler::Ring {
+        Ring*               next;           // in SamplingProfiler::_rings
+        SamplingProfiler*   prof;
+        size_t              mapSize;
+        uint32_t            mask;
+        volatile uint32_t   head;
+        volatile uint32_t   tail;
+        volatile uint32_t   dropped;
+        volatile uint32_t   elsewhere;
+        uint32_t            droppedSeen;    // as of the last drain()
+        uint32_t            elsewhereSeen;
+        volatile uint32_t   depth;          // of enterCode() calls
+        const void*         stackBase;      // as of the outermost enterCode()
+        Sample              samples[1];     // more follow
+    };
+
+    static __thread SamplingProfiler::Ring* t_ring;
+
+    // The running profiler, if there is one.
+    static SamplingProfiler* s_running;
+
+    // How many SIGPROF handlers are under way.  A handler counts itself
+    // before it looks at s_running, so once s_running is cleared, a count
+    // of zero means no handler can still touch the rings.
+    static uint32_t s_inHandler;
+
+    SamplingProfiler::SamplingProfiler(CodeAlloc& codeAlloc, uint32_t ringSize)
+        : _codeAlloc(codeAlloc)
+        , _ringSize(16)
+        , _rings(NULL)
+        , _running(false)
+        , _fragments(_alloc)
+        , _guards(_alloc)
+        , _helpers(_alloc)
+    {
+        while (_ringSize < ringSize)
+            _ringSize *= 2;
+        VMPI_memset(&_totals, 0, sizeof(_totals));
+    }
+
+    SamplingProfiler::~SamplingProfiler()
+    {
+        stop();
+
+        // stop() cleared s_running, but a handler on another thread may
+        // have read it just before and still be writing to a ring.
+        while (__atomic_load_n(&s_inHandler, __ATOMIC_SEQ_CST) != 0)
+            sched_yield();
+
+        for (Ring* r = _rings; r != NULL; ) {
+            Ring* next = r->next;
+            if (t_ring == r)
+                t_ring = NULL;
+            munmap(r, r->mapSize);
+            r = next;
+        }
+    }
+
+    bool SamplingProfiler::start(uint32_t usec)
+    {
+        SamplingProfiler* none = NULL;
+        if (!__atomic_compare_exchange_n(&s_running, &none, this, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return false;
+
+        struct sigaction sa;
+        VMPI_memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = onSignal;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPROF, &sa, &_oldAction) != 0) {
+            s_running = NULL;
+            return false;
+        }
+
+        struct itimerval it;
+        it.it_interval.tv_sec = usec / 1000000;
+        it.it_interval.tv_usec = usec % 1000000;
+        it.it_value = it.it_interval;
+        if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+            sigaction(SIGPROF, &_oldAction, NULL);
+            s_running = NULL;
+            return false;
+        }
+        _running = true;
+        return true;
+    }
+
+    void SamplingProfiler::stop()
+    {
+        if (!_running)
+            return;
+        struct itimerval it;
+        VMPI_memset(&it, 0, sizeof(it));
+        setitimer(ITIMER_PROF, &it, NULL);
+
+        // A SIGPROF may still be on its way, and by default it would kill
+        // the process.
+        if (_oldAction.sa_handler == SIG_DFL && !(_oldAction.sa_flags & SA_SIGINFO)) {
+            struct sigaction ignore;
+            VMPI_memset(&ignore, 0, sizeof(ignore));
+            ignore.sa_handler = SIG_IGN;
+            sigemptyset(&ignore.sa_mask);
+            sigaction(SIGPROF, &ignore, NULL);
+        } else {
+            sigaction(SIGPROF, &_oldAction, NULL);
+        }
+        _running = false;
+        __atomic_store_n(&s_running, (SamplingProfiler*)NULL, __ATOMIC_SEQ_CST);
+    }
+
+    void SamplingProfiler::registerThread()
+    {
+        if (t_ring)
+            return;
+        size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+        size_t size = sizeof(Ring) + (_ringSize - 1) * sizeof(Sample);
+        size = (size + pageSize - 1) & ~(pageSize - 1);
+        void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return;     // the thread's samples go uncounted
+
+        // mmap() hands out zeroed memory.
+        Ring* r = (Ring*)mem;
+        r->prof = this;
+        r->mapSize = size;
+        r->mask = _ringSize - 1;
+
+        // Threads may register at the same time.
+        Ring* head = __atomic_load_n(&_rings, __ATOMIC_SEQ_CST);
+        do {
+            r->next = head;
+        } while (!__atomic_compare_exchange_n(&_rings, &head, r, false,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+        __atomic_store_n(&t_ring, r, __ATOMIC_SEQ_CST);
+    }
+
+    void SamplingProfiler::unregisterThread()
+    {
+        // The ring stays on _rings, for drain() to pick up what is left in it.
+        __atomic_store_n(&t_ring, (Ring*)NULL, __ATOMIC_SEQ_CST);
+    }
+
+    void SamplingProfiler::enterCode()
+    {
+        Ring* r = t_ring;
+        if (!r)
+            return;
+        if (r->depth == 0)
+            r->stackBase = __builtin_frame_address(0);
+        __atomic_store_n(&r->depth, r->depth + 1, __ATOMIC_SEQ_CST);
+    }
+
+    void SamplingProfiler::leaveCode()
+    {
+        Ring* r = t_ring;
+        if (!r)
+            return;
+        NanoAssert(r->depth > 0);
+        __atomic_store_n(&r->depth, r->depth - 1, __ATOMIC_SEQ_CST);
+    }
+
+    void SamplingProfiler::onSignal(int, siginfo_t*, void* context)
+    {
+        __atomic_add_fetch(&s_inHandler, 1, __ATOMIC_SEQ_CST);
+        SamplingProfiler* prof = __atomic_load_n(&s_running, __ATOMIC_SEQ_CST);
+        if (prof)
+            prof->takeSample(context);
+        __atomic_sub_fetch(&s_inHandler, 1, __ATOMIC_SEQ_CST);
+    }
+
+    // Only calls what is async-signal-safe:  findOwner() and atomic
+    // accesses to the ring of the interrupted thread.
+    void SamplingProfiler::takeSample(void* context)
+    {
+        Ring* r = t_ring;
+        if (!r || r->prof != this)
+            return;
+        if (r->depth == 0) {
+            __atomic_store_n(&r->elsewhere, r->elsewhere + 1, __ATOMIC_RELEASE);
+            return;
+        }
+
+        const ucontext_t* uc = (const ucontext_t*)context;
+    #if defined __x86_64__
+        const void* pc = (const void*)uc->uc_mcontext.gregs[REG_RIP];
+        uintptr_t sp = uintptr_t(uc->uc_mcontext.gregs[REG_RSP]);
+    #elif defined __i386__
+        const void* pc = (const void*)uc->uc_mcontext.gregs[REG_EIP];
+        uintptr_t sp = uintptr_t(uc->uc_mcontext.gregs[REG_ESP]);
+    #elif defined __arm__
+        const void* pc = (const void*)uc->uc_mcontext.arm_pc;
+        uintptr_t sp = uintptr_t(uc->uc_mcontext.arm_sp);
+    #elif defined __aarch64__
+        const void* pc = (const void*)uc->uc_mcontext.pc;
+        uintptr_t sp = uintptr_t(uc->uc_mcontext.sp);
+    #else
+        const void* pc = NULL;
+        uintptr_t sp = 0;
+        (void)uc;
+    #endif
+
+        CodeAlloc& codeAlloc = r->prof->_codeAlloc;
+        Sample s;
+        s.pc = pc;
+        s.owner = codeAlloc.findOwner(pc);
+        s.inHelper = false;
+        if (!s.owner) {
+            // In a helper:  the closest word up the stack that points into
+            // compiled code is most likely where it returns to.  With none,
+            // the thread is still on its way in or out of compiled code.
+            s.pc = NULL;
+            s.inHelper = true;
+            const void* const* p = (const void* const*)(sp & ~(sizeof(void*) - 1));
+            const void* const* limit = p + MAX_STACK_SCAN;
+            if ((const void*)limit > r->stackBase)
+                limit = (const void* const*)r->stackBase;
+            for (; p < limit; p++) {
+                s.owner = codeAlloc.findOwner(*p);
+                if (s.owner) {
+                    s.pc = *p;
+                    break;
+                }
+            }
+            if (!s.owner) {
+                __atomic_store_n(&r->elsewhere, r->elsewhere + 1, __ATOMIC_RELEASE);
+                return;
+            }
+        }
+
+        uint32_t head = r->head;
+        if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > r->mask) {
+            __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELEASE);
+            return;
+        }
+        r->samples[head & r->mask] = s;
+        __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    void SamplingProfiler::drain()
+    {
+        for (Ring* r = __atomic_load_n(&_rings, __ATOMIC_SEQ_CST); r != NULL; r = r->next) {
+            uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+            for (uint32_t i = r->tail; i != head; i++)
+                record(r->samples[i & r->mask]);
+            __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+
+            uint32_t dropped = __atomic_load_n(&r->dropped, __ATOMIC_ACQUIRE);
+            uint32_t elsewhere = __atomic_load_n(&r->elsewhere, __ATOMIC_ACQUIRE);
+            _totals.dropped += dropped - r->droppedSeen;
+            _totals.elsewhere += elsewhere - r->elsewhereSeen;
+            _totals.samples += (dropped - r->droppedSeen) + (elsewhere - r->elsewhereSeen);
+            r->droppedSeen = dropped;
+            r->elsewhereSeen = elsewhere;
+        }
+    }
+
+    SamplingProfiler::FragmentProfile* SamplingProfiler::fragmentProfile(Fragment* frag)
+    {
+        FragmentProfile* fp = _fragments.get(frag);
+        if (!fp) {
+            fp = new (_alloc) FragmentProfile();
+            VMPI_memset(fp, 0, sizeof(FragmentProfile));
+            fp->frag = frag;
+            _fragments.put(frag, fp);
+        }
+        return fp;
+    }
+
+    void SamplingProfiler::record(const Sample& s)
+    {
+        // Charge the fragment the handler found:  by now its code may have
+        // been freed and reused, and findOwner() would name another one.
+        Fragment* frag = s.owner;
+        NanoAssert(frag);
+        _totals.samples++;
+        FragmentProfile* fp = fragmentProfile(frag);
+        fp->samples++;
+        if (s.inHelper) {
+            _totals.inHelpers++;
+            fp->helperSamples++;
+            // The return address is just past the call.
+            NIns* call = (NIns*)(uintptr_t(s.pc) - 1);
+            LIns* ins = frag->pcMap ? frag->pcMap->lookup(call) : NULL;
+            const CallInfo* ci = ins && ins->isCall() ? ins->callInfo() : NULL;
+            HelperProfile* hp = _helpers.get(ci);
+            if (!hp) {
+                hp = new (_alloc) HelperProfile();
+                hp->ci = ci;
+                hp->samples = 0;
+                _helpers.put(ci, hp);
+            }
+            hp->samples++;
+            return;
+        }
+
+        bool isExit = false;
+        LIns* ins = frag->pcMap ? frag->pcMap->lookup((NIns*)s.pc, &isExit) : NULL;
+        if (!isExit) {
+            _totals.inFragments++;
+            return;
+        }
+        _totals.inExits++;
+        fp->exitSamples++;
+        if (ins && ins->isGuard()) {
+            GuardProfile* gp = _guards.get(ins);
+            if (!gp) {
+                gp = new (_alloc) GuardProfile();
+                gp->frag = frag;
+                gp->guard = ins;
+                gp->samples = 0;
+                _guards.put(ins, gp);
+            }
+            gp->samples++;
+        }
+    }
+
+    void SamplingProfiler::reset()
+    {
+        drain();
+        _fragments.clear();
+        _guards.clear();
+        _helpers.clear();
+        VMPI_memset(&_totals, 0, sizeof(_totals));
+    }
+
+    // Fills in the 'n' entries of 'out' with the most samples, from the
+    // values of 'map', and returns how many it filled in.
+    template <class K, class P>
+    static uint32_t top(HashMap<K, P*>& map, P* out, uint32_t n)
+    {
+        uint32_t count = 0;
+        typename HashMap<K, P*>::Iter iter(map);
+        while (iter.next()) {
+            P* p = iter.value();
+            // Insert 'p' in order, dropping whatever falls off the end.
+            uint32_t i = count < n ? count++ : n;
+            while (i > 0 && out[i-1].samples < p->samples) {
+                if (i < n)
+                    out[i] = out[i-1];
+                i--;
+            }
+            if (i < n)
+                out[i] = *p;
+        }
+        return count;
+    }
+
+    uint32_t SamplingProfiler::topFragments(FragmentProfile* out, uint32_t n)
+    {
+        return top(_fragments, out, n);
+    }
+
+    uint32_t SamplingProfiler::topGuards(GuardProfile* out, uint32_t n)
+    {
+        return top(_guards, out, n);
+    }
+
+    uint32_t SamplingProfiler::topHelpers(HelperProfile* out, uint32_t n)
+    {
+        return top(_helpers, out, n);
+    }
+}
+
+#endif // FEATURE_NANOJIT && __linux__
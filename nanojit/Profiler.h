@@ -0,0 +1,139 @@
+/* -*- Mode: C++; c-basic-offset: 4; indent-tabs-mode: nil; tab-width: 4 -*- */
+/* vi: set ts=4 sw=4 expandtab: (add to ~/.vimrc: set modeline modelines=5) */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef __nanojit_Profiler__
+#define __nanojit_Profiler__
+
+#ifdef __linux__
+
+#include <signal.h>
+
+namespace nanojit
+{
+    /**
+     * SamplingProfiler finds out where the threads running compiled code
+     * spend their time, without outside tools.  A SIGPROF handler, driven
+     * by setitimer(), takes the interrupted pc and charges it to the body
+     * of a fragment, the exit stub of one of its guards, or a helper the
+     * fragment called.  Fragments are found through CodeAlloc::findOwner(),
+     * so Config::code_index must be set;  telling exit stubs and the calls
+     * to helpers apart also takes Config::pc_map.
+     *
+     * A thread that runs compiled code calls registerThread() first, and
+     * brackets its calls into compiled code with enterCode() and
+     * leaveCode().  Samples it takes outside them count as time elsewhere.
+     * When a sample lands outside compiled code, the handler looks up the
+     * stack for an address in compiled code that a helper returns to;  if
+     * there is none, the sample counts as elsewhere too.
+     *
+     * The handler appends each sample to a ring buffer of the thread's own,
+     * without locks, and drops it if the ring is full.  drain() moves the
+     * samples in the rings into the totals that the report methods read,
+     * and should be called often enough to keep the rings from filling up.
+     * drain(), the report methods and reset() may only be called from one
+     * thread at a time, and only while the fragments sampled are still
+     * around.
+     *
+     * Only one SamplingProfiler can run at a time in a process.  The
+     * destructor waits for SIGPROF handlers still running on other threads
+     * before it unmaps the rings.
+     */
+    class SamplingProfiler
+    {
+    public:
+        struct Totals {
+            uint64_t    samples;        // all those taken on registered threads
+            uint64_t    inFragments;    // in the bodies of fragments
+            uint64_t    inExits;        // in exit stubs
+            uint64_t    inHelpers;      // in helpers called from compiled code
+            uint64_t    elsewhere;      // outside compiled code and the helpers it called
+            uint64_t    dropped;        // lost because a ring was full
+        };
+
+        struct FragmentProfile {
+            Fragment*   frag;
+            uint64_t    samples;        // in all of the below
+            uint64_t    exitSamples;    // in the fragment's exit stubs
+            uint64_t    helperSamples;  // in helpers the fragment called
+        };
+
+        struct GuardProfile {
+            Fragment*   frag;
+            LIns*       guard;
+            uint64_t    samples;        // in the guard's exit stub
+        };
+
+        struct HelperProfile {
+            const CallInfo* ci;         // NULL for calls the pc map couldn't name
+            uint64_t    samples;
+        };
+
+        // 'ringSize' is the number of samples each thread's ring holds,
+        // rounded up to a power of two.
+        SamplingProfiler(CodeAlloc& codeAlloc, uint32_t ringSize = 4096);
+        ~SamplingProfiler();
+
+        // Starts sampling every 'usec' microseconds of CPU time the process
+        // uses.  Returns false if another profiler is running or the timer
+        // can't be set.
+        bool start(uint32_t usec = 1000);
+        void stop();
+
+        // Gives the calling thread a ring.  It must call unregisterThread()
+        // before it exits or the profiler is destroyed.
+        void registerThread();
+        void unregisterThread();
+
+        // Bracket each call into compiled code.  They nest, and cost an
+        // increment of a thread-local counter each.
+        static void enterCode();
+        static void leaveCode();
+
+        // Moves the samples in the rings into the totals.
+        void drain();
+
+        // Throws away all the samples taken so far.
+        void reset();
+
+        const Totals& totals() const { return _totals; }
+
+        // Fill in up to 'n' entries of 'out', the ones with the most
+        // samples first, and return how many were filled in.
+        uint32_t topFragments(FragmentProfile* out, uint32_t n);
+        uint32_t topGuards(GuardProfile* out, uint32_t n);
+        uint32_t topHelpers(HelperProfile* out, uint32_t n);
+
+        struct Ring;
+
+    private:
+        struct Sample {
+            const void* pc;             // in a helper, where it returns to
+            Fragment*   owner;          // whose code 'pc' was in when sampled
+            bool        inHelper;
+        };
+
+        void        takeSample(void* context);
+        void        record(const Sample& s);
+        FragmentProfile* fragmentProfile(Fragment* frag);
+
+        static void onSignal(int sig, siginfo_t* info, void* context);
+
+        CodeAlloc&  _codeAlloc;
+        uint32_t    _ringSize;
+        Ring*       _rings;             // of all threads ever registered
+        bool        _running;
+        struct sigaction _oldAction;
+
+        Allocator   _alloc;
+        Totals      _totals;
+        HashMap<Fragment*, FragmentProfile*>    _fragments;
+        HashMap<LIns*, GuardProfile*>           _guards;
+        HashMap<const CallInfo*, HelperProfile*> _helpers;
+    };
+}
+
+#endif // __linux__
+#endif // __nanojit_Profiler__
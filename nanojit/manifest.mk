@@ -49,6 +49,8 @@ avmplus_CXXSRCS := $(avmplus_CXXSRCS) \
   $(curdir)/Fragmento.cpp \
   $(curdir)/LIR.cpp \
   $(curdir)/njconfig.cpp \
+  $(curdir)/PerfMap.cpp \
+  $(curdir)/Profiler.cpp \
   $(curdir)/RegAlloc.cpp \
   $(curdir)/$(nanojit_cpu_cxxsrc) \
   $(NULL)
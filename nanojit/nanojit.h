@@ -56,6 +56,12 @@
     #define CASE86(x)
 #endif
 
+#if defined NANOJIT_X64
+    #define CASEX64(x)  case x
+#else
+    #define CASEX64(x)
+#endif
+
 // Embed no-op macros that let Valgrind work with the JIT.
 #ifdef MOZ_VALGRIND
 #  define JS_VALGRIND
@@ -343,6 +349,8 @@ namespace nanojit {
 #include "RegAlloc.h"
 #include "Fragmento.h"
 #include "Assembler.h"
+#include "PerfMap.h"
+#include "Profiler.h"
 
 #endif // FEATURE_NANOJIT
 #endif // __nanojit_h__
@@ -6,6 +6,10 @@
 
 #include "nanojit.h"
 
+#if defined NANOJIT_X64 && defined _MSC_VER
+#include <intrin.h>
+#endif
+
 #ifdef FEATURE_NANOJIT
 
 namespace nanojit
@@ -53,6 +57,25 @@ namespace nanojit
         config->i386_use_cmov = (edx_flags & (1<<15)) != 0;
         config->i386_fixed_esp = false;
     }
+#elif defined NANOJIT_X64
+    static void setCpuFeatures(Config* config)
+    {
+        int ecx_flags = 0;
+    #if defined _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        ecx_flags = info[2];
+    #elif defined __GNUC__
+        int eax_flags = 1, ebx_flags, edx_flags;
+        asm("cpuid\n"
+            : "+a" (eax_flags), "=b" (ebx_flags), "=c" (ecx_flags), "=d" (edx_flags)
+           );
+        (void) ebx_flags;
+        (void) edx_flags;
+    #endif
+
+        config->i386_sse41 = (ecx_flags & (1 << 19)) != 0;
+    }
 #endif
 
     Config::Config()
@@ -63,8 +86,17 @@ namespace nanojit
         harden_function_alignment = false;
         harden_nop_insertion = false;
         check_page_flags = false;
+        relax_branches = false;
+        pinned_context = false;
+        lazy_exits = false;
+        share_exits = false;
+        prof_counters = false;
+        edge_counters = false;
+        pc_map = false;
+        code_index = false;
+        code_align = 0;
 
-#ifdef NANOJIT_IA32
+#if defined NANOJIT_IA32 || defined NANOJIT_X64
         setCpuFeatures(this);
 #endif
 
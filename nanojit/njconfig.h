@@ -40,6 +40,10 @@ namespace nanojit
         // ARM architecture to assume when generate instructions for (currently, 4 <= arm_arch <= 7)
         uint8_t arm_arch;
 
+        // If nonzero, align fragment entry points and small innermost loops to
+        // this many bytes (16, 32 or 64) by padding with no-ops. (x64 only)
+        uint8_t code_align;
+
         // If true, use CSE.
         uint32_t cseopt:1;
 
@@ -49,7 +53,7 @@ namespace nanojit
         // Can we use SSE3 instructions? (x86-only)
         uint32_t i386_sse3:1;
 
-        // Can we use SSE4.1 instructions? (x86 only)
+        // Can we use SSE4.1 instructions? (x86 and x64)
         uint32_t i386_sse41:1;
 
         // Can we use cmov instructions? (x86-only)
@@ -77,6 +81,53 @@ namespace nanojit
 		// Check protection flags when allocating memory for compiled code.
         uint32_t check_page_flags:1;
 
+        // If true, fragments containing loops are reassembled when that lets back
+        // edges use short branch encodings.  That costs a second pass, so it
+        // is off by default. (x64 only)
+        uint32_t relax_branches:1;
+
+        // If true, reserve a callee-saved register (R15) to hold the runtime
+        // context pointer for all fragments; LIR_contextp reads it.  Native
+        // entries load it from the first argument. (x64 only)
+        uint32_t pinned_context:1;
+
+        // If true, a guard whose target is not compiled yet gets a small stub
+        // that jumps to a trampoline shared by its fragment, instead of a full
+        // exit stub.  The trampoline only counts the exits it takes;  the
+        // embedder calls Assembler::materializeHotExits() now and then to give
+        // the guards that are taken often their own stub. (x64 only)
+        uint32_t lazy_exits:1;
+
+        // If true, guards of a fragment whose exits reload the same registers
+        // and go to the same place share one exit stub body.  Bodies are not
+        // shared across fragments, so each fragment's code can still be
+        // freed on its own. (x64 only)
+        uint32_t share_exits:1;
+
+        // If true, fragments count how often they are entered (at
+        // Fragment::loopLabel, if it is set) and how often each of their
+        // exits is taken, in 64-bit counters kept apart from the code.  See
+        // Fragment::profCounters. (x64 only)
+        uint32_t prof_counters:1;
+
+        // If true, every LIR_jt, LIR_jf and LIR_jtbl counts how often each
+        // of its edges is taken, in 64-bit counters kept apart from the
+        // code.  See Fragment::edgeCounters and Assembler::getBranchWeights().
+        // (x64 only)
+        uint32_t edge_counters:1;
+
+        // If true, the assembler records which LIR instruction each piece of
+        // native code was generated from, in a PcMap per fragment.  CodeAlloc
+        // then indexes code as if code_index were set, so that the map goes
+        // out of reach when the fragment's code is freed.  See
+        // Assembler::lookupPc().
+        uint32_t pc_map:1;
+
+        // If true, CodeAlloc keeps an index from code addresses to the
+        // fragments owning them, which even signal handlers may search.  See
+        // CodeAlloc::findOwner().
+        uint32_t code_index:1;
+
         inline bool
         use_cmov()
         {